@@ -0,0 +1,24 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+/**
+ * Stand-ins for the few engine definitions used by the engine independent sources of the module: the conversion
+ * kernels, the depth compression, the packet ring, the worker pool, the TCP server, the recorder and the shared
+ * memory ring. The benchmark, the checks and readers of the shared memory force include it in front of these sources, so they
+ * compile without the engine.
+ */
+
+#include <cassert>
+#include <cstdint>
+
+#define ROSINTEGRATIONVISION_API
+
+typedef uint8_t uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+typedef int32_t int32;
+typedef int64_t int64;
+
+#define check(Expression) assert(Expression)
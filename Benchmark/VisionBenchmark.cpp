@@ -0,0 +1,1001 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+/**
+ * Standalone benchmark of the hot paths between the readback and the publishing job, built without the engine
+ * as described in README.md. Synthetic Float16 and 8 bit frames of the common resolutions are run through the
+ * conversion kernels, each implementation on its own, through the runtime dispatch and in parallel stripes on the
+ * worker pool like the components do. The packet ring is measured for its throughput and for the latency of
+ * the handoff from the conversion job to the publishing job. The TCP server streams packets over loopback to
+ * fast clients and a slow one, which has to drop frames without holding back the others. The recorder appends
+ * packets to a capture log in the record directory for the sustained write throughput, the replay reads such a log
+ * back from the mapping. The depth compression is decoded again and compared with the original, the back-projection
+ * kernels are compared with the scalar one, a mismatch fails the run.
+ * The results are printed as a table and with --json written as JSON, so that runs can be compared over time.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "BackProjection.h"
+#include "DepthCompression.h"
+#include "FrameRecorder.h"
+#include "ImageConversion.h"
+#include "PacketBuffer.h"
+#include "PacketServer.h"
+#include "WorkerPool.h"
+
+// The PNG entries need libpng, which the engine bundles. Build with -DVISION_BENCHMARK_PNG -lpng to include them.
+#if defined(VISION_BENCHMARK_PNG)
+  #include <png.h>
+#endif
+
+#if defined(__linux__)
+  #include <arpa/inet.h>
+  #include <netinet/in.h>
+  #include <sys/socket.h>
+  #include <unistd.h>
+  #define LOOPBACK_SUPPORTED 1
+#else
+  #define LOOPBACK_SUPPORTED 0
+#endif
+
+namespace
+{
+  typedef std::chrono::steady_clock Clock;
+
+  struct Resolution
+  {
+    const char *Name;
+    uint32 Width;
+    uint32 Height;
+  };
+
+  const Resolution Resolutions[] =
+  {
+    { "640x480", 640, 480 },
+    { "960x540", 960, 540 },
+    { "1080p", 1920, 1080 },
+    { "4K", 3840, 2160 }
+  };
+
+  struct Options
+  {
+    double MinSeconds = 0.5;   // Time spent on each benchmark, at least 3 runs are measured
+    uint32 Threads = 0;        // Workers of the pool, 0 like the module
+    std::string Filter;        // Only benchmarks whose name contains it
+    std::string Json;          // File for the JSON results, "-" for stdout
+    std::string RecordDir = "."; // Directory of the capture logs of the recorder and replay benchmarks
+    bool Scaling = false;      // Only the parallel conversions of a 4K frame on 1, 2, 4 and 8 cores
+  };
+
+  struct Result
+  {
+    std::string Benchmark;
+    const Resolution *Frame;
+    uint64 Runs;
+    std::vector<std::pair<const char*, double>> Metrics;
+  };
+
+  uint64 NowNanoseconds()
+  {
+    return (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+  }
+
+  // Truncating conversion to an IEEE half float, tiny values become 0. Good enough for synthetic frames.
+  uint16_t FloatToHalf(const float Value)
+  {
+    uint32 Bits;
+    std::memcpy(&Bits, &Value, sizeof(Bits));
+    const uint16_t Sign = (uint16_t)((Bits >> 16) & 0x8000);
+    const int32 Exponent = (int32)((Bits >> 23) & 0xff) - 127 + 15;
+    if (Exponent <= 0)
+    {
+      return Sign;
+    }
+    if (Exponent >= 31)
+    {
+      return Sign | 0x7c00;
+    }
+    return Sign | (uint16_t)(Exponent << 10) | (uint16_t)((Bits & 0x7fffff) >> 13);
+  }
+
+  /**
+   * Input and output buffers of one resolution. The color frame is noise in [0, 1], the depth frame a sloped
+   * floor in centimeters with a little noise and some far pixels, so that the depth compression sees runs and
+   * small deltas like in a rendered scene.
+   */
+  struct Frames
+  {
+    const uint32 Pixels;
+    std::vector<uint16_t> HalfColor, HalfDepth;
+    std::vector<uint8_t> LDR, BGR;
+    std::vector<float> Meters;
+    std::vector<uint16_t> Millimeters, Decoded;
+    std::vector<uint8_t> RVL, PNG;
+
+    explicit Frames(const Resolution &Frame) :
+      Pixels(Frame.Width * Frame.Height),
+      HalfColor(Pixels * 4), HalfDepth(Pixels * 4), LDR(Pixels * 4), BGR(Pixels * 4),
+      Meters(Pixels), Millimeters(Pixels), Decoded(Pixels), RVL(DepthCompression::MaxRVLSize(Pixels))
+    {
+      std::mt19937 Random(42);
+      std::uniform_real_distribution<float> Unit(0.f, 1.f);
+      std::uniform_real_distribution<float> Noise(-2.f, 2.f);
+      for (uint32 i = 0; i < Pixels * 4; ++i)
+      {
+        HalfColor[i] = FloatToHalf(Unit(Random));
+        LDR[i] = (uint8_t)Random();
+      }
+      for (uint32 y = 0; y < Frame.Height; ++y)
+      {
+        for (uint32 x = 0; x < Frame.Width; ++x)
+        {
+          const uint32 i = y * Frame.Width + x;
+          const float Centimeters = Unit(Random) < 0.03f ? 65504.f : 100.f + 5000.f * y / Frame.Height + Noise(Random);
+          HalfDepth[i * 4] = FloatToHalf(Centimeters);
+          HalfDepth[i * 4 + 1] = HalfDepth[i * 4 + 2] = 0;
+          HalfDepth[i * 4 + 3] = FloatToHalf(1.f);
+        }
+      }
+      ImageConversion::HalfToMillimetersScalar(HalfDepth.data(), Millimeters.data(), Pixels, 65535.f);
+      ImageConversion::HalfToMetersScalar(HalfDepth.data(), Meters.data(), Pixels, 100.f);
+    }
+  };
+
+  // Runs Body until MinSeconds passed and at least 3 times after a warm up run. Returns the median seconds of a run.
+  double Measure(const Options &Opts, const std::function<void()> &Body, uint64 &Runs)
+  {
+    Body();
+
+    std::vector<double> Times;
+    const Clock::time_point End = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(Opts.MinSeconds));
+    do
+    {
+      const Clock::time_point Start = Clock::now();
+      Body();
+      Times.push_back(std::chrono::duration<double>(Clock::now() - Start).count());
+    }
+    while (Times.size() < 3 || Clock::now() < End);
+
+    Runs = Times.size();
+    std::nth_element(Times.begin(), Times.begin() + Times.size() / 2, Times.end());
+    return Times[Times.size() / 2];
+  }
+
+  // Percentile of sorted samples
+  double Percentile(const std::vector<double> &Sorted, const double Quantile)
+  {
+    const size_t Index = (size_t)(Quantile * (Sorted.size() - 1) + 0.5);
+    return Sorted[std::min(Index, Sorted.size() - 1)];
+  }
+
+  class Benchmark
+  {
+  public:
+    // The table of the results is printed to Table while the benchmarks run
+    Benchmark(const Options &Opts, FILE *Table) : Opts(Opts), Table(Table), Pool(Opts.Threads) {}
+
+    void Run()
+    {
+      if (Opts.Scaling)
+      {
+        RunScaling(Resolutions[3]);
+        return;
+      }
+      for (const Resolution &Frame : Resolutions)
+      {
+        Frames Data(Frame);
+        RunKernels(Frame, Data);
+        RunBackProjection(Frame, Data, true);
+        RunBackProjection(Frame, Data, false);
+        RunHandoff(Frame, false);
+        RunHandoff(Frame, true);
+        RunServer(Frame);
+        RunRecorder(Frame);
+        RunReplay(Frame);
+      }
+    }
+
+    const std::vector<Result> &GetResults() const
+    {
+      return Results;
+    }
+
+    // Number of benchmarks whose output differed from the reference
+    uint32 GetMismatches() const
+    {
+      return Mismatches;
+    }
+
+    uint32 GetNumThreads() const
+    {
+      return Pool.GetNumThreads();
+    }
+
+  private:
+    const Options &Opts;
+    FILE *Table;
+    WorkerPool Pool;
+    std::vector<Result> Results;
+    uint32 Mismatches = 0;
+
+    bool Selected(const std::string &Name) const
+    {
+      return Opts.Filter.empty() || Name.find(Opts.Filter) != std::string::npos;
+    }
+
+    void Add(Result Entry)
+    {
+      std::fprintf(Table, "%-32s %-8s", Entry.Benchmark.c_str(), Entry.Frame->Name);
+      for (const std::pair<const char*, double> &Metric : Entry.Metrics)
+      {
+        std::fprintf(Table, " %s=%.3f", Metric.first, Metric.second);
+      }
+      std::fprintf(Table, "\n");
+      std::fflush(Table);
+      Results.push_back(std::move(Entry));
+    }
+
+    // Reports a benchmark whose output differs from the one of the reference implementation
+    void ExpectSame(const bool Same, const std::string &Name, const Resolution &Frame)
+    {
+      if (!Same)
+      {
+        std::fprintf(stderr, "%s %s: output differs from the reference.\n", Name.c_str(), Frame.Name);
+        ++Mismatches;
+      }
+    }
+
+    // Measures a conversion of the whole frame, InputBytes per pixel are read. Finish may add further metrics.
+    void Kernel(const std::string &Name, const Resolution &Frame, const uint32 InputBytes, const std::function<void()> &Body,
+                const std::function<void(Result&)> &Finish = nullptr)
+    {
+      if (!Selected(Name))
+      {
+        return;
+      }
+
+      Result Entry;
+      Entry.Benchmark = Name;
+      Entry.Frame = &Frame;
+      const double Seconds = Measure(Opts, Body, Entry.Runs);
+      const double Pixels = (double)Frame.Width * Frame.Height;
+      Entry.Metrics.push_back({ "ms_per_frame", Seconds * 1e3 });
+      Entry.Metrics.push_back({ "mb_per_s", Pixels * InputBytes / Seconds / (1024 * 1024) });
+      Entry.Metrics.push_back({ "ns_per_pixel", Seconds * 1e9 / Pixels });
+      if (Finish)
+      {
+        Finish(Entry);
+      }
+      Add(std::move(Entry));
+    }
+
+    // Splits the frame into stripes of rows on the pool like the components
+    void Striped(const Resolution &Frame, const std::function<void(uint32, uint32)> &Body)
+    {
+      Striped(Pool, Frame, Body);
+    }
+
+    static void Striped(WorkerPool &Stripes, const Resolution &Frame, const std::function<void(uint32, uint32)> &Body)
+    {
+      const uint32 MinRows = (uint32)((ImageConversion::MinStripePixels + Frame.Width - 1) / Frame.Width);
+      Stripes.ParallelFor(Frame.Height, MinRows, [&Frame, &Body](uint32 Begin, uint32 End)
+      {
+        Body(Begin * Frame.Width, (End - Begin) * Frame.Width);
+      });
+    }
+
+    /*
+     * Scaling of the parallel stripes: every conversion of the components on Cores threads, the calling one and a
+     * pool of Cores - 1 workers like a component job on the module pool. One core converts the whole frame on the
+     * calling thread. The speedup is relative to that.
+     */
+    void RunScaling(const Resolution &Frame)
+    {
+      using namespace ImageConversion;
+      Frames Data(Frame);
+      const uint16_t *Color = Data.HalfColor.data();
+      const uint16_t *Depth = Data.HalfDepth.data();
+      const uint8_t *LDR = Data.LDR.data();
+      uint8_t *BGR = Data.BGR.data();
+      float *Meters = Data.Meters.data();
+      uint16_t *Millimeters = Data.Millimeters.data();
+
+      typedef std::function<void(uint32, uint32)> Stripe;
+      const std::pair<const char*, std::pair<uint32, Stripe>> Conversions[] =
+      {
+        { "HalfToBGR8", { 8, [&](uint32 First, uint32 Count) { HalfToBGR8(Color + First * 4, BGR + First * 3, Count); } } },
+        { "BGRA8ToBGR8", { 4, [&](uint32 First, uint32 Count) { BGRA8ToBGR8(LDR + First * 4, BGR + First * 3, Count); } } },
+        { "HalfToMeters", { 8, [&](uint32 First, uint32 Count) { HalfToMeters(Depth + First * 4, Meters + First, Count, 100.f); } } },
+        { "HalfToMillimeters", { 8, [&](uint32 First, uint32 Count) { HalfToMillimeters(Depth + First * 4, Millimeters + First, Count, 65535.f); } } }
+      };
+
+      const uint32 Available = std::thread::hardware_concurrency();
+      for (const uint32 Cores : { 1u, 2u, 4u, 8u })
+      {
+        if (Cores > Available)
+        {
+          std::fprintf(stderr, "%u cores are measured on %u, the speedup is not meaningful.\n", Cores, Available);
+        }
+        std::unique_ptr<WorkerPool> Stripes(Cores > 1 ? new WorkerPool(Cores - 1) : nullptr);
+        for (const auto &Conversion : Conversions)
+        {
+          const std::string Name = std::string(Conversion.first) + "/Cores" + std::to_string(Cores);
+          const Stripe &Body = Conversion.second.second;
+          double Serial = 0;
+          Kernel(Name, Frame, Conversion.second.first, [&]()
+          {
+            if (Stripes)
+            {
+              Striped(*Stripes, Frame, Body);
+            }
+            else
+            {
+              Body(0, Data.Pixels);
+            }
+          },
+          [&](Result &Entry)
+          {
+            const double Milliseconds = Entry.Metrics[0].second;
+            for (const Result &Earlier : Results)
+            {
+              if (Earlier.Benchmark == std::string(Conversion.first) + "/Cores1")
+              {
+                Serial = Earlier.Metrics[0].second;
+              }
+            }
+            Entry.Metrics.push_back({ "cores", (double)Cores });
+            Entry.Metrics.push_back({ "speedup", Serial > 0 ? Serial / Milliseconds : 1.0 });
+          });
+        }
+      }
+    }
+
+    void RunKernels(const Resolution &Frame, Frames &Data)
+    {
+      using namespace ImageConversion;
+      const uint16_t *Color = Data.HalfColor.data();
+      const uint16_t *Depth = Data.HalfDepth.data();
+      const uint8_t *LDR = Data.LDR.data();
+      uint8_t *BGR = Data.BGR.data();
+      float *Meters = Data.Meters.data();
+      uint16_t *Millimeters = Data.Millimeters.data();
+      const uint32 Pixels = Data.Pixels;
+      const float MaxMeters = 100.f;
+      const float MaxMillimeters = 65535.f;
+
+      // Half float color of the BGR8FromFloat16 format, 8 bytes per pixel
+      Kernel("HalfToBGR8/Scalar", Frame, 8, [&]() { HalfToBGR8Scalar(Color, BGR, Pixels); });
+      if (HasF16C())
+      {
+        Kernel("HalfToBGR8/SSE", Frame, 8, [&]() { HalfToBGR8SSE(Color, BGR, Pixels); });
+      }
+      if (HasAVX2())
+      {
+        Kernel("HalfToBGR8/AVX2", Frame, 8, [&]() { HalfToBGR8AVX2(Color, BGR, Pixels); });
+      }
+      Kernel("HalfToBGR8/Dispatch", Frame, 8, [&]() { HalfToBGR8(Color, BGR, Pixels); });
+      Kernel("HalfToBGR8/Parallel", Frame, 8, [&]()
+      {
+        Striped(Frame, [&](uint32 First, uint32 Count) { HalfToBGR8(Color + First * 4, BGR + First * 3, Count); });
+      });
+
+      // 8 bit color of the BGR8 format, 4 bytes per pixel
+      Kernel("BGRA8ToBGR8/Scalar", Frame, 4, [&]() { BGRA8ToBGR8Scalar(LDR, BGR, Pixels); });
+      if (HasSSE41())
+      {
+        Kernel("BGRA8ToBGR8/SSE", Frame, 4, [&]() { BGRA8ToBGR8SSE(LDR, BGR, Pixels); });
+      }
+      if (HasAVX2())
+      {
+        Kernel("BGRA8ToBGR8/AVX2", Frame, 4, [&]() { BGRA8ToBGR8AVX2(LDR, BGR, Pixels); });
+      }
+      Kernel("BGRA8ToBGR8/Dispatch", Frame, 4, [&]() { BGRA8ToBGR8(LDR, BGR, Pixels); });
+      Kernel("BGRA8ToBGR8/Parallel", Frame, 4, [&]()
+      {
+        Striped(Frame, [&](uint32 First, uint32 Count) { BGRA8ToBGR8(LDR + First * 4, BGR + First * 3, Count); });
+      });
+
+      // Scene depth to 32FC1 and 16UC1
+      Kernel("HalfToMeters/Scalar", Frame, 8, [&]() { HalfToMetersScalar(Depth, Meters, Pixels, MaxMeters); });
+      if (HasF16C())
+      {
+        Kernel("HalfToMeters/SSE", Frame, 8, [&]() { HalfToMetersSSE(Depth, Meters, Pixels, MaxMeters); });
+      }
+      if (HasAVX2())
+      {
+        Kernel("HalfToMeters/AVX2", Frame, 8, [&]() { HalfToMetersAVX2(Depth, Meters, Pixels, MaxMeters); });
+      }
+      Kernel("HalfToMeters/Dispatch", Frame, 8, [&]() { HalfToMeters(Depth, Meters, Pixels, MaxMeters); });
+      Kernel("HalfToMeters/Parallel", Frame, 8, [&]()
+      {
+        Striped(Frame, [&](uint32 First, uint32 Count) { HalfToMeters(Depth + First * 4, Meters + First, Count, MaxMeters); });
+      });
+
+      Kernel("HalfToMillimeters/Scalar", Frame, 8, [&]() { HalfToMillimetersScalar(Depth, Millimeters, Pixels, MaxMillimeters); });
+      if (HasF16C())
+      {
+        Kernel("HalfToMillimeters/SSE", Frame, 8, [&]() { HalfToMillimetersSSE(Depth, Millimeters, Pixels, MaxMillimeters); });
+      }
+      if (HasAVX2())
+      {
+        Kernel("HalfToMillimeters/AVX2", Frame, 8, [&]() { HalfToMillimetersAVX2(Depth, Millimeters, Pixels, MaxMillimeters); });
+      }
+      Kernel("HalfToMillimeters/Dispatch", Frame, 8, [&]() { HalfToMillimeters(Depth, Millimeters, Pixels, MaxMillimeters); });
+      Kernel("HalfToMillimeters/Parallel", Frame, 8, [&]()
+      {
+        Striped(Frame, [&](uint32 First, uint32 Count) { HalfToMillimeters(Depth + First * 4, Millimeters + First, Count, MaxMillimeters); });
+      });
+
+      // Compressed depth of the 16UC1 image, 2 bytes per pixel
+      size_t Compressed = 0;
+      Kernel("CompressRVL", Frame, 2, [&]() { Compressed = DepthCompression::CompressRVL(Millimeters, Data.RVL.data(), Pixels); },
+             [&](Result &Entry) { Entry.Metrics.push_back({ "ratio", Pixels * 2.0 / Compressed }); });
+
+      // Decoding is measured in MB/s of the decoded image, like the encoding, from a stream of this frame
+      if (Selected("DecompressRVL"))
+      {
+        Compressed = DepthCompression::CompressRVL(Millimeters, Data.RVL.data(), Pixels);
+        std::fill(Data.Decoded.begin(), Data.Decoded.end(), 0);
+        Kernel("DecompressRVL", Frame, 2, [&]() { DepthCompression::DecompressRVL(Data.RVL.data(), Compressed, Data.Decoded.data(), Pixels); });
+        ExpectSame(Data.Decoded == Data.Millimeters, "DecompressRVL", Frame);
+      }
+#if defined(VISION_BENCHMARK_PNG)
+      RunPNG(Frame, Data);
+#endif
+    }
+
+#if defined(VISION_BENCHMARK_PNG)
+    /**
+     * The 16 bit grayscale PNG of compressedDepth, the alternative to RVL, with libpng's default settings. The
+     * image wrapper of the engine may choose another zlib level, so the numbers are a reference point.
+     */
+    void RunPNG(const Resolution &Frame, Frames &Data)
+    {
+      if (!Selected("CompressPNG") && !Selected("DecompressPNG"))
+      {
+        return;
+      }
+
+      png_image Image;
+      std::memset(&Image, 0, sizeof(Image));
+      Image.version = PNG_IMAGE_VERSION;
+      Image.width = Frame.Width;
+      Image.height = Frame.Height;
+      Image.format = PNG_FORMAT_LINEAR_Y;
+      png_alloc_size_t Compressed = 0;
+      const std::function<bool()> Compress = [&]()
+      {
+        Data.PNG.resize(PNG_IMAGE_PNG_SIZE_MAX(Image));
+        Compressed = Data.PNG.size();
+        return png_image_write_to_memory(&Image, Data.PNG.data(), &Compressed, 0, Data.Millimeters.data(), 0, nullptr) != 0;
+      };
+      if (!Compress())
+      {
+        std::fprintf(stderr, "CompressPNG %s: %s\n", Frame.Name, Image.message);
+        ++Mismatches;
+        return;
+      }
+      Kernel("CompressPNG", Frame, 2, [&]() { Compress(); },
+             [&](Result &Entry) { Entry.Metrics.push_back({ "ratio", (double)Frame.Width * Frame.Height * 2.0 / Compressed }); });
+
+      std::fill(Data.Decoded.begin(), Data.Decoded.end(), 0);
+      bool Decoded = false;
+      Kernel("DecompressPNG", Frame, 2, [&]()
+      {
+        png_image Read;
+        std::memset(&Read, 0, sizeof(Read));
+        Read.version = PNG_IMAGE_VERSION;
+        Decoded = png_image_begin_read_from_memory(&Read, Data.PNG.data(), Compressed) != 0;
+        Read.format = PNG_FORMAT_LINEAR_Y;
+        Decoded = Decoded && Read.width == Frame.Width && Read.height == Frame.Height &&
+                  png_image_finish_read(&Read, nullptr, Data.Decoded.data(), 0, nullptr) != 0;
+        png_image_free(&Read);
+      });
+      ExpectSame(Decoded && Data.Decoded == Data.Millimeters, "DecompressPNG", Frame);
+    }
+#endif
+
+    /**
+     * Projects the depth in meters with the 8 bit color into an organized or a dense point cloud, row by row on one
+     * core like a stripe of the RGBD component, with every implementation of the row kernel. The far pixels and
+     * the floor beyond 40 m are out of range, so the dense cloud has gaps. All implementations have to write the same
+     * points as the scalar one.
+     */
+    void RunBackProjection(const Resolution &Frame, const Frames &Data, const bool Organized)
+    {
+      const std::string Prefix = Organized ? "BackProjection/Organized/" : "BackProjection/Dense/";
+      typedef size_t (*ProjectRowFunction)(const float *, const uint32_t *, const float *, const float, const size_t,
+                                           const float, const float, const bool, BackProjection::Point *);
+      std::vector<std::pair<std::string, ProjectRowFunction>> Kernels = { { "Scalar", BackProjection::ProjectRowScalar } };
+      if (ImageConversion::HasAVX2())
+      {
+        Kernels.push_back({ "AVX2", BackProjection::ProjectRowAVX2 });
+      }
+
+      std::vector<float> RaysX(Frame.Width), RaysY(Frame.Height);
+      BackProjection::ComputeRays(RaysX.data(), Frame.Width, 1, Frame.Width / 2.0, Frame.Width / 2.0);
+      BackProjection::ComputeRays(RaysY.data(), Frame.Height, 1, Frame.Height / 2.0, Frame.Width / 2.0);
+      const uint32_t *Colors = reinterpret_cast<const uint32_t *>(Data.LDR.data());
+      const float MaxDepth = 40.f;
+
+      std::vector<BackProjection::Point> Reference, Points(Data.Pixels);
+      size_t ReferenceCount = 0;
+      for (const auto &Entry : Kernels)
+      {
+        const std::string Name = Prefix + Entry.first;
+        if (!Selected(Name))
+        {
+          continue;
+        }
+
+        size_t Count = 0;
+        Kernel(Name, Frame, 8, [&]()
+        {
+          BackProjection::Point *Out = Points.data();
+          for (uint32 Row = 0; Row < Frame.Height; ++Row)
+          {
+            const size_t Offset = (size_t)Row * Frame.Width;
+            Out += Entry.second(Data.Meters.data() + Offset, Colors + Offset, RaysX.data(), RaysY[Row], Frame.Width,
+                                0.f, MaxDepth, Organized, Out);
+          }
+          Count = Out - Points.data();
+        },
+        [&](Result &Result)
+        {
+          const double Seconds = Result.Metrics[0].second / 1e3;
+          Result.Metrics.push_back({ "mpoints_per_s", Data.Pixels / Seconds / 1e6 });
+          Result.Metrics.push_back({ "valid", (double)Count / Data.Pixels });
+        });
+
+        // The points are compared bit for bit, NaN included
+        if (Reference.empty())
+        {
+          Reference.assign(Points.begin(), Points.begin() + Count);
+          ReferenceCount = Count;
+        }
+        else
+        {
+          ExpectSame(Count == ReferenceCount && std::memcmp(Points.data(), Reference.data(), Count * sizeof(BackProjection::Point)) == 0,
+                     Name, Frame);
+        }
+      }
+    }
+
+    /**
+     * Hands bgr8 packets from a writer thread, which copies every frame into its slot like a conversion job, to
+     * a reader thread. Unpaced, the writer runs as fast as the ring lets it under NeverDrop and the latency
+     * includes the time the packets wait in the ring. Paced, the writer waits until the reader got the previous
+     * packet, so the latency is the handoff alone.
+     */
+    void RunHandoff(const Resolution &Frame, const bool Paced)
+    {
+      const std::string Name = Paced ? "PacketBuffer/HandoffPaced" : "PacketBuffer/Throughput";
+      if (!Selected(Name))
+      {
+        return;
+      }
+
+      PacketBuffer Buffer(Frame.Width, Frame.Height, 3, 90.f, 3, PacketBuffer::Policy::NeverDrop);
+      const std::vector<uint8_t> Source(Buffer.SizeImage, 0x5a);
+      std::atomic<uint64> Received(0);
+      std::vector<double> Latencies;
+
+      std::thread Reader([&Buffer, &Received, &Latencies]()
+      {
+        while (Buffer.StartReading())
+        {
+          Latencies.push_back((NowNanoseconds() - Buffer.HeaderRead->TimestampSent) / 1e3);
+          Buffer.DoneReading();
+          Received.fetch_add(1, std::memory_order_release);
+        }
+      });
+
+      const Clock::time_point Start = Clock::now();
+      const Clock::time_point End = Start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(Opts.MinSeconds));
+      uint64 Sent = 0;
+      while (Sent < 3 || Clock::now() < End)
+      {
+        std::memcpy(Buffer.Image, Source.data(), Source.size());
+        Buffer.HeaderWrite->TimestampSent = NowNanoseconds();
+        Buffer.DoneWriting();
+        ++Sent;
+        while (Paced && Received.load(std::memory_order_acquire) < Sent)
+        {
+          std::this_thread::yield();
+        }
+      }
+      Buffer.Release();
+      Reader.join();
+      const double Seconds = std::chrono::duration<double>(Clock::now() - Start).count();
+
+      std::sort(Latencies.begin(), Latencies.end());
+      Result Entry;
+      Entry.Benchmark = Name;
+      Entry.Frame = &Frame;
+      Entry.Runs = Latencies.size();
+      Entry.Metrics.push_back({ "frames_per_s", Latencies.size() / Seconds });
+      Entry.Metrics.push_back({ "mb_per_s", Latencies.size() * (double)Buffer.SizeImage / Seconds / (1024 * 1024) });
+      Entry.Metrics.push_back({ "handoff_p50_us", Percentile(Latencies, 0.5) });
+      Entry.Metrics.push_back({ "handoff_p99_us", Percentile(Latencies, 0.99) });
+      Entry.Metrics.push_back({ "handoff_max_us", Latencies.back() });
+      Add(std::move(Entry));
+    }
+
+#if LOOPBACK_SUPPORTED
+    // Receives packets from the server until it closes the connection, a slow client waits after every packet
+    static void ReceivePackets(const uint16_t Port, const bool Slow, uint64 &Frames, uint64 &Bytes, std::vector<double> &Latencies)
+    {
+      const int Socket = socket(AF_INET, SOCK_STREAM, 0);
+      sockaddr_in Address;
+      std::memset(&Address, 0, sizeof(Address));
+      Address.sin_family = AF_INET;
+      Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      Address.sin_port = htons(Port);
+      if (connect(Socket, reinterpret_cast<sockaddr*>(&Address), sizeof(Address)) != 0)
+      {
+        close(Socket);
+        return;
+      }
+
+      std::vector<uint8_t> Packet(sizeof(PacketBuffer::PacketHeader));
+      size_t Received = 0;
+      while (true)
+      {
+        const ssize_t Count = recv(Socket, Packet.data() + Received, Packet.size() - Received, 0);
+        if (Count <= 0)
+        {
+          break;
+        }
+        Received += (size_t)Count;
+        if (Received < Packet.size())
+        {
+          continue;
+        }
+
+        // The header tells the size of the rest of the packet
+        const PacketBuffer::PacketHeader Header = *reinterpret_cast<const PacketBuffer::PacketHeader*>(Packet.data());
+        if (Packet.size() < Header.Size)
+        {
+          Packet.resize(Header.Size);
+          continue;
+        }
+        Latencies.push_back((std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count() - (double)Header.TimestampSent) / 1e3);
+        ++Frames;
+        Bytes += Header.Size;
+        Packet.resize(sizeof(PacketBuffer::PacketHeader));
+        Received = 0;
+        if (Slow)
+        {
+          std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+      }
+      close(Socket);
+    }
+#endif
+
+    /**
+     * Streams bgr8 packets through the TCP server to two clients that read as fast as they can and one that
+     * waits 20 ms after every packet, all on loopback. The writer leases every packet to the server like the
+     * publishing job, without waiting for the clients. The throughput and latency are the ones of the fast clients.
+     */
+    void RunServer(const Resolution &Frame)
+    {
+      const std::string Name = "PacketServer/Loopback";
+      if (!Selected(Name))
+      {
+        return;
+      }
+#if LOOPBACK_SUPPORTED
+      PacketServer Server;
+      if (!Server.Start(0))
+      {
+        std::fprintf(Table, "%-32s %-8s could not listen\n", Name.c_str(), Frame.Name);
+        return;
+      }
+
+      const uint32 NumClients = 3;
+      PacketBuffer Buffer(Frame.Width, Frame.Height, 3, 90.f, 7);
+      const std::vector<uint8_t> Source(Buffer.SizeImage, 0x5a);
+      uint64 Frames[NumClients] = {}, Bytes[NumClients] = {};
+      std::vector<double> Latencies[NumClients];
+      std::vector<std::thread> Clients;
+      for (uint32 i = 0; i < NumClients; ++i)
+      {
+        Clients.emplace_back(&Benchmark::ReceivePackets, Server.GetPort(), i == NumClients - 1, std::ref(Frames[i]),
+                             std::ref(Bytes[i]), std::ref(Latencies[i]));
+      }
+      while (Server.GetNumClients() < NumClients)
+      {
+        std::this_thread::yield();
+      }
+
+      const Clock::time_point Start = Clock::now();
+      const Clock::time_point End = Start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(Opts.MinSeconds));
+      while (Clock::now() < End)
+      {
+        std::memcpy(Buffer.Image, Source.data(), Source.size());
+        Buffer.DoneWriting();
+        if (Buffer.TryStartReading())
+        {
+          Server.Send(Buffer.LeaseRead());
+        }
+      }
+      const double Seconds = std::chrono::duration<double>(Clock::now() - Start).count();
+      const double Dropped = (double)Server.GetDropped(), Sent = (double)Server.GetSent();
+      Server.Stop();
+      for (std::thread &Client : Clients)
+      {
+        Client.join();
+      }
+
+      std::vector<double> Fast(Latencies[0]);
+      Fast.insert(Fast.end(), Latencies[1].begin(), Latencies[1].end());
+      std::sort(Fast.begin(), Fast.end());
+      if (Fast.empty())
+      {
+        Fast.push_back(0);
+      }
+      Result Entry;
+      Entry.Benchmark = Name;
+      Entry.Frame = &Frame;
+      Entry.Runs = Frames[0] + Frames[1];
+      Entry.Metrics.push_back({ "client_frames_per_s", (Frames[0] + Frames[1]) / 2.0 / Seconds });
+      Entry.Metrics.push_back({ "client_mb_per_s", (Bytes[0] + Bytes[1]) / 2.0 / Seconds / (1024 * 1024) });
+      Entry.Metrics.push_back({ "total_mb_per_s", (Bytes[0] + Bytes[1] + Bytes[2]) / Seconds / (1024 * 1024) });
+      Entry.Metrics.push_back({ "slow_frames_per_s", Frames[2] / Seconds });
+      Entry.Metrics.push_back({ "drop_ratio", Dropped + Sent > 0 ? Dropped / (Dropped + Sent) : 0 });
+      Entry.Metrics.push_back({ "latency_p50_us", Percentile(Fast, 0.5) });
+      Entry.Metrics.push_back({ "latency_p99_us", Percentile(Fast, 0.99) });
+      Add(std::move(Entry));
+#endif
+    }
+
+    /**
+     * Appends bgr8 packets to a capture log as fast as the recorder takes them, like a publishing job that is
+     * never held back by the disk. Frames are dropped once all staging buffers wait for the disk, so the frames
+     * per second are the ones the disk sustains. The time includes writing out the buffers and the index on close,
+     * the write calls are the time the publishing job spends in copying a packet.
+     */
+    void RunRecorder(const Resolution &Frame)
+    {
+      const std::string Name = "FrameRecorder/SustainedWrite";
+      if (!Selected(Name))
+      {
+        return;
+      }
+
+      PacketBuffer Buffer(Frame.Width, Frame.Height, 3, 90.f, 3);
+      std::memset(Buffer.Image, 0x5a, Buffer.SizeImage);
+      CaptureLog::FileHeader Description;
+      std::memset(&Description, 0, sizeof(Description));
+      Description.PacketSize = Buffer.Size;
+      Description.OffsetImage = Buffer.OffsetImage;
+      Description.Width = Frame.Width;
+      Description.Height = Frame.Height;
+      Description.Bytes = 3;
+      std::strncpy(Description.Encoding, "bgr8", sizeof(Description.Encoding) - 1);
+
+      const std::string Path = Opts.RecordDir + "/vision_benchmark.rec";
+      FrameRecorder Recorder;
+      if (!Recorder.Open(Path, Description))
+      {
+        std::fprintf(Table, "%-32s %-8s could not create %s\n", Name.c_str(), Frame.Name, Path.c_str());
+        return;
+      }
+
+      const Clock::time_point Start = Clock::now();
+      const Clock::time_point End = Start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(Opts.MinSeconds));
+      std::vector<double> Calls;
+      while (Clock::now() < End)
+      {
+        const uint64 Now = NowNanoseconds();
+        Buffer.HeaderWrite->TimestampCapture = Now;
+        if (Recorder.Write(reinterpret_cast<const uint8*>(Buffer.HeaderWrite)))
+        {
+          Calls.push_back((NowNanoseconds() - Now) / 1e3);
+        }
+        else
+        {
+          std::this_thread::yield();
+        }
+      }
+      Recorder.Close();
+      const double Seconds = std::chrono::duration<double>(Clock::now() - Start).count();
+      const FrameRecorder::Statistics Stats = Recorder.GetStatistics();
+      std::remove(Path.c_str());
+
+      Result Entry;
+      Entry.Benchmark = Name;
+      Entry.Frame = &Frame;
+      Entry.Runs = Calls.size();
+      std::sort(Calls.begin(), Calls.end());
+      if (Calls.empty())
+      {
+        Calls.push_back(0);
+      }
+      Entry.Metrics.push_back({ "frames_per_s", Stats.Frames / Seconds });
+      Entry.Metrics.push_back({ "mb_per_s", Stats.Bytes / Seconds / (1024 * 1024) });
+      Entry.Metrics.push_back({ "write_mb_per_s", Stats.WriteSeconds > 0 ? Stats.Bytes / Stats.WriteSeconds / (1024 * 1024) : 0 });
+      Entry.Metrics.push_back({ "write_call_p50_us", Percentile(Calls, 0.5) });
+      Entry.Metrics.push_back({ "write_call_p99_us", Percentile(Calls, 0.99) });
+      Entry.Metrics.push_back({ "direct", Stats.Direct ? 1 : 0 });
+      Add(std::move(Entry));
+    }
+
+    /**
+     * Replays a capture log of at least 256 MB as fast as possible, like a component with ReplaySpeed 0. Every
+     * packet is leased from the mapping and copied out once, like the shared memory ring or a socket would, so the
+     * pages are actually read. The first pass reads from the disk as the recorder bypassed the page cache.
+     */
+    void RunReplay(const Resolution &Frame)
+    {
+      const std::string Name = "CaptureLogReader/Replay";
+      if (!Selected(Name))
+      {
+        return;
+      }
+
+      PacketBuffer Buffer(Frame.Width, Frame.Height, 3, 90.f, 3);
+      std::memset(Buffer.Image, 0x5a, Buffer.SizeImage);
+      CaptureLog::FileHeader Description;
+      std::memset(&Description, 0, sizeof(Description));
+      Description.PacketSize = Buffer.Size;
+      Description.OffsetImage = Buffer.OffsetImage;
+      Description.Width = Frame.Width;
+      Description.Height = Frame.Height;
+      Description.Bytes = 3;
+      std::strncpy(Description.Encoding, "bgr8", sizeof(Description.Encoding) - 1);
+
+      const std::string Path = Opts.RecordDir + "/vision_benchmark_replay.rec";
+      FrameRecorder Recorder;
+      if (!Recorder.Open(Path, Description))
+      {
+        std::fprintf(Table, "%-32s %-8s could not create %s\n", Name.c_str(), Frame.Name, Path.c_str());
+        return;
+      }
+      const uint64 NumFrames = std::max<uint64>(8, (256ull * 1024 * 1024) / Buffer.Size);
+      for (uint64 i = 0; i < NumFrames; ++i)
+      {
+        Buffer.HeaderWrite->TimestampCapture = i * 1000000;
+        while (!Recorder.Write(reinterpret_cast<const uint8*>(Buffer.HeaderWrite)))
+        {
+          std::this_thread::yield();
+        }
+      }
+      Recorder.Close();
+
+      CaptureLogReader Reader;
+      if (!Reader.Open(Path) || Reader.GetNumFrames() != NumFrames)
+      {
+        std::fprintf(Table, "%-32s %-8s could not read back %s\n", Name.c_str(), Frame.Name, Path.c_str());
+        std::remove(Path.c_str());
+        return;
+      }
+      std::vector<uint8> Copy(Buffer.Size);
+      const Clock::time_point Start = Clock::now();
+      const Clock::time_point End = Start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(Opts.MinSeconds));
+      uint64 Replayed = 0;
+      while (Replayed < NumFrames || Clock::now() < End)
+      {
+        const std::shared_ptr<const uint8> Lease = Reader.Lease(Replayed++ % NumFrames);
+        std::memcpy(Copy.data(), Lease.get(), Buffer.Size);
+      }
+      const double Seconds = std::chrono::duration<double>(Clock::now() - Start).count();
+      Reader.Close();
+      std::remove(Path.c_str());
+
+      Result Entry;
+      Entry.Benchmark = Name;
+      Entry.Frame = &Frame;
+      Entry.Runs = Replayed;
+      Entry.Metrics.push_back({ "frames_per_s", Replayed / Seconds });
+      Entry.Metrics.push_back({ "mb_per_s", Replayed * (double)Buffer.Size / Seconds / (1024 * 1024) });
+      Add(std::move(Entry));
+    }
+  };
+
+  bool WriteJson(const std::string &Path, const Benchmark &Bench)
+  {
+    FILE *File = Path == "-" ? stdout : std::fopen(Path.c_str(), "w");
+    if (!File)
+    {
+      return false;
+    }
+
+    std::fprintf(File, "{\n  \"threads\": %u,\n", Bench.GetNumThreads());
+    std::fprintf(File, "  \"features\": { \"sse41\": %s, \"f16c\": %s, \"avx2\": %s },\n",
+                 ImageConversion::HasSSE41() ? "true" : "false", ImageConversion::HasF16C() ? "true" : "false",
+                 ImageConversion::HasAVX2() ? "true" : "false");
+    std::fprintf(File, "  \"results\": [");
+    const std::vector<Result> &Results = Bench.GetResults();
+    for (size_t i = 0; i < Results.size(); ++i)
+    {
+      const Result &Entry = Results[i];
+      std::fprintf(File, "%s\n    { \"benchmark\": \"%s\", \"resolution\": \"%s\", \"width\": %u, \"height\": %u, \"runs\": %llu",
+                   i > 0 ? "," : "", Entry.Benchmark.c_str(), Entry.Frame->Name, Entry.Frame->Width, Entry.Frame->Height,
+                   (unsigned long long)Entry.Runs);
+      for (const std::pair<const char*, double> &Metric : Entry.Metrics)
+      {
+        std::fprintf(File, ", \"%s\": %.6g", Metric.first, Metric.second);
+      }
+      std::fprintf(File, " }");
+    }
+    std::fprintf(File, "\n  ]\n}\n");
+    return File == stdout || std::fclose(File) == 0;
+  }
+
+  void PrintUsage(const char *Program)
+  {
+    std::fprintf(stderr,
+      "Usage: %s [--min-time SECONDS] [--threads N] [--filter TEXT] [--json FILE] [--record-dir DIR] [--scaling]\n"
+      "  --min-time    Time spent on each benchmark, default 0.5\n"
+      "  --threads     Workers of the pool for the parallel conversions, default one less than the cores\n"
+      "  --filter      Only runs the benchmarks whose name contains TEXT\n"
+      "  --json        Writes the results as JSON to FILE, - for stdout\n"
+      "  --record-dir  Directory of the capture logs of the recorder and replay benchmarks, default the current one\n"
+      "  --scaling     Only measures the parallel conversions of a 4K frame on 1, 2, 4 and 8 cores\n", Program);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  Options Opts;
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string Arg = argv[i];
+    const bool HasValue = i + 1 < argc;
+    if (Arg == "--min-time" && HasValue)
+    {
+      Opts.MinSeconds = std::atof(argv[++i]);
+    }
+    else if (Arg == "--threads" && HasValue)
+    {
+      Opts.Threads = (uint32)std::atoi(argv[++i]);
+    }
+    else if (Arg == "--filter" && HasValue)
+    {
+      Opts.Filter = argv[++i];
+    }
+    else if (Arg == "--json" && HasValue)
+    {
+      Opts.Json = argv[++i];
+    }
+    else if (Arg == "--record-dir" && HasValue)
+    {
+      Opts.RecordDir = argv[++i];
+    }
+    else if (Arg == "--scaling")
+    {
+      Opts.Scaling = true;
+    }
+    else
+    {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  // The table goes to stderr if the JSON is written to stdout
+  Benchmark Bench(Opts, Opts.Json == "-" ? stderr : stdout);
+  Bench.Run();
+
+  if (!Opts.Json.empty() && !WriteJson(Opts.Json, Bench))
+  {
+    std::fprintf(stderr, "Writing %s failed.\n", Opts.Json.c_str());
+    return 1;
+  }
+  return Bench.GetMismatches() > 0 ? 1 : 0;
+}
@@ -0,0 +1,680 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+/**
+ * Standalone checks of the engine independent sources of the module, built without the engine like the benchmark
+ * as described in README.md. Every check prints its name and whether it passed, the exit code is the number of
+ * failed checks. --filter runs only the checks whose name contains the text.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DepthCompression.h"
+#include "ImageConversion.h"
+#include "PacketBuffer.h"
+#include "SharedFrameRing.h"
+
+#if defined(__linux__)
+  #include <sys/wait.h>
+  #include <unistd.h>
+  #define FORKED_READER_SUPPORTED 1
+#else
+  #define FORKED_READER_SUPPORTED 0
+#endif
+
+namespace
+{
+  // Failures of the running check, reported with the first one
+  uint32 Failures = 0;
+  std::string FirstFailure;
+
+  void Fail(const std::string &What, const char *File, const int Line)
+  {
+    if (Failures++ == 0)
+    {
+      FirstFailure = std::string(File) + ":" + std::to_string(Line) + ": " + What;
+    }
+  }
+
+  #define EXPECT(Condition) \
+    do { if (!(Condition)) { Fail(#Condition, __FILE__, __LINE__); } } while (0)
+
+  #define EXPECT_MSG(Condition, Message) \
+    do { if (!(Condition)) { Fail(std::string(#Condition) + " (" + (Message) + ")", __FILE__, __LINE__); } } while (0)
+
+  struct Check
+  {
+    const char *Name;
+    std::function<void()> Run;
+  };
+
+  /*
+   * ImageConversion: the vector kernels have to produce the same bytes as the scalar reference
+   */
+
+  // Pixel counts around the vector widths, so that every kernel runs its tails, and a few odd frame sizes
+  const size_t TailCounts[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 47, 63, 64, 65, 127, 129, 641, 1001 };
+
+  // Runs a kernel and its reference on Pixels pixels of In, starting Offset pixels in so that the input and output
+  // are misaligned, and compares the output and the guard bytes behind it byte for byte
+  template<typename Input, typename Output>
+  bool SameOutput(const std::function<void(const Input*, Output*, size_t)> &Kernel,
+                  const std::function<void(const Input*, Output*, size_t)> &Reference,
+                  const std::vector<Input> &In, const size_t InPerPixel, const size_t OutPerPixel,
+                  const size_t Offset, const size_t Pixels)
+  {
+    const size_t Guard = 64;
+    std::vector<Output> Expected(Offset * OutPerPixel + Pixels * OutPerPixel + Guard);
+    std::vector<Output> Actual(Expected.size());
+    std::memset(Expected.data(), 0xcd, Expected.size() * sizeof(Output));
+    std::memset(Actual.data(), 0xcd, Actual.size() * sizeof(Output));
+    Reference(In.data() + Offset * InPerPixel, Expected.data() + Offset * OutPerPixel, Pixels);
+    Kernel(In.data() + Offset * InPerPixel, Actual.data() + Offset * OutPerPixel, Pixels);
+    return std::memcmp(Expected.data(), Actual.data(), Expected.size() * sizeof(Output)) == 0;
+  }
+
+  // Compares a kernel with its reference on every half value in every channel and on all tails
+  template<typename Output>
+  void CheckHalfKernel(const char *Name, const std::function<void(const uint16_t*, Output*, size_t)> &Kernel,
+                       const std::function<void(const uint16_t*, Output*, size_t)> &Reference, const size_t OutPerPixel)
+  {
+    // Pixel i holds the half value i in R and permutations of it in G and B, so all 65536 values are converted in
+    // every channel, including denormals, infinities and NaNs
+    std::vector<uint16_t> In(65536 * 4 + 4 * 4);
+    for (uint32 i = 0; i < 65536 + 4; ++i)
+    {
+      In[i * 4 + 0] = (uint16_t)i;
+      In[i * 4 + 1] = (uint16_t)(i * 40503u);
+      In[i * 4 + 2] = (uint16_t)(i * 7919u + 12345u);
+      In[i * 4 + 3] = (uint16_t)~i;
+    }
+    EXPECT_MSG((SameOutput<uint16_t, Output>(Kernel, Reference, In, 4, OutPerPixel, 0, 65536)), Name);
+
+    for (const size_t Pixels : TailCounts)
+    {
+      for (size_t Offset = 0; Offset < 3; ++Offset)
+      {
+        EXPECT_MSG((SameOutput<uint16_t, Output>(Kernel, Reference, In, 4, OutPerPixel, Offset * 1237 + Offset, Pixels)),
+                   std::string(Name) + ", " + std::to_string(Pixels) + " pixels at offset " + std::to_string(Offset));
+      }
+    }
+  }
+
+  void CheckHalfToBGR8()
+  {
+    using namespace ImageConversion;
+    if (HasSSE41() && HasF16C())
+    {
+      CheckHalfKernel<uint8_t>("SSE", HalfToBGR8SSE, HalfToBGR8Scalar, 3);
+    }
+    if (HasAVX2() && HasF16C())
+    {
+      CheckHalfKernel<uint8_t>("AVX2", HalfToBGR8AVX2, HalfToBGR8Scalar, 3);
+    }
+    CheckHalfKernel<uint8_t>("Dispatch", HalfToBGR8, HalfToBGR8Scalar, 3);
+  }
+
+  void CheckHalfToMeters()
+  {
+    using namespace ImageConversion;
+    for (const float MaxMeters : { 655.f, 100.f, 1.f, 0.f })
+    {
+      const auto Bind = [MaxMeters](void (*Kernel)(const uint16_t*, float*, size_t, float))
+      {
+        return std::function<void(const uint16_t*, float*, size_t)>(
+          [Kernel, MaxMeters](const uint16_t *In, float *Out, size_t Pixels) { Kernel(In, Out, Pixels, MaxMeters); });
+      };
+      if (HasSSE41() && HasF16C())
+      {
+        CheckHalfKernel<float>("SSE", Bind(HalfToMetersSSE), Bind(HalfToMetersScalar), 1);
+      }
+      if (HasAVX2() && HasF16C())
+      {
+        CheckHalfKernel<float>("AVX2", Bind(HalfToMetersAVX2), Bind(HalfToMetersScalar), 1);
+      }
+      CheckHalfKernel<float>("Dispatch", Bind(HalfToMeters), Bind(HalfToMetersScalar), 1);
+    }
+  }
+
+  void CheckHalfToMillimeters()
+  {
+    using namespace ImageConversion;
+    for (const float MaxMillimeters : { 65535.f, 10000.f, 1.f })
+    {
+      const auto Bind = [MaxMillimeters](void (*Kernel)(const uint16_t*, uint16_t*, size_t, float))
+      {
+        return std::function<void(const uint16_t*, uint16_t*, size_t)>(
+          [Kernel, MaxMillimeters](const uint16_t *In, uint16_t *Out, size_t Pixels) { Kernel(In, Out, Pixels, MaxMillimeters); });
+      };
+      if (HasSSE41() && HasF16C())
+      {
+        CheckHalfKernel<uint16_t>("SSE", Bind(HalfToMillimetersSSE), Bind(HalfToMillimetersScalar), 1);
+      }
+      if (HasAVX2() && HasF16C())
+      {
+        CheckHalfKernel<uint16_t>("AVX2", Bind(HalfToMillimetersAVX2), Bind(HalfToMillimetersScalar), 1);
+      }
+      CheckHalfKernel<uint16_t>("Dispatch", Bind(HalfToMillimeters), Bind(HalfToMillimetersScalar), 1);
+    }
+  }
+
+  // The meters of the 32FC1 encoding are compressed as millimeters, with the rounding of HalfToMillimeters
+  void CheckMetersToMillimeters()
+  {
+    using namespace ImageConversion;
+    const float Infinity = std::numeric_limits<float>::infinity();
+    const float Meters[] = { std::nanf(""), -1.f, 0.f, 0.0004f, 0.0006f, 1.2344f, 1.2346f, 65.535f, 70.f, Infinity };
+    const uint16_t Expected[] = { 0, 0, 0, 0, 1, 1234, 1235, 65535, 65535, 65535 };
+    const size_t Pixels = sizeof(Meters) / sizeof(Meters[0]);
+    uint16_t Millimeters[Pixels];
+    MetersToMillimeters(Meters, Millimeters, Pixels, 65535.f);
+    for (size_t i = 0; i < Pixels; ++i)
+    {
+      EXPECT_MSG(Millimeters[i] == Expected[i], std::to_string(Meters[i]) + " m gave " + std::to_string(Millimeters[i]) + " mm");
+    }
+  }
+
+  void CheckBGRA8ToBGR8()
+  {
+    using namespace ImageConversion;
+    std::vector<uint8_t> In((65536 + 4) * 4);
+    std::mt19937 Random(7);
+    for (uint8_t &Byte : In)
+    {
+      Byte = (uint8_t)Random();
+    }
+
+    typedef std::function<void(const uint8_t*, uint8_t*, size_t)> Kernel;
+    std::vector<std::pair<const char*, Kernel>> Kernels = { { "Dispatch", BGRA8ToBGR8 } };
+    if (HasSSE41())
+    {
+      Kernels.push_back({ "SSE", BGRA8ToBGR8SSE });
+    }
+    if (HasAVX2())
+    {
+      Kernels.push_back({ "AVX2", BGRA8ToBGR8AVX2 });
+    }
+    for (const auto &Entry : Kernels)
+    {
+      EXPECT_MSG((SameOutput<uint8_t, uint8_t>(Entry.second, BGRA8ToBGR8Scalar, In, 4, 3, 0, 65536)), Entry.first);
+      for (const size_t Pixels : TailCounts)
+      {
+        for (size_t Offset = 0; Offset < 3; ++Offset)
+        {
+          EXPECT_MSG((SameOutput<uint8_t, uint8_t>(Entry.second, BGRA8ToBGR8Scalar, In, 4, 3, Offset * 1237 + Offset, Pixels)),
+                     std::string(Entry.first) + ", " + std::to_string(Pixels) + " pixels at offset " + std::to_string(Offset));
+        }
+      }
+    }
+  }
+
+  /*
+   * PacketBuffer: a writer, a reader and a thread holding leases hammer a small ring. Build with
+   * -fsanitize=thread to have the handovers checked for races as well.
+   */
+
+  const uint32 StressWidth = 32, StressHeight = 8, StressPackets = 100000;
+
+  // Fills the image of a packet with bytes derived from its sequence, so that a torn or overwritten packet shows
+  void FillPacket(PacketBuffer &Buffer, const uint64_t Sequence)
+  {
+    Buffer.HeaderWrite->TimestampCapture = Sequence;
+    for (uint32 i = 0; i < Buffer.SizeImage; ++i)
+    {
+      Buffer.Image[i] = (uint8)(Sequence * 31 + i);
+    }
+  }
+
+  bool IsIntact(const uint8 *Packet, const uint32 SizeHeader, const uint32 SizeImage)
+  {
+    const uint64_t Sequence = reinterpret_cast<const PacketBuffer::PacketHeader*>(Packet)->TimestampCapture;
+    for (uint32 i = 0; i < SizeImage; ++i)
+    {
+      if (Packet[SizeHeader + i] != (uint8)(Sequence * 31 + i))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void StressPacketBuffer(const PacketBuffer::Policy DropPolicy)
+  {
+    PacketBuffer Buffer(StressWidth, StressHeight, 3, 90.f, 4, DropPolicy);
+    const bool InOrder = DropPolicy == PacketBuffer::Policy::NeverDrop;
+
+    // Every other packet is leased to the holder thread, which checks it again before it lets go of it
+    std::mutex LeaseLock;
+    std::condition_variable LeaseAdded;
+    std::deque<std::shared_ptr<const uint8>> Leases;
+    bool Finished = false;
+    std::atomic<uint32> LeaseFailures(0);
+    std::thread Holder([&]()
+    {
+      std::unique_lock<std::mutex> Lock(LeaseLock);
+      while (true)
+      {
+        LeaseAdded.wait(Lock, [&]() { return Finished || !Leases.empty(); });
+        if (Leases.empty())
+        {
+          return;
+        }
+        std::shared_ptr<const uint8> Lease = std::move(Leases.front());
+        Leases.pop_front();
+        Lock.unlock();
+        std::this_thread::yield();
+        if (!IsIntact(Lease.get(), Buffer.SizeHeader, Buffer.SizeImage))
+        {
+          ++LeaseFailures;
+        }
+        Lease.reset();
+        Lock.lock();
+      }
+    });
+
+    uint64_t Received = 0, Last = 0;
+    uint32 OrderFailures = 0, TornFailures = 0;
+    std::thread Reader([&]()
+    {
+      while (Buffer.StartReading())
+      {
+        const uint64_t Sequence = Buffer.HeaderRead->TimestampCapture;
+        if (InOrder ? Sequence != Last + 1 : Sequence <= Last)
+        {
+          ++OrderFailures;
+        }
+        Last = Sequence;
+        if (!IsIntact(Buffer.Read, Buffer.SizeHeader, Buffer.SizeImage))
+        {
+          ++TornFailures;
+        }
+        if (++Received % 2 == 0)
+        {
+          std::lock_guard<std::mutex> Lock(LeaseLock);
+          Leases.push_back(Buffer.LeaseRead());
+          LeaseAdded.notify_one();
+        }
+        else
+        {
+          Buffer.DoneReading();
+        }
+      }
+    });
+
+    for (uint64_t Sequence = 1; Sequence <= StressPackets; ++Sequence)
+    {
+      FillPacket(Buffer, Sequence);
+      Buffer.DoneWriting();
+    }
+    Buffer.Release();
+    Reader.join();
+    {
+      std::lock_guard<std::mutex> Lock(LeaseLock);
+      Finished = true;
+      LeaseAdded.notify_one();
+    }
+    Holder.join();
+
+    EXPECT_MSG(OrderFailures == 0, std::to_string(OrderFailures) + " packets out of order");
+    EXPECT_MSG(TornFailures == 0, std::to_string(TornFailures) + " torn packets");
+    EXPECT_MSG(LeaseFailures == 0, std::to_string(LeaseFailures.load()) + " leased packets overwritten");
+    if (InOrder)
+    {
+      EXPECT_MSG(Received == StressPackets && Buffer.GetDropped() == 0, std::to_string(Received) + " packets received");
+    }
+    else
+    {
+      EXPECT_MSG(Received + Buffer.GetDropped() <= StressPackets && Last == StressPackets, std::to_string(Received) +
+                 " received, " + std::to_string(Buffer.GetDropped()) + " dropped, last " + std::to_string(Last));
+    }
+  }
+
+  /*
+   * DepthCompression: RVL has to give back every depth image unchanged, including the ones the run lengths and the
+   * deltas are worst for
+   */
+
+  // Compresses Depth, checks the size against MaxRVLSize and that decompressing it restores Depth without writing
+  // past the end of the image
+  void CheckRVLRoundTrip(const std::string &Name, const std::vector<uint16_t> &Depth)
+  {
+    const size_t Pixels = Depth.size();
+    std::vector<uint8_t> Stream(DepthCompression::MaxRVLSize(Pixels) + 64, 0xcd);
+    const size_t Size = DepthCompression::CompressRVL(Depth.data(), Stream.data(), Pixels);
+    EXPECT_MSG(Size <= DepthCompression::MaxRVLSize(Pixels) && Size % 4 == 0, Name + ", " + std::to_string(Size) + " bytes");
+    EXPECT_MSG(std::all_of(Stream.begin() + DepthCompression::MaxRVLSize(Pixels), Stream.end(), [](uint8_t Byte) { return Byte == 0xcd; }),
+               Name + ", wrote past MaxRVLSize");
+
+    // The decoder only gets the bytes of the stream
+    Stream.resize(Size);
+    const size_t Guard = 16;
+    std::vector<uint16_t> Decoded(Pixels + Guard, 0xabcd);
+    EXPECT_MSG(DepthCompression::DecompressRVL(Stream.data(), Size, Decoded.data(), Pixels), Name + ", stream rejected");
+    EXPECT_MSG(std::equal(Depth.begin(), Depth.end(), Decoded.begin()), Name);
+    EXPECT_MSG(std::all_of(Decoded.begin() + Pixels, Decoded.end(), [](uint16_t Value) { return Value == 0xabcd; }),
+               Name + ", wrote past the image");
+  }
+
+  void CheckRVL()
+  {
+    // A rendered scene: a sloped floor in millimeters with noise, holes and pixels at the far plane
+    const uint32 Width = 640, Height = 480;
+    std::vector<uint16_t> Scene(Width * Height);
+    std::mt19937 Random(42);
+    for (uint32 y = 0; y < Height; ++y)
+    {
+      for (uint32 x = 0; x < Width; ++x)
+      {
+        const uint32 Dice = Random() % 100;
+        Scene[y * Width + x] = Dice < 3 ? 0 : Dice < 6 ? 65535 : (uint16_t)(1000 + 50000 * y / Height + Random() % 40);
+      }
+    }
+    CheckRVLRoundTrip("scene", Scene);
+
+    CheckRVLRoundTrip("empty", std::vector<uint16_t>());
+    CheckRVLRoundTrip("all zero", std::vector<uint16_t>(Width * Height, 0));
+    CheckRVLRoundTrip("all max range", std::vector<uint16_t>(Width * Height, 65535));
+    CheckRVLRoundTrip("one valid pixel", std::vector<uint16_t>(1, 1));
+
+    // The largest deltas, with and without zeros in between
+    std::vector<uint16_t> Extremes(Width * Height);
+    std::vector<uint16_t> Sparse(Width * Height);
+    for (uint32 i = 0; i < Width * Height; ++i)
+    {
+      Extremes[i] = i % 2 ? 65535 : 1;
+      Sparse[i] = i % 2 ? 0 : i % 4 ? 1 : 65535;
+    }
+    CheckRVLRoundTrip("alternating 1 and max range", Extremes);
+    CheckRVLRoundTrip("alternating zeros", Sparse);
+
+    // Runs longer than any nibble count of a single word, valid and invalid, ending on either
+    std::vector<uint16_t> Runs;
+    const uint32 RunLengths[] = { 1, 7, 8, 9, 63, 64, 65, 511, 4096, 262143, 262145, 1000000 };
+    for (const uint32 Length : RunLengths)
+    {
+      Runs.insert(Runs.end(), Length, 0);
+      Runs.insert(Runs.end(), Length, (uint16_t)(Length * 7));
+    }
+    CheckRVLRoundTrip("long runs", Runs);
+    Runs.insert(Runs.end(), 12345, 0);
+    CheckRVLRoundTrip("long runs ending with zeros", Runs);
+
+    // Random values over the whole range, at every length around the 8 nibbles of a word
+    for (uint32 Pixels = 1; Pixels <= 67; ++Pixels)
+    {
+      std::vector<uint16_t> Noise(Pixels);
+      for (uint16_t &Value : Noise)
+      {
+        Value = Random() % 4 == 0 ? 0 : (uint16_t)Random();
+      }
+      CheckRVLRoundTrip("noise of " + std::to_string(Pixels) + " pixels", Noise);
+    }
+
+    // Truncated streams are rejected, the image is decoded up to where they end and empty after that. The copy
+    // of the truncated part lets AddressSanitizer catch reads past the end.
+    std::vector<uint8_t> Stream(DepthCompression::MaxRVLSize(Scene.size()));
+    Stream.resize(DepthCompression::CompressRVL(Scene.data(), Stream.data(), Scene.size()));
+    for (const size_t Size : { (size_t)0, (size_t)4, Stream.size() / 2, Stream.size() - 4 })
+    {
+      const std::vector<uint8_t> Truncated(Stream.begin(), Stream.begin() + Size);
+      std::vector<uint16_t> Decoded(Scene.size(), 0xabcd);
+      const bool Accepted = DepthCompression::DecompressRVL(Truncated.data(), Size, Decoded.data(), Decoded.size());
+      const auto Decodable = std::mismatch(Decoded.begin(), Decoded.end(), Scene.begin()).first;
+      EXPECT_MSG(!Accepted && std::all_of(Decodable, Decoded.end(), [](uint16_t Value) { return Value == 0; }),
+                 "truncated to " + std::to_string(Size) + " bytes");
+    }
+
+    // Continuation nibbles beyond 32 bits are rejected instead of shifting past the word
+    const std::vector<uint8_t> Endless(64, 0xff);
+    std::vector<uint16_t> Decoded(16, 0xabcd);
+    EXPECT_MSG(!DepthCompression::DecompressRVL(Endless.data(), Endless.size(), Decoded.data(), Decoded.size()) &&
+               std::all_of(Decoded.begin(), Decoded.end(), [](uint16_t Value) { return Value == 0; }), "endless value");
+  }
+
+#if FORKED_READER_SUPPORTED
+  /*
+   * SharedFrameRing: a reader in another process has to get the frames in order, and every frame IsValid accepts
+   * has to be intact, while the writer overwrites the slots as fast as it can
+   */
+
+  const uint32 RingSlots = 3;
+  const uint32 RingImageSize = 64 * 1024;
+  const uint64_t RingFrames = 20000;
+
+  // Results the reader process sends back through a pipe
+  struct RingResults
+  {
+    uint64_t Frames;        // Frames returned by Wait
+    uint64_t Discarded;     // Frames IsValid rejected
+    uint64_t OutOfOrder;    // Frames not newer than the one before
+    uint64_t TornAccepted;  // Frames IsValid accepted although their data was not intact
+    uint64_t Last;          // Sequence of the last frame
+    uint64_t Skipped;
+    bool Closed;
+  };
+
+  std::string RingName(const char *Check)
+  {
+    return "/vision_tests_" + std::string(Check) + "_" + std::to_string(getpid());
+  }
+
+  // Writes frame Sequence of the ring, the sequence is stored in TimestampCapture like in the packet ring checks
+  void FillRingPacket(std::vector<uint8> &Packet, const uint64_t Sequence)
+  {
+    PacketBuffer::PacketHeader *Header = reinterpret_cast<PacketBuffer::PacketHeader*>(Packet.data());
+    Header->TimestampCapture = Sequence;
+    for (uint32 i = 0; i < RingImageSize; ++i)
+    {
+      Packet[sizeof(PacketBuffer::PacketHeader) + i] = (uint8)(Sequence * 31 + i);
+    }
+  }
+
+  // Runs in the forked process: reads the ring until the writer closes it
+  RingResults ReadRing(const std::string &Name, const int Ready)
+  {
+    RingResults Results = {};
+    SharedFrameReader Reader;
+    const bool Opened = Reader.Open(Name);
+    const char Signal = Opened ? 1 : 0;
+    if (write(Ready, &Signal, 1) != 1 || !Opened)
+    {
+      return Results;
+    }
+
+    SharedFrameReader::Frame Frame;
+    while (Reader.Wait(Frame, 5000))
+    {
+      ++Results.Frames;
+      if (Frame.Sequence <= Results.Last)
+      {
+        ++Results.OutOfOrder;
+      }
+      Results.Last = Frame.Sequence;
+
+      // Some frames are held until the writer starts to overwrite their slot or is done with it, the others are
+      // checked right away. The frame is checked in place, like a reader working on it would.
+      if (Results.Frames % 8 == 0)
+      {
+        const uint64_t Until = Frame.Sequence + RingSlots - (Results.Frames % 16 == 0 ? 0 : 1);
+        while (Reader.GetRing()->Published.load(std::memory_order_acquire) < Until && !Reader.IsClosed())
+        {
+        }
+      }
+      const bool Intact = Frame.Header->TimestampCapture == Frame.Sequence &&
+        IsIntact(reinterpret_cast<const uint8*>(Frame.Header), sizeof(PacketBuffer::PacketHeader), RingImageSize);
+      if (!Reader.IsValid(Frame))
+      {
+        ++Results.Discarded;
+      }
+      else if (!Intact)
+      {
+        ++Results.TornAccepted;
+      }
+    }
+    Results.Skipped = Reader.GetSkipped();
+    Results.Closed = Reader.IsClosed();
+    return Results;
+  }
+
+  void CheckForkedReader()
+  {
+    const std::string Name = RingName("reader");
+    const uint32 PacketSize = sizeof(PacketBuffer::PacketHeader) + RingImageSize;
+    SharedFrameWriter Writer;
+    EXPECT(Writer.Open(Name, RingSlots, PacketSize, sizeof(PacketBuffer::PacketHeader), 256, 256, 1, "mono8"));
+    if (!Writer.IsOpen())
+    {
+      return;
+    }
+
+    int ReadyPipe[2], ResultPipe[2];
+    EXPECT(pipe(ReadyPipe) == 0 && pipe(ResultPipe) == 0);
+    const pid_t Child = fork();
+    if (Child == 0)
+    {
+      // The reader leaves the ring of the writer alone, _exit skips the destructor of the inherited writer
+      const RingResults Results = ReadRing(Name, ReadyPipe[1]);
+      const bool Sent = write(ResultPipe[1], &Results, sizeof(Results)) == (ssize_t)sizeof(Results);
+      _exit(Sent ? 0 : 1);
+    }
+    EXPECT(Child > 0);
+    char Ready = 0;
+    EXPECT_MSG(Child > 0 && read(ReadyPipe[0], &Ready, 1) == 1 && Ready == 1, "the reader could not open the ring");
+
+    std::vector<uint8> Packet(PacketSize, 0);
+    for (uint64_t Sequence = 1; Sequence <= RingFrames; ++Sequence)
+    {
+      FillRingPacket(Packet, Sequence);
+      Writer.Write(Packet.data());
+    }
+    Writer.Close();
+
+    RingResults Results = {};
+    int Status = 0;
+    EXPECT(Child > 0 && read(ResultPipe[0], &Results, sizeof(Results)) == (ssize_t)sizeof(Results));
+    EXPECT(Child > 0 && waitpid(Child, &Status, 0) == Child && WIFEXITED(Status) && WEXITSTATUS(Status) == 0);
+    for (const int File : { ReadyPipe[0], ReadyPipe[1], ResultPipe[0], ResultPipe[1] })
+    {
+      close(File);
+    }
+
+    const std::string Summary = std::to_string(Results.Frames) + " frames, " + std::to_string(Results.Discarded) +
+      " discarded, " + std::to_string(Results.Skipped) + " skipped, last " + std::to_string(Results.Last);
+    EXPECT_MSG(Results.OutOfOrder == 0, std::to_string(Results.OutOfOrder) + " frames out of order");
+    EXPECT_MSG(Results.TornAccepted == 0, std::to_string(Results.TornAccepted) + " torn frames accepted by IsValid");
+    EXPECT_MSG(Results.Frames > 0 && Results.Last == RingFrames && Results.Closed, Summary);
+    EXPECT_MSG(Results.Frames + Results.Skipped == RingFrames && Results.Discarded > 0, Summary);
+  }
+
+  void CheckRingNameInUse()
+  {
+    const std::string Name = RingName("name");
+    const uint32 PacketSize = sizeof(PacketBuffer::PacketHeader) + 64;
+    std::vector<uint8> Packet(PacketSize, 0);
+
+    // A running writer keeps its ring, a second one does not take it over
+    SharedFrameWriter First, Second;
+    EXPECT(First.Open(Name, 2, PacketSize, sizeof(PacketBuffer::PacketHeader), 8, 8, 1, "mono8"));
+    SharedFrameReader Reader;
+    EXPECT(Reader.Open(Name));
+    EXPECT(!Second.Open(Name, 2, PacketSize, sizeof(PacketBuffer::PacketHeader), 8, 8, 1, "mono8"));
+    First.Write(Packet.data());
+    SharedFrameReader::Frame Frame;
+    EXPECT(Reader.Wait(Frame, 0) && Frame.Sequence == 1 && Reader.IsValid(Frame) && !Reader.IsClosed());
+    First.Close();
+    EXPECT(Reader.IsClosed());
+    EXPECT(Second.Open(Name, 2, PacketSize, sizeof(PacketBuffer::PacketHeader), 8, 8, 1, "mono8"));
+    Second.Close();
+
+    // The ring of a writer process that exited without closing it is replaced
+    const pid_t Child = fork();
+    if (Child == 0)
+    {
+      SharedFrameWriter *Crashed = new SharedFrameWriter();
+      _exit(Crashed->Open(Name, 2, PacketSize, sizeof(PacketBuffer::PacketHeader), 8, 8, 1, "mono8") ? 0 : 1);
+    }
+    int Status = 0;
+    EXPECT(Child > 0 && waitpid(Child, &Status, 0) == Child && WIFEXITED(Status) && WEXITSTATUS(Status) == 0);
+    SharedFrameWriter Replacing;
+    EXPECT(Replacing.Open(Name, 2, PacketSize, sizeof(PacketBuffer::PacketHeader), 8, 8, 1, "mono8"));
+  }
+#endif
+
+  const Check Checks[] =
+  {
+    { "ImageConversion/HalfToBGR8", CheckHalfToBGR8 },
+    { "ImageConversion/HalfToMeters", CheckHalfToMeters },
+    { "ImageConversion/HalfToMillimeters", CheckHalfToMillimeters },
+    { "ImageConversion/MetersToMillimeters", CheckMetersToMillimeters },
+    { "ImageConversion/BGRA8ToBGR8", CheckBGRA8ToBGR8 },
+    { "PacketBuffer/NeverDropStress", []() { StressPacketBuffer(PacketBuffer::Policy::NeverDrop); } },
+    { "PacketBuffer/LatestWinsStress", []() { StressPacketBuffer(PacketBuffer::Policy::LatestWins); } },
+    { "DepthCompression/RVLRoundTrip", CheckRVL },
+#if FORKED_READER_SUPPORTED
+    { "SharedFrameRing/ForkedReader", CheckForkedReader },
+    { "SharedFrameRing/NameInUse", CheckRingNameInUse },
+#endif
+  };
+
+  void PrintUsage(const char *Program)
+  {
+    std::fprintf(stderr,
+      "Usage: %s [--filter TEXT]\n"
+      "  --filter  Only runs the checks whose name contains TEXT\n", Program);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  std::string Filter;
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string Arg = argv[i];
+    if (Arg == "--filter" && i + 1 < argc)
+    {
+      Filter = argv[++i];
+    }
+    else
+    {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  std::printf("sse41=%d f16c=%d avx2=%d\n", ImageConversion::HasSSE41(), ImageConversion::HasF16C(), ImageConversion::HasAVX2());
+  int Failed = 0;
+  for (const Check &Entry : Checks)
+  {
+    if (!Filter.empty() && std::string(Entry.Name).find(Filter) == std::string::npos)
+    {
+      continue;
+    }
+    Failures = 0;
+    FirstFailure.clear();
+    Entry.Run();
+    if (Failures == 0)
+    {
+      std::printf("PASS %s\n", Entry.Name);
+    }
+    else
+    {
+      std::printf("FAIL %s, %u failures, first: %s\n", Entry.Name, Failures, FirstFailure.c_str());
+      ++Failed;
+    }
+    std::fflush(stdout);
+  }
+  return Failed;
+}
@@ -0,0 +1,157 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "BackProjection.h"
+
+#include <limits>
+
+#include "ImageConversion.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  #define PROJECTION_X86 1
+  #include <immintrin.h>
+#else
+  #define PROJECTION_X86 0
+#endif
+
+// MSVC allows intrinsics of any instruction set, gcc and clang need them enabled per function
+#if defined(_MSC_VER) && !defined(__clang__)
+  #define PROJECTION_TARGET(Features)
+#else
+  #define PROJECTION_TARGET(Features) __attribute__((target(Features)))
+#endif
+
+static_assert(sizeof(BackProjection::Point) == 16, "Points have to be packed with a point_step of 16 bytes");
+
+namespace BackProjection
+{
+
+void ComputeRays(float *Rays, const uint32_t Count, const uint32_t Stride, const double Center, const double Focal)
+{
+  for (uint32_t i = 0; i < Count; ++i)
+  {
+    Rays[i] = (float)(((double)i * Stride - Center) / Focal);
+  }
+}
+
+size_t ProjectRowScalar(const float *Depth, const uint32_t *RGB, const float *RaysX, const float RayY,
+                        const size_t Count, const float MinDepth, const float MaxDepth, const bool Organized,
+                        Point *Out)
+{
+  const float NaN = std::numeric_limits<float>::quiet_NaN();
+  const Point *Begin = Out;
+  for (size_t i = 0; i < Count; ++i)
+  {
+    const float Z = Depth[i];
+    const bool Valid = Z > MinDepth && Z <= MaxDepth;
+    if (!Valid && !Organized)
+    {
+      continue;
+    }
+    Out->X = Valid ? RaysX[i] * Z : NaN;
+    Out->Y = Valid ? RayY * Z : NaN;
+    Out->Z = Valid ? Z : NaN;
+    Out->RGB = RGB ? RGB[i] & 0xffffff : 0;
+    ++Out;
+  }
+  return Out - Begin;
+}
+
+#if PROJECTION_X86
+PROJECTION_TARGET("avx2")
+size_t ProjectRowAVX2(const float *Depth, const uint32_t *RGB, const float *RaysX, const float RayY,
+                      const size_t Count, const float MinDepth, const float MaxDepth, const bool Organized,
+                      Point *Out)
+{
+  const __m256 Min = _mm256_set1_ps(MinDepth);
+  const __m256 Max = _mm256_set1_ps(MaxDepth);
+  const __m256 NaN = _mm256_set1_ps(std::numeric_limits<float>::quiet_NaN());
+  const __m256 RayYx8 = _mm256_set1_ps(RayY);
+  const __m256i ColorMask = _mm256_set1_epi32(0xffffff);
+  const Point *Begin = Out;
+  size_t i = 0;
+  for (; i + 8 <= Count; i += 8)
+  {
+    const __m256 Z = _mm256_loadu_ps(Depth + i);
+    // Ordered comparisons, NaN is invalid
+    const __m256 Valid = _mm256_and_ps(_mm256_cmp_ps(Z, Min, _CMP_GT_OQ), _mm256_cmp_ps(Z, Max, _CMP_LE_OQ));
+    const __m256 X = _mm256_blendv_ps(NaN, _mm256_mul_ps(_mm256_loadu_ps(RaysX + i), Z), Valid);
+    const __m256 Y = _mm256_blendv_ps(NaN, _mm256_mul_ps(RayYx8, Z), Valid);
+    const __m256 ZOut = _mm256_blendv_ps(NaN, Z, Valid);
+    const __m256 C = RGB ? _mm256_castsi256_ps(_mm256_and_si256(
+                             _mm256_loadu_si256(reinterpret_cast<const __m256i *>(RGB + i)), ColorMask))
+                         : _mm256_setzero_ps();
+
+    // Transposing the four coordinates of 8 points, each lane holds the points 0-3 and 4-7 afterwards
+    const __m256 XY0 = _mm256_unpacklo_ps(X, Y);
+    const __m256 XY1 = _mm256_unpackhi_ps(X, Y);
+    const __m256 ZC0 = _mm256_unpacklo_ps(ZOut, C);
+    const __m256 ZC1 = _mm256_unpackhi_ps(ZOut, C);
+    const __m256 P04 = _mm256_shuffle_ps(XY0, ZC0, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 P15 = _mm256_shuffle_ps(XY0, ZC0, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m256 P26 = _mm256_shuffle_ps(XY1, ZC1, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 P37 = _mm256_shuffle_ps(XY1, ZC1, _MM_SHUFFLE(3, 2, 3, 2));
+
+    const int Mask = _mm256_movemask_ps(Valid);
+    float *Points = reinterpret_cast<float *>(Out);
+    if (Organized || Mask == 0xff)
+    {
+      _mm256_storeu_ps(Points, _mm256_permute2f128_ps(P04, P15, 0x20));
+      _mm256_storeu_ps(Points + 8, _mm256_permute2f128_ps(P26, P37, 0x20));
+      _mm256_storeu_ps(Points + 16, _mm256_permute2f128_ps(P04, P15, 0x31));
+      _mm256_storeu_ps(Points + 24, _mm256_permute2f128_ps(P26, P37, 0x31));
+      Out += 8;
+      continue;
+    }
+
+    // Every point is stored, but the output only advances for valid ones, so the next point overwrites an
+    // invalid one. All stores stay within the first i + 8 points of the output.
+    _mm_storeu_ps(reinterpret_cast<float *>(Out), _mm256_castps256_ps128(P04));
+    Out += Mask & 1;
+    _mm_storeu_ps(reinterpret_cast<float *>(Out), _mm256_castps256_ps128(P15));
+    Out += (Mask >> 1) & 1;
+    _mm_storeu_ps(reinterpret_cast<float *>(Out), _mm256_castps256_ps128(P26));
+    Out += (Mask >> 2) & 1;
+    _mm_storeu_ps(reinterpret_cast<float *>(Out), _mm256_castps256_ps128(P37));
+    Out += (Mask >> 3) & 1;
+    _mm_storeu_ps(reinterpret_cast<float *>(Out), _mm256_extractf128_ps(P04, 1));
+    Out += (Mask >> 4) & 1;
+    _mm_storeu_ps(reinterpret_cast<float *>(Out), _mm256_extractf128_ps(P15, 1));
+    Out += (Mask >> 5) & 1;
+    _mm_storeu_ps(reinterpret_cast<float *>(Out), _mm256_extractf128_ps(P26, 1));
+    Out += (Mask >> 6) & 1;
+    _mm_storeu_ps(reinterpret_cast<float *>(Out), _mm256_extractf128_ps(P37, 1));
+    Out += (Mask >> 7) & 1;
+  }
+  Out += ProjectRowScalar(Depth + i, RGB ? RGB + i : nullptr, RaysX + i, RayY, Count - i, MinDepth, MaxDepth,
+                          Organized, Out);
+  return Out - Begin;
+}
+#else
+size_t ProjectRowAVX2(const float *Depth, const uint32_t *RGB, const float *RaysX, const float RayY,
+                      const size_t Count, const float MinDepth, const float MaxDepth, const bool Organized,
+                      Point *Out)
+{
+  return ProjectRowScalar(Depth, RGB, RaysX, RayY, Count, MinDepth, MaxDepth, Organized, Out);
+}
+#endif
+
+typedef size_t (*ProjectRowFunction)(const float *, const uint32_t *, const float *, const float, const size_t,
+                                     const float, const float, const bool, Point *);
+
+static ProjectRowFunction SelectProjectRow()
+{
+  if (ImageConversion::HasAVX2())
+  {
+    return &ProjectRowAVX2;
+  }
+  return &ProjectRowScalar;
+}
+
+size_t ProjectRow(const float *Depth, const uint32_t *RGB, const float *RaysX, const float RayY, const size_t Count,
+                  const float MinDepth, const float MaxDepth, const bool Organized, Point *Out)
+{
+  static const ProjectRowFunction Function = SelectProjectRow();
+  return Function(Depth, RGB, RaysX, RayY, Count, MinDepth, MaxDepth, Organized, Out);
+}
+
+}
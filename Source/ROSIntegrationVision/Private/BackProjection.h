@@ -0,0 +1,42 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Back-projection of depth images into point clouds for sensor_msgs/PointCloud2, the same as depth_image_proc does.
+ * The ray of a pinhole pixel (u, v) is ((u - cx) / fx, (v - cy) / fy, 1), so the rays are stored separately per
+ * column and per row instead of a table per pixel, and a point is the ray scaled by the depth.
+ * The AVX2 kernel is selected at runtime and produces bit-identical results to the scalar one.
+ */
+namespace BackProjection
+{
+  // Layout of the points in the published cloud, fields x, y, z and rgb with a point_step of 16 bytes.
+  // The color is packed as 0x00RRGGBB like PCL does, which is a FColor without alpha.
+  struct Point
+  {
+    float X;
+    float Y;
+    float Z;
+    uint32_t RGB;
+  };
+
+  // Computes the ray factors (i * Stride - Center) / Focal of Count pixels of one axis, taking every Stride-th pixel
+  void ComputeRays(float *Rays, const uint32_t Count, const uint32_t Stride, const double Center, const double Focal);
+
+  // Projects one row of Count depth values in meters with their ray factors. Depth values in (MinDepth, MaxDepth]
+  // are valid, NaN is not. Organized writes Count points with NaN coordinates for invalid ones, otherwise only the
+  // valid points are written. RGB may be nullptr, the color is 0 then. Returns the number of points written.
+  size_t ProjectRow(const float *Depth, const uint32_t *RGB, const float *RaysX, const float RayY, const size_t Count,
+                    const float MinDepth, const float MaxDepth, const bool Organized, Point *Out);
+
+  // The single implementations, exposed for testing and benchmarking
+  size_t ProjectRowScalar(const float *Depth, const uint32_t *RGB, const float *RaysX, const float RayY,
+                          const size_t Count, const float MinDepth, const float MaxDepth, const bool Organized,
+                          Point *Out);
+  size_t ProjectRowAVX2(const float *Depth, const uint32_t *RGB, const float *RaysX, const float RayY,
+                        const size_t Count, const float MinDepth, const float MaxDepth, const bool Organized,
+                        Point *Out);
+}
@@ -0,0 +1,110 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CameraIntrinsics.h"
+
+#include <cmath>
+
+#include "OutgoingQueue.h"
+
+CameraIntrinsics::CameraIntrinsics() : Width(0), Height(0), FieldOfView(0), Baseline(0)
+{
+  Current = { 0, 0, 0, 0, 0, 0, 0, 0 };
+}
+
+void CameraIntrinsics::Update(const uint32 NewWidth, const uint32 NewHeight, const float NewFieldOfView,
+                              const float NewBaseline)
+{
+  std::lock_guard<std::mutex> Lock(Mutex);
+  if (Current.Version > 0 && NewWidth == Width && NewHeight == Height && NewFieldOfView == FieldOfView &&
+      NewBaseline == Baseline)
+  {
+    return;
+  }
+  Width = NewWidth;
+  Height = NewHeight;
+  FieldOfView = NewFieldOfView;
+  Baseline = NewBaseline;
+
+  // The field of view belongs to the larger side, the pixels are square
+  const float FOVX = Height > Width ? FieldOfView * Width / Height : FieldOfView;
+  const double HalfFOVX = FOVX * PI / 360.0;
+  Current.Width = Width;
+  Current.Height = Height;
+  Current.CX = Width / 2.0;
+  Current.CY = Height / 2.0;
+  Current.FX = Current.CX / std::tan(HalfFOVX);
+  Current.FY = Current.FX;
+  Current.TX = Current.FX * Baseline;
+  ++Current.Version;
+
+  Template.height = Height;
+  Template.width = Width;
+  Template.distortion_model = TEXT("plumb_bob");
+  for (uint32 i = 0; i < 5; ++i)
+  {
+    Template.D[i] = 0;
+  }
+
+  Template.K[0] = Current.FX;
+  Template.K[1] = 0;
+  Template.K[2] = Current.CX;
+  Template.K[3] = 0;
+  Template.K[4] = Current.FY;
+  Template.K[5] = Current.CY;
+  Template.K[6] = 0;
+  Template.K[7] = 0;
+  Template.K[8] = 1;
+
+  Template.R[0] = 1;
+  Template.R[1] = 0;
+  Template.R[2] = 0;
+  Template.R[3] = 0;
+  Template.R[4] = 1;
+  Template.R[5] = 0;
+  Template.R[6] = 0;
+  Template.R[7] = 0;
+  Template.R[8] = 1;
+
+  Template.P[0] = Current.FX;
+  Template.P[1] = 0;
+  Template.P[2] = Current.CX;
+  Template.P[3] = Current.TX;
+  Template.P[4] = 0;
+  Template.P[5] = Current.FY;
+  Template.P[6] = Current.CY;
+  Template.P[7] = 0;
+  Template.P[8] = 0;
+  Template.P[9] = 0;
+  Template.P[10] = 1;
+  Template.P[11] = 0;
+
+  Template.binning_x = 0;
+  Template.binning_y = 0;
+
+  Template.roi.x_offset = 0;
+  Template.roi.y_offset = 0;
+  Template.roi.height = 0;
+  Template.roi.width = 0;
+  Template.roi.do_rectify = false;
+}
+
+CameraIntrinsics::Values CameraIntrinsics::Get() const
+{
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return Current;
+}
+
+void CameraIntrinsics::Publish(OutgoingQueue &Queue, const FROSTime &Time, const FString &FrameId)
+{
+  TSharedPtr<ROSMessages::sensor_msgs::CameraInfo> Message;
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Message = MakeShareable(new ROSMessages::sensor_msgs::CameraInfo(Template));
+  }
+  Message->header.seq = 0;
+  Message->header.time = Time;
+  Message->header.frame_id = FrameId;
+
+  // Outside of the lock, the queue may wait for space under the Block policy
+  Queue.Publish(MoveTemp(Message), sizeof(ROSMessages::sensor_msgs::CameraInfo));
+}
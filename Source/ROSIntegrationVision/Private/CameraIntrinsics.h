@@ -0,0 +1,54 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include <mutex>
+
+#include "ROSTime.h"
+#include "sensor_msgs/CameraInfo.h"
+
+class OutgoingQueue;
+
+/**
+ * Pinhole intrinsics of a capture component and the CameraInfo message built from them. Both are only recomputed
+ * when the image size, the field of view or the baseline change.
+ * All methods are thread-safe, Update is called from the game thread and the others from any thread.
+ * Every published message is a new copy handed over to the queue, as the reference counts of TSharedPtr are not
+ * atomic and the queue releases the message on the thread that serializes it.
+ */
+class ROSINTEGRATIONVISION_API CameraIntrinsics
+{
+public:
+  struct Values
+  {
+    uint32 Width;
+    uint32 Height;
+    double FX, FY; // Focal lengths in pixels
+    double CX, CY; // Principal point in pixels
+    double TX;     // P[3], focal length times the baseline
+    uint32 Version; // Increased with every change, so that consumers can tell when to update derived data
+  };
+
+private:
+  mutable std::mutex Mutex;
+  // Parameters the values were computed for
+  uint32 Width, Height;
+  float FieldOfView, Baseline;
+  Values Current;
+  // Message without header
+  ROSMessages::sensor_msgs::CameraInfo Template;
+
+public:
+  CameraIntrinsics();
+
+  // Recomputes the intrinsics if any of the parameters changed, FieldOfView is the horizontal field of view in
+  // degrees of the larger image side and Baseline is in meters.
+  void Update(const uint32 Width, const uint32 Height, const float FieldOfView, const float Baseline);
+
+  Values Get() const;
+
+  // Publishes the CameraInfo message of the current intrinsics with the given header
+  void Publish(OutgoingQueue &Queue, const FROSTime &Time, const FString &FrameId);
+};
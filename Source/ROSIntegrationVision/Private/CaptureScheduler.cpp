@@ -0,0 +1,136 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CaptureScheduler.h"
+
+#include <cmath>
+
+// Length of the windows in seconds over which the achieved rates are measured
+static const double StatsWindow = 5.0;
+
+CaptureScheduler::CaptureScheduler(const uint64 Budget) :
+  NextHandle(1), NextPhase(0), Budget(Budget), StatsStart(FPlatformTime::Seconds())
+{
+}
+
+CaptureScheduler::Client *CaptureScheduler::Find(const Handle Id)
+{
+  return Clients.FindByPredicate([Id](const Client &Current) { return Current.Id == Id; });
+}
+
+const CaptureScheduler::Client *CaptureScheduler::Find(const Handle Id) const
+{
+  return Clients.FindByPredicate([Id](const Client &Current) { return Current.Id == Id; });
+}
+
+CaptureScheduler::Handle CaptureScheduler::Register(const FString &Name, const float Rate, const uint64 Bytes,
+                                                    std::function<bool()> Publish)
+{
+  // The phases follow the golden ratio sequence, which spreads any number of clients evenly over a period
+  NextPhase = std::fmod(NextPhase + 0.6180339887, 1.0);
+
+  Client NewClient;
+  NewClient.Id = NextHandle++;
+  NewClient.Name = Name;
+  NewClient.Rate = Rate;
+  NewClient.Bytes = Bytes;
+  NewClient.Publish = std::move(Publish);
+  NewClient.NextDue = FPlatformTime::Seconds() + (Rate > 0 ? NextPhase / Rate : 0);
+  NewClient.Attempted = 0;
+  NewClient.Captured = 0;
+  NewClient.Deferred = 0;
+  NewClient.AchievedRate = 0;
+  Clients.Add(std::move(NewClient));
+  return Clients.Last().Id;
+}
+
+void CaptureScheduler::Unregister(const Handle Id)
+{
+  Clients.RemoveAll([Id](const Client &Current) { return Current.Id == Id; });
+}
+
+void CaptureScheduler::SetRate(const Handle Id, const float Rate)
+{
+  Client *Current = Find(Id);
+  if (!Current || Current->Rate == Rate)
+  {
+    return;
+  }
+  // A shorter period takes effect right away, a longer one after the next publish
+  const double Now = FPlatformTime::Seconds();
+  if (Rate > 0 && (Current->Rate <= 0 || Current->NextDue > Now + 1.0 / Rate))
+  {
+    Current->NextDue = Now + 1.0 / Rate;
+  }
+  Current->Rate = Rate;
+}
+
+float CaptureScheduler::GetAchievedRate(const Handle Id) const
+{
+  const Client *Current = Find(Id);
+  return Current ? Current->AchievedRate : 0.f;
+}
+
+bool CaptureScheduler::Tick(float DeltaTime)
+{
+  const double Now = FPlatformTime::Seconds();
+
+  TArray<int32, TInlineAllocator<16>> Due;
+  for (int32 i = 0; i < Clients.Num(); ++i)
+  {
+    if (Clients[i].Rate > 0 && Clients[i].NextDue <= Now)
+    {
+      Due.Add(i);
+    }
+  }
+  Due.Sort([this](const int32 A, const int32 B) { return Clients[A].NextDue < Clients[B].NextDue; });
+
+  uint64 Bytes = 0;
+  for (const int32 Index : Due)
+  {
+    Client &Current = Clients[Index];
+    if (Budget > 0 && Bytes > 0 && Bytes + Current.Bytes > Budget)
+    {
+      ++Current.Deferred;
+      continue;
+    }
+
+    // The next capture is due one period after this one was due, not after it was served, so the phases stay
+    // staggered. Deferred clients keep their phase as long as they are less than a period late.
+    const double Period = 1.0 / Current.Rate;
+    Current.NextDue += Period;
+    if (Current.NextDue <= Now)
+    {
+      Current.NextDue = Now + Period;
+    }
+    ++Current.Attempted;
+    if (Current.Publish())
+    {
+      ++Current.Captured;
+      Bytes += Current.Bytes;
+    }
+  }
+
+  const double Elapsed = Now - StatsStart;
+  if (Elapsed >= StatsWindow && Clients.Num() > 0)
+  {
+    for (Client &Current : Clients)
+    {
+      Current.AchievedRate = Current.Captured / Elapsed;
+      if (Current.Rate > 0)
+      {
+        UE_LOG(LogTemp, Log, TEXT("%s captured at %.1f of %.1f Hz, %u of %u calls skipped the frame, %u times deferred by the readback budget."),
+               *Current.Name, Current.AchievedRate, Current.Rate, Current.Attempted - Current.Captured, Current.Attempted,
+               Current.Deferred);
+      }
+      Current.Attempted = 0;
+      Current.Captured = 0;
+      Current.Deferred = 0;
+    }
+    StatsStart = Now;
+  }
+  else if (Clients.Num() == 0)
+  {
+    StatsStart = Now;
+  }
+  return true;
+}
@@ -0,0 +1,64 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include <functional>
+
+/**
+ * Calls the PublishImages of all components with a target rate, spread over the engine frames instead of all
+ * cameras capturing in the same frame. Clients start with staggered phases, so cameras with the same rate take
+ * turns. Each frame the due clients are served most overdue first until the readback budget of the frame is used
+ * up, the others are deferred to the next frame. A client that fell behind by more than one period does not catch
+ * up with a burst of captures.
+ * Achieved rates count the frames actually captured, they are measured over windows of a few seconds and logged next
+ * to the requested ones.
+ * All methods have to be called from the game thread.
+ */
+class ROSINTEGRATIONVISION_API CaptureScheduler
+{
+public:
+  typedef uint32 Handle;
+
+private:
+  struct Client
+  {
+    Handle Id;
+    FString Name;
+    float Rate;
+    uint64 Bytes;
+    std::function<bool()> Publish;
+    double NextDue;
+    // Calls of Publish and the ones that captured a frame, a call skips the frame if nobody subscribed or all
+    // readbacks are in flight
+    uint32 Attempted, Captured, Deferred;
+    float AchievedRate;
+  };
+
+  TArray<Client> Clients;
+  Handle NextHandle;
+  double NextPhase;
+  const uint64 Budget;
+  double StatsStart;
+
+  Client *Find(const Handle Id);
+  const Client *Find(const Handle Id) const;
+
+public:
+  // Budget is the number of bytes that may be read back per frame, 0 is unlimited. A single client is always
+  // served even if it exceeds the budget on its own.
+  explicit CaptureScheduler(const uint64 Budget);
+
+  // Registers a client that reads back Bytes per published frame, Publish is called at Rate Hz. Rate may be 0.
+  // Publish returns whether it read back a frame, only those count against the budget.
+  Handle Register(const FString &Name, const float Rate, const uint64 Bytes, std::function<bool()> Publish);
+  void Unregister(const Handle Id);
+  void SetRate(const Handle Id, const float Rate);
+
+  // Rate in Hz at which the client captured frames during the last measurement window
+  float GetAchievedRate(const Handle Id) const;
+
+  // Publishes the clients that are due, called once per engine frame
+  bool Tick(float DeltaTime);
+};
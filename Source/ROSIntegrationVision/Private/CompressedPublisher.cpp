@@ -0,0 +1,85 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CompressedPublisher.h"
+
+#include "sensor_msgs/CompressedImage.h"
+
+#include "OutgoingQueue.h"
+
+CompressedPublisher::CompressedPublisher(const FString &_Name, WorkerPool &_Pool, WorkerPool::Group &_Jobs, StageTimes &_Stages) :
+  Name(_Name), Pool(_Pool), Jobs(_Jobs), Stages(_Stages), Running(0), StartedSequence(0), PublishedSequence(0),
+  StatsStart(FPlatformTime::Seconds()), StatsEncodeTime(0), StatsFrames(0), StatsSkipped(0), StatsBytes(0)
+{
+}
+
+bool CompressedPublisher::Publish(const std::shared_ptr<const uint8> &Lease, const Encoder &Compress, OutgoingQueue &Queue, const FROSTime &Time,
+                                  const FString &FrameId, const FString &Format, const uint64 RawBytes, const int32 MaxJobs)
+{
+  uint64 Sequence;
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    if (Running >= MaxJobs)
+    {
+      UE_LOG(LogTemp, Verbose, TEXT("All %d encoding jobs of %s busy, not compressing frame."), MaxJobs, *Name);
+      ++StatsSkipped;
+      return false;
+    }
+    ++Running;
+    Sequence = ++StartedSequence;
+  }
+
+  OutgoingQueue *Target = &Queue;
+  Pool.Submit(Jobs, [this, Lease, Compress, Target, Time, FrameId, Format, RawBytes, Sequence]()
+  {
+    const double Start = FPlatformTime::Seconds();
+    TSharedPtr<ROSMessages::sensor_msgs::CompressedImage> CompressedMessage(new ROSMessages::sensor_msgs::CompressedImage());
+    {
+      MEASURE_STAGE(Stages, Encode);
+      Compress(Lease.get(), CompressedMessage->data);
+    }
+    const double EncodeTime = FPlatformTime::Seconds() - Start;
+    const uint64 Bytes = CompressedMessage->data.Num();
+
+    // Publishing in order, a frame finished after a newer one is dropped
+    std::lock_guard<std::mutex> Lock(Mutex);
+    if (Bytes == 0)
+    {
+      UE_LOG(LogTemp, Warning, TEXT("%s failed to compress a frame."), *Name);
+    }
+    else if (Sequence < PublishedSequence)
+    {
+      UE_LOG(LogTemp, Verbose, TEXT("Frame compressed after a newer one, dropping it."));
+      ++StatsSkipped;
+    }
+    else
+    {
+      CompressedMessage->header.seq = 0;
+      CompressedMessage->header.time = Time;
+      CompressedMessage->header.frame_id = FrameId;
+      CompressedMessage->format = Format;
+      Target->Publish(MoveTemp(CompressedMessage), Bytes);
+      PublishedSequence = Sequence;
+
+      ++StatsFrames;
+      StatsBytes += Bytes;
+      StatsEncodeTime += EncodeTime;
+    }
+
+    const double Now = FPlatformTime::Seconds();
+    if (StatsFrames > 0 && Now - StatsStart >= 1.0)
+    {
+      const double Elapsed = Now - StatsStart;
+      UE_LOG(LogTemp, Log, TEXT("%s compressed %.1f frames/s, %.1f MB/s raw, %.1f KB/frame (%.1f:1), %.2f ms encoding/frame, %u frames skipped."),
+        *Name, StatsFrames / Elapsed, StatsFrames * (double)RawBytes / Elapsed / (1024 * 1024), StatsBytes / 1024.0 / StatsFrames,
+        StatsFrames * (double)RawBytes / StatsBytes, StatsEncodeTime * 1000 / StatsFrames, StatsSkipped);
+      StatsStart = Now;
+      StatsEncodeTime = 0;
+      StatsFrames = 0;
+      StatsSkipped = 0;
+      StatsBytes = 0;
+    }
+
+    --Running;
+  });
+  return true;
+}
@@ -0,0 +1,55 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "ROSTime.h"
+
+#include "StopTime.h"
+#include "WorkerPool.h"
+
+class OutgoingQueue;
+
+/**
+ * Compresses the images of leased packets on the thread pool and publishes them as sensor_msgs/CompressedImage,
+ * for the color and the depth component. At most MaxJobs frames are encoded at the same time, further frames are
+ * skipped. A frame compressed after a newer one is dropped, so that the messages stay in order. The rate, size and
+ * encoding time of the compressed frames are logged once per second.
+ * Publish may be called from any thread.
+ */
+class ROSINTEGRATIONVISION_API CompressedPublisher
+{
+public:
+  // Compresses the image of a packet into the message data, leaves it empty if that failed. Runs on the pool.
+  typedef std::function<void(const uint8 *Packet, TArray<uint8> &Data)> Encoder;
+
+private:
+  const FString Name;
+  WorkerPool &Pool;
+  WorkerPool::Group &Jobs;
+  StageTimes &Stages;
+  // All members below are protected by Mutex
+  std::mutex Mutex;
+  int32 Running;
+  uint64 StartedSequence;   // Sequence of the last started job
+  uint64 PublishedSequence; // Sequence of the last published frame
+  double StatsStart, StatsEncodeTime;
+  uint32 StatsFrames, StatsSkipped;
+  uint64 StatsBytes;
+
+public:
+  // Name of the component for the log, the jobs run in its group and record its Encode stage
+  CompressedPublisher(const FString &Name, WorkerPool &Pool, WorkerPool::Group &Jobs, StageTimes &Stages);
+
+  // Starts a job that compresses the leased packet with Compress and publishes it to Queue, with the stamp, frame and
+  // format given. RawBytes is the size of the uncompressed image. Returns false if all jobs are busy and the frame
+  // is skipped. The job keeps the lease, so the slot is not overwritten while it is encoded. The queue has to
+  // outlive the jobs of the group.
+  bool Publish(const std::shared_ptr<const uint8> &Lease, const Encoder &Compress, OutgoingQueue &Queue, const FROSTime &Time,
+               const FString &FrameId, const FString &Format, const uint64 RawBytes, const int32 MaxJobs);
+};
@@ -1,308 +1,719 @@
-// Fill out your copyright notice in the Description page of Project Settings.
-
-#include "DepthComponent.h"
-
-#include <cmath>
-#include <thread>
-
-#include "ROSTime.h"
-#include "sensor_msgs/CameraInfo.h"
-#include "sensor_msgs/Image.h"
-
-#include "PacketBuffer.h"
-#include "ROSIntegrationGameInstance.h"
-
-#include "EngineUtils.h"
-#include "IImageWrapper.h"
-#include "IImageWrapperModule.h"
-#include "UObject/ConstructorHelpers.h"
-
-#if PLATFORM_WINDOWS
-  #define _USE_MATH_DEFINES
-#endif
-
-// Private data container so that internal structures are not visible to the outside
-class ROSINTEGRATIONVISION_API UDepthComponent::PrivateData
-{
-public:
-	TSharedPtr<PacketBuffer> Buffer;
-	// TCPServer Server;
-	std::mutex WaitDepth;
-	std::condition_variable CVDepth;
-	std::thread ThreadDepth;
-	bool DoDepth;
-};
-
-UDepthComponent::UDepthComponent() :
-Width(960),
-Height(540),
-ServerPort(10000)
-{
-    Priv = new PrivateData();
-    FieldOfView = 90.0;
-    PrimaryComponentTick.bCanEverTick = true;
-
-    auto owner = GetOwner();
-    if (owner)
-    {
-        Depth = CreateDefaultSubobject<USceneCaptureComponent2D>(TEXT("DepthCapture"));
-        Depth->SetupAttachment(this);
-        Depth->CaptureSource = ESceneCaptureSource::SCS_SceneDepth;
-        Depth->TextureTarget = CreateDefaultSubobject<UTextureRenderTarget2D>(TEXT("DepthTarget"));
-        Depth->TextureTarget->RenderTargetFormat = ETextureRenderTargetFormat::RTF_RGBA16f;
-        Depth->TextureTarget->InitAutoFormat(Width, Height);
-        Depth->FOVAngle = FieldOfView;
-    }
-    else
-    {
-        UE_LOG(LogTemp, Warning, TEXT("No owner!"));
-    }
-}
-
-UDepthComponent::~UDepthComponent()
-{
-    delete Priv;
-}
-
-void UDepthComponent::Pause(const bool _Pause)
-{
-    Paused = _Pause;
-}
-
-bool UDepthComponent::IsPaused() const
-{
-    return Paused;
-}
-
-void UDepthComponent::InitializeTopics()
-{
-	// Establish ROS communication
-	UROSIntegrationGameInstance* rosinst = Cast<UROSIntegrationGameInstance>
-		(GetOwner()->GetGameInstance());
-
-	if (rosinst && rosinst->bConnectToROS)
-	{
-		CameraInfoPublisher = NewObject<UTopic>(UTopic::StaticClass());
-		ImagePublisher = NewObject<UTopic>(UTopic::StaticClass());
-
-		CameraInfoPublisher->Init(rosinst->ROSIntegrationCore, CameraInfoTopicName, TEXT("sensor_msgs/CameraInfo"));
-		CameraInfoPublisher->Advertise();
-
-		ImagePublisher->Init(rosinst->ROSIntegrationCore, ImageTopicName, TEXT("sensor_msgs/Image"));
-		ImagePublisher->Advertise();
-	}
-	else
-	{
-		UE_LOG(LogTemp, Warning, TEXT("UnrealROSInstance not existing."));
-	}
-}
-
-void UDepthComponent::PublishImages() {
-	// Check if paused
-	if (Paused) {
-		return;
-	}
-
-	FROSTime time = FROSTime::Now();
-
-	if (ImagePublisher && ImagePublisher->IsAdvertising()) {
-		auto owner = GetOwner();
-		owner->UpdateComponentTransforms();
-
-		FDateTime Now = FDateTime::UtcNow();
-		Priv->Buffer->HeaderWrite->TimestampCapture = Now.ToUnixTimestamp() * 1000000000 + Now.GetMillisecond() * 1000000;
-
-		FVector Translation = GetComponentLocation();
-		FQuat Rotation = GetComponentQuat();
-		// Convert to meters and ROS coordinate system
-		Priv->Buffer->HeaderWrite->Translation.X = Translation.X / 100.0f;
-		Priv->Buffer->HeaderWrite->Translation.Y = -Translation.Y / 100.0f;
-		Priv->Buffer->HeaderWrite->Translation.Z = Translation.Z / 100.0f;
-		Priv->Buffer->HeaderWrite->Rotation.X = -Rotation.X;
-		Priv->Buffer->HeaderWrite->Rotation.Y = Rotation.Y;
-		Priv->Buffer->HeaderWrite->Rotation.Z = -Rotation.Z;
-		Priv->Buffer->HeaderWrite->Rotation.W = Rotation.W;
-
-		Priv->WaitDepth.lock();
-		ReadImage(Depth->TextureTarget, ImageDepth);
-		Priv->WaitDepth.unlock();
-		Priv->DoDepth = true;
-		Priv->CVDepth.notify_one();
-
-		Priv->Buffer->StartReading();
-		const uint32_t& OffsetDepth = Priv->Buffer->OffsetImage;
-		UE_LOG(LogTemp, Verbose, TEXT("Buffer Offsets: %d"), OffsetDepth);
-
-		TSharedPtr<ROSMessages::sensor_msgs::Image> DepthMessage(new ROSMessages::sensor_msgs::Image());
-
-		DepthMessage->header.seq = 0;
-		DepthMessage->header.time = time;
-		DepthMessage->header.frame_id = ImageOpticalFrame;
-		DepthMessage->height = Height;
-		DepthMessage->width = Width;
-		DepthMessage->encoding = TEXT("32FC1");
-		DepthMessage->step = Width * 4;
-		DepthMessage->data = &Priv->Buffer->Read[OffsetDepth];
-		ImagePublisher->Publish(DepthMessage);
-
-		Priv->Buffer->DoneReading();
-	}
-
-	// Construct and publish CameraInfo
-	if (CameraInfoPublisher && CameraInfoPublisher->IsAdvertising()) {
-		const float FOVX = Height > Width ? FieldOfView * Width / Height : FieldOfView;
-		const float FOVY = Width > Height ? FieldOfView * Height / Width : FieldOfView;
-		double halfFOVX = FOVX * PI / 360.0; // was M_PI on gcc
-		double halfFOVY = FOVY * PI / 360.0; // was M_PI on gcc
-		const double cX = Width / 2.0;
-		const double cY = Height / 2.0;
-
-		const double K0 = cX / std::tan(halfFOVX);
-		const double K2 = cX;
-		const double K4 = K0;
-		const double K5 = cY;
-		const double K8 = 1;
-
-		const double P0 = K0;
-		const double P2 = K2;
-		const double P5 = K4;
-		const double P6 = K5;
-		const double P10 = 1;
-
-		TSharedPtr<ROSMessages::sensor_msgs::CameraInfo> CamInfo(new ROSMessages::sensor_msgs::CameraInfo());
-		CamInfo->header.seq = 0;
-		CamInfo->header.time = time;
-		CamInfo->header.frame_id = ImageOpticalFrame;
-		CamInfo->height = Height;
-		CamInfo->width = Width;
-		CamInfo->distortion_model = TEXT("plumb_bob");
-		CamInfo->D[0] = 0;
-		CamInfo->D[1] = 0;
-		CamInfo->D[2] = 0;
-		CamInfo->D[3] = 0;
-		CamInfo->D[4] = 0;
-
-		CamInfo->K[0] = K0;
-		CamInfo->K[1] = 0;
-		CamInfo->K[2] = K2;
-		CamInfo->K[3] = 0;
-		CamInfo->K[4] = K4;
-		CamInfo->K[5] = K5;
-		CamInfo->K[6] = 0;
-		CamInfo->K[7] = 0;
-		CamInfo->K[8] = K8;
-
-		CamInfo->R[0] = 1;
-		CamInfo->R[1] = 0;
-		CamInfo->R[2] = 0;
-		CamInfo->R[3] = 0;
-		CamInfo->R[4] = 1;
-		CamInfo->R[5] = 0;
-		CamInfo->R[6] = 0;
-		CamInfo->R[7] = 0;
-		CamInfo->R[8] = 1;
-
-		CamInfo->P[0] = P0;
-		CamInfo->P[1] = 0;
-		CamInfo->P[2] = P2;
-		CamInfo->P[3] = P0 * 0.08;
-		CamInfo->P[4] = 0;
-		CamInfo->P[5] = P5;
-		CamInfo->P[6] = P6;
-		CamInfo->P[7] = 0;
-		CamInfo->P[8] = 0;
-		CamInfo->P[9] = 0;
-		CamInfo->P[10] = P10;
-		CamInfo->P[11] = 0;
-
-		CamInfo->binning_x = 0;
-		CamInfo->binning_y = 0;
-
-		CamInfo->roi.x_offset = 0;
-		CamInfo->roi.y_offset = 0;
-		CamInfo->roi.height = 0;
-		CamInfo->roi.width = 0;
-		CamInfo->roi.do_rectify = false;
-
-		CameraInfoPublisher->Publish(CamInfo);
-	}
-}
-
-void UDepthComponent::InitializeComponent()
-{
-	Super::InitializeComponent();
-}
-
-void UDepthComponent::BeginPlay()
-{
-	Super::BeginPlay();
-	// Initializing buffers for reading images from the GPU
-	ImageDepth.AddUninitialized(Width * Height);
-
-	// Reinit renderer
-	Depth->TextureTarget->InitAutoFormat(Width, Height);
-
-	AspectRatio = Width / (float)Height;
-
-	// Creating double buffer and setting the pointer of the server object
-	Priv->Buffer = TSharedPtr<PacketBuffer>(new PacketBuffer(Width, Height, 2, FieldOfView));
-
-	Running = true;
-	Paused = false;
-
-	Priv->DoDepth = false;
-
-	// Starting threads to process image data
-	Priv->ThreadDepth = std::thread(&UDepthComponent::ProcessDepth, this);
-}
-
-void UDepthComponent::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* TickFunction)
-{
-	Super::TickComponent(DeltaTime, TickType, TickFunction);
-}
-
-void UDepthComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
-{
-	Super::EndPlay(EndPlayReason);
-	Running = false;
-
-	// Stopping processing threads
-	Priv->DoDepth = true;
-	Priv->CVDepth.notify_one();
-
-	Priv->ThreadDepth.join();
-}
-
-void UDepthComponent::ReadImage(UTextureRenderTarget2D* RenderTarget, TArray<FFloat16Color>& ImageData) const
-{
-	FTextureRenderTargetResource* RenderTargetResource = RenderTarget->GameThread_GetRenderTargetResource();
-	RenderTargetResource->ReadFloat16Pixels(ImageData);
-}
-
-void UDepthComponent::ToDepthImage(const TArray<FFloat16Color>& ImageData, uint8* Bytes) const
-{
-	const FFloat16Color* itI = ImageData.GetData();
-	uint16_t* itO = reinterpret_cast<uint16_t*>(Bytes);
-
-	// Just copies the encoded Float16 values
-	for (size_t i = 0; i < ImageData.Num(); ++i, ++itI, ++itO)
-	{
-		*itO = (uint8_t)std::round((float)itI->R.Encoded / 100.f);
-	}
-	return;
-}
-
-void UDepthComponent::ProcessDepth()
-{
-	while (true)
-	{
-		std::unique_lock<std::mutex> WaitLock(Priv->WaitDepth);
-		Priv->CVDepth.wait(WaitLock, [this] {return Priv->DoDepth; });
-		Priv->DoDepth = false;
-		if (!this->Running) break;
-		ToDepthImage(ImageDepth, Priv->Buffer->Image);
-
-		// Complete Buffer
-		Priv->Buffer->DoneWriting();
-	}
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "DepthComponent.h"
+
+#include <atomic>
+#include <limits>
+#include <mutex>
+
+#include "ROSTime.h"
+#include "sensor_msgs/Image.h"
+
+#include "DepthCompression.h"
+#include "CameraIntrinsics.h"
+#include "CaptureScheduler.h"
+#include "CompressedPublisher.h"
+#include "ImageConversion.h"
+#include "LeasedImage.h"
+#include "OutgoingQueue.h"
+#include "PacketBuffer.h"
+#include "PacketOutputs.h"
+#include "ReadbackQueue.h"
+#include "ROSIntegrationVision.h"
+#include "ROSIntegrationGameInstance.h"
+#include "StopTime.h"
+#include "SubscriberCounts.h"
+#include "SubscriberPoller.h"
+#include "WorkerPool.h"
+
+#include "EngineUtils.h"
+#include "IImageWrapper.h"
+#include "IImageWrapperModule.h"
+#include "UObject/ConstructorHelpers.h"
+
+#if PLATFORM_WINDOWS
+  #define _USE_MATH_DEFINES
+#endif
+
+// Private data container so that internal structures are not visible to the outside
+class ROSINTEGRATIONVISION_API UDepthComponent::PrivateData
+{
+public:
+	TSharedPtr<PacketBuffer> Buffer;
+	TSharedPtr<ReadbackQueue> Readback;
+	// Bounded queues of the topics in front of the bridge, created with the topics
+	TSharedPtr<OutgoingQueue> CameraInfoQueue, ImageQueue, CompressedDepthQueue;
+	// Shared memory ring, TCP server and capture log of the packets, and the replay of a capture log instead of
+	// the rendered images if ReplayPath is set
+	TSharedPtr<PacketOutputs> Outputs;
+	// Conversion, publishing and encoding jobs of this component on the module thread pool
+	WorkerPool *Pool;
+	WorkerPool::Group Jobs;
+	// CaptureOnDemand or readbacks at BeginPlay, and the number of captures and ticks for the statistics
+	bool OnDemand;
+	// Whether the scene capture renders every frame, it is stopped while no image topic has subscribers
+	bool Capturing;
+	// Topics with subscribers as of the last PublishImages, also read by the publishing job
+	std::atomic<bool> PublishRaw, PublishCompressed, PublishInfo;
+	// Registration with the module scheduler for PublishRate, 0 if not registered yet
+	CaptureScheduler::Handle Schedule;
+	float ScheduledRate;
+	uint32 StatsCaptures, StatsTicks;
+	double StatsCaptureStart;
+	// Intrinsics for the camera info, only recomputed when the properties change
+	CameraIntrinsics Intrinsics;
+	// Latency histograms of the stages of the frames, empty without stage timing
+	StageTimes Stages;
+	// Game thread and job time per frame, logged once per second
+	PipelineTimes Times;
+	std::mutex WaitDepth;
+	bool DoDepth;
+	bool Converting;
+	// Frame handed over from the game thread to the conversion job, and the one the job converts
+	TArray<FFloat16Color> PendingDepth;
+	TArray<FFloat16Color> ProcessingDepth;
+	FrameInfo PendingInfo;
+	// Packets completed since the publishing job last looked for them
+	std::atomic<uint32> PublishRequests;
+	// Encoding the buffer was created for
+	EDepthEncoding Encoding;
+	// Compression jobs of the compressed topic on the thread pool
+	IImageWrapperModule *ImageWrapperModule;
+	TSharedPtr<CompressedPublisher> Compressor;
+};
+
+UDepthComponent::UDepthComponent() :
+TranslateX(0),
+Width(960),
+Height(540),
+ServerPort(10000),
+ReadbackDepth(0),
+Encoding(EDepthEncoding::Float32Meters),
+MaxRange(0)
+{
+    Priv = new PrivateData();
+    FieldOfView = 90.0;
+    PrimaryComponentTick.bCanEverTick = true;
+
+    auto owner = GetOwner();
+    if (owner)
+    {
+        Depth = CreateDefaultSubobject<USceneCaptureComponent2D>(TEXT("DepthCapture"));
+        Depth->SetupAttachment(this);
+        Depth->CaptureSource = ESceneCaptureSource::SCS_SceneDepth;
+        Depth->TextureTarget = CreateDefaultSubobject<UTextureRenderTarget2D>(TEXT("DepthTarget"));
+        Depth->TextureTarget->RenderTargetFormat = ETextureRenderTargetFormat::RTF_RGBA16f;
+        Depth->TextureTarget->InitAutoFormat(Width, Height);
+        Depth->FOVAngle = FieldOfView;
+    }
+    else
+    {
+        UE_LOG(LogTemp, Warning, TEXT("No owner!"));
+    }
+}
+
+UDepthComponent::~UDepthComponent()
+{
+    delete Priv;
+}
+
+void UDepthComponent::Pause(const bool _Pause)
+{
+    Paused = _Pause;
+}
+
+bool UDepthComponent::IsPaused() const
+{
+    return Paused;
+}
+
+float UDepthComponent::GetAchievedPublishRate() const
+{
+	return Priv->Schedule != 0 ? FROSIntegrationVisionModule::Get().GetScheduler().GetAchievedRate(Priv->Schedule) : 0.f;
+}
+
+FStageLatency UDepthComponent::GetStageLatency(EVisionStage Stage) const
+{
+	return Priv->Stages.Get(Stage);
+}
+
+void UDepthComponent::ResetStageLatencies()
+{
+	Priv->Stages.Reset();
+}
+
+bool UDepthComponent::DumpStageLatencies(const FString &Path) const
+{
+	return Priv->Stages.WriteCSV(Path, GetName());
+}
+
+void UDepthComponent::InitializeTopics()
+{
+	// Establish ROS communication
+	UROSIntegrationGameInstance* rosinst = Cast<UROSIntegrationGameInstance>
+		(GetOwner()->GetGameInstance());
+
+	if (rosinst && rosinst->bConnectToROS)
+	{
+		CameraInfoPublisher = NewObject<UTopic>(UTopic::StaticClass());
+		ImagePublisher = NewObject<UTopic>(UTopic::StaticClass());
+
+		CameraInfoPublisher->Init(rosinst->ROSIntegrationCore, CameraInfoTopicName, TEXT("sensor_msgs/CameraInfo"), PublishQueue.GetTopicQueueSize());
+		CameraInfoPublisher->Advertise();
+
+		ImagePublisher->Init(rosinst->ROSIntegrationCore, ImageTopicName, TEXT("sensor_msgs/Image"), PublishQueue.GetTopicQueueSize());
+		ImagePublisher->Advertise();
+
+		if (!CompressedDepthTopicName.IsEmpty())
+		{
+			CompressedDepthPublisher = NewObject<UTopic>(UTopic::StaticClass());
+			CompressedDepthPublisher->Init(rosinst->ROSIntegrationCore, CompressedDepthTopicName, TEXT("sensor_msgs/CompressedImage"), PublishQueue.GetTopicQueueSize());
+			CompressedDepthPublisher->Advertise();
+		}
+
+		// Every topic gets its own bounded queue in front of the bridge
+		Priv->CameraInfoQueue = MakeShareable(new OutgoingQueue(CameraInfoTopicName, CameraInfoPublisher, PublishQueue));
+		Priv->ImageQueue = MakeShareable(new OutgoingQueue(ImageTopicName, ImagePublisher, PublishQueue));
+		if (CompressedDepthPublisher)
+		{
+			Priv->CompressedDepthQueue = MakeShareable(new OutgoingQueue(CompressedDepthTopicName, CompressedDepthPublisher, PublishQueue));
+		}
+
+		// Subscriber counts of the topics come from rosapi, empty topic names are not polled
+		SubscriberPoller &Poller = FROSIntegrationVisionModule::Get().GetSubscriberPoller();
+		Poller.Watch(rosinst->ROSIntegrationCore, CameraInfoTopicName);
+		Poller.Watch(rosinst->ROSIntegrationCore, ImageTopicName);
+		Poller.Watch(rosinst->ROSIntegrationCore, CompressedDepthTopicName);
+	}
+	else
+	{
+		UE_LOG(LogTemp, Warning, TEXT("UnrealROSInstance not existing."));
+	}
+}
+
+void UDepthComponent::PublishImages() {
+	CaptureImages();
+}
+
+bool UDepthComponent::CaptureImages()
+{
+	PipelineTimer GameThreadTime(Priv->Times, false);
+
+	// Check if paused
+	if (Paused) {
+		return false;
+	}
+
+	// A replay publishes the frames of the log instead
+	if (Priv->Outputs->GetReplay()) {
+		return false;
+	}
+
+	FROSTime time = FROSTime::Now();
+	Priv->Intrinsics.Update(Width, Height, FieldOfView, TranslateX);
+	const bool Capture = UpdateSubscribers();
+
+	// Rendering stops while nobody listens, the first frame after that is captured right away instead of reading
+	// back the stale render target
+	const bool Resume = Capture && !Priv->Capturing;
+	if (!Priv->OnDemand && Capture != Priv->Capturing) {
+		Depth->bCaptureEveryFrame = Capture;
+		Depth->bCaptureOnMovement = Capture;
+		UE_LOG(LogTemp, Verbose, TEXT("%s %s capturing."), *GetName(), Capture ? TEXT("resumes") : TEXT("stops"));
+	}
+	Priv->Capturing = Capture;
+
+	if (Capture) {
+		if (Priv->Readback.IsValid() && Priv->Readback->IsFull()) {
+			UE_LOG(LogTemp, Verbose, TEXT("All %d readbacks in flight, skipping frame."), ReadbackDepth);
+			return false;
+		}
+		MEASURE_STAGE(Priv->Stages, Capture);
+
+		// In capture on demand mode the scene is only rendered for frames that are read back. The readback copies
+		// the render target after the capture commands, so it gets the frame of this stamp and pose.
+		if (Priv->OnDemand || Resume) {
+			Depth->CaptureScene();
+			++Priv->StatsCaptures;
+		}
+
+		if (Priv->Readback.IsValid()) {
+			// Only queue the readback, TickComponent submits the frame once the data arrived
+			ReadbackQueue::Frame &Frame = Priv->Readback->Enqueue(Depth->TextureTarget);
+			GetFrameInfo(Frame, time);
+			return true;
+		}
+
+		FrameInfo Info;
+		GetFrameInfo(Info, time);
+
+		{
+			MEASURE_STAGE(Priv->Stages, Readback);
+			ReadImage(Depth->TextureTarget, ImageDepth);
+		}
+		SubmitFrame(ImageDepth, Info);
+		return true;
+	}
+
+	// A job publishes the camera info alone, serializing it or waiting for a full queue must not hold up the frame
+	if (Priv->PublishInfo) {
+		Priv->Pool->Submit(Priv->Jobs, [this, time]() { PublishCameraInfo(time); });
+	}
+	return false;
+}
+
+bool UDepthComponent::UpdateSubscribers()
+{
+	// Topics without subscribers are skipped, subscribers of the camera info alone do not need the image.
+	// Returns whether any output takes the images.
+	SubscriberCounts &Subscribers = FROSIntegrationVisionModule::Get().GetSubscriberCounts();
+	Priv->PublishRaw = ImagePublisher && ImagePublisher->IsAdvertising() && Subscribers.IsSubscribed(ImageTopicName);
+	Priv->PublishCompressed = CompressedDepthPublisher && CompressedDepthPublisher->IsAdvertising() &&
+		Subscribers.IsSubscribed(CompressedDepthTopicName);
+	Priv->PublishInfo = CameraInfoPublisher && CameraInfoPublisher->IsAdvertising() &&
+		Subscribers.IsSubscribed(CameraInfoTopicName);
+	return Priv->PublishRaw || Priv->PublishCompressed || Priv->Outputs->HasConsumers();
+}
+
+void UDepthComponent::GetFrameInfo(FrameInfo &Info, const FROSTime &Time)
+{
+	auto owner = GetOwner();
+	owner->UpdateComponentTransforms();
+
+	// The capture timestamp is the stamp of the messages, so that the publishing thread can restore it
+	Info.Time = Time;
+	Info.TimestampCapture = (uint64_t)Time._Sec * 1000000000 + Time._NSec;
+	Info.ClockCapture = STAGE_TIMESTAMP();
+
+	FVector Translation = GetComponentLocation();
+	FQuat Rotation = GetComponentQuat();
+	// Convert to meters and ROS coordinate system
+	Info.Translation.X = Translation.X / 100.0f;
+	Info.Translation.Y = -Translation.Y / 100.0f;
+	Info.Translation.Z = Translation.Z / 100.0f;
+	Info.Rotation.X = -Rotation.X;
+	Info.Rotation.Y = Rotation.Y;
+	Info.Rotation.Z = -Rotation.Z;
+	Info.Rotation.W = Rotation.W;
+}
+
+void UDepthComponent::SubmitFrame(TArray<FFloat16Color> &Pixels, const FrameInfo &Info)
+{
+	// Only swaps the frame in, the conversion job converts it while the game thread continues.
+	// Pixels receives the previous buffer, which keeps its size for the next read.
+	std::unique_lock<std::mutex> Lock(Priv->WaitDepth);
+	if (Priv->DoDepth) {
+		UE_LOG(LogTemp, Verbose, TEXT("Conversion is behind, replacing pending frame."));
+	}
+	Swap(Priv->PendingDepth, Pixels);
+	Priv->PendingInfo = Info;
+	Priv->DoDepth = true;
+	Priv->Times.CountFrame();
+	// At most one conversion job per component, the buffer has a single writer
+	const bool StartJob = !Priv->Converting;
+	Priv->Converting = true;
+	Lock.unlock();
+
+	if (StartJob) {
+		Priv->Pool->Submit(Priv->Jobs, [this]() { ProcessDepth(); });
+	}
+}
+
+void UDepthComponent::PublishDepth()
+{
+	// Publishes the completed packets, the job is started for the first request and runs until it handled all
+	// requests that came in meanwhile. Under LatestWins only the newest packet of several is published.
+	uint32 Requests = Priv->PublishRequests.load();
+	while (true)
+	{
+		if (!Priv->Buffer->TryStartReading())
+		{
+			Requests = Priv->PublishRequests.fetch_sub(Requests) - Requests;
+			if (Requests == 0)
+			{
+				break;
+			}
+			continue;
+		}
+
+		MEASURE_STAGE(Priv->Stages, Publish);
+		PipelineTimer WorkerTime(Priv->Times, true);
+
+		// The messages lease the slot, it returns to the buffer once all of them are serialized and destroyed.
+		// The local lease keeps the header valid until the latency is recorded.
+		const std::shared_ptr<const uint8> Lease = Priv->Buffer->LeaseRead();
+		Priv->Outputs->Publish(Lease, true);
+		RECORD_STAGE_SINCE(Priv->Stages, EndToEnd, reinterpret_cast<const PacketBuffer::PacketHeader*>(Lease.get())->ClockCapture);
+	}
+}
+
+void UDepthComponent::PublishMessages(const std::shared_ptr<const uint8> &Lease, const FROSTime &Time)
+{
+	// Publishes a packet of the buffer or of the replayed log to the topics, stamped with the time of its capture
+	const PacketBuffer::PacketHeader &Header = *reinterpret_cast<const PacketBuffer::PacketHeader*>(Lease.get());
+
+	const uint32_t OffsetDepth = Header.SizeHeader;
+	UE_LOG(LogTemp, Verbose, TEXT("Buffer Offsets: %d"), OffsetDepth);
+
+	if (Priv->PublishRaw) {
+		TSharedPtr<ROSMessages::sensor_msgs::Image> DepthMessage(new LeasedImage(Lease, OffsetDepth));
+
+		DepthMessage->header.seq = 0;
+		DepthMessage->header.time = Time;
+		DepthMessage->header.frame_id = ImageOpticalFrame;
+		DepthMessage->height = Header.Height;
+		DepthMessage->width = Header.Width;
+		DepthMessage->encoding = Priv->Encoding == EDepthEncoding::UInt16Millimeters ? TEXT("16UC1") : TEXT("32FC1");
+		DepthMessage->step = Header.Width * Header.Bytes;
+		const uint64 DepthBytes = DepthMessage->step * DepthMessage->height;
+		Priv->ImageQueue->Publish(MoveTemp(DepthMessage), DepthBytes);
+	}
+
+	if (Priv->PublishCompressed) {
+		EncodeCompressed(Lease, Time);
+	}
+
+	PublishCameraInfo(Time);
+}
+
+void UDepthComponent::EncodeCompressed(const std::shared_ptr<const uint8> &Lease, const FROSTime &Time)
+{
+	const uint32 OffsetDepth = Priv->Buffer->OffsetImage;
+	const bool IsRVL = Compression == EDepthCompression::RVL;
+	const bool IsMeters = Priv->Encoding == EDepthEncoding::Float32Meters;
+	const uint32 ImageWidth = Width, ImageHeight = Height;
+	IImageWrapperModule *ImageWrapperModule = Priv->ImageWrapperModule;
+	auto Encode = [OffsetDepth, IsRVL, IsMeters, ImageWidth, ImageHeight, ImageWrapperModule](const uint8 *Packet, TArray<uint8> &Data)
+	{
+		const uint32 Pixels = ImageWidth * ImageHeight;
+
+		// compressedDepth only supports 16UC1, so 32FC1 meters are rounded to millimeters first
+		TArray<uint16_t> Millimeters;
+		const uint16_t *Depth16 = reinterpret_cast<const uint16_t*>(Packet + OffsetDepth);
+		if (IsMeters) {
+			const float *Meters = reinterpret_cast<const float*>(Packet + OffsetDepth);
+			Millimeters.SetNumUninitialized(Pixels);
+			ImageConversion::MetersToMillimeters(Meters, Millimeters.GetData(), Pixels, 65535.f);
+			Depth16 = Millimeters.GetData();
+		}
+
+		DepthCompression::ConfigHeader Config = { 0, { 0.f, 0.f } };
+		if (IsRVL) {
+			// The RVL stream is preceded by the image size
+			const int32 Size[2] = { (int32)ImageWidth, (int32)ImageHeight };
+			const uint32 OffsetStream = sizeof(Config) + sizeof(Size);
+			Data.SetNumUninitialized(OffsetStream + DepthCompression::MaxRVLSize(Pixels));
+			FMemory::Memcpy(Data.GetData(), &Config, sizeof(Config));
+			FMemory::Memcpy(Data.GetData() + sizeof(Config), Size, sizeof(Size));
+			Data.SetNum(OffsetStream + DepthCompression::CompressRVL(Depth16, Data.GetData() + OffsetStream, Pixels), false);
+		}
+		else {
+			TSharedPtr<IImageWrapper> Wrapper = ImageWrapperModule->CreateImageWrapper(EImageFormat::PNG);
+			if (Wrapper.IsValid() && Wrapper->SetRaw(Depth16, Pixels * sizeof(uint16_t), ImageWidth, ImageHeight, ERGBFormat::Gray, 16)) {
+				const TArray<uint8> &PNG = Wrapper->GetCompressed();
+				if (PNG.Num() > 0) {
+					Data.SetNumUninitialized(sizeof(Config) + PNG.Num());
+					FMemory::Memcpy(Data.GetData(), &Config, sizeof(Config));
+					FMemory::Memcpy(Data.GetData() + sizeof(Config), PNG.GetData(), PNG.Num());
+				}
+			}
+		}
+	};
+
+	Priv->Compressor->Publish(Lease, Encode, *Priv->CompressedDepthQueue, Time, ImageOpticalFrame,
+		IsRVL ? TEXT("16UC1; compressedDepth rvl") : TEXT("16UC1; compressedDepth png"), (uint64)Width * Height * sizeof(uint16_t), MaxEncodingJobs);
+}
+
+void UDepthComponent::PublishCameraInfo(const FROSTime &Time)
+{
+	if (Priv->PublishInfo) {
+		Priv->Intrinsics.Publish(*Priv->CameraInfoQueue, Time, ImageOpticalFrame);
+	}
+}
+
+void UDepthComponent::InitializeComponent()
+{
+	Super::InitializeComponent();
+}
+
+void UDepthComponent::BeginPlay()
+{
+	Super::BeginPlay();
+
+	// The outputs besides the topics, the topics get the packets from PublishMessages. A replay at full speed
+	// publishes a frame once the image topic has room for it, if it has subscribers.
+	Priv->Pool = &FROSIntegrationVisionModule::Get().GetWorkerPool();
+	Priv->Outputs = MakeShareable(new PacketOutputs(GetName(),
+		[this](const std::shared_ptr<const uint8> &Lease, const FROSTime &Time) { PublishMessages(Lease, Time); },
+		[this](const double Timeout) {
+			const CaptureLog::FileHeader &Log = *Priv->Outputs->GetReplay()->GetHeader();
+			return !Priv->PublishRaw || Priv->ImageQueue->WaitForSpace((uint64)Log.Width * Log.Height * Log.Bytes, Timeout);
+		}));
+
+	// A replay takes the layout of the images from the log instead of the properties
+	if (!ReplayPath.IsEmpty()) {
+		const CaptureLog::FileHeader *Header = Priv->Outputs->OpenReplay(ReplayPath);
+		const bool Millimeters = Header && Header->Bytes == sizeof(uint16_t) &&
+			FCStringAnsi::Strncmp(Header->Encoding, "16UC1", sizeof(Header->Encoding)) == 0;
+		const bool Meters = Header && Header->Bytes == sizeof(float) &&
+			FCStringAnsi::Strncmp(Header->Encoding, "32FC1", sizeof(Header->Encoding)) == 0;
+		if ((Millimeters || Meters) && Header->OffsetImage == sizeof(PacketBuffer::PacketHeader) &&
+			Header->PacketSize == Header->OffsetImage + Header->Width * Header->Height * Header->Bytes) {
+			Width = Header->Width;
+			Height = Header->Height;
+			TranslateX = Header->TranslateX;
+			Encoding = Millimeters ? EDepthEncoding::UInt16Millimeters : EDepthEncoding::Float32Meters;
+			if (Priv->Outputs->GetReplay()->GetNumFrames() > 0) {
+				const PacketBuffer::PacketHeader *First = Priv->Outputs->GetReplay()->GetPacket(0);
+				FieldOfView = FMath::Max(First->FieldOfViewX, First->FieldOfViewY);
+			}
+		}
+		else {
+			UE_LOG(LogTemp, Warning, TEXT("%s could not replay %s, it is no depth capture log."), *GetName(), *ReplayPath);
+			Priv->Outputs->CloseReplay();
+		}
+	}
+
+	// Initializing buffers for reading images from the GPU
+	ImageDepth.AddUninitialized(Width * Height);
+
+	// Reinit renderer
+	Depth->TextureTarget->InitAutoFormat(Width, Height);
+
+	AspectRatio = Width / (float)Height;
+
+	// Creating packet ring buffer and setting the pointer of the server object
+	Priv->Encoding = Encoding;
+	const uint32 Bytes = Encoding == EDepthEncoding::UInt16Millimeters ? sizeof(uint16_t) : sizeof(float);
+	// One slot more than the minimum, so that a message still holding its lease does not stall the writer,
+	// one for each encoding job, which also holds a lease, and the three the server holds at most
+	const uint32 EncodingSlots = CompressedDepthTopicName.IsEmpty() ? 0 : FMath::Max(MaxEncodingJobs, 0);
+	Priv->Buffer = TSharedPtr<PacketBuffer>(new PacketBuffer(Width, Height, Bytes, FieldOfView, 4 + EncodingSlots + (EnableServer ? 3 : 0)));
+
+	// The packets are described like in a capture log, for the shared memory ring as well
+	CaptureLog::FileHeader Description;
+	FMemory::Memzero(Description);
+	Description.PacketSize = Priv->Buffer->Size;
+	Description.OffsetImage = Priv->Buffer->OffsetImage;
+	Description.Width = Width;
+	Description.Height = Height;
+	Description.Bytes = Bytes;
+	Description.TranslateX = TranslateX;
+	FCStringAnsi::Strncpy(Description.Encoding, Encoding == EDepthEncoding::UInt16Millimeters ? "16UC1" : "32FC1", sizeof(Description.Encoding));
+	FCStringAnsi::Strncpy(Description.FrameId, TCHAR_TO_UTF8(*ImageOpticalFrame), sizeof(Description.FrameId));
+	PacketOutputs::Settings Settings;
+	Settings.SharedMemoryName = SharedMemoryName;
+	Settings.SharedMemorySlots = SharedMemorySlots;
+	Settings.EnableServer = EnableServer;
+	Settings.ServerPort = ServerPort;
+	Settings.RecordPath = RecordPath;
+	Priv->Outputs->Open(Settings, Description);
+
+	Running = true;
+	Paused = false;
+	Priv->Schedule = 0;
+	Priv->ScheduledRate = 0;
+
+	// Without per-frame captures the render target is only updated by PublishImages. Readbacks always capture
+	// explicitly, a capture every frame is rendered after the tick and the copy would get the previous frame.
+	Priv->OnDemand = CaptureOnDemand || ReadbackDepth > 0;
+	Depth->bCaptureEveryFrame = !Priv->OnDemand;
+	Depth->bCaptureOnMovement = !Priv->OnDemand;
+	Priv->Capturing = !Priv->OnDemand;
+	Priv->PublishRaw = false;
+	Priv->PublishCompressed = false;
+	Priv->PublishInfo = false;
+	Priv->StatsCaptures = 0;
+	Priv->StatsTicks = 0;
+	Priv->StatsCaptureStart = FPlatformTime::Seconds();
+	Priv->Stages.Reset();
+
+	Priv->DoDepth = false;
+	Priv->Converting = false;
+	Priv->PublishRequests = 0;
+	Priv->PendingDepth.AddUninitialized(Width * Height);
+	Priv->ProcessingDepth.AddUninitialized(Width * Height);
+
+	// The module has to be loaded on the game thread, the encoding jobs only create image wrappers
+	Priv->ImageWrapperModule = &FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
+	Priv->Compressor = MakeShareable(new CompressedPublisher(GetName(), *Priv->Pool, Priv->Jobs, Priv->Stages));
+
+	// Ring of non-blocking readbacks, without it the render target is read synchronously
+	if (ReadbackDepth > 0)
+	{
+		Priv->Readback = TSharedPtr<ReadbackQueue>(new ReadbackQueue(ReadbackDepth, Width, Height));
+	}
+
+	// Nothing is rendered during a replay
+	if (Priv->Outputs->GetReplay()) {
+		Depth->bCaptureEveryFrame = false;
+		Depth->bCaptureOnMovement = false;
+		Priv->Capturing = false;
+		Priv->Intrinsics.Update(Width, Height, FieldOfView, TranslateX);
+		Priv->Outputs->StartReplay(ReplaySpeed, ReplayLoop);
+	}
+}
+
+void UDepthComponent::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* TickFunction)
+{
+	Super::TickComponent(DeltaTime, TickType, TickFunction);
+
+	// The replay publishes to the outputs that take the images as of the last tick, and pauses without any
+	if (Priv->Outputs->GetReplay()) {
+		Priv->Intrinsics.Update(Width, Height, FieldOfView, TranslateX);
+		Priv->Outputs->SetConsumed(UpdateSubscribers());
+		return;
+	}
+
+	PipelineTimer GameThreadTime(Priv->Times, false);
+
+	// Submit all frames whose readback completed in the meantime, oldest first
+	while (Priv->Readback.IsValid())
+	{
+		ReadbackQueue::Frame *Frame = Priv->Readback->Peek();
+		if (!Frame)
+		{
+			break;
+		}
+		RECORD_STAGE_SINCE(Priv->Stages, Readback, Frame->ClockCapture);
+
+		SubmitFrame(Frame->Pixels, *Frame);
+		Priv->Readback->Pop();
+	}
+
+	// The module scheduler calls PublishImages at the target rate, staggered with the other components
+	if (PublishRate != Priv->ScheduledRate && Running) {
+		CaptureScheduler &Scheduler = FROSIntegrationVisionModule::Get().GetScheduler();
+		if (Priv->Schedule == 0) {
+			const uint64 ReadbackBytes = (uint64)Width * Height * sizeof(FFloat16Color);
+			Priv->Schedule = Scheduler.Register(GetName(), PublishRate, ReadbackBytes, [this]() { return CaptureImages(); });
+		}
+		else {
+			Scheduler.SetRate(Priv->Schedule, PublishRate);
+		}
+		Priv->ScheduledRate = PublishRate;
+	}
+
+	++Priv->StatsTicks;
+	if (!Priv->OnDemand && Priv->Capturing) {
+		++Priv->StatsCaptures;
+	}
+	const double Now = FPlatformTime::Seconds();
+	if (Now - Priv->StatsCaptureStart >= 1.0) {
+		UE_LOG(LogTemp, Verbose, TEXT("%s captured %u times in %u frames."), *GetName(), Priv->StatsCaptures, Priv->StatsTicks);
+		Priv->StatsCaptureStart = Now;
+		Priv->StatsCaptures = 0;
+		Priv->StatsTicks = 0;
+	}
+	Priv->Times.Report(GetName());
+}
+
+void UDepthComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	Super::EndPlay(EndPlayReason);
+	Running = false;
+
+	if (Priv->Schedule != 0) {
+		FROSIntegrationVisionModule::Get().GetScheduler().Unregister(Priv->Schedule);
+		Priv->Schedule = 0;
+	}
+
+	// Waiting for readbacks in flight before their frames are destroyed
+	Priv->Readback.Reset();
+
+	// The replay stops within one frame or queue timeout, leases of its frames keep the log mapped
+	Priv->Outputs->StopReplay();
+
+	// Waiting for the conversion, publishing and encoding jobs, they access the component
+	Priv->Jobs.Wait();
+	Priv->Outputs->Close();
+
+	// Messages still waiting for the bridge are dropped, the ones it holds finish on their own
+	if (Priv->CameraInfoQueue.IsValid()) {
+		Priv->CameraInfoQueue->Close();
+	}
+	if (Priv->ImageQueue.IsValid()) {
+		Priv->ImageQueue->Close();
+	}
+	if (Priv->CompressedDepthQueue.IsValid()) {
+		Priv->CompressedDepthQueue->Close();
+	}
+}
+
+void UDepthComponent::ReadImage(UTextureRenderTarget2D* RenderTarget, TArray<FFloat16Color>& ImageData) const
+{
+	FTextureRenderTargetResource* RenderTargetResource = RenderTarget->GameThread_GetRenderTargetResource();
+	RenderTargetResource->ReadFloat16Pixels(ImageData);
+}
+
+void UDepthComponent::ToDepthImage(const TArray<FFloat16Color>& ImageData, uint8* Bytes) const
+{
+	static_assert(sizeof(FFloat16Color) == 4 * sizeof(uint16_t), "FFloat16Color has to be four packed half floats");
+	check((uint32)ImageData.Num() == Width * Height);
+
+	// Large frames are split into stripes of rows that are converted in parallel
+	const uint16_t* In = reinterpret_cast<const uint16_t*>(ImageData.GetData());
+	const uint32 MinRows = FMath::DivideAndRoundUp<uint32>(ImageConversion::MinStripePixels, Width);
+	if (Priv->Encoding == EDepthEncoding::UInt16Millimeters)
+	{
+		// Scene depth is stored in centimeters in the R channel, 16UC1 is in millimeters
+		const float MaxMillimeters = MaxRange > 0 ? FMath::Min(MaxRange * 1000.f, 65535.f) : 65535.f;
+		uint16_t* Out = reinterpret_cast<uint16_t*>(Bytes);
+		Priv->Pool->ParallelFor(Height, MinRows, [this, In, Out, MaxMillimeters](uint32 Begin, uint32 End) {
+			ImageConversion::HalfToMillimeters(In + Begin * Width * 4, Out + Begin * Width, (End - Begin) * Width, MaxMillimeters);
+		});
+		return;
+	}
+
+	float* Out = reinterpret_cast<float*>(Bytes);
+	Priv->Pool->ParallelFor(Height, MinRows, [this, In, Out](uint32 Begin, uint32 End) {
+		convertDepth(In + Begin * Width * 4, Out + Begin * Width, (End - Begin) * Width);
+	});
+}
+
+void UDepthComponent::convertDepth(const uint16_t* in, float* out, const uint32 Pixels) const
+{
+	// Scene depth is stored in centimeters in the R channel, 32FC1 is in meters
+	const float MaxMeters = MaxRange > 0 ? MaxRange : std::numeric_limits<float>::infinity();
+	ImageConversion::HalfToMeters(in, out, Pixels, MaxMeters);
+}
+
+void UDepthComponent::ProcessDepth()
+{
+	FrameInfo Info;
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> WaitLock(Priv->WaitDepth);
+			if (!Priv->DoDepth) {
+				Priv->Converting = false;
+				break;
+			}
+			Priv->DoDepth = false;
+			Swap(Priv->ProcessingDepth, Priv->PendingDepth);
+			Info = Priv->PendingInfo;
+		}
+
+		// Converting outside of the lock, so that the game thread can submit the next frame meanwhile
+		{
+			MEASURE_STAGE(Priv->Stages, Conversion);
+			PipelineTimer WorkerTime(Priv->Times, true);
+			ToDepthImage(Priv->ProcessingDepth, Priv->Buffer->Image);
+		}
+		Priv->Buffer->HeaderWrite->TimestampCapture = Info.TimestampCapture;
+		Priv->Buffer->HeaderWrite->ClockCapture = Info.ClockCapture;
+		Priv->Buffer->HeaderWrite->Translation = Info.Translation;
+		Priv->Buffer->HeaderWrite->Rotation = Info.Rotation;
+
+		// Complete Buffer, waits for a slot that no message leases anymore
+		{
+			MEASURE_STAGE(Priv->Stages, BufferWait);
+			Priv->Buffer->DoneWriting();
+		}
+
+		// Starting the publishing job unless it is running already
+		if (Priv->PublishRequests.fetch_add(1) == 0) {
+			Priv->Pool->Submit(Priv->Jobs, [this]() { PublishDepth(); });
+		}
+	}
 }
\ No newline at end of file
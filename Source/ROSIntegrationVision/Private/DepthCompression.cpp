@@ -0,0 +1,179 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "DepthCompression.h"
+
+#include <cstring>
+
+namespace DepthCompression
+{
+  namespace
+  {
+    // The stream consists of 32 bit words, each holding 8 nibbles starting with the most significant one.
+    // A nibble carries 3 bits of a value, least significant first, and the 4th bit marks that more follow.
+    class NibbleWriter
+    {
+    public:
+      explicit NibbleWriter(uint8_t *Out) : Out(Out), Begin(Out), Word(0), Nibbles(0)
+      {
+      }
+
+      void Encode(uint32_t Value)
+      {
+        do
+        {
+          uint32_t Nibble = Value & 0x7;
+          Value >>= 3;
+          if (Value)
+          {
+            Nibble |= 0x8;
+          }
+          Word = (Word << 4) | Nibble;
+          if (++Nibbles == 8)
+          {
+            Store();
+          }
+        } while (Value);
+      }
+
+      size_t Finish()
+      {
+        if (Nibbles)
+        {
+          Word <<= 4 * (8 - Nibbles);
+          Store();
+        }
+        return Out - Begin;
+      }
+
+    private:
+      uint8_t *Out;
+      uint8_t *const Begin;
+      uint32_t Word;
+      uint32_t Nibbles;
+
+      void Store()
+      {
+        // Words are stored in native byte order, like the reference implementation does
+        std::memcpy(Out, &Word, sizeof(Word));
+        Out += sizeof(Word);
+        Word = 0;
+        Nibbles = 0;
+      }
+    };
+
+    class NibbleReader
+    {
+    public:
+      NibbleReader(const uint8_t *In, const size_t Size) : In(In), End(In + Size), Word(0), Nibbles(0)
+      {
+      }
+
+      // Returns false at the end of the stream or if the value does not fit into 32 bits
+      bool Decode(uint32_t &Value)
+      {
+        Value = 0;
+        uint32_t Shift = 0;
+        uint32_t Nibble;
+        do
+        {
+          if (Shift >= 32)
+          {
+            return false;
+          }
+          if (!Nibbles)
+          {
+            if (End - In < (ptrdiff_t)sizeof(Word))
+            {
+              return false;
+            }
+            std::memcpy(&Word, In, sizeof(Word));
+            In += sizeof(Word);
+            Nibbles = 8;
+          }
+          Nibble = Word >> 28;
+          Value |= (Nibble & 0x7) << Shift;
+          Word <<= 4;
+          --Nibbles;
+          Shift += 3;
+        } while (Nibble & 0x8);
+        return true;
+      }
+
+    private:
+      const uint8_t *In;
+      const uint8_t *const End;
+      uint32_t Word;
+      uint32_t Nibbles;
+    };
+  }
+
+  size_t MaxRVLSize(const size_t Pixels)
+  {
+    // A zigzag encoded delta has at most 17 bits and needs 6 nibbles, the run counts add at most 2 nibbles per pixel
+    return Pixels * 4 + 16;
+  }
+
+  size_t CompressRVL(const uint16_t *In, uint8_t *Out, const size_t Pixels)
+  {
+    NibbleWriter Writer(Out);
+    const uint16_t *End = In + Pixels;
+    int32_t Previous = 0;
+    while (In != End)
+    {
+      uint32_t Zeros = 0;
+      for (; In != End && !*In; ++In)
+      {
+        ++Zeros;
+      }
+      Writer.Encode(Zeros);
+
+      uint32_t NonZeros = 0;
+      for (const uint16_t *Run = In; Run != End && *Run; ++Run)
+      {
+        ++NonZeros;
+      }
+      Writer.Encode(NonZeros);
+
+      for (uint32_t i = 0; i < NonZeros; ++i, ++In)
+      {
+        const int32_t Delta = (int32_t)*In - Previous;
+        Writer.Encode(((uint32_t)Delta << 1) ^ (uint32_t)(Delta >> 31));
+        Previous = *In;
+      }
+    }
+    return Writer.Finish();
+  }
+
+  bool DecompressRVL(const uint8_t *In, const size_t Size, uint16_t *Out, const size_t Pixels)
+  {
+    NibbleReader Reader(In, Size);
+    uint16_t *End = Out + Pixels;
+    int32_t Previous = 0;
+    uint32_t Zeros, NonZeros, Positive;
+    bool Valid = true;
+    while (Out < End && Valid)
+    {
+      // The run lengths are limited to the remaining pixels, so a corrupt stream cannot write past the image
+      Valid = Reader.Decode(Zeros);
+      const size_t ZerosClamped = !Valid ? 0 : Zeros < (size_t)(End - Out) ? Zeros : End - Out;
+      std::memset(Out, 0, ZerosClamped * sizeof(uint16_t));
+      Out += ZerosClamped;
+
+      Valid = Valid && Reader.Decode(NonZeros);
+      for (size_t i = 0; Valid && i < NonZeros && Out < End; ++i)
+      {
+        Valid = Reader.Decode(Positive);
+        if (Valid)
+        {
+          const int32_t Delta = (int32_t)(Positive >> 1) ^ -(int32_t)(Positive & 1);
+          Previous += Delta;
+          *Out++ = (uint16_t)Previous;
+        }
+      }
+    }
+
+    // The pixels a truncated or corrupt stream does not cover stay empty
+    std::memset(Out, 0, (End - Out) * sizeof(uint16_t));
+    return Valid;
+  }
+}
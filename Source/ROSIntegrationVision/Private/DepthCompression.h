@@ -0,0 +1,33 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Lossless compression of 16 bit depth images for the compressedDepth format of image_transport.
+ * A compressedDepth message starts with a ConfigHeader, followed by a 16 bit grayscale PNG or, for RVL, by the
+ * number of columns and rows as int32 and the RVL stream.
+ * RVL (Wilson, "Fast Lossless Depth Image Compression", 2017) run-length encodes zeros and stores the deltas of
+ * valid pixels with variable length nibbles. It is bit compatible with the codec of compressed_depth_image_transport.
+ */
+namespace DepthCompression
+{
+  // Header in front of the compressed data of a compressedDepth message
+  struct ConfigHeader
+  {
+    int32_t Format;        // compressionFormat of compressed_depth_image_transport, INV_DEPTH (0) for 16UC1
+    float DepthParam[2];   // Inverse depth quantization, unused for 16UC1
+  };
+
+  // Upper bound of the size of the RVL stream for the given number of pixels
+  size_t MaxRVLSize(const size_t Pixels);
+
+  // Compresses the depth values and returns the number of bytes written to Out, which must hold MaxRVLSize bytes
+  size_t CompressRVL(const uint16_t *In, uint8_t *Out, const size_t Pixels);
+
+  // Decompresses an RVL stream of Size bytes into Pixels depth values. Returns false if the stream ends early or
+  // holds a value of more than 32 bits, the pixels it does not cover are set to 0.
+  bool DecompressRVL(const uint8_t *In, const size_t Size, uint16_t *Out, const size_t Pixels);
+}
@@ -0,0 +1,402 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FrameRecorder.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#if defined(__linux__)
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+  #define FRAME_RECORDER_SUPPORTED 1
+#else
+  #define FRAME_RECORDER_SUPPORTED 0
+#endif
+
+namespace
+{
+  uint64_t AlignUp(const uint64_t Value)
+  {
+    return (Value + CaptureLog::Alignment - 1) / CaptureLog::Alignment * CaptureLog::Alignment;
+  }
+
+  // Zeroed memory of Size bytes starting at a multiple of the alignment, as O_DIRECT needs it
+  uint8 *AllocateAligned(std::vector<uint8> &Memory, const size_t Size)
+  {
+    Memory.assign(Size + CaptureLog::Alignment, 0);
+    return Memory.data() + (CaptureLog::Alignment - (uintptr_t)Memory.data() % CaptureLog::Alignment) % CaptureLog::Alignment;
+  }
+}
+
+FrameRecorder::FrameRecorder() : File(-1), Capacity(0), Filling(nullptr), NextOffset(0), Closing(false),
+  Frames(0), Dropped(0), Bytes(0), WriteNanoseconds(0), Direct(false), Failed(false)
+{
+  std::memset(&Header, 0, sizeof(Header));
+}
+
+FrameRecorder::~FrameRecorder()
+{
+  Close();
+}
+
+bool FrameRecorder::Open(const std::string &Path, const CaptureLog::FileHeader &Description, const uint32_t NumBuffers,
+                         const uint32_t BufferBytes)
+{
+  Close();
+#if FRAME_RECORDER_SUPPORTED
+  // Filesystems without O_DIRECT, like tmpfs, get the same aligned writes through the page cache
+  File = open(Path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+  Direct = File >= 0;
+  if (File < 0 && errno == EINVAL)
+  {
+    File = open(Path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  }
+  if (File < 0)
+  {
+    return false;
+  }
+
+  Header = Description;
+  Header.Magic = CaptureLog::Magic;
+  Header.Version = CaptureLog::Version;
+  Header.RecordSize = (uint32_t)AlignUp(Header.PacketSize);
+  Header.NumFrames = 0;
+  Header.IndexOffset = 0;
+  Header.Encoding[sizeof(Header.Encoding) - 1] = 0;
+  Header.FrameId[sizeof(Header.FrameId) - 1] = 0;
+
+  std::vector<uint8> Memory;
+  uint8 *Block = AllocateAligned(Memory, CaptureLog::Alignment);
+  std::memcpy(Block, &Header, sizeof(Header));
+  if (!WriteAt(Block, CaptureLog::Alignment, 0))
+  {
+    close(File);
+    File = -1;
+    return false;
+  }
+
+  // The padding of the records stays zero, every record overwrites the same part of its slot in the buffer
+  Capacity = Header.RecordSize * (BufferBytes / Header.RecordSize > 0 ? BufferBytes / Header.RecordSize : 1);
+  Buffers.resize(NumBuffers > 2 ? NumBuffers : 2);
+  for (Staging &Buffer : Buffers)
+  {
+    Buffer.Data = AllocateAligned(Buffer.Memory, Capacity);
+    Buffer.Used = 0;
+    Free.push_back(&Buffer);
+  }
+
+  NextOffset = CaptureLog::Alignment;
+  Closing = false;
+  Frames = 0;
+  Dropped = 0;
+  Bytes = CaptureLog::Alignment;
+  WriteNanoseconds = 0;
+  Failed = false;
+  Thread = std::thread(&FrameRecorder::Run, this);
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool FrameRecorder::Write(const uint8 *Packet)
+{
+  if (File < 0)
+  {
+    return false;
+  }
+
+  if (!Filling)
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    if (Free.empty() || Failed)
+    {
+      Dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    Filling = Free.front();
+    Free.pop_front();
+    Filling->Used = 0;
+    Filling->Offset = NextOffset;
+  }
+
+  std::memcpy(Filling->Data + Filling->Used, Packet, Header.PacketSize);
+  Filling->Used += Header.RecordSize;
+  Index.push_back({ reinterpret_cast<const PacketBuffer::PacketHeader*>(Packet)->TimestampCapture, NextOffset });
+  NextOffset += Header.RecordSize;
+  Frames.fetch_add(1, std::memory_order_relaxed);
+
+  if (Filling->Used == Capacity)
+  {
+    {
+      std::lock_guard<std::mutex> Lock(Mutex);
+      Full.push_back(Filling);
+    }
+    CVWork.notify_one();
+    Filling = nullptr;
+  }
+  return true;
+}
+
+void FrameRecorder::Run()
+{
+  while (true)
+  {
+    Staging *Buffer;
+    {
+      std::unique_lock<std::mutex> Lock(Mutex);
+      CVWork.wait(Lock, [this]() { return !Full.empty() || Closing; });
+      if (Full.empty())
+      {
+        return;
+      }
+      Buffer = Full.front();
+      Full.pop_front();
+    }
+
+    if (!Failed && !WriteAt(Buffer->Data, Buffer->Used, Buffer->Offset))
+    {
+      Failed = true;
+    }
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Free.push_back(Buffer);
+  }
+}
+
+bool FrameRecorder::WriteAt(const uint8 *Data, const size_t Size, const uint64_t Offset)
+{
+#if FRAME_RECORDER_SUPPORTED
+  const auto Start = std::chrono::steady_clock::now();
+  size_t Written = 0;
+  while (Written < Size)
+  {
+    const ssize_t Count = pwrite(File, Data + Written, Size - Written, (off_t)(Offset + Written));
+    if (Count < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (Count <= 0)
+    {
+      return false;
+    }
+    Written += (size_t)Count;
+  }
+  Bytes.fetch_add(Size, std::memory_order_relaxed);
+  WriteNanoseconds.fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - Start).count(), std::memory_order_relaxed);
+  return true;
+#else
+  return false;
+#endif
+}
+
+void FrameRecorder::Close()
+{
+#if FRAME_RECORDER_SUPPORTED
+  if (File < 0)
+  {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    if (Filling && Filling->Used > 0)
+    {
+      Full.push_back(Filling);
+    }
+    Closing = true;
+  }
+  Filling = nullptr;
+  CVWork.notify_one();
+  Thread.join();
+
+  // The index of the frames that made it to the file, the trailer ends the last block
+  if (Failed)
+  {
+    Index.clear();
+  }
+  const uint64_t IndexOffset = NextOffset;
+  const size_t IndexBytes = Index.size() * sizeof(CaptureLog::IndexEntry);
+  const size_t IndexSize = (size_t)AlignUp(IndexBytes + sizeof(CaptureLog::Trailer));
+  std::vector<uint8> Memory;
+  uint8 *Block = AllocateAligned(Memory, IndexSize);
+  if (IndexBytes > 0)
+  {
+    std::memcpy(Block, Index.data(), IndexBytes);
+  }
+  CaptureLog::Trailer End;
+  End.IndexOffset = IndexOffset;
+  End.NumFrames = Index.size();
+  End.Magic = CaptureLog::TrailerMagic;
+  End.Version = CaptureLog::Version;
+  std::memcpy(Block + IndexSize - sizeof(End), &End, sizeof(End));
+
+  // Without the index the log stays unfinished, readers fall back to the records
+  if (!Failed && WriteAt(Block, IndexSize, IndexOffset))
+  {
+    Header.NumFrames = Index.size();
+    Header.IndexOffset = IndexOffset;
+    std::memset(Block, 0, CaptureLog::Alignment);
+    std::memcpy(Block, &Header, sizeof(Header));
+    WriteAt(Block, CaptureLog::Alignment, 0);
+  }
+  close(File);
+#endif
+  File = -1;
+  Filling = nullptr;
+  Full.clear();
+  Free.clear();
+  Buffers.clear();
+  Index.clear();
+}
+
+bool FrameRecorder::IsOpen() const
+{
+  return File >= 0;
+}
+
+FrameRecorder::Statistics FrameRecorder::GetStatistics() const
+{
+  Statistics Stats;
+  Stats.Frames = Frames.load(std::memory_order_relaxed);
+  Stats.Dropped = Dropped.load(std::memory_order_relaxed);
+  Stats.Bytes = Bytes.load(std::memory_order_relaxed);
+  Stats.WriteSeconds = WriteNanoseconds.load(std::memory_order_relaxed) / 1e9;
+  Stats.Direct = Direct.load(std::memory_order_relaxed);
+  Stats.Failed = Failed.load(std::memory_order_relaxed);
+  return Stats;
+}
+
+CaptureLogReader::CaptureLogReader() : Header(nullptr), Index(nullptr), NumFrames(0)
+{
+}
+
+bool CaptureLogReader::Open(const std::string &Path)
+{
+  Close();
+#if FRAME_RECORDER_SUPPORTED
+  const int File = open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (File < 0)
+  {
+    return false;
+  }
+  struct stat Status;
+  if (fstat(File, &Status) != 0 || (size_t)Status.st_size < CaptureLog::Alignment)
+  {
+    close(File);
+    return false;
+  }
+  const size_t Size = (size_t)Status.st_size;
+  void *Mapped = mmap(nullptr, Size, PROT_READ, MAP_SHARED, File, 0);
+  close(File);
+  if (Mapped == MAP_FAILED)
+  {
+    return false;
+  }
+  // Replays read the records in order
+  madvise(Mapped, Size, MADV_SEQUENTIAL);
+  Mapping = std::shared_ptr<const uint8>(static_cast<const uint8*>(Mapped), [Size](const uint8 *Memory)
+  {
+    munmap(const_cast<uint8*>(Memory), Size);
+  });
+
+  Header = reinterpret_cast<const CaptureLog::FileHeader*>(Mapping.get());
+  if (Header->Magic != CaptureLog::Magic || Header->Version != CaptureLog::Version ||
+      Header->PacketSize < sizeof(PacketBuffer::PacketHeader) || Header->RecordSize != AlignUp(Header->PacketSize) ||
+      Header->OffsetImage < sizeof(PacketBuffer::PacketHeader) || Header->OffsetImage > Header->PacketSize)
+  {
+    Close();
+    return false;
+  }
+
+  // The index of a finished log has to lie between the records and the trailer
+  const CaptureLog::Trailer *End = reinterpret_cast<const CaptureLog::Trailer*>(Mapping.get() + Size - sizeof(CaptureLog::Trailer));
+  if (Header->IndexOffset != 0 && End->Magic == CaptureLog::TrailerMagic && End->IndexOffset == Header->IndexOffset &&
+      End->NumFrames == Header->NumFrames &&
+      End->IndexOffset + End->NumFrames * sizeof(CaptureLog::IndexEntry) <= Size - sizeof(CaptureLog::Trailer))
+  {
+    Index = reinterpret_cast<const CaptureLog::IndexEntry*>(Mapping.get() + End->IndexOffset);
+    NumFrames = End->NumFrames;
+    for (uint64_t i = 0; i < NumFrames; ++i)
+    {
+      if (Index[i].Offset < CaptureLog::Alignment || Index[i].Offset + Header->PacketSize > End->IndexOffset)
+      {
+        Close();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Records of an unfinished log, a crash may have left zeros at the end of the last buffer
+  NumFrames = (Size - CaptureLog::Alignment) / Header->RecordSize;
+  while (NumFrames > 0 && GetPacket(NumFrames - 1)->Size != Header->PacketSize)
+  {
+    --NumFrames;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void CaptureLogReader::Close()
+{
+  Mapping.reset();
+  Header = nullptr;
+  Index = nullptr;
+  NumFrames = 0;
+}
+
+bool CaptureLogReader::IsOpen() const
+{
+  return Header != nullptr;
+}
+
+const CaptureLog::FileHeader *CaptureLogReader::GetHeader() const
+{
+  return Header;
+}
+
+uint64_t CaptureLogReader::GetNumFrames() const
+{
+  return NumFrames;
+}
+
+const PacketBuffer::PacketHeader *CaptureLogReader::GetPacket(const uint64_t Frame) const
+{
+  const uint64_t Offset = Index ? Index[Frame].Offset : CaptureLog::Alignment + Frame * Header->RecordSize;
+  return reinterpret_cast<const PacketBuffer::PacketHeader*>(Mapping.get() + Offset);
+}
+
+uint64_t CaptureLogReader::GetTimestamp(const uint64_t Frame) const
+{
+  return Index ? Index[Frame].TimestampCapture : GetPacket(Frame)->TimestampCapture;
+}
+
+std::shared_ptr<const uint8> CaptureLogReader::Lease(const uint64_t Frame) const
+{
+  return std::shared_ptr<const uint8>(Mapping, reinterpret_cast<const uint8*>(GetPacket(Frame)));
+}
+
+uint64_t CaptureLogReader::Find(const uint64_t Timestamp) const
+{
+  uint64_t First = 0, Last = NumFrames;
+  while (First < Last)
+  {
+    const uint64_t Middle = First + (Last - First) / 2;
+    if (GetTimestamp(Middle) < Timestamp)
+    {
+      First = Middle + 1;
+    }
+    else
+    {
+      Last = Middle;
+    }
+  }
+  return First;
+}
@@ -0,0 +1,178 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PacketBuffer.h"
+
+/**
+ * Append-only capture log of the packets of a component, for generating datasets without recording bags behind
+ * rosbridge. The file starts with a FileHeader block, followed by one record per frame: the packet as it is in the
+ * PacketBuffer, the PacketHeader with the timestamp and pose of the capture followed by the image, padded to the
+ * alignment. Closing appends the index, one IndexEntry per frame, and a Trailer that ends the file, and updates the
+ * frame count and the index offset in the FileHeader.
+ * All blocks start and end at multiples of Alignment, so the file can be written with O_DIRECT and the records
+ * can be mapped in place. An unfinished log has no index, its records are the FileHeader.RecordSize blocks after
+ * the header up to the end of the file.
+ */
+namespace CaptureLog
+{
+  const uint32_t Magic = 0x4c564952;        // "RIVL"
+  const uint32_t TrailerMagic = 0x58564952; // "RIVX"
+  const uint32_t Version = 1;
+  const uint32_t Alignment = 4096;
+
+  struct FileHeader
+  {
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t PacketSize;  // Size of every packet, PacketHeader and image
+    uint32_t RecordSize;  // PacketSize rounded up to the alignment
+    uint32_t OffsetImage; // Offset of the image in the packet
+    uint32_t Width;
+    uint32_t Height;
+    uint32_t Bytes;       // Bytes per pixel
+    float TranslateX;     // Baseline of the camera in meters
+    char Encoding[16];    // Encoding of the image like in sensor_msgs/Image
+    char FrameId[128];    // Frame of the images when they were recorded
+    uint64_t NumFrames;   // Set on close, 0 in an unfinished log
+    uint64_t IndexOffset; // Set on close, 0 in an unfinished log
+  };
+
+  struct IndexEntry
+  {
+    uint64_t TimestampCapture; // Of the frame, ordered like the frames
+    uint64_t Offset;           // Of the packet in the file
+  };
+
+  struct Trailer
+  {
+    uint64_t IndexOffset;
+    uint64_t NumFrames;
+    uint32_t Magic;
+    uint32_t Version;
+  };
+}
+
+/**
+ * Writes a capture log on its own thread. Write copies the packet into the current staging buffer, a full buffer
+ * is written with one large aligned write while the next one fills. If all buffers wait for the disk, the frame is
+ * dropped instead of waiting, so the component never stalls on a slow disk.
+ * Open, Write and Close must be called from one thread at a time. Only Linux is supported, Open fails on the
+ * other platforms.
+ */
+class ROSINTEGRATIONVISION_API FrameRecorder
+{
+public:
+  struct Statistics
+  {
+    uint64_t Frames;      // Frames written or waiting in a staging buffer
+    uint64_t Dropped;     // Frames dropped because all staging buffers were waiting for the disk
+    uint64_t Bytes;       // Bytes written to the file
+    double WriteSeconds;  // Time spent in writing them
+    bool Direct;          // Whether the file bypasses the page cache with O_DIRECT
+    bool Failed;          // Whether a write failed, the following frames are dropped
+  };
+
+private:
+  struct Staging
+  {
+    std::vector<uint8> Memory;
+    uint8 *Data;
+    uint32_t Used;
+    uint64_t Offset; // Of the buffer in the file
+  };
+
+  int File;
+  CaptureLog::FileHeader Header;
+  std::vector<Staging> Buffers;
+  uint32_t Capacity; // Bytes of a staging buffer, a multiple of RecordSize
+  // Only accessed by the thread calling Write
+  Staging *Filling;
+  uint64_t NextOffset;
+  std::vector<CaptureLog::IndexEntry> Index;
+
+  std::thread Thread;
+  std::mutex Mutex;
+  std::condition_variable CVWork;
+  std::deque<Staging*> Full, Free;
+  bool Closing;
+
+  std::atomic<uint64_t> Frames, Dropped, Bytes, WriteNanoseconds;
+  std::atomic<bool> Direct, Failed;
+
+  void Run();
+  bool WriteAt(const uint8 *Data, const size_t Size, const uint64_t Offset);
+
+public:
+  FrameRecorder();
+
+  // Closes the log
+  ~FrameRecorder();
+
+  // Creates the log at Path and replaces an existing file. Description fills the file header apart from the
+  // magic, the version, RecordSize and the fields set on close. About NumBuffers * BufferBytes are allocated for
+  // staging, at least one record per buffer. Returns false if the file could not be created or the platform is not
+  // supported.
+  bool Open(const std::string &Path, const CaptureLog::FileHeader &Description, const uint32_t NumBuffers = 4,
+            const uint32_t BufferBytes = 32 * 1024 * 1024);
+
+  // Appends a packet of PacketSize bytes, returns false if it was dropped
+  bool Write(const uint8 *Packet);
+
+  // Writes the remaining frames and the index and closes the file
+  void Close();
+
+  bool IsOpen() const;
+
+  Statistics GetStatistics() const;
+};
+
+/**
+ * Maps a capture log read-only for replaying it. Leases of the packets point into the mapping, nothing is copied,
+ * and keep the file mapped until the last one is gone, also if the reader is closed before. Unfinished logs are
+ * read up to their last complete record.
+ */
+class ROSINTEGRATIONVISION_API CaptureLogReader
+{
+private:
+  std::shared_ptr<const uint8> Mapping;
+  const CaptureLog::FileHeader *Header;
+  // Index of a finished log, nullptr for an unfinished one
+  const CaptureLog::IndexEntry *Index;
+  uint64_t NumFrames;
+
+public:
+  CaptureLogReader();
+
+  // Maps the log at Path, returns false if it is not a compatible capture log or the platform is not supported
+  bool Open(const std::string &Path);
+  void Close();
+
+  bool IsOpen() const;
+
+  // Header of the mapped log, nullptr if not open
+  const CaptureLog::FileHeader *GetHeader() const;
+
+  uint64_t GetNumFrames() const;
+
+  // Packet of a frame, the PacketHeader followed by the image
+  const PacketBuffer::PacketHeader *GetPacket(const uint64_t Frame) const;
+
+  uint64_t GetTimestamp(const uint64_t Frame) const;
+
+  // Packet of a frame as a lease like PacketBuffer::LeaseRead
+  std::shared_ptr<const uint8> Lease(const uint64_t Frame) const;
+
+  // First frame captured at or after Timestamp, GetNumFrames if there is none
+  uint64_t Find(const uint64_t Timestamp) const;
+};
@@ -0,0 +1,611 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "ImageConversion.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  #define CONVERSION_X86 1
+  #include <immintrin.h>
+  #if defined(_MSC_VER)
+    #include <intrin.h>
+  #else
+    #include <cpuid.h>
+  #endif
+#else
+  #define CONVERSION_X86 0
+#endif
+
+// MSVC allows intrinsics of any instruction set, gcc and clang need them enabled per function
+#if defined(_MSC_VER) && !defined(__clang__)
+  #define CONVERSION_TARGET(Features)
+#else
+  #define CONVERSION_TARGET(Features) __attribute__((target(Features)))
+#endif
+
+namespace ImageConversion
+{
+
+/*
+ * CPU feature detection
+ */
+
+#if CONVERSION_X86
+struct CpuFeatures
+{
+  bool SSE41;
+  bool F16C;
+  bool AVX2;
+
+  CpuFeatures() : SSE41(false), F16C(false), AVX2(false)
+  {
+    int Info[4];
+    CpuId(Info, 0, 0);
+    const int MaxLeaf = Info[0];
+    if (MaxLeaf < 1)
+    {
+      return;
+    }
+
+    CpuId(Info, 1, 0);
+    SSE41 = (Info[2] & (1 << 19)) != 0;
+    const bool OSXSAVE = (Info[2] & (1 << 27)) != 0;
+    const bool AVX = (Info[2] & (1 << 28)) != 0;
+    const bool HasF16C = (Info[2] & (1 << 29)) != 0;
+
+    // F16C instructions are VEX encoded, so the OS has to save the AVX registers
+    if (!OSXSAVE || !AVX || (XGetBV() & 0x6) != 0x6)
+    {
+      return;
+    }
+    F16C = SSE41 && HasF16C;
+
+    if (MaxLeaf >= 7)
+    {
+      CpuId(Info, 7, 0);
+      AVX2 = F16C && (Info[1] & (1 << 5)) != 0;
+    }
+  }
+
+  static void CpuId(int Info[4], const int Leaf, const int SubLeaf)
+  {
+#if defined(_MSC_VER)
+    __cpuidex(Info, Leaf, SubLeaf);
+#else
+    unsigned int A, B, C, D;
+    __cpuid_count(Leaf, SubLeaf, A, B, C, D);
+    Info[0] = (int)A;
+    Info[1] = (int)B;
+    Info[2] = (int)C;
+    Info[3] = (int)D;
+#endif
+  }
+
+  static uint64_t XGetBV()
+  {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t A, D;
+    __asm__ volatile("xgetbv" : "=a"(A), "=d"(D) : "c"(0));
+    return ((uint64_t)D << 32) | A;
+#endif
+  }
+};
+
+static const CpuFeatures &GetCpuFeatures()
+{
+  static const CpuFeatures Features;
+  return Features;
+}
+
+bool HasSSE41()
+{
+  return GetCpuFeatures().SSE41;
+}
+
+bool HasF16C()
+{
+  return GetCpuFeatures().F16C;
+}
+
+bool HasAVX2()
+{
+  return GetCpuFeatures().AVX2;
+}
+#else
+bool HasSSE41()
+{
+  return false;
+}
+
+bool HasF16C()
+{
+  return false;
+}
+
+bool HasAVX2()
+{
+  return false;
+}
+#endif
+
+/*
+ * Scalar kernels
+ */
+
+float HalfToFloat(const uint16_t Half)
+{
+  const uint32_t Sign = (uint32_t)(Half & 0x8000) << 16;
+  const uint32_t Exponent = (Half >> 10) & 0x1f;
+  uint32_t Mantissa = Half & 0x3ff;
+  uint32_t Bits;
+
+  if (Exponent == 0x1f)
+  {
+    // Inf and NaN
+    Bits = Sign | 0x7f800000 | (Mantissa << 13);
+  }
+  else if (Exponent != 0)
+  {
+    Bits = Sign | ((Exponent + 127 - 15) << 23) | (Mantissa << 13);
+  }
+  else if (Mantissa == 0)
+  {
+    Bits = Sign;
+  }
+  else
+  {
+    // Denormals are normal numbers as float
+    uint32_t FloatExponent = 127 - 15 + 1;
+    while (!(Mantissa & 0x400))
+    {
+      Mantissa <<= 1;
+      --FloatExponent;
+    }
+    Bits = Sign | (FloatExponent << 23) | ((Mantissa & 0x3ff) << 13);
+  }
+
+  float Value;
+  std::memcpy(&Value, &Bits, sizeof(Value));
+  return Value;
+}
+
+static inline uint8_t ToByte(const uint16_t Half)
+{
+  // Same operations as the vector kernels: scale, add 0.5, clamp (NaN to 0) and truncate.
+  // Separate statements so that the compiler does not contract them into a fused multiply add.
+  float Value = HalfToFloat(Half) * 255.f;
+  Value += 0.5f;
+  Value = Value > 0.f ? Value : 0.f;
+  Value = Value < 255.f ? Value : 255.f;
+  return (uint8_t)Value;
+}
+
+void HalfToBGR8Scalar(const uint16_t *In, uint8_t *Out, const size_t Pixels)
+{
+  for (size_t i = 0; i < Pixels; ++i, In += 4, Out += 3)
+  {
+    Out[0] = ToByte(In[2]);
+    Out[1] = ToByte(In[1]);
+    Out[2] = ToByte(In[0]);
+  }
+}
+
+void HalfToMetersScalar(const uint16_t *In, float *Out, const size_t Pixels, const float MaxMeters)
+{
+  for (size_t i = 0; i < Pixels; ++i, In += 4, ++Out)
+  {
+    const float Value = HalfToFloat(*In) * 0.01f;
+    *Out = MaxMeters < Value ? MaxMeters : Value;
+  }
+}
+
+static inline uint16_t ToMillimeters(float Value, const float MaxMillimeters)
+{
+  // Same operations as the vector kernels, see ToByte
+  Value += 0.5f;
+  Value = Value > 0.f ? Value : 0.f;
+  Value = Value < MaxMillimeters ? Value : MaxMillimeters;
+  return (uint16_t)Value;
+}
+
+void HalfToMillimetersScalar(const uint16_t *In, uint16_t *Out, const size_t Pixels, const float MaxMillimeters)
+{
+  for (size_t i = 0; i < Pixels; ++i, In += 4, ++Out)
+  {
+    *Out = ToMillimeters(HalfToFloat(*In) * 10.f, MaxMillimeters);
+  }
+}
+
+void MetersToMillimeters(const float *In, uint16_t *Out, const size_t Pixels, const float MaxMillimeters)
+{
+  for (size_t i = 0; i < Pixels; ++i)
+  {
+    Out[i] = ToMillimeters(In[i] * 1000.f, MaxMillimeters);
+  }
+}
+
+void BGRA8ToBGR8Scalar(const uint8_t *In, uint8_t *Out, const size_t Pixels)
+{
+  for (size_t i = 0; i < Pixels; ++i, In += 4, Out += 3)
+  {
+    Out[0] = In[0];
+    Out[1] = In[1];
+    Out[2] = In[2];
+  }
+}
+
+/*
+ * Vector kernels
+ */
+
+#if CONVERSION_X86
+// Scales, rounds and clamps 4 floats to [0, 255] as integers
+CONVERSION_TARGET("sse4.1,f16c")
+static inline __m128i ToBytesSSE(const __m128 Value)
+{
+  __m128 Scaled = _mm_add_ps(_mm_mul_ps(Value, _mm_set1_ps(255.f)), _mm_set1_ps(0.5f));
+  Scaled = _mm_min_ps(_mm_max_ps(Scaled, _mm_setzero_ps()), _mm_set1_ps(255.f));
+  return _mm_cvttps_epi32(Scaled);
+}
+
+// Converts 4 RGBA half pixels into 12 BGR bytes in the lower part of the result
+CONVERSION_TARGET("sse4.1,f16c")
+static inline __m128i HalfToBGR8x4SSE(const uint16_t *In)
+{
+  const __m128i Pixel01 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(In));
+  const __m128i Pixel23 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(In + 8));
+
+  const __m128i Int0 = ToBytesSSE(_mm_cvtph_ps(Pixel01));
+  const __m128i Int1 = ToBytesSSE(_mm_cvtph_ps(_mm_unpackhi_epi64(Pixel01, Pixel01)));
+  const __m128i Int2 = ToBytesSSE(_mm_cvtph_ps(Pixel23));
+  const __m128i Int3 = ToBytesSSE(_mm_cvtph_ps(_mm_unpackhi_epi64(Pixel23, Pixel23)));
+
+  const __m128i RGBA = _mm_packus_epi16(_mm_packs_epi32(Int0, Int1), _mm_packs_epi32(Int2, Int3));
+  return _mm_shuffle_epi8(RGBA, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+// Stores two blocks of 12 BGR bytes as exactly 24 bytes
+CONVERSION_TARGET("sse4.1,f16c")
+static inline void StoreBGR8x8(uint8_t *Out, const __m128i Low, const __m128i High)
+{
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(Out), _mm_or_si128(Low, _mm_slli_si128(High, 12)));
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(Out + 16), _mm_srli_si128(High, 4));
+}
+
+CONVERSION_TARGET("sse4.1,f16c")
+void HalfToBGR8SSE(const uint16_t *In, uint8_t *Out, const size_t Pixels)
+{
+  size_t i = 0;
+  for (; i + 8 <= Pixels; i += 8, In += 32, Out += 24)
+  {
+    StoreBGR8x8(Out, HalfToBGR8x4SSE(In), HalfToBGR8x4SSE(In + 16));
+  }
+  HalfToBGR8Scalar(In, Out, Pixels - i);
+}
+
+// Converts 8 RGBA half pixels into BGR bytes, 4 pixels (12 bytes) in the lower part of each 128 bit lane
+CONVERSION_TARGET("avx2,f16c")
+static inline __m256i HalfToBGR8x8AVX2(const uint16_t *In)
+{
+  const __m256 Scale = _mm256_set1_ps(255.f);
+  const __m256 Round = _mm256_set1_ps(0.5f);
+  const __m256 Zero = _mm256_setzero_ps();
+  __m256i Int[4];
+
+  // Each conversion handles 2 pixels
+  for (int j = 0; j < 4; ++j)
+  {
+    const __m256 Value = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(In + j * 8)));
+    __m256 Scaled = _mm256_add_ps(_mm256_mul_ps(Value, Scale), Round);
+    Scaled = _mm256_min_ps(_mm256_max_ps(Scaled, Zero), Scale);
+    Int[j] = _mm256_cvttps_epi32(Scaled);
+  }
+
+  // Packing works per lane, so the pixels end up in the order 0 2 4 6 | 1 3 5 7
+  const __m256i RGBA = _mm256_packus_epi16(_mm256_packs_epi32(Int[0], Int[1]), _mm256_packs_epi32(Int[2], Int[3]));
+  const __m256i Ordered = _mm256_permutevar8x32_epi32(RGBA, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+  return _mm256_shuffle_epi8(Ordered, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+CONVERSION_TARGET("avx2,f16c")
+void HalfToBGR8AVX2(const uint16_t *In, uint8_t *Out, const size_t Pixels)
+{
+  size_t i = 0;
+  for (; i + 16 <= Pixels; i += 16, In += 64, Out += 48)
+  {
+    const __m256i Low = HalfToBGR8x8AVX2(In);
+    const __m256i High = HalfToBGR8x8AVX2(In + 32);
+    const __m128i A = _mm256_castsi256_si128(Low);
+    const __m128i B = _mm256_extracti128_si256(Low, 1);
+    const __m128i C = _mm256_castsi256_si128(High);
+    const __m128i D = _mm256_extracti128_si256(High, 1);
+
+    // Four blocks of 12 bytes are stored as three blocks of 16 bytes
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(Out), _mm_or_si128(A, _mm_slli_si128(B, 12)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(Out + 16), _mm_or_si128(_mm_srli_si128(B, 4), _mm_slli_si128(C, 8)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(Out + 32), _mm_or_si128(_mm_srli_si128(C, 8), _mm_slli_si128(D, 4)));
+  }
+  HalfToBGR8SSE(In, Out, Pixels - i);
+}
+
+// Drops the alpha channel of 4 BGRA pixels, leaving 12 BGR bytes in the lower part of the result
+CONVERSION_TARGET("sse4.1")
+static inline __m128i DropAlphax4SSE(const uint8_t *In)
+{
+  const __m128i Pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(In));
+  return _mm_shuffle_epi8(Pixels, _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+}
+
+// Stores four blocks of 12 BGR bytes as three blocks of 16 bytes
+CONVERSION_TARGET("sse4.1")
+static inline void StoreBGR8x16(uint8_t *Out, const __m128i A, const __m128i B, const __m128i C, const __m128i D)
+{
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(Out), _mm_or_si128(A, _mm_slli_si128(B, 12)));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(Out + 16), _mm_or_si128(_mm_srli_si128(B, 4), _mm_slli_si128(C, 8)));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(Out + 32), _mm_or_si128(_mm_srli_si128(C, 8), _mm_slli_si128(D, 4)));
+}
+
+CONVERSION_TARGET("sse4.1")
+void BGRA8ToBGR8SSE(const uint8_t *In, uint8_t *Out, const size_t Pixels)
+{
+  size_t i = 0;
+  for (; i + 16 <= Pixels; i += 16, In += 64, Out += 48)
+  {
+    StoreBGR8x16(Out, DropAlphax4SSE(In), DropAlphax4SSE(In + 16), DropAlphax4SSE(In + 32), DropAlphax4SSE(In + 48));
+  }
+  BGRA8ToBGR8Scalar(In, Out, Pixels - i);
+}
+
+CONVERSION_TARGET("avx2")
+void BGRA8ToBGR8AVX2(const uint8_t *In, uint8_t *Out, const size_t Pixels)
+{
+  // The shuffle works per lane, so every lane holds 12 BGR bytes of 4 pixels afterwards
+  const __m256i DropAlpha = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                             0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  size_t i = 0;
+  for (; i + 32 <= Pixels; i += 32, In += 128, Out += 96)
+  {
+    const __m256i P0 = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(In)), DropAlpha);
+    const __m256i P1 = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(In + 32)), DropAlpha);
+    const __m256i P2 = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(In + 64)), DropAlpha);
+    const __m256i P3 = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(In + 96)), DropAlpha);
+    StoreBGR8x16(Out, _mm256_castsi256_si128(P0), _mm256_extracti128_si256(P0, 1),
+                      _mm256_castsi256_si128(P1), _mm256_extracti128_si256(P1, 1));
+    StoreBGR8x16(Out + 48, _mm256_castsi256_si128(P2), _mm256_extracti128_si256(P2, 1),
+                           _mm256_castsi256_si128(P3), _mm256_extracti128_si256(P3, 1));
+  }
+  BGRA8ToBGR8SSE(In, Out, Pixels - i);
+}
+
+// Gathers the R channel of 4 RGBA half pixels into the lower 64 bits
+CONVERSION_TARGET("sse4.1,f16c")
+static inline __m128i GatherRedx4SSE(const uint16_t *In)
+{
+  const __m128i Red = _mm_setr_epi8(0, 1, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i Pixel01 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(In)), Red);
+  const __m128i Pixel23 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(In + 8)), Red);
+  return _mm_unpacklo_epi32(Pixel01, Pixel23);
+}
+
+CONVERSION_TARGET("sse4.1,f16c")
+void HalfToMetersSSE(const uint16_t *In, float *Out, const size_t Pixels, const float MaxMeters)
+{
+  const __m128 Scale = _mm_set1_ps(0.01f);
+  const __m128 Max = _mm_set1_ps(MaxMeters);
+  size_t i = 0;
+  for (; i + 8 <= Pixels; i += 8, In += 32, Out += 8)
+  {
+    // Max as first operand, so that NaN is passed through
+    _mm_storeu_ps(Out, _mm_min_ps(Max, _mm_mul_ps(_mm_cvtph_ps(GatherRedx4SSE(In)), Scale)));
+    _mm_storeu_ps(Out + 4, _mm_min_ps(Max, _mm_mul_ps(_mm_cvtph_ps(GatherRedx4SSE(In + 16)), Scale)));
+  }
+  HalfToMetersScalar(In, Out, Pixels - i, MaxMeters);
+}
+
+// Converts 4 half centimeters to rounded and saturated millimeters as 32 bit integers
+CONVERSION_TARGET("sse4.1,f16c")
+static inline __m128i ToMillimetersSSE(const __m128i Half, const __m128 Max)
+{
+  __m128 Value = _mm_add_ps(_mm_mul_ps(_mm_cvtph_ps(Half), _mm_set1_ps(10.f)), _mm_set1_ps(0.5f));
+  Value = _mm_min_ps(_mm_max_ps(Value, _mm_setzero_ps()), Max);
+  return _mm_cvttps_epi32(Value);
+}
+
+CONVERSION_TARGET("sse4.1,f16c")
+void HalfToMillimetersSSE(const uint16_t *In, uint16_t *Out, const size_t Pixels, const float MaxMillimeters)
+{
+  const __m128 Max = _mm_set1_ps(MaxMillimeters);
+  size_t i = 0;
+  for (; i + 8 <= Pixels; i += 8, In += 32, Out += 8)
+  {
+    const __m128i Low = ToMillimetersSSE(GatherRedx4SSE(In), Max);
+    const __m128i High = ToMillimetersSSE(GatherRedx4SSE(In + 16), Max);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(Out), _mm_packus_epi32(Low, High));
+  }
+  HalfToMillimetersScalar(In, Out, Pixels - i, MaxMillimeters);
+}
+
+// Gathers the R channel of 8 RGBA half pixels
+CONVERSION_TARGET("avx2,f16c")
+static inline __m128i GatherRedx8AVX2(const uint16_t *In)
+{
+  const __m256i Red = _mm256_setr_epi8(0, 1, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                       0, 1, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m256i Pixel0123 = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(In)), Red);
+  const __m256i Pixel4567 = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(In + 16)), Red);
+
+  // Lanes hold the pixels 01 45 | 23 67 afterwards
+  const __m256i Unpacked = _mm256_unpacklo_epi32(Pixel0123, Pixel4567);
+  return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(Unpacked, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)));
+}
+
+CONVERSION_TARGET("avx2,f16c")
+void HalfToMetersAVX2(const uint16_t *In, float *Out, const size_t Pixels, const float MaxMeters)
+{
+  const __m256 Scale = _mm256_set1_ps(0.01f);
+  const __m256 Max = _mm256_set1_ps(MaxMeters);
+  size_t i = 0;
+  for (; i + 16 <= Pixels; i += 16, In += 64, Out += 16)
+  {
+    _mm256_storeu_ps(Out, _mm256_min_ps(Max, _mm256_mul_ps(_mm256_cvtph_ps(GatherRedx8AVX2(In)), Scale)));
+    _mm256_storeu_ps(Out + 8, _mm256_min_ps(Max, _mm256_mul_ps(_mm256_cvtph_ps(GatherRedx8AVX2(In + 32)), Scale)));
+  }
+  HalfToMetersSSE(In, Out, Pixels - i, MaxMeters);
+}
+
+// Converts 8 half centimeters to 8 rounded and saturated 16 bit millimeters
+CONVERSION_TARGET("avx2,f16c")
+static inline __m128i ToMillimetersAVX2(const __m128i Half, const __m256 Max)
+{
+  __m256 Value = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtph_ps(Half), _mm256_set1_ps(10.f)), _mm256_set1_ps(0.5f));
+  Value = _mm256_min_ps(_mm256_max_ps(Value, _mm256_setzero_ps()), Max);
+  const __m256i Int = _mm256_cvttps_epi32(Value);
+  return _mm_packus_epi32(_mm256_castsi256_si128(Int), _mm256_extracti128_si256(Int, 1));
+}
+
+CONVERSION_TARGET("avx2,f16c")
+void HalfToMillimetersAVX2(const uint16_t *In, uint16_t *Out, const size_t Pixels, const float MaxMillimeters)
+{
+  const __m256 Max = _mm256_set1_ps(MaxMillimeters);
+  size_t i = 0;
+  for (; i + 16 <= Pixels; i += 16, In += 64, Out += 16)
+  {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(Out), ToMillimetersAVX2(GatherRedx8AVX2(In), Max));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(Out + 8), ToMillimetersAVX2(GatherRedx8AVX2(In + 32), Max));
+  }
+  HalfToMillimetersSSE(In, Out, Pixels - i, MaxMillimeters);
+}
+#else
+void HalfToBGR8SSE(const uint16_t *In, uint8_t *Out, const size_t Pixels)
+{
+  HalfToBGR8Scalar(In, Out, Pixels);
+}
+
+void HalfToBGR8AVX2(const uint16_t *In, uint8_t *Out, const size_t Pixels)
+{
+  HalfToBGR8Scalar(In, Out, Pixels);
+}
+
+void HalfToMetersSSE(const uint16_t *In, float *Out, const size_t Pixels, const float MaxMeters)
+{
+  HalfToMetersScalar(In, Out, Pixels, MaxMeters);
+}
+
+void HalfToMetersAVX2(const uint16_t *In, float *Out, const size_t Pixels, const float MaxMeters)
+{
+  HalfToMetersScalar(In, Out, Pixels, MaxMeters);
+}
+
+void HalfToMillimetersSSE(const uint16_t *In, uint16_t *Out, const size_t Pixels, const float MaxMillimeters)
+{
+  HalfToMillimetersScalar(In, Out, Pixels, MaxMillimeters);
+}
+
+void HalfToMillimetersAVX2(const uint16_t *In, uint16_t *Out, const size_t Pixels, const float MaxMillimeters)
+{
+  HalfToMillimetersScalar(In, Out, Pixels, MaxMillimeters);
+}
+
+void BGRA8ToBGR8SSE(const uint8_t *In, uint8_t *Out, const size_t Pixels)
+{
+  BGRA8ToBGR8Scalar(In, Out, Pixels);
+}
+
+void BGRA8ToBGR8AVX2(const uint8_t *In, uint8_t *Out, const size_t Pixels)
+{
+  BGRA8ToBGR8Scalar(In, Out, Pixels);
+}
+#endif
+
+/*
+ * Runtime dispatch
+ */
+
+typedef void (*HalfToBGR8Function)(const uint16_t *, uint8_t *, const size_t);
+
+static HalfToBGR8Function SelectHalfToBGR8()
+{
+  if (HasAVX2())
+  {
+    return &HalfToBGR8AVX2;
+  }
+  if (HasF16C())
+  {
+    return &HalfToBGR8SSE;
+  }
+  return &HalfToBGR8Scalar;
+}
+
+void HalfToBGR8(const uint16_t *In, uint8_t *Out, const size_t Pixels)
+{
+  static const HalfToBGR8Function Function = SelectHalfToBGR8();
+  Function(In, Out, Pixels);
+}
+
+typedef void (*HalfToMetersFunction)(const uint16_t *, float *, const size_t, const float);
+
+static HalfToMetersFunction SelectHalfToMeters()
+{
+  if (HasAVX2())
+  {
+    return &HalfToMetersAVX2;
+  }
+  if (HasF16C())
+  {
+    return &HalfToMetersSSE;
+  }
+  return &HalfToMetersScalar;
+}
+
+void HalfToMeters(const uint16_t *In, float *Out, const size_t Pixels, const float MaxMeters)
+{
+  static const HalfToMetersFunction Function = SelectHalfToMeters();
+  Function(In, Out, Pixels, MaxMeters);
+}
+
+typedef void (*HalfToMillimetersFunction)(const uint16_t *, uint16_t *, const size_t, const float);
+
+static HalfToMillimetersFunction SelectHalfToMillimeters()
+{
+  if (HasAVX2())
+  {
+    return &HalfToMillimetersAVX2;
+  }
+  if (HasF16C())
+  {
+    return &HalfToMillimetersSSE;
+  }
+  return &HalfToMillimetersScalar;
+}
+
+void HalfToMillimeters(const uint16_t *In, uint16_t *Out, const size_t Pixels, const float MaxMillimeters)
+{
+  static const HalfToMillimetersFunction Function = SelectHalfToMillimeters();
+  Function(In, Out, Pixels, MaxMillimeters);
+}
+
+typedef void (*BGRA8ToBGR8Function)(const uint8_t *, uint8_t *, const size_t);
+
+static BGRA8ToBGR8Function SelectBGRA8ToBGR8()
+{
+  if (HasAVX2())
+  {
+    return &BGRA8ToBGR8AVX2;
+  }
+  if (HasSSE41())
+  {
+    return &BGRA8ToBGR8SSE;
+  }
+  return &BGRA8ToBGR8Scalar;
+}
+
+void BGRA8ToBGR8(const uint8_t *In, uint8_t *Out, const size_t Pixels)
+{
+  static const BGRA8ToBGR8Function Function = SelectBGRA8ToBGR8();
+  Function(In, Out, Pixels);
+}
+
+}
@@ -0,0 +1,60 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Kernels converting the data read from the Float16 render targets into the formats that are published.
+ * The input is the raw FFloat16Color data, four IEEE half floats per pixel in RGBA order, or for LDR captures
+ * the raw FColor data, four bytes per pixel in BGRA order.
+ * The vectorized half float kernels need F16C, the best one is selected at runtime through CPUID. The scalar kernels
+ * perform the same operations in the same order and therefore produce bit-identical results.
+ */
+namespace ImageConversion
+{
+  // Converts RGBA half pixels with values in [0, 1] to packed 8 bit BGR. Values are rounded to the nearest
+  // integer and saturated, NaN becomes 0.
+  void HalfToBGR8(const uint16_t *In, uint8_t *Out, const size_t Pixels);
+
+  // Converts the scene depth in centimeters from the R channel of RGBA half pixels to float meters.
+  // Values beyond MaxMeters are clamped, NaN is kept.
+  void HalfToMeters(const uint16_t *In, float *Out, const size_t Pixels, const float MaxMeters);
+
+  // Converts the scene depth in centimeters from the R channel of RGBA half pixels to 16 bit millimeters.
+  // Values are rounded to the nearest integer and saturated to [0, MaxMillimeters], NaN becomes 0.
+  // MaxMillimeters must not be larger than 65535.
+  void HalfToMillimeters(const uint16_t *In, uint16_t *Out, const size_t Pixels, const float MaxMillimeters);
+
+  // Converts float meters to 16 bit millimeters, rounded and saturated like HalfToMillimeters
+  void MetersToMillimeters(const float *In, uint16_t *Out, const size_t Pixels, const float MaxMillimeters);
+
+  // Drops the alpha channel of BGRA 8 bit pixels
+  void BGRA8ToBGR8(const uint8_t *In, uint8_t *Out, const size_t Pixels);
+
+  // The single implementations, exposed for testing and benchmarking
+  void HalfToBGR8Scalar(const uint16_t *In, uint8_t *Out, const size_t Pixels);
+  void HalfToBGR8SSE(const uint16_t *In, uint8_t *Out, const size_t Pixels);
+  void HalfToBGR8AVX2(const uint16_t *In, uint8_t *Out, const size_t Pixels);
+  void HalfToMetersScalar(const uint16_t *In, float *Out, const size_t Pixels, const float MaxMeters);
+  void HalfToMetersSSE(const uint16_t *In, float *Out, const size_t Pixels, const float MaxMeters);
+  void HalfToMetersAVX2(const uint16_t *In, float *Out, const size_t Pixels, const float MaxMeters);
+  void HalfToMillimetersScalar(const uint16_t *In, uint16_t *Out, const size_t Pixels, const float MaxMillimeters);
+  void HalfToMillimetersSSE(const uint16_t *In, uint16_t *Out, const size_t Pixels, const float MaxMillimeters);
+  void HalfToMillimetersAVX2(const uint16_t *In, uint16_t *Out, const size_t Pixels, const float MaxMillimeters);
+  void BGRA8ToBGR8Scalar(const uint8_t *In, uint8_t *Out, const size_t Pixels);
+  void BGRA8ToBGR8SSE(const uint8_t *In, uint8_t *Out, const size_t Pixels);
+  void BGRA8ToBGR8AVX2(const uint8_t *In, uint8_t *Out, const size_t Pixels);
+
+  // Smallest number of pixels that is worth converting as a separate parallel stripe
+  const size_t MinStripePixels = 1 << 16;
+
+  // CPU features detected at runtime
+  bool HasSSE41();
+  bool HasF16C();
+  bool HasAVX2();
+
+  // Exact conversion of an IEEE half float
+  float HalfToFloat(const uint16_t Half);
+}
@@ -0,0 +1,24 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <memory>
+
+#include "sensor_msgs/Image.h"
+
+/**
+ * Image message whose data points directly into a PacketBuffer slot instead of a copy. The message owns a lease
+ * of the slot, so the data stays valid for as long as the message exists, also if it is serialized asynchronously.
+ * The slot returns to the buffer once the message is destroyed.
+ */
+class LeasedImage : public ROSMessages::sensor_msgs::Image
+{
+public:
+  LeasedImage(const std::shared_ptr<const uint8> &Lease, const uint32 Offset) : Lease(Lease)
+  {
+    data = Lease.get() + Offset;
+  }
+
+private:
+  std::shared_ptr<const uint8> Lease;
+};
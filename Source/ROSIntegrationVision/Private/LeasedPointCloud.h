@@ -0,0 +1,22 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <memory>
+
+#include "sensor_msgs/PointCloud2.h"
+
+/**
+ * Point cloud message whose data points directly into a PacketBuffer slot, the same as LeasedImage.
+ */
+class LeasedPointCloud : public ROSMessages::sensor_msgs::PointCloud2
+{
+public:
+  LeasedPointCloud(const std::shared_ptr<const uint8> &Lease, const uint32 Offset) : Lease(Lease)
+  {
+    data_ptr = Lease.get() + Offset;
+  }
+
+private:
+  std::shared_ptr<const uint8> Lease;
+};
@@ -0,0 +1,171 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "OutgoingQueue.h"
+
+#include <chrono>
+
+// Seconds between the warnings about dropped messages of a topic
+static const double StatsWindow = 5.0;
+
+OutgoingQueue::State::State(const FString &Name, UTopic *Topic) :
+  Name(Name), Topic(Topic), Sending(false), Closed(false), StatsStart(FPlatformTime::Seconds()), StatsDropped(0)
+{
+  FMemory::Memzero(Stats);
+}
+
+void OutgoingQueue::State::Drain(std::unique_lock<std::mutex> &Lock)
+{
+  // Only one thread serializes the messages of the topic, it continues with the ones queued meanwhile
+  while (!Sending && !Closed && !Waiting.empty())
+  {
+    Entry Next = std::move(Waiting.front());
+    Waiting.pop_front();
+    Sending = true;
+    ++Stats.Published;
+
+    // Publish serializes the message and queues the result in the bridge, the message is released here
+    UTopic *Target = Topic;
+    Lock.unlock();
+    Target->Publish(Next.Message);
+    Next.Message.Reset();
+    Lock.lock();
+
+    Sending = false;
+    --Stats.Frames;
+    Stats.Bytes -= Next.Bytes;
+    CVSpace.notify_all();
+  }
+}
+
+void OutgoingQueue::State::Drop(const DropReason Reason)
+{
+  ++Stats.Dropped[Reason];
+  ++StatsDropped;
+
+  const double Now = FPlatformTime::Seconds();
+  if (Now - StatsStart >= StatsWindow)
+  {
+    UE_LOG(LogTemp, Warning, TEXT("%s dropped %llu messages in %.1f s, the ROS bridge falls behind. "
+                                  "In total %llu replaced by newer ones, %llu not fitting, %llu timed out."),
+           *Name, StatsDropped, Now - StatsStart, Stats.Dropped[Oldest], Stats.Dropped[Newest], Stats.Dropped[Timeout]);
+    StatsStart = Now;
+    StatsDropped = 0;
+  }
+}
+
+OutgoingQueue::OutgoingQueue(const FString &Name, UTopic *Topic, const FOutgoingQueueSettings &Settings) :
+  MaxFrames(Settings.GetTopicQueueSize()),
+  MaxBytes((uint64)(FMath::Max(Settings.MaxMegabytes, 0.f) * 1024 * 1024)),
+  Policy(Settings.Policy),
+  BlockTimeout(FMath::Max(Settings.BlockTimeout, 0.f)),
+  Shared(new State(Name, Topic))
+{
+}
+
+OutgoingQueue::~OutgoingQueue()
+{
+  Close();
+}
+
+bool OutgoingQueue::Fits(const uint64 Bytes) const
+{
+  const Statistics &Stats = Shared->Stats;
+  return Stats.Frames == 0 || (Stats.Frames < MaxFrames && (MaxBytes == 0 || Stats.Bytes + Bytes <= MaxBytes));
+}
+
+bool OutgoingQueue::Publish(TSharedPtr<FROSBaseMsg> &&Message, const uint64 Bytes)
+{
+  State &Current = *Shared;
+  std::unique_lock<std::mutex> Lock(Current.Mutex);
+  if (Current.Closed)
+  {
+    return false;
+  }
+
+  if (!Fits(Bytes))
+  {
+    switch (Policy)
+    {
+    case EQueuePolicy::DropOldest:
+      // The message being serialized cannot be taken back, so the new one is queued in any case
+      while (!Current.Waiting.empty() && !Fits(Bytes))
+      {
+        --Current.Stats.Frames;
+        Current.Stats.Bytes -= Current.Waiting.front().Bytes;
+        Current.Waiting.pop_front();
+        Current.Drop(Oldest);
+      }
+      break;
+
+    case EQueuePolicy::DropNewest:
+      Current.Drop(Newest);
+      return false;
+
+    case EQueuePolicy::Block:
+    {
+      // The waiting thread serializes the next message itself if the previous one is done
+      const auto Deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(BlockTimeout);
+      while (!Fits(Bytes) && !Current.Closed)
+      {
+        if (Current.CVSpace.wait_until(Lock, Deadline) == std::cv_status::timeout && !Fits(Bytes))
+        {
+          break;
+        }
+        Current.Drain(Lock);
+      }
+      if (Current.Closed)
+      {
+        return false;
+      }
+      if (!Fits(Bytes))
+      {
+        Current.Drop(Timeout);
+        return false;
+      }
+      break;
+    }
+    }
+  }
+
+  ++Current.Stats.Frames;
+  Current.Stats.Bytes += Bytes;
+  Current.Waiting.push_back(Entry{ MoveTemp(Message), Bytes });
+  Current.Drain(Lock);
+  return true;
+}
+
+bool OutgoingQueue::WaitForSpace(const uint64 Bytes, const double Timeout)
+{
+  State &Current = *Shared;
+  std::unique_lock<std::mutex> Lock(Current.Mutex);
+  const auto Deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(Timeout);
+  while (!Fits(Bytes) && !Current.Closed)
+  {
+    if (Current.CVSpace.wait_until(Lock, Deadline) == std::cv_status::timeout)
+    {
+      break;
+    }
+    Current.Drain(Lock);
+  }
+  return !Current.Closed && Fits(Bytes);
+}
+
+void OutgoingQueue::Close()
+{
+  std::unique_lock<std::mutex> Lock(Shared->Mutex);
+  Shared->Closed = true;
+  for (const Entry &Dropped : Shared->Waiting)
+  {
+    --Shared->Stats.Frames;
+    Shared->Stats.Bytes -= Dropped.Bytes;
+  }
+  Shared->Waiting.clear();
+  Shared->CVSpace.notify_all();
+  Shared->CVSpace.wait(Lock, [this]() { return !Shared->Sending; });
+}
+
+OutgoingQueue::Statistics OutgoingQueue::GetStatistics() const
+{
+  std::lock_guard<std::mutex> Lock(Shared->Mutex);
+  return Shared->Stats;
+}
@@ -0,0 +1,99 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include "RI/Topic.h"
+
+#include "OutgoingQueueSettings.h"
+
+/**
+ * Bounded queue of the messages of one topic in front of UTopic::Publish. Publish serializes a message right away
+ * and appends it to the send queue of the topic in the ROS bridge, which holds up to the queue size given to
+ * UTopic::Init and drops its oldest message beyond that. The topics are initialized with MaxFrames of the settings,
+ * so that the bridge keeps at most that many serialized messages per topic. In front of it, one thread at a time
+ * serializes the messages of a topic, meanwhile new messages wait in this queue, which is limited in frames and
+ * bytes. A full queue drops messages according to its policy and counts them per reason. Messages the bridge drops
+ * from its send queue are not counted.
+ * Publish may be called from any thread, but it may serialize messages and wait under Block, so the components
+ * only call it from their jobs, never from the game thread. It takes over the message, the caller must not keep a reference to it, as
+ * the reference counts of TSharedPtr are not atomic and the message is released by the thread serializing it.
+ */
+class ROSINTEGRATIONVISION_API OutgoingQueue
+{
+public:
+  enum DropReason
+  {
+    Oldest,  // Replaced by a newer message under DropOldest
+    Newest,  // Did not fit under DropNewest
+    Timeout, // Did not fit within the timeout under Block
+    NumReasons
+  };
+
+  struct Statistics
+  {
+    uint32 Frames; // Messages waiting or being serialized
+    uint64 Bytes;
+    uint64 Published;
+    uint64 Dropped[NumReasons];
+  };
+
+private:
+  struct Entry
+  {
+    TSharedPtr<FROSBaseMsg> Message;
+    uint64 Bytes;
+  };
+
+  struct State
+  {
+    std::mutex Mutex;
+    std::condition_variable CVSpace;
+    const FString Name;
+    UTopic *Topic;
+    std::deque<Entry> Waiting;
+    Statistics Stats;
+    // Whether a thread is serializing a message of the topic
+    bool Sending, Closed;
+    // Messages dropped since the last warning
+    double StatsStart;
+    uint64 StatsDropped;
+
+    State(const FString &Name, UTopic *Topic);
+    void Drain(std::unique_lock<std::mutex> &Lock);
+    void Drop(const DropReason Reason);
+  };
+
+  const uint32 MaxFrames;
+  const uint64 MaxBytes;
+  const EQueuePolicy Policy;
+  const double BlockTimeout;
+  std::unique_ptr<State> Shared;
+
+  bool Fits(const uint64 Bytes) const;
+
+public:
+  // Name of the topic for the log, Topic has to be initialized with GetTopicQueueSize of the settings
+  OutgoingQueue(const FString &Name, UTopic *Topic, const FOutgoingQueueSettings &Settings);
+
+  // Closes the queue
+  ~OutgoingQueue();
+
+  // Serializes Message or queues it, Bytes is its approximate size. Returns false if it was dropped.
+  bool Publish(TSharedPtr<FROSBaseMsg> &&Message, const uint64 Bytes);
+
+  // Waits up to Timeout seconds until a message of Bytes fits without dropping anything, for producers that can
+  // hold back their messages instead. Returns false on timeout or if the queue is closed.
+  bool WaitForSpace(const uint64 Bytes, const double Timeout);
+
+  // Drops the waiting messages and waits for the message being serialized, nothing is published afterwards
+  void Close();
+
+  Statistics GetStatistics() const;
+};
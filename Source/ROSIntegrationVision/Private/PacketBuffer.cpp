@@ -2,73 +2,231 @@
 
 #include "PacketBuffer.h"
 
-PacketBuffer::PacketBuffer(const uint32 Width, const uint32 Height, const uint32 Bytes, const float FieldOfView) :
-  IsDataReadable(false), SizeHeader(sizeof(PacketHeader)), SizeImage(Width * Height * Bytes * sizeof(uint8)),
-  OffsetImage(SizeHeader), Size(SizeHeader + SizeImage)
+void PacketBuffer::Shared::Notify()
 {
-  ReadBuffer.resize(Size);
-  WriteBuffer.resize(Size);
+  // Pairs with the fence in Wait: either the waiter sees the new state, or this sees the waiter and wakes it up
+  // under the mutex it holds from its check until it sleeps
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (Waiters.load(std::memory_order_relaxed) > 0)
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    CVState.notify_all();
+  }
+}
+
+void PacketBuffer::Shared::Wait(const std::function<bool()> &Done)
+{
+  std::unique_lock<std::mutex> Lock(Mutex);
+  Waiters.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  while (!Done())
+  {
+    CVState.wait(Lock);
+  }
+  Waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+PacketBuffer::PacketBuffer(const uint32 Width, const uint32 Height, const uint32 Bytes, const float FieldOfView,
+                           const uint32 NumSlots, const Policy DropPolicy, const uint32 SizeExtra) :
+  State(new Shared()), Slots(nullptr), NumSlots(NumSlots),
+  DropPolicy(DropPolicy), WriteSlot(0), WriteSequence(0), ReadSlot(0), ReadSequence(0), Released(false), Dropped(0),
+  SizeHeader(sizeof(PacketHeader)), SizeImage(Width * Height * Bytes * sizeof(uint8) + SizeExtra), OffsetImage(SizeHeader), Size(SizeHeader + SizeImage)
+{
+  check(NumSlots >= 3);
+  State->Slots.reset(new Slot[NumSlots]);
+  State->Waiters.store(0, std::memory_order_relaxed);
+  Slots = State->Slots.get();
 
   // Create relative FOV for each axis
   const float FOVX = Height > Width ? FieldOfView * Width / Height : FieldOfView;
   const float FOVY = Width > Height ? FieldOfView * Height / Width : FieldOfView;
 
   // Setting header information that do not change
-  HeaderRead = reinterpret_cast<PacketHeader*>(&ReadBuffer[0]);
-  HeaderRead->Size = Size;
-  HeaderRead->SizeHeader = SizeHeader;
-  HeaderRead->Width = Width;
-  HeaderRead->Height = Height;
-  HeaderRead->Bytes = Bytes;
-  HeaderRead->FieldOfViewX = FOVX;
-  HeaderRead->FieldOfViewY = FOVY;
-
-  HeaderWrite = reinterpret_cast<PacketHeader*>(&WriteBuffer[0]);
-  HeaderWrite->Size = Size;
-  HeaderWrite->SizeHeader = SizeHeader;
-  HeaderWrite->Width = Width;
-  HeaderWrite->Height = Height;
-  HeaderWrite->Bytes = Bytes;
-  HeaderWrite->FieldOfViewX = FOVX;
-  HeaderWrite->FieldOfViewY = FOVY;
-
-  // Setting the pointers to the data
-  Image = &WriteBuffer[OffsetImage];
-  Read = &ReadBuffer[0];
-
-  IsDataReadable = false;
+  for (uint32 i = 0; i < NumSlots; ++i)
+  {
+    Slot &Current = Slots[i];
+    Current.Data.resize(Size);
+    Current.State.store(Free, std::memory_order_relaxed);
+    Current.Sequence.store(0, std::memory_order_relaxed);
+
+    PacketHeader *Header = reinterpret_cast<PacketHeader*>(&Current.Data[0]);
+    Header->Size = Size;
+    Header->SizeHeader = SizeHeader;
+    Header->Width = Width;
+    Header->Height = Height;
+    Header->Bytes = Bytes;
+    Header->FieldOfViewX = FOVX;
+    Header->FieldOfViewY = FOVY;
+    Header->Points = 0;
+    Header->Contents = 0;
+    Header->ClockCapture = 0;
+  }
+
+  // The writer starts with the first slot, the reader has none until StartReading
+  Slots[0].State.store(Writing, std::memory_order_relaxed);
+  Image = &Slots[0].Data[OffsetImage];
+  HeaderWrite = reinterpret_cast<PacketHeader*>(&Slots[0].Data[0]);
+  Read = &Slots[1].Data[0];
+  HeaderRead = reinterpret_cast<PacketHeader*>(&Slots[1].Data[0]);
+}
+
+bool PacketBuffer::TryAcquireWriteSlot()
+{
+  while (true)
+  {
+    // Prefer free slots
+    for (uint32 i = 1; i <= NumSlots; ++i)
+    {
+      const uint32 Index = (WriteSlot + i) % NumSlots;
+      uint8 Expected = Free;
+      if (Slots[Index].State.compare_exchange_strong(Expected, Writing, std::memory_order_acq_rel))
+      {
+        WriteSlot = Index;
+        return true;
+      }
+    }
+
+    // Reuse the oldest unread packet. Only the writer sets slots to Ready, so a slot found here can only be
+    // taken away by the reader in the meantime, which lets the exchange fail.
+    if (DropPolicy == Policy::LatestWins || Released.load(std::memory_order_acquire))
+    {
+      int32 Oldest = -1;
+      uint64_t OldestSequence = 0;
+      for (uint32 i = 0; i < NumSlots; ++i)
+      {
+        const uint64_t Sequence = Slots[i].Sequence.load(std::memory_order_relaxed);
+        if (Slots[i].State.load(std::memory_order_relaxed) == Ready && (Oldest < 0 || Sequence < OldestSequence))
+        {
+          Oldest = i;
+          OldestSequence = Sequence;
+        }
+      }
+
+      if (Oldest >= 0)
+      {
+        uint8 Expected = Ready;
+        if (Slots[Oldest].State.compare_exchange_strong(Expected, Writing, std::memory_order_acq_rel))
+        {
+          Dropped.fetch_add(1, std::memory_order_relaxed);
+          WriteSlot = Oldest;
+          return true;
+        }
+        // The reader took it meanwhile, so look again
+        continue;
+      }
+    }
+    return false;
+  }
+}
+
+void PacketBuffer::AcquireWriteSlot()
+{
+  // Waits for the reader or a lease to return a slot
+  if (!TryAcquireWriteSlot())
+  {
+    State->Wait([this]() { return TryAcquireWriteSlot(); });
+  }
 }
 
 void PacketBuffer::DoneWriting()
 {
-  // Swapping buffers
-  LockBuffer.lock();
-  IsDataReadable = true;
-  WriteBuffer.swap(ReadBuffer);
-  Image = &WriteBuffer[OffsetImage];
-  Read = &ReadBuffer[0];
-  HeaderRead = reinterpret_cast<PacketHeader*>(&ReadBuffer[0]);
-  HeaderWrite = reinterpret_cast<PacketHeader*>(&WriteBuffer[0]);
-  LockBuffer.unlock();
-  CVWait.notify_one();
+  // The next slot is acquired before the completed one is handed over, so the reader always finds the
+  // pointers to the new writing slot updated once it acquired the completed packet.
+  Slot &Completed = Slots[WriteSlot];
+  AcquireWriteSlot();
+  Image = &Slots[WriteSlot].Data[OffsetImage];
+  HeaderWrite = reinterpret_cast<PacketHeader*>(&Slots[WriteSlot].Data[0]);
+
+  Completed.Sequence.store(++WriteSequence, std::memory_order_relaxed);
+  Completed.State.store(Ready, std::memory_order_release);
+  State->Notify();
 }
 
-void PacketBuffer::StartReading()
+bool PacketBuffer::StartReading()
 {
-  // Waits until writing is done
-  std::unique_lock<std::mutex> WaitLock(LockRead);
-  CVWait.wait(WaitLock, [this] { return IsDataReadable; });
-  LockBuffer.lock();
+  // Waits until writing is done. Released is checked before looking for packets, so that packets completed before
+  // Release are still read.
+  bool Acquired = false;
+  const auto Done = [this, &Acquired]()
+  {
+    const bool WasReleased = Released.load(std::memory_order_acquire);
+    Acquired = TryStartReading();
+    return Acquired || WasReleased;
+  };
+  if (!Done())
+  {
+    State->Wait(Done);
+  }
+  return Acquired;
+}
+
+bool PacketBuffer::TryStartReading()
+{
+  while (true)
+  {
+    // Newest packet that was not read yet (LatestWins) or exactly the next one (NeverDrop), the slots are not
+    // scanned atomically and a newer packet might be completed while the scan already passed an older one.
+    // Older packets skipped by LatestWins stay Ready until the writer reuses them.
+    int32 Next = -1;
+    uint64_t NextSequence = 0;
+    for (uint32 i = 0; i < NumSlots; ++i)
+    {
+      if (Slots[i].State.load(std::memory_order_acquire) != Ready)
+      {
+        continue;
+      }
+      const uint64_t Sequence = Slots[i].Sequence.load(std::memory_order_relaxed);
+      if (DropPolicy == Policy::LatestWins ? Sequence > ReadSequence && (Next < 0 || Sequence > NextSequence)
+                                           : Sequence == ReadSequence + 1)
+      {
+        Next = i;
+        NextSequence = Sequence;
+      }
+    }
+
+    if (Next < 0)
+    {
+      return false;
+    }
+
+    // Fails if the writer reused the slot in the meantime, it completes a newer packet then
+    uint8 Expected = Ready;
+    if (Slots[Next].State.compare_exchange_strong(Expected, Reading, std::memory_order_acq_rel))
+    {
+      // The slot might have been reused and completed again before the exchange, so its sequence is read again
+      ReadSlot = Next;
+      ReadSequence = Slots[Next].Sequence.load(std::memory_order_relaxed);
+      Read = &Slots[Next].Data[0];
+      HeaderRead = reinterpret_cast<PacketHeader*>(&Slots[Next].Data[0]);
+      return true;
+    }
+  }
 }
 
 void PacketBuffer::DoneReading()
 {
-  IsDataReadable = false;
-  LockBuffer.unlock();
+  Slots[ReadSlot].State.store(Free, std::memory_order_release);
+  State->Notify();
+}
+
+std::shared_ptr<const uint8> PacketBuffer::LeaseRead()
+{
+  std::shared_ptr<Shared> Owner = State;
+  Slot *Leased = &Slots[ReadSlot];
+  return std::shared_ptr<const uint8>(Read, [Owner, Leased](const uint8*)
+  {
+    Leased->State.store(Free, std::memory_order_release);
+    Owner->Notify();
+  });
 }
 
 void PacketBuffer::Release()
 {
-  IsDataReadable = true;
-  CVWait.notify_one();
+  Released.store(true, std::memory_order_release);
+  State->Notify();
+}
+
+uint64_t PacketBuffer::GetDropped() const
+{
+  return Dropped.load(std::memory_order_relaxed);
 }
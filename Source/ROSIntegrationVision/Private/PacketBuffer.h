@@ -2,23 +2,39 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <vector>
-#include <condition_variable>
 
 /**
- * This is a double buffer, one for reading and one for writing. When writing is done they will be swapped.
+ * This is a lock-free ring of packet slots between exactly one writing and one reading thread. The writer always
+ * owns one slot (Image, HeaderWrite) and hands it over with DoneWriting. StartReading acquires a completed slot
+ * (Read, HeaderRead) and DoneReading returns it to the ring, or LeaseRead hands it over to a reference counted lease
+ * that returns it once the last owner is gone. Slots change hands through atomic state transitions. A thread that
+ * has to wait for a slot sleeps on a condition variable, which the others only lock while somebody waits.
  * It also acts as the connection between VisionActor and Server. The StartReading method is blocking until
- * the DoneWriting method is called. So when the VisionActor is done writing, the StartReading methods returns
+ * a packet is completed, so when the VisionActor is done writing, the StartReading methods returns
  * and the Server will start reading and sending the packet.
  */
 class ROSINTEGRATIONVISION_API PacketBuffer
 {
 public:
+  enum class Policy
+  {
+    // The writer never waits, if no slot is free the oldest unread packet is dropped. The reader gets the newest packet.
+    LatestWins,
+    // The writer waits for a free slot and the reader gets every packet in order
+    NeverDrop
+  };
+
   /**
    * packet format:
    * - PacketHeader
    * - Image data (width * height * Bytes (Float16 / BGR))
+   * - SizeExtra bytes of further data, like a point cloud
    */
 
   struct Vector
@@ -51,16 +67,61 @@ public:
 
     Vector Translation;  // Translation of the camera for current frame
     Quaternion Rotation; // Rotation of the camera for current frame
+
+    uint32_t Points;     // Number of points in the extra data, if it holds a point cloud
+    uint32_t Contents;   // Bit mask of the parts the component converted into the packet, if it skips some
+    uint64_t ClockCapture; // StopTime::Timestamp at capture for the stage latencies, 0 without stage timing
   };
 
 private:
-  std::vector<uint8> ReadBuffer, WriteBuffer;
-  bool IsDataReadable;
-  std::mutex LockBuffer, LockRead;
-  std::condition_variable CVWait;
+  enum SlotState : uint8
+  {
+    Free,
+    Writing,
+    Ready,
+    Reading
+  };
+
+  struct Slot
+  {
+    std::vector<uint8> Data;
+    std::atomic<uint8> State;
+    std::atomic<uint64_t> Sequence; // Number of the packet, increasing with every DoneWriting
+  };
+
+  // Shared with the leases, so that leased slots stay valid even if the buffer is destroyed before them
+  struct Shared
+  {
+    std::unique_ptr<Slot[]> Slots;
+    // Threads waiting for a slot, woken up by every state change that may let them continue
+    std::mutex Mutex;
+    std::condition_variable CVState;
+    std::atomic<uint32> Waiters;
+
+    // Called after a state change, wakes up the waiting threads if there are any
+    void Notify();
+    // Waits until Done returns true, it is checked again after every state change
+    void Wait(const std::function<bool()> &Done);
+  };
+
+  std::shared_ptr<Shared> State;
+  Slot *Slots;
+  const uint32 NumSlots;
+  const Policy DropPolicy;
+  // Only accessed by the writer
+  uint32 WriteSlot;
+  uint64_t WriteSequence;
+  // Only accessed by the reader
+  uint32 ReadSlot;
+  uint64_t ReadSequence;
+  std::atomic<bool> Released;
+  std::atomic<uint64_t> Dropped;
+
+  bool TryAcquireWriteSlot();
+  void AcquireWriteSlot();
 
 public:
-  // Sizes of the Header, the image data
+  // Sizes of the Header, the image data including the extra data
   const uint32 SizeHeader, SizeImage;
   // Offsets for the image in the packet buffer
   const uint32 OffsetImage;
@@ -71,18 +132,33 @@ public:
   // Pointer to the packet headers
   PacketHeader *HeaderWrite, *HeaderRead;
 
-  // Initializes the buffer, widht and height are not changeable afterwards
-  PacketBuffer(const uint32 Width, const uint32 Height, const uint32 Bytes, const float FieldOfView);
+  // Initializes the buffer, widht and height are not changeable afterwards.
+  // At least 3 slots are needed, so that the writer and the reader each own one while another one is completed.
+  PacketBuffer(const uint32 Width, const uint32 Height, const uint32 Bytes, const float FieldOfView,
+               const uint32 NumSlots = 3, const Policy DropPolicy = Policy::LatestWins, const uint32 SizeExtra = 0);
 
-  // Swaps reading and writing buffer and unblocks the reading thread
+  // Completes the packet of the writing slot and moves the writer on to the next slot
   void DoneWriting();
 
-  // Waits until the reading buffer is valid and locks it.
-  void StartReading();
+  // Waits until a completed packet is available and acquires its slot for reading.
+  // Returns false if the buffer was released and no packet is left.
+  bool StartReading();
+
+  // Acquires a completed packet like StartReading, but returns false right away if there is none
+  bool TryStartReading();
 
-  // Unlocks the reading buffer
+  // Returns the reading slot to the ring
   void DoneReading();
 
-  // Releases the lock so that StartReading will return, this is needed to stop the server in the end.
+  // Instead of DoneReading, hands the reading slot over to a lease pointing at Read. The slot is returned to the
+  // ring when the last copy of the lease is destroyed, which may happen on any thread. StartReading can be called
+  // again right away. As long as leases are held, their slots are not available to the writer.
+  std::shared_ptr<const uint8> LeaseRead();
+
+  // Lets StartReading return false instead of waiting and the writer drop packets instead of waiting,
+  // this is needed to stop the server in the end.
   void Release();
+
+  // Number of packets that were overwritten before they were read
+  uint64_t GetDropped() const;
 };
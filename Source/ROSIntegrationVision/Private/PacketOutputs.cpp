@@ -0,0 +1,252 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "PacketOutputs.h"
+
+#include "Misc/Paths.h"
+
+#include "PacketServer.h"
+#include "SharedFrameRing.h"
+
+namespace
+{
+  FString InSavedDir(const FString &Path)
+  {
+    return FPaths::ConvertRelativePathToFull(FPaths::IsRelative(Path) ? FPaths::ProjectSavedDir() / Path : Path);
+  }
+}
+
+PacketOutputs::PacketOutputs(const FString &_Name, const Publisher &_PublishMessages, const Throttle &_WaitForSpace) :
+  Name(_Name), PublishMessages(_PublishMessages), WaitForSpace(_WaitForSpace), Replaying(false), Consumed(false),
+  ReplaySpeed(1), ReplayLoop(false), ReplayFrame(0), ReplayPublished(0), ReplaySeconds(0)
+{
+}
+
+PacketOutputs::~PacketOutputs()
+{
+  StopReplay();
+  Close();
+}
+
+const CaptureLog::FileHeader *PacketOutputs::OpenReplay(const FString &Path)
+{
+  ReplayPath = InSavedDir(Path);
+  ReplayLog = MakeShareable(new CaptureLogReader());
+  if (!ReplayLog->Open(TCHAR_TO_UTF8(*ReplayPath)))
+  {
+    ReplayLog.Reset();
+    return nullptr;
+  }
+  return ReplayLog->GetHeader();
+}
+
+void PacketOutputs::CloseReplay()
+{
+  StopReplay();
+  ReplayLog.Reset();
+}
+
+const CaptureLogReader *PacketOutputs::GetReplay() const
+{
+  return ReplayLog.Get();
+}
+
+void PacketOutputs::Open(const Settings &Outputs, const CaptureLog::FileHeader &Description)
+{
+  if (!Outputs.SharedMemoryName.IsEmpty())
+  {
+    SharedFrames = MakeShareable(new SharedFrameWriter());
+    if (!SharedFrames->Open(TCHAR_TO_UTF8(*Outputs.SharedMemoryName), FMath::Max(Outputs.SharedMemorySlots, 2),
+                            Description.PacketSize, Description.OffsetImage, Description.Width, Description.Height,
+                            Description.Bytes, Description.Encoding))
+    {
+      UE_LOG(LogTemp, Warning, TEXT("%s could not create the shared memory %s, is another writer using the name?"), *Name, *Outputs.SharedMemoryName);
+      SharedFrames.Reset();
+    }
+  }
+  if (Outputs.EnableServer)
+  {
+    Server = MakeShareable(new PacketServer());
+    if (!Server->Start((uint16)Outputs.ServerPort))
+    {
+      UE_LOG(LogTemp, Warning, TEXT("%s could not listen on port %d."), *Name, Outputs.ServerPort);
+      Server.Reset();
+    }
+  }
+  if (!Outputs.RecordPath.IsEmpty() && !ReplayLog.IsValid())
+  {
+    const FString Path = InSavedDir(Outputs.RecordPath);
+    Recorder = MakeShareable(new FrameRecorder());
+    if (!Recorder->Open(TCHAR_TO_UTF8(*Path), Description))
+    {
+      UE_LOG(LogTemp, Warning, TEXT("%s could not create the capture log %s."), *Name, *Path);
+      Recorder.Reset();
+    }
+  }
+}
+
+void PacketOutputs::StartReplay(const float Speed, const bool Loop)
+{
+  if (!ReplayLog.IsValid() || ReplayThread.joinable())
+  {
+    return;
+  }
+  ReplaySpeed = FMath::Max(Speed, 0.f);
+  ReplayLoop = Loop;
+  ReplayFrame = 0;
+  ReplayPublished = 0;
+  ReplaySeconds = 0;
+  Consumed = false;
+  Replaying = ReplayLog->GetNumFrames() > 0;
+  UE_LOG(LogTemp, Log, TEXT("%s replays %llu frames of %s."), *Name, (unsigned long long)ReplayLog->GetNumFrames(), *ReplayPath);
+  if (Replaying)
+  {
+    ReplayThread = std::thread([this]() { Replay(); });
+  }
+}
+
+void PacketOutputs::SetConsumed(const bool IsConsumed)
+{
+  // Set under the lock, so that the replay thread cannot miss it between checking and waiting
+  std::lock_guard<std::mutex> Lock(ReplayMutex);
+  Consumed = IsConsumed;
+  ReplayWake.notify_one();
+}
+
+void PacketOutputs::Replay()
+{
+  // Publishes the frames of the log, the messages lease the packets straight from the mapping. A frame is due at
+  // the time it was captured relative to the first one divided by ReplaySpeed, with ReplaySpeed 0 as soon as
+  // WaitForSpace lets it through. While nobody takes the frames the thread waits, and continues with the frame after
+  // the last one published.
+  const CaptureLogReader &Log = *ReplayLog;
+  const uint64 NumFrames = Log.GetNumFrames();
+  std::unique_lock<std::mutex> Lock(ReplayMutex);
+  while (Replaying)
+  {
+    if (!Consumed)
+    {
+      ReplayWake.wait(Lock, [this]() { return Consumed || !Replaying; });
+      continue;
+    }
+    Lock.unlock();
+
+    const double Start = FPlatformTime::Seconds();
+    double LoopStart = Start;
+    if (ReplaySpeed > 0)
+    {
+      LoopStart -= (int64)(Log.GetTimestamp(ReplayFrame) - Log.GetTimestamp(0)) / 1e9 / ReplaySpeed;
+    }
+    while (Replaying && Consumed)
+    {
+      if (ReplaySpeed > 0)
+      {
+        const double Due = LoopStart + (int64)(Log.GetTimestamp(ReplayFrame) - Log.GetTimestamp(0)) / 1e9 / ReplaySpeed;
+        for (double Now = FPlatformTime::Seconds(); Now < Due && Replaying && Consumed; Now = FPlatformTime::Seconds())
+        {
+          FPlatformProcess::Sleep(FMath::Min(Due - Now, 0.01));
+        }
+      }
+      else
+      {
+        while (Replaying && Consumed && !WaitForSpace(0.1))
+        {
+        }
+      }
+      if (!Replaying || !Consumed)
+      {
+        break;
+      }
+
+      Publish(Log.Lease(ReplayFrame), false);
+      ++ReplayPublished;
+      if (++ReplayFrame == NumFrames)
+      {
+        if (!ReplayLoop)
+        {
+          Replaying = false;
+          break;
+        }
+        ReplayFrame = 0;
+        LoopStart = FPlatformTime::Seconds();
+      }
+    }
+    ReplaySeconds += FPlatformTime::Seconds() - Start;
+
+    Lock.lock();
+  }
+}
+
+bool PacketOutputs::HasConsumers() const
+{
+  return SharedFrames.IsValid() || Recorder.IsValid() || (Server.IsValid() && Server->GetNumClients() > 0);
+}
+
+void PacketOutputs::Publish(const std::shared_ptr<const uint8> &Lease, const bool Record)
+{
+  // The log gets the packet before anything else holds it, replayed packets are not recorded again
+  if (Record && Recorder.IsValid())
+  {
+    Recorder->Write(Lease.get());
+  }
+
+  const PacketBuffer::PacketHeader &Header = *reinterpret_cast<const PacketBuffer::PacketHeader*>(Lease.get());
+  const FROSTime Time(Header.TimestampCapture / 1000000000, Header.TimestampCapture % 1000000000);
+
+  // Readers on the same host get a copy of the whole packet
+  if (SharedFrames.IsValid())
+  {
+    SharedFrames->Write(Lease.get());
+  }
+  if (Server.IsValid() && Server->GetNumClients() > 0)
+  {
+    Server->Send(Lease);
+  }
+
+  PublishMessages(Lease, Time);
+}
+
+void PacketOutputs::StopReplay()
+{
+  // The thread stops within one frame or WaitForSpace timeout
+  {
+    std::lock_guard<std::mutex> Lock(ReplayMutex);
+    Replaying = false;
+    ReplayWake.notify_one();
+  }
+  if (!ReplayThread.joinable())
+  {
+    return;
+  }
+  ReplayThread.join();
+
+  const CaptureLog::FileHeader &Header = *ReplayLog->GetHeader();
+  const double FrameBytes = (double)Header.Width * Header.Height * Header.Bytes;
+  UE_LOG(LogTemp, Log, TEXT("%s replayed %llu frames at %.1f frames/s, %.1f MB/s."), *Name,
+    (unsigned long long)ReplayPublished, ReplaySeconds > 0 ? ReplayPublished / ReplaySeconds : 0.0,
+    ReplaySeconds > 0 ? ReplayPublished * FrameBytes / ReplaySeconds / (1024 * 1024) : 0.0);
+}
+
+void PacketOutputs::Close()
+{
+  ReplayLog.Reset();
+
+  // Readers see the ring closed, the shared memory object is removed
+  SharedFrames.Reset();
+  if (Recorder.IsValid())
+  {
+    // Writes out the staging buffers and the index
+    Recorder->Close();
+    const FrameRecorder::Statistics Stats = Recorder->GetStatistics();
+    UE_LOG(LogTemp, Log, TEXT("%s recorded %llu frames, %.1f MB at %.1f MB/s, %llu were dropped%s."), *Name,
+      (unsigned long long)Stats.Frames, Stats.Bytes / (1024.0 * 1024.0),
+      Stats.WriteSeconds > 0 ? Stats.Bytes / Stats.WriteSeconds / (1024.0 * 1024.0) : 0.0,
+      (unsigned long long)Stats.Dropped, Stats.Failed ? TEXT(", writing failed") : TEXT(""));
+    Recorder.Reset();
+  }
+  if (Server.IsValid())
+  {
+    UE_LOG(LogTemp, Log, TEXT("%s sent %llu packets to TCP clients, %llu were dropped."), *Name,
+      (unsigned long long)Server->GetSent(), (unsigned long long)Server->GetDropped());
+    Server.Reset();
+  }
+}
@@ -0,0 +1,112 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "ROSTime.h"
+
+#include "FrameRecorder.h"
+#include "PacketBuffer.h"
+
+class PacketServer;
+class SharedFrameWriter;
+
+/**
+ * Outputs of the packets of the color and the depth component next to their topics: the shared memory ring, the
+ * TCP server and the capture log, and the replay of a capture log instead of the rendered frames. Every packet is
+ * published through Publish, which hands it to these outputs and to the Publisher of the component for the topics.
+ * The replay runs on its own thread, as it sleeps until its frames are due or the topics take them and would hold up
+ * a worker of the pool meanwhile. It pauses while no output takes the frames and continues with the next frame
+ * when they are back.
+ * Publish is called from the publishing jobs and the replay, all other methods from the game thread.
+ */
+class ROSINTEGRATIONVISION_API PacketOutputs
+{
+public:
+  // Publishes the messages of a packet to the topics of the component, stamped with the time of its capture
+  typedef std::function<void(const std::shared_ptr<const uint8> &Lease, const FROSTime &Time)> Publisher;
+
+  // Waits up to Timeout seconds until the topics take another frame, paces a replay at full speed. Returns false
+  // on timeout.
+  typedef std::function<bool(const double Timeout)> Throttle;
+
+  struct Settings
+  {
+    FString SharedMemoryName; // Empty disables the shared memory ring
+    int32 SharedMemorySlots;
+    bool EnableServer;
+    int32 ServerPort;
+    FString RecordPath;       // Empty disables recording, relative paths are in the Saved directory of the project
+  };
+
+private:
+  const FString Name;
+  const Publisher PublishMessages;
+  const Throttle WaitForSpace;
+  TSharedPtr<SharedFrameWriter> SharedFrames;
+  TSharedPtr<PacketServer> Server;
+  TSharedPtr<FrameRecorder> Recorder;
+
+  TSharedPtr<CaptureLogReader> ReplayLog;
+  FString ReplayPath;
+  std::thread ReplayThread;
+  // Wakes the paused replay thread
+  std::mutex ReplayMutex;
+  std::condition_variable ReplayWake;
+  // Whether the replay has frames left and whether any output takes them as of the last tick
+  std::atomic<bool> Replaying, Consumed;
+  float ReplaySpeed;
+  bool ReplayLoop;
+  // Only accessed by the replay thread while it runs: the next frame, and the published frames and time spent for
+  // the statistics
+  uint64 ReplayFrame;
+  uint64 ReplayPublished;
+  double ReplaySeconds;
+
+  void Replay();
+
+public:
+  // Name of the component for the log
+  PacketOutputs(const FString &Name, const Publisher &PublishMessages, const Throttle &WaitForSpace);
+
+  // Stops the replay and closes the outputs
+  ~PacketOutputs();
+
+  // Maps the capture log Path for a replay, relative paths are in the Saved directory of the project. Returns its
+  // header, or nullptr if it could not be opened. A log the component cannot publish is closed with CloseReplay.
+  const CaptureLog::FileHeader *OpenReplay(const FString &Path);
+  void CloseReplay();
+
+  // Mapped capture log, nullptr without a replay
+  const CaptureLogReader *GetReplay() const;
+
+  // Creates the outputs of Outputs for packets described by Description and warns about the ones that failed.
+  // Nothing is recorded during a replay.
+  void Open(const Settings &Outputs, const CaptureLog::FileHeader &Description);
+
+  // Starts the replay thread for the mapped log, ReplaySpeed 0 publishes the frames as fast as WaitForSpace allows
+  void StartReplay(const float Speed, const bool Loop);
+
+  // Whether any output takes the frames as of this tick, a replay only publishes while they do
+  void SetConsumed(const bool IsConsumed);
+
+  // Whether the shared memory ring, the capture log or a TCP client take the packets
+  bool HasConsumers() const;
+
+  // Appends the packet to the capture log if Record is set, then hands it to the outputs and to the topics
+  void Publish(const std::shared_ptr<const uint8> &Lease, const bool Record);
+
+  // Stops the replay and joins its thread. Leases of replayed frames keep the log mapped.
+  void StopReplay();
+
+  // Closes the outputs and logs their statistics, once no publishing job of the component runs anymore
+  void Close();
+};
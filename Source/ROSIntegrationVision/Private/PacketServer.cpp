@@ -0,0 +1,405 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "PacketServer.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#if defined(__linux__)
+  #include <arpa/inet.h>
+  #include <netinet/in.h>
+  #include <netinet/tcp.h>
+  #include <sys/epoll.h>
+  #include <sys/eventfd.h>
+  #include <sys/socket.h>
+  #include <unistd.h>
+  #define PACKET_SERVER_SUPPORTED 1
+#else
+  #define PACKET_SERVER_SUPPORTED 0
+#endif
+
+PacketServer::PacketServer() : Listener(-1), Epoll(-1), Wakeup(-1), Port(0), Running(false), Sequence(0),
+  NumClients(0), Sent(0), Dropped(0)
+{
+}
+
+PacketServer::~PacketServer()
+{
+  Stop();
+}
+
+bool PacketServer::Start(const uint16_t _Port)
+{
+  Stop();
+#if PACKET_SERVER_SUPPORTED
+  Listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  Epoll = epoll_create1(EPOLL_CLOEXEC);
+  Wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (Listener < 0 || Epoll < 0 || Wakeup < 0)
+  {
+    Stop();
+    return false;
+  }
+
+  const int Reuse = 1;
+  setsockopt(Listener, SOL_SOCKET, SO_REUSEADDR, &Reuse, sizeof(Reuse));
+  sockaddr_in Address;
+  std::memset(&Address, 0, sizeof(Address));
+  Address.sin_family = AF_INET;
+  Address.sin_addr.s_addr = htonl(INADDR_ANY);
+  Address.sin_port = htons(_Port);
+  socklen_t AddressSize = sizeof(Address);
+  if (bind(Listener, reinterpret_cast<sockaddr*>(&Address), sizeof(Address)) != 0 || listen(Listener, 16) != 0 ||
+      getsockname(Listener, reinterpret_cast<sockaddr*>(&Address), &AddressSize) != 0)
+  {
+    Stop();
+    return false;
+  }
+  Port = ntohs(Address.sin_port);
+
+  epoll_event Event;
+  Event.events = EPOLLIN;
+  Event.data.fd = Listener;
+  epoll_ctl(Epoll, EPOLL_CTL_ADD, Listener, &Event);
+  Event.data.fd = Wakeup;
+  epoll_ctl(Epoll, EPOLL_CTL_ADD, Wakeup, &Event);
+
+  Running = true;
+  Thread = std::thread(&PacketServer::Run, this);
+  return true;
+#else
+  return false;
+#endif
+}
+
+void PacketServer::Stop()
+{
+#if PACKET_SERVER_SUPPORTED
+  Running = false;
+  if (Thread.joinable())
+  {
+    const uint64_t One = 1;
+    (void)!write(Wakeup, &One, sizeof(One));
+    Thread.join();
+  }
+
+  for (auto &Entry : Clients)
+  {
+    close(Entry.first);
+  }
+  for (int *Socket : { &Listener, &Epoll, &Wakeup })
+  {
+    if (*Socket >= 0)
+    {
+      close(*Socket);
+      *Socket = -1;
+    }
+  }
+#endif
+  Clients.clear();
+  Latest.reset();
+  Previous.reset();
+  {
+    std::lock_guard<std::mutex> Lock(PendingLock);
+    Pending.reset();
+  }
+  NumClients = 0;
+  Port = 0;
+}
+
+void PacketServer::Send(const std::shared_ptr<const uint8> &Packet)
+{
+#if PACKET_SERVER_SUPPORTED
+  if (!Running.load(std::memory_order_relaxed))
+  {
+    return;
+  }
+
+  // Only the header is copied, it gets the sending time as wall clock in nanoseconds. The image is sent from the lease.
+  std::shared_ptr<Frame> Next(new Frame());
+  std::memcpy(&Next->Header, Packet.get(), sizeof(Next->Header));
+  Next->Header.TimestampSent = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  Next->Packet = Packet;
+  {
+    std::lock_guard<std::mutex> Lock(PendingLock);
+    Next->Sequence = ++Sequence;
+    Pending = Next;
+  }
+  const uint64_t One = 1;
+  (void)!write(Wakeup, &One, sizeof(One));
+#endif
+}
+
+void PacketServer::Run()
+{
+#if PACKET_SERVER_SUPPORTED
+  epoll_event Events[64];
+  while (Running.load(std::memory_order_acquire))
+  {
+    const int Count = epoll_wait(Epoll, Events, 64, -1);
+    for (int i = 0; i < Count; ++i)
+    {
+      const int Socket = Events[i].data.fd;
+      if (Socket == Listener)
+      {
+        Accept();
+      }
+      else if (Socket == Wakeup)
+      {
+        uint64_t Value;
+        (void)!read(Wakeup, &Value, sizeof(Value));
+        std::shared_ptr<const Frame> Next;
+        {
+          std::lock_guard<std::mutex> Lock(PendingLock);
+          Next.swap(Pending);
+        }
+        if (Next)
+        {
+          Distribute(Next);
+        }
+      }
+      else
+      {
+        auto Found = Clients.find(Socket);
+        if (Found == Clients.end())
+        {
+          continue;
+        }
+
+        // Clients do not send anything, reading only notices when they are gone
+        bool Gone = (Events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) != 0;
+        if (!Gone && (Events[i].events & EPOLLIN))
+        {
+          uint8 Discard[256];
+          const ssize_t Received = recv(Socket, Discard, sizeof(Discard), 0);
+          Gone = Received == 0 || (Received < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+        }
+        if (!Gone && (Events[i].events & EPOLLOUT))
+        {
+          Gone = !Flush(Found->second);
+        }
+        if (Gone)
+        {
+          Close(Socket);
+        }
+      }
+    }
+  }
+#endif
+}
+
+void PacketServer::Accept()
+{
+#if PACKET_SERVER_SUPPORTED
+  while (true)
+  {
+    const int Socket = accept4(Listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (Socket < 0)
+    {
+      return;
+    }
+
+    const int NoDelay = 1;
+    setsockopt(Socket, IPPROTO_TCP, TCP_NODELAY, &NoDelay, sizeof(NoDelay));
+    epoll_event Event;
+    Event.events = EPOLLIN | EPOLLRDHUP;
+    Event.data.fd = Socket;
+    if (epoll_ctl(Epoll, EPOLL_CTL_ADD, Socket, &Event) != 0)
+    {
+      close(Socket);
+      continue;
+    }
+
+    // New clients start with the next packet, the ones sent before do not count as dropped
+    Client &Added = Clients[Socket];
+    Added.Socket = Socket;
+    Added.Offset = 0;
+    Added.Size = 0;
+    Added.Last = Latest ? Latest->Sequence : 0;
+    Added.Blocked = false;
+    NumClients.store((uint32_t)Clients.size(), std::memory_order_relaxed);
+  }
+#endif
+}
+
+void PacketServer::Distribute(const std::shared_ptr<const Frame> &Next)
+{
+  Previous = Latest;
+  Latest = Next;
+
+  std::vector<int> Gone;
+  for (auto &Entry : Clients)
+  {
+    Client &Target = Entry.second;
+    if (Target.Current)
+    {
+      // Busy clients keep the lease of the previous packet, older ones would keep slots away from the writer
+      if (Target.Current != Previous)
+      {
+        Detach(Target);
+      }
+      continue;
+    }
+    if (!Target.Detached.empty())
+    {
+      continue;
+    }
+
+    StartFrame(Target, Next);
+    if (!Flush(Target))
+    {
+      Gone.push_back(Entry.first);
+    }
+  }
+  for (const int Socket : Gone)
+  {
+    Close(Socket);
+  }
+}
+
+void PacketServer::StartFrame(Client &Target, const std::shared_ptr<const Frame> &Next)
+{
+  if (Next->Sequence > Target.Last + 1)
+  {
+    Dropped.fetch_add(Next->Sequence - Target.Last - 1, std::memory_order_relaxed);
+  }
+  Target.Last = Next->Sequence;
+  Target.Current = Next;
+  Target.Offset = 0;
+  Target.Size = Next->Header.Size;
+}
+
+void PacketServer::Detach(Client &Target)
+{
+  const size_t SizeHeader = sizeof(PacketBuffer::PacketHeader);
+  Target.Detached.resize(Target.Size - Target.Offset);
+  uint8 *Rest = Target.Detached.data();
+  if (Target.Offset < SizeHeader)
+  {
+    std::memcpy(Rest, reinterpret_cast<const uint8*>(&Target.Current->Header) + Target.Offset, SizeHeader - Target.Offset);
+    Rest += SizeHeader - Target.Offset;
+  }
+  const size_t OffsetImage = Target.Offset > SizeHeader ? Target.Offset : SizeHeader;
+  std::memcpy(Rest, Target.Current->Packet.get() + OffsetImage, Target.Size - OffsetImage);
+
+  Target.Current.reset();
+  Target.Size -= Target.Offset;
+  Target.Offset = 0;
+}
+
+bool PacketServer::Flush(Client &Target)
+{
+#if PACKET_SERVER_SUPPORTED
+  while (Target.Current || !Target.Detached.empty())
+  {
+    // The header copy and the image in the slot, or the detached rest of the packet
+    iovec Parts[2];
+    int NumParts = 0;
+    if (Target.Current)
+    {
+      const size_t SizeHeader = sizeof(PacketBuffer::PacketHeader);
+      if (Target.Offset < SizeHeader)
+      {
+        Parts[NumParts].iov_base = const_cast<uint8*>(reinterpret_cast<const uint8*>(&Target.Current->Header) + Target.Offset);
+        Parts[NumParts++].iov_len = SizeHeader - Target.Offset;
+      }
+      const size_t OffsetImage = Target.Offset > SizeHeader ? Target.Offset : SizeHeader;
+      Parts[NumParts].iov_base = const_cast<uint8*>(Target.Current->Packet.get() + OffsetImage);
+      Parts[NumParts++].iov_len = Target.Size - OffsetImage;
+    }
+    else
+    {
+      Parts[NumParts].iov_base = Target.Detached.data() + Target.Offset;
+      Parts[NumParts++].iov_len = Target.Size - Target.Offset;
+    }
+
+    msghdr Message;
+    std::memset(&Message, 0, sizeof(Message));
+    Message.msg_iov = Parts;
+    Message.msg_iovlen = NumParts;
+    const ssize_t Written = sendmsg(Target.Socket, &Message, MSG_NOSIGNAL);
+    if (Written < 0)
+    {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+      {
+        return false;
+      }
+
+      // Waits for the socket to drain, the client skips the packets arriving meanwhile
+      if (!Target.Blocked)
+      {
+        epoll_event Event;
+        Event.events = EPOLLIN | EPOLLRDHUP | EPOLLOUT;
+        Event.data.fd = Target.Socket;
+        epoll_ctl(Epoll, EPOLL_CTL_MOD, Target.Socket, &Event);
+        Target.Blocked = true;
+      }
+      return true;
+    }
+
+    Target.Offset += (size_t)Written;
+    if (Target.Offset < Target.Size)
+    {
+      continue;
+    }
+
+    Sent.fetch_add(1, std::memory_order_relaxed);
+    Target.Current.reset();
+    Target.Detached.clear();
+    Target.Offset = 0;
+    Target.Size = 0;
+    if (Latest && Latest->Sequence > Target.Last)
+    {
+      StartFrame(Target, Latest);
+    }
+  }
+
+  if (Target.Blocked)
+  {
+    epoll_event Event;
+    Event.events = EPOLLIN | EPOLLRDHUP;
+    Event.data.fd = Target.Socket;
+    epoll_ctl(Epoll, EPOLL_CTL_MOD, Target.Socket, &Event);
+    Target.Blocked = false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void PacketServer::Close(const int Socket)
+{
+#if PACKET_SERVER_SUPPORTED
+  close(Socket);
+#endif
+  Clients.erase(Socket);
+  NumClients.store((uint32_t)Clients.size(), std::memory_order_relaxed);
+}
+
+bool PacketServer::IsRunning() const
+{
+  return Running.load(std::memory_order_relaxed);
+}
+
+uint16_t PacketServer::GetPort() const
+{
+  return Port;
+}
+
+uint32_t PacketServer::GetNumClients() const
+{
+  return NumClients.load(std::memory_order_relaxed);
+}
+
+uint64_t PacketServer::GetSent() const
+{
+  return Sent.load(std::memory_order_relaxed);
+}
+
+uint64_t PacketServer::GetDropped() const
+{
+  return Dropped.load(std::memory_order_relaxed);
+}
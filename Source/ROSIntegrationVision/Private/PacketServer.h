@@ -0,0 +1,102 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "PacketBuffer.h"
+
+/**
+ * TCP server that streams the packets of a component, the PacketBuffer::PacketHeader followed by the image, to
+ * any number of clients. The header tells the size of each packet, so the stream needs no further framing.
+ * One thread serves all clients with epoll on non-blocking sockets. A packet is sent with a copy of its header,
+ * which gets the sending time, and the image straight out of the leased slot of the PacketBuffer in one
+ * scatter-gather call.
+ * A client that is still busy with a packet when newer ones arrive skips them and gets the newest one next, so a
+ * slow client drops frames instead of stalling the others or the component. The server holds at most the leases
+ * of the newest two packets and the pending one, a client that falls further behind copies the rest of its packet.
+ * Only Linux is supported, Start fails on the other platforms.
+ */
+class ROSINTEGRATIONVISION_API PacketServer
+{
+private:
+  struct Frame
+  {
+    PacketBuffer::PacketHeader Header;
+    std::shared_ptr<const uint8> Packet;
+    uint64_t Sequence;
+  };
+
+  struct Client
+  {
+    int Socket;
+    std::shared_ptr<const Frame> Current;
+    // Rest of the packet once the client let go of the lease, sent instead of Current
+    std::vector<uint8> Detached;
+    size_t Offset;
+    size_t Size;
+    uint64_t Last;
+    bool Blocked;
+  };
+
+  int Listener, Epoll, Wakeup;
+  uint16_t Port;
+  std::thread Thread;
+  std::atomic<bool> Running;
+
+  // Handed over by Send, a packet that was not picked up yet is replaced by the next one
+  std::mutex PendingLock;
+  std::shared_ptr<const Frame> Pending;
+  uint64_t Sequence;
+
+  // Only accessed by the server thread
+  std::shared_ptr<const Frame> Latest, Previous;
+  std::unordered_map<int, Client> Clients;
+
+  std::atomic<uint32_t> NumClients;
+  std::atomic<uint64_t> Sent, Dropped;
+
+  void Run();
+  void Accept();
+  void Distribute(const std::shared_ptr<const Frame> &Next);
+  void StartFrame(Client &Target, const std::shared_ptr<const Frame> &Next);
+  void Detach(Client &Target);
+  // Sends as much of the current packet as the socket takes, returns false if the client is gone
+  bool Flush(Client &Target);
+  void Close(const int Socket);
+
+public:
+  PacketServer();
+
+  // Stops the server
+  ~PacketServer();
+
+  // Listens on Port of all interfaces, 0 picks a free port. Returns false if that failed or the platform is not
+  // supported.
+  bool Start(const uint16_t Port);
+
+  // Disconnects all clients and releases the leases
+  void Stop();
+
+  // Hands a leased packet over to the server thread, never waits for the clients
+  void Send(const std::shared_ptr<const uint8> &Packet);
+
+  bool IsRunning() const;
+
+  // Port the server listens on, 0 if it is not running
+  uint16_t GetPort() const;
+
+  uint32_t GetNumClients() const;
+
+  // Packets completely sent, counted for every client
+  uint64_t GetSent() const;
+
+  // Packets that were skipped for a client because it was still busy, counted for every client
+  uint64_t GetDropped() const;
+};
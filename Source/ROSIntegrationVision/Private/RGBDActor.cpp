@@ -0,0 +1,29 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RGBDActor.h"
+#include "ROSIntegrationGameInstance.h"
+
+// Sets default values
+ARGBDActor::ARGBDActor() : AActor()
+{
+    // Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
+    PrimaryActorTick.bCanEverTick = false;
+
+    RootComponent = CreateDefaultSubobject<USceneComponent>(TEXT("Root"));
+    SetRootComponent(RootComponent);
+
+    rgbd = CreateDefaultSubobject<URGBDComponent>(TEXT("RGBD"));
+    rgbd->SetupAttachment(RootComponent);
+}
+
+// Called when the game starts or when spawned
+void ARGBDActor::BeginPlay()
+{
+    Super::BeginPlay();
+}
+
+// Called every frame
+void ARGBDActor::Tick(float DeltaTime)
+{
+    Super::Tick(DeltaTime);
+}
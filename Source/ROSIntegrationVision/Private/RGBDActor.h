@@ -0,0 +1,22 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "GameFramework/Actor.h"
+#include "RGBDComponent.h"
+
+#include "RGBDActor.generated.h"
+
+UCLASS()
+class ROSINTEGRATIONVISION_API ARGBDActor : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	ARGBDActor();
+	virtual void BeginPlay() override;
+	virtual void Tick(float DeltaSeconds) override;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RGBD Actor")
+	URGBDComponent* rgbd;
+};
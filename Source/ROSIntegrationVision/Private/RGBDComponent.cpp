@@ -0,0 +1,810 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RGBDComponent.h"
+
+#include <atomic>
+#include <limits>
+#include <mutex>
+
+#include "ROSTime.h"
+#include "sensor_msgs/Image.h"
+#include "sensor_msgs/PointCloud2.h"
+#include "sensor_msgs/PointField.h"
+
+#include "BackProjection.h"
+#include "CameraIntrinsics.h"
+#include "CaptureScheduler.h"
+#include "ImageConversion.h"
+#include "LeasedImage.h"
+#include "LeasedPointCloud.h"
+#include "OutgoingQueue.h"
+#include "PacketBuffer.h"
+#include "ReadbackQueue.h"
+#include "ROSIntegrationVision.h"
+#include "ROSIntegrationGameInstance.h"
+#include "StopTime.h"
+#include "SubscriberCounts.h"
+#include "SubscriberPoller.h"
+#include "WorkerPool.h"
+
+#include "EngineUtils.h"
+
+#if PLATFORM_WINDOWS
+  #define _USE_MATH_DEFINES
+#endif
+
+// Parts of a packet, only those with subscribers are converted
+static const uint32 ContentColor = 1;
+static const uint32 ContentDepth = 2;
+static const uint32 ContentPointCloud = 4;
+
+// Private data container so that internal structures are not visible to the outside
+class ROSINTEGRATIONVISION_API URGBDComponent::PrivateData
+{
+public:
+	// Each packet holds the bgr8 color image followed by the depth image and the point cloud
+	TSharedPtr<PacketBuffer> Buffer;
+	TSharedPtr<ReadbackQueue> Readback;
+	// Bounded queues of the topics in front of the bridge, created with the topics
+	TSharedPtr<OutgoingQueue> CameraInfoQueue, ColorQueue, DepthQueue, PointCloudQueue;
+	uint32 OffsetDepth;
+	uint32 OffsetPoints;
+	// Conversion and publishing jobs of this component on the module thread pool
+	WorkerPool *Pool;
+	WorkerPool::Group Jobs;
+	// CaptureOnDemand or readbacks at BeginPlay, and the number of captures and ticks for the statistics
+	bool OnDemand;
+	// Whether the scene captures render every frame, they are stopped while no image topic has subscribers
+	bool Capturing;
+	// Topics with subscribers as of the last PublishImages, also read by the conversion and publishing jobs
+	std::atomic<bool> PublishColor, PublishDepth, PublishPointCloud, PublishInfo;
+	// Registration with the module scheduler for PublishRate, 0 if not registered yet
+	CaptureScheduler::Handle Schedule;
+	float ScheduledRate;
+	uint32 StatsCaptures, StatsTicks;
+	double StatsCaptureStart;
+	// Intrinsics for the camera info, only recomputed when the properties change
+	CameraIntrinsics Intrinsics;
+	// Latency histograms of the stages of the frames, empty without stage timing
+	StageTimes Stages;
+	// Game thread and job time per frame, logged once per second
+	PipelineTimes Times;
+	std::mutex WaitFrame;
+	bool DoFrame;
+	bool Converting;
+	// Frame handed over from the game thread to the conversion job, and the one the job converts
+	TArray<FColor> PendingColor;
+	TArray<FColor> ProcessingColor;
+	TArray<FFloat16Color> PendingDepth;
+	TArray<FFloat16Color> ProcessingDepth;
+	FrameInfo PendingInfo;
+	// Packets completed since the publishing job last looked for them
+	std::atomic<uint32> PublishRequests;
+	// Depth encoding the buffer was created for
+	EDepthEncoding Encoding;
+	// Point cloud settings at BeginPlay, the ray factors of the columns and rows and the points per row
+	bool DoPointCloud;
+	bool Organized;
+	uint32 Stride, Columns, Rows;
+	uint32 RaysVersion; // Version of the intrinsics the rays were computed for
+	TArray<float> RaysX;
+	TArray<float> RaysY;
+	TArray<uint32> RowPoints;
+	// Point cloud statistics, reported once per second by the conversion job
+	double StatsStart, StatsTime;
+	uint32 StatsClouds;
+	uint64_t StatsPoints;
+};
+
+URGBDComponent::URGBDComponent() :
+Width(960),
+Height(540),
+ReadbackDepth(0),
+DepthEncoding(EDepthEncoding::Float32Meters),
+MaxRange(0)
+{
+    Priv = new PrivateData();
+    FieldOfView = 90.0;
+    PrimaryComponentTick.bCanEverTick = true;
+
+    auto owner = GetOwner();
+    if (owner)
+    {
+        Color = CreateDefaultSubobject<USceneCaptureComponent2D>(TEXT("ColorCapture"));
+        Color->SetupAttachment(this);
+        Color->CaptureSource = ESceneCaptureSource::SCS_FinalColorLDR;
+        Color->TextureTarget = CreateDefaultSubobject<UTextureRenderTarget2D>(TEXT("ColorTarget"));
+        Color->TextureTarget->TargetGamma = 2.0;
+        Color->TextureTarget->InitCustomFormat(Width, Height, PF_B8G8R8A8, false);
+        Color->FOVAngle = FieldOfView;
+
+        Depth = CreateDefaultSubobject<USceneCaptureComponent2D>(TEXT("DepthCapture"));
+        Depth->SetupAttachment(this);
+        Depth->CaptureSource = ESceneCaptureSource::SCS_SceneDepth;
+        Depth->TextureTarget = CreateDefaultSubobject<UTextureRenderTarget2D>(TEXT("DepthTarget"));
+        Depth->TextureTarget->RenderTargetFormat = ETextureRenderTargetFormat::RTF_RGBA16f;
+        Depth->TextureTarget->InitAutoFormat(Width, Height);
+        Depth->FOVAngle = FieldOfView;
+    }
+    else
+    {
+        UE_LOG(LogTemp, Warning, TEXT("No owner!"));
+    }
+}
+
+URGBDComponent::~URGBDComponent()
+{
+    delete Priv;
+}
+
+void URGBDComponent::Pause(const bool _Pause)
+{
+    Paused = _Pause;
+}
+
+bool URGBDComponent::IsPaused() const
+{
+    return Paused;
+}
+
+float URGBDComponent::GetAchievedPublishRate() const
+{
+	return Priv->Schedule != 0 ? FROSIntegrationVisionModule::Get().GetScheduler().GetAchievedRate(Priv->Schedule) : 0.f;
+}
+
+FStageLatency URGBDComponent::GetStageLatency(EVisionStage Stage) const
+{
+	return Priv->Stages.Get(Stage);
+}
+
+void URGBDComponent::ResetStageLatencies()
+{
+	Priv->Stages.Reset();
+}
+
+bool URGBDComponent::DumpStageLatencies(const FString &Path) const
+{
+	return Priv->Stages.WriteCSV(Path, GetName());
+}
+
+void URGBDComponent::InitializeTopics()
+{
+	// Establish ROS communication
+	UROSIntegrationGameInstance* rosinst = Cast<UROSIntegrationGameInstance>
+		(GetOwner()->GetGameInstance());
+
+	if (rosinst && rosinst->bConnectToROS)
+	{
+		CameraInfoPublisher = NewObject<UTopic>(UTopic::StaticClass());
+		ColorPublisher = NewObject<UTopic>(UTopic::StaticClass());
+		DepthPublisher = NewObject<UTopic>(UTopic::StaticClass());
+
+		CameraInfoPublisher->Init(rosinst->ROSIntegrationCore, CameraInfoTopicName, TEXT("sensor_msgs/CameraInfo"), PublishQueue.GetTopicQueueSize());
+		CameraInfoPublisher->Advertise();
+
+		ColorPublisher->Init(rosinst->ROSIntegrationCore, ColorTopicName, TEXT("sensor_msgs/Image"), PublishQueue.GetTopicQueueSize());
+		ColorPublisher->Advertise();
+
+		DepthPublisher->Init(rosinst->ROSIntegrationCore, DepthTopicName, TEXT("sensor_msgs/Image"), PublishQueue.GetTopicQueueSize());
+		DepthPublisher->Advertise();
+
+		if (!PointCloudTopicName.IsEmpty())
+		{
+			PointCloudPublisher = NewObject<UTopic>(UTopic::StaticClass());
+			PointCloudPublisher->Init(rosinst->ROSIntegrationCore, PointCloudTopicName, TEXT("sensor_msgs/PointCloud2"), PublishQueue.GetTopicQueueSize());
+			PointCloudPublisher->Advertise();
+		}
+
+		// Every topic gets its own bounded queue in front of the bridge
+		Priv->CameraInfoQueue = MakeShareable(new OutgoingQueue(CameraInfoTopicName, CameraInfoPublisher, PublishQueue));
+		Priv->ColorQueue = MakeShareable(new OutgoingQueue(ColorTopicName, ColorPublisher, PublishQueue));
+		Priv->DepthQueue = MakeShareable(new OutgoingQueue(DepthTopicName, DepthPublisher, PublishQueue));
+		if (PointCloudPublisher)
+		{
+			Priv->PointCloudQueue = MakeShareable(new OutgoingQueue(PointCloudTopicName, PointCloudPublisher, PublishQueue));
+		}
+
+		// Subscriber counts of the topics come from rosapi, empty topic names are not polled
+		SubscriberPoller &Poller = FROSIntegrationVisionModule::Get().GetSubscriberPoller();
+		Poller.Watch(rosinst->ROSIntegrationCore, CameraInfoTopicName);
+		Poller.Watch(rosinst->ROSIntegrationCore, ColorTopicName);
+		Poller.Watch(rosinst->ROSIntegrationCore, DepthTopicName);
+		Poller.Watch(rosinst->ROSIntegrationCore, PointCloudTopicName);
+	}
+	else
+	{
+		UE_LOG(LogTemp, Warning, TEXT("UnrealROSInstance not existing."));
+	}
+}
+
+void URGBDComponent::PublishImages() {
+	CaptureImages();
+}
+
+bool URGBDComponent::CaptureImages()
+{
+	PipelineTimer GameThreadTime(Priv->Times, false);
+
+	// Check if paused
+	if (Paused) {
+		return false;
+	}
+
+	FROSTime time = FROSTime::Now();
+	Priv->Intrinsics.Update(Width, Height, FieldOfView, 0);
+
+	// Topics without subscribers are skipped, subscribers of the camera info alone do not need the images.
+	// Both targets are read back for any image topic, the conversion skips the parts nobody listens to.
+	SubscriberCounts &Subscribers = FROSIntegrationVisionModule::Get().GetSubscriberCounts();
+	Priv->PublishColor = ColorPublisher && ColorPublisher->IsAdvertising() && Subscribers.IsSubscribed(ColorTopicName);
+	Priv->PublishDepth = DepthPublisher && DepthPublisher->IsAdvertising() && Subscribers.IsSubscribed(DepthTopicName);
+	Priv->PublishPointCloud = PointCloudPublisher && PointCloudPublisher->IsAdvertising() &&
+		Subscribers.IsSubscribed(PointCloudTopicName);
+	Priv->PublishInfo = CameraInfoPublisher && CameraInfoPublisher->IsAdvertising() &&
+		Subscribers.IsSubscribed(CameraInfoTopicName);
+	const bool Capture = Priv->PublishColor || Priv->PublishDepth || Priv->PublishPointCloud;
+
+	// Rendering stops while nobody listens, the first frame after that is captured right away instead of reading
+	// back the stale render targets
+	const bool Resume = Capture && !Priv->Capturing;
+	if (!Priv->OnDemand && Capture != Priv->Capturing) {
+		Color->bCaptureEveryFrame = Capture;
+		Color->bCaptureOnMovement = Capture;
+		Depth->bCaptureEveryFrame = Capture;
+		Depth->bCaptureOnMovement = Capture;
+		UE_LOG(LogTemp, Verbose, TEXT("%s %s capturing."), *GetName(), Capture ? TEXT("resumes") : TEXT("stops"));
+	}
+	Priv->Capturing = Capture;
+
+	if (Capture) {
+		if (Priv->Readback.IsValid() && Priv->Readback->IsFull()) {
+			UE_LOG(LogTemp, Verbose, TEXT("All %d readbacks in flight, skipping frame."), ReadbackDepth);
+			return false;
+		}
+		MEASURE_STAGE(Priv->Stages, Capture);
+
+		// In capture on demand mode the scene is only rendered for frames that are read back. The readback copies
+		// the render target after the capture commands, so it gets the frame of this stamp and pose.
+		if (Priv->OnDemand || Resume) {
+			Color->CaptureScene();
+			Depth->CaptureScene();
+			++Priv->StatsCaptures;
+		}
+
+		if (Priv->Readback.IsValid()) {
+			// Only queue the readback of both targets, TickComponent submits the frame once the data arrived
+			ReadbackQueue::Frame &Frame = Priv->Readback->Enqueue(Color->TextureTarget, Depth->TextureTarget);
+			GetFrameInfo(Frame, time);
+			return true;
+		}
+
+		FrameInfo Info;
+		GetFrameInfo(Info, time);
+
+		{
+			MEASURE_STAGE(Priv->Stages, Readback);
+			ReadImages(ImageColor, ImageDepth);
+		}
+		SubmitFrame(ImageColor, ImageDepth, Info);
+		return true;
+	}
+
+	// A job publishes the camera info alone, serializing it or waiting for a full queue must not hold up the frame
+	if (Priv->PublishInfo) {
+		Priv->Pool->Submit(Priv->Jobs, [this, time]() { PublishCameraInfo(time); });
+	}
+	return false;
+}
+
+void URGBDComponent::GetFrameInfo(FrameInfo &Info, const FROSTime &Time)
+{
+	auto owner = GetOwner();
+	owner->UpdateComponentTransforms();
+
+	// The capture timestamp is the stamp of all messages of the frame, so that the publishing thread can restore it
+	Info.Time = Time;
+	Info.TimestampCapture = (uint64_t)Time._Sec * 1000000000 + Time._NSec;
+	Info.ClockCapture = STAGE_TIMESTAMP();
+
+	FVector Translation = GetComponentLocation();
+	FQuat Rotation = GetComponentQuat();
+	// Convert to meters and ROS coordinate system
+	Info.Translation.X = Translation.X / 100.0f;
+	Info.Translation.Y = -Translation.Y / 100.0f;
+	Info.Translation.Z = Translation.Z / 100.0f;
+	Info.Rotation.X = -Rotation.X;
+	Info.Rotation.Y = Rotation.Y;
+	Info.Rotation.Z = -Rotation.Z;
+	Info.Rotation.W = Rotation.W;
+}
+
+void URGBDComponent::SubmitFrame(TArray<FColor> &ColorPixels, TArray<FFloat16Color> &DepthPixels, const FrameInfo &Info)
+{
+	// Only swaps the frame in, the conversion job converts it while the game thread continues.
+	// The arrays receive the previous buffers, which keep their size for the next read.
+	std::unique_lock<std::mutex> Lock(Priv->WaitFrame);
+	if (Priv->DoFrame) {
+		UE_LOG(LogTemp, Verbose, TEXT("Conversion is behind, replacing pending frame."));
+	}
+	Swap(Priv->PendingColor, ColorPixels);
+	Swap(Priv->PendingDepth, DepthPixels);
+	Priv->PendingInfo = Info;
+	Priv->DoFrame = true;
+	Priv->Times.CountFrame();
+	// At most one conversion job per component, the buffer has a single writer
+	const bool StartJob = !Priv->Converting;
+	Priv->Converting = true;
+	Lock.unlock();
+
+	if (StartJob) {
+		Priv->Pool->Submit(Priv->Jobs, [this]() { ProcessFrame(); });
+	}
+}
+
+void URGBDComponent::PublishFrame()
+{
+	// Publishes the completed packets, the job is started for the first request and runs until it handled all
+	// requests that came in meanwhile. Under LatestWins only the newest packet of several is published.
+	uint32 Requests = Priv->PublishRequests.load();
+	while (true)
+	{
+		if (!Priv->Buffer->TryStartReading())
+		{
+			Requests = Priv->PublishRequests.fetch_sub(Requests) - Requests;
+			if (Requests == 0)
+			{
+				break;
+			}
+			continue;
+		}
+
+		MEASURE_STAGE(Priv->Stages, Publish);
+		PipelineTimer WorkerTime(Priv->Times, true);
+
+		// Color, depth and camera info carry the same stamp
+		const uint64_t TimestampCapture = Priv->Buffer->HeaderRead->TimestampCapture;
+		const FROSTime Time(TimestampCapture / 1000000000, TimestampCapture % 1000000000);
+
+		const uint32 OffsetColor = Priv->Buffer->OffsetImage;
+		const uint32 OffsetDepth = Priv->OffsetDepth;
+		const uint32 Points = Priv->Buffer->HeaderRead->Points;
+		const uint32 Contents = Priv->Buffer->HeaderRead->Contents;
+
+		// Both messages lease the same slot, it returns to the buffer once both are serialized and destroyed
+		const std::shared_ptr<const uint8> Lease = Priv->Buffer->LeaseRead();
+
+		if ((Contents & ContentColor) && Priv->PublishColor) {
+			TSharedPtr<ROSMessages::sensor_msgs::Image> ColorMessage(new LeasedImage(Lease, OffsetColor));
+
+			ColorMessage->header.seq = 0;
+			ColorMessage->header.time = Time;
+			ColorMessage->header.frame_id = ImageOpticalFrame;
+			ColorMessage->height = Height;
+			ColorMessage->width = Width;
+			ColorMessage->encoding = TEXT("bgr8");
+			ColorMessage->step = Width * 3;
+			const uint64 ColorBytes = ColorMessage->step * ColorMessage->height;
+			Priv->ColorQueue->Publish(MoveTemp(ColorMessage), ColorBytes);
+		}
+
+		if ((Contents & ContentDepth) && Priv->PublishDepth) {
+			TSharedPtr<ROSMessages::sensor_msgs::Image> DepthMessage(new LeasedImage(Lease, OffsetDepth));
+
+			DepthMessage->header.seq = 0;
+			DepthMessage->header.time = Time;
+			DepthMessage->header.frame_id = ImageOpticalFrame;
+			DepthMessage->height = Height;
+			DepthMessage->width = Width;
+			DepthMessage->encoding = Priv->Encoding == EDepthEncoding::UInt16Millimeters ? TEXT("16UC1") : TEXT("32FC1");
+			DepthMessage->step = Width * (Priv->Encoding == EDepthEncoding::UInt16Millimeters ? sizeof(uint16_t) : sizeof(float));
+			const uint64 DepthBytes = DepthMessage->step * DepthMessage->height;
+			Priv->DepthQueue->Publish(MoveTemp(DepthMessage), DepthBytes);
+		}
+
+		if ((Contents & ContentPointCloud) && Priv->PublishPointCloud) {
+			TSharedPtr<ROSMessages::sensor_msgs::PointCloud2> CloudMessage(new LeasedPointCloud(Lease, Priv->OffsetPoints));
+
+			CloudMessage->header.seq = 0;
+			CloudMessage->header.time = Time;
+			CloudMessage->header.frame_id = ImageOpticalFrame;
+			CloudMessage->height = Priv->Organized ? Priv->Rows : 1;
+			CloudMessage->width = Priv->Organized ? Priv->Columns : Points;
+			const TCHAR *Names[4] = { TEXT("x"), TEXT("y"), TEXT("z"), TEXT("rgb") };
+			for (uint32 i = 0; i < 4; ++i) {
+				ROSMessages::sensor_msgs::PointField Field;
+				Field.name = Names[i];
+				Field.offset = i * sizeof(float);
+				Field.datatype = ROSMessages::sensor_msgs::PointField::FLOAT32;
+				Field.count = 1;
+				CloudMessage->fields.Add(Field);
+			}
+			CloudMessage->is_bigendian = false;
+			CloudMessage->point_step = sizeof(BackProjection::Point);
+			CloudMessage->row_step = CloudMessage->width * sizeof(BackProjection::Point);
+			CloudMessage->is_dense = !Priv->Organized;
+			const uint64 CloudBytes = CloudMessage->row_step * CloudMessage->height;
+			Priv->PointCloudQueue->Publish(MoveTemp(CloudMessage), CloudBytes);
+		}
+
+		PublishCameraInfo(Time);
+		RECORD_STAGE_SINCE(Priv->Stages, EndToEnd, Priv->Buffer->HeaderRead->ClockCapture);
+	}
+}
+
+void URGBDComponent::PublishCameraInfo(const FROSTime &Time)
+{
+	if (Priv->PublishInfo) {
+		Priv->Intrinsics.Publish(*Priv->CameraInfoQueue, Time, ImageOpticalFrame);
+	}
+}
+
+void URGBDComponent::InitializeComponent()
+{
+	Super::InitializeComponent();
+}
+
+void URGBDComponent::BeginPlay()
+{
+	Super::BeginPlay();
+	// Initializing buffers for reading images from the GPU
+	ImageColor.AddUninitialized(Width * Height);
+	ImageDepth.AddUninitialized(Width * Height);
+
+	// Reinit renderers, the color is read as it is from an 8 bit target
+	Color->TextureTarget->InitCustomFormat(Width, Height, PF_B8G8R8A8, false);
+	Depth->TextureTarget->InitAutoFormat(Width, Height);
+	Color->FOVAngle = FieldOfView;
+	Depth->FOVAngle = FieldOfView;
+
+	AspectRatio = Width / (float)Height;
+
+	ShowFlagsLit(Color->ShowFlags);
+
+	// Rays of the point cloud pixels, computed by the conversion job from the intrinsics of the camera info
+	Priv->Intrinsics.Update(Width, Height, FieldOfView, 0);
+	Priv->DoPointCloud = !PointCloudTopicName.IsEmpty();
+	Priv->Organized = PointCloudOrganized;
+	Priv->Stride = FMath::Max(PointCloudStride, 1);
+	Priv->Columns = FMath::DivideAndRoundUp(Width, Priv->Stride);
+	Priv->Rows = FMath::DivideAndRoundUp(Height, Priv->Stride);
+	Priv->RaysVersion = 0;
+	if (Priv->DoPointCloud) {
+		Priv->RaysX.SetNumUninitialized(Priv->Columns);
+		Priv->RaysY.SetNumUninitialized(Priv->Rows);
+		Priv->RowPoints.SetNumUninitialized(Priv->Rows);
+	}
+	Priv->StatsStart = FPlatformTime::Seconds();
+	Priv->StatsTime = 0;
+	Priv->StatsClouds = 0;
+	Priv->StatsPoints = 0;
+
+	// Creating packet ring buffer with the color and the depth image and the point cloud in each packet.
+	// One slot more than the minimum, so that a message still holding its lease does not stall the writer.
+	Priv->Encoding = DepthEncoding;
+	const uint32 DepthBytes = DepthEncoding == EDepthEncoding::UInt16Millimeters ? sizeof(uint16_t) : sizeof(float);
+	const uint32 PointBytes = Priv->DoPointCloud ? Priv->Columns * Priv->Rows * sizeof(BackProjection::Point) : 0;
+	Priv->Buffer = TSharedPtr<PacketBuffer>(new PacketBuffer(Width, Height, 3 + DepthBytes, FieldOfView, 4,
+		PacketBuffer::Policy::LatestWins, PointBytes));
+	Priv->OffsetDepth = Priv->Buffer->OffsetImage + Width * Height * 3;
+	Priv->OffsetPoints = Priv->OffsetDepth + Width * Height * DepthBytes;
+
+	Running = true;
+	Paused = false;
+	Priv->Schedule = 0;
+	Priv->ScheduledRate = 0;
+
+	// Without per-frame captures the render target is only updated by PublishImages. Readbacks always capture
+	// explicitly, a capture every frame is rendered after the tick and the copy would get the previous frame.
+	Priv->OnDemand = CaptureOnDemand || ReadbackDepth > 0;
+	Color->bCaptureEveryFrame = !Priv->OnDemand;
+	Color->bCaptureOnMovement = !Priv->OnDemand;
+	Depth->bCaptureEveryFrame = !Priv->OnDemand;
+	Depth->bCaptureOnMovement = !Priv->OnDemand;
+	Priv->Capturing = !Priv->OnDemand;
+	Priv->PublishColor = false;
+	Priv->PublishDepth = false;
+	Priv->PublishPointCloud = false;
+	Priv->PublishInfo = false;
+	Priv->StatsCaptures = 0;
+	Priv->StatsTicks = 0;
+	Priv->StatsCaptureStart = FPlatformTime::Seconds();
+	Priv->Stages.Reset();
+
+	Priv->Pool = &FROSIntegrationVisionModule::Get().GetWorkerPool();
+	Priv->DoFrame = false;
+	Priv->Converting = false;
+	Priv->PublishRequests = 0;
+	Priv->PendingColor.AddUninitialized(Width * Height);
+	Priv->ProcessingColor.AddUninitialized(Width * Height);
+	Priv->PendingDepth.AddUninitialized(Width * Height);
+	Priv->ProcessingDepth.AddUninitialized(Width * Height);
+
+	// Ring of non-blocking readbacks, without it the render targets are read synchronously
+	if (ReadbackDepth > 0)
+	{
+		Priv->Readback = TSharedPtr<ReadbackQueue>(new ReadbackQueue(ReadbackDepth, Width, Height, ReadbackQueue::Content::LDRAndFloat16));
+	}
+}
+
+void URGBDComponent::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* TickFunction)
+{
+	Super::TickComponent(DeltaTime, TickType, TickFunction);
+
+	PipelineTimer GameThreadTime(Priv->Times, false);
+
+	// Submit all frames whose readback completed in the meantime, oldest first
+	while (Priv->Readback.IsValid())
+	{
+		ReadbackQueue::Frame *Frame = Priv->Readback->Peek();
+		if (!Frame)
+		{
+			break;
+		}
+		RECORD_STAGE_SINCE(Priv->Stages, Readback, Frame->ClockCapture);
+
+		SubmitFrame(Frame->PixelsLDR, Frame->Pixels, *Frame);
+		Priv->Readback->Pop();
+	}
+
+	// The module scheduler calls PublishImages at the target rate, staggered with the other components
+	if (PublishRate != Priv->ScheduledRate && Running) {
+		CaptureScheduler &Scheduler = FROSIntegrationVisionModule::Get().GetScheduler();
+		if (Priv->Schedule == 0) {
+			const uint64 ReadbackBytes = (uint64)Width * Height * (sizeof(FColor) + sizeof(FFloat16Color));
+			Priv->Schedule = Scheduler.Register(GetName(), PublishRate, ReadbackBytes, [this]() { return CaptureImages(); });
+		}
+		else {
+			Scheduler.SetRate(Priv->Schedule, PublishRate);
+		}
+		Priv->ScheduledRate = PublishRate;
+	}
+
+	++Priv->StatsTicks;
+	if (!Priv->OnDemand && Priv->Capturing) {
+		++Priv->StatsCaptures;
+	}
+	const double Now = FPlatformTime::Seconds();
+	if (Now - Priv->StatsCaptureStart >= 1.0) {
+		UE_LOG(LogTemp, Verbose, TEXT("%s captured %u times in %u frames."), *GetName(), Priv->StatsCaptures, Priv->StatsTicks);
+		Priv->StatsCaptureStart = Now;
+		Priv->StatsCaptures = 0;
+		Priv->StatsTicks = 0;
+	}
+	Priv->Times.Report(GetName());
+}
+
+void URGBDComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	Super::EndPlay(EndPlayReason);
+	Running = false;
+
+	if (Priv->Schedule != 0) {
+		FROSIntegrationVisionModule::Get().GetScheduler().Unregister(Priv->Schedule);
+		Priv->Schedule = 0;
+	}
+
+	// Waiting for readbacks in flight before their frames are destroyed
+	Priv->Readback.Reset();
+
+	// Waiting for the conversion and publishing jobs, they access the component
+	Priv->Jobs.Wait();
+
+	// Messages still waiting for the bridge are dropped, the ones it holds finish on their own
+	if (Priv->CameraInfoQueue.IsValid()) {
+		Priv->CameraInfoQueue->Close();
+	}
+	if (Priv->ColorQueue.IsValid()) {
+		Priv->ColorQueue->Close();
+	}
+	if (Priv->DepthQueue.IsValid()) {
+		Priv->DepthQueue->Close();
+	}
+	if (Priv->PointCloudQueue.IsValid()) {
+		Priv->PointCloudQueue->Close();
+	}
+}
+
+void URGBDComponent::ShowFlagsLit(FEngineShowFlags &ShowFlags) const
+{
+	ShowFlags = FEngineShowFlags(EShowFlagInitMode::ESFIM_Game);
+	ApplyViewMode(VMI_Lit, true, ShowFlags);
+	ShowFlags.SetMaterials(true);
+	ShowFlags.SetLighting(true);
+	ShowFlags.SetPostProcessing(true);
+	// ToneMapper needs to be enabled, otherwise the screen will be very dark
+	ShowFlags.SetTonemapper(true);
+	// TemporalAA needs to be disabled, otherwise the previous frame might contaminate current frame.
+	ShowFlags.SetTemporalAA(false);
+	ShowFlags.SetAntiAliasing(true);
+	ShowFlags.SetEyeAdaptation(false); // Eye adaption is a slow temporal procedure, not useful for image capture
+}
+
+void URGBDComponent::ReadImages(TArray<FColor> &ColorData, TArray<FFloat16Color> &DepthData) const
+{
+	// Both reads flush the rendering commands, the second one returns right away
+	FReadSurfaceDataFlags Flags(RCM_UNorm, CubeFace_MAX);
+	Flags.SetLinearToGamma(false);
+	Color->TextureTarget->GameThread_GetRenderTargetResource()->ReadPixelsPtr(ColorData.GetData(), Flags);
+	Depth->TextureTarget->GameThread_GetRenderTargetResource()->ReadFloat16Pixels(DepthData);
+}
+
+void URGBDComponent::ToImages(const TArray<FColor> &ColorData, const TArray<FFloat16Color> &DepthData, uint8 *Bytes, const uint32 Contents) const
+{
+	static_assert(sizeof(FColor) == 4, "FColor has to be four packed bytes");
+	static_assert(sizeof(FFloat16Color) == 4 * sizeof(uint16_t), "FFloat16Color has to be four packed half floats");
+	check((uint32)ColorData.Num() == Width * Height);
+	check((uint32)DepthData.Num() == Width * Height);
+
+	// Each stripe of rows converts the images in Contents, the color image is followed by the depth image in the packet
+	const uint8 *InColor = reinterpret_cast<const uint8 *>(ColorData.GetData());
+	const uint16_t *InDepth = reinterpret_cast<const uint16_t *>(DepthData.GetData());
+	uint8 *OutColor = Bytes;
+	uint8 *OutDepth = Bytes + Width * Height * 3;
+	const bool Millimeters = Priv->Encoding == EDepthEncoding::UInt16Millimeters;
+	// Scene depth is stored in centimeters in the R channel
+	const float MaxMillimeters = MaxRange > 0 ? FMath::Min(MaxRange * 1000.f, 65535.f) : 65535.f;
+	const float MaxMeters = MaxRange > 0 ? MaxRange : std::numeric_limits<float>::infinity();
+	const uint32 MinRows = FMath::DivideAndRoundUp<uint32>(ImageConversion::MinStripePixels, Width);
+	const bool DoColor = (Contents & ContentColor) != 0;
+	const bool DoDepth = (Contents & ContentDepth) != 0;
+	if (!DoColor && !DoDepth) {
+		return;
+	}
+	Priv->Pool->ParallelFor(Height, MinRows, [=](uint32 Begin, uint32 End) {
+		const uint32 First = Begin * Width;
+		const uint32 Pixels = (End - Begin) * Width;
+		if (DoColor) {
+			ImageConversion::BGRA8ToBGR8(InColor + First * 4, OutColor + First * 3, Pixels);
+		}
+		if (!DoDepth) {
+			return;
+		}
+		if (Millimeters) {
+			ImageConversion::HalfToMillimeters(InDepth + First * 4, reinterpret_cast<uint16_t *>(OutDepth) + First, Pixels, MaxMillimeters);
+		}
+		else {
+			ImageConversion::HalfToMeters(InDepth + First * 4, reinterpret_cast<float *>(OutDepth) + First, Pixels, MaxMeters);
+		}
+	});
+}
+
+uint32 URGBDComponent::ToPointCloud(const TArray<FColor> &ColorData, const uint8 *DepthBytes, uint8 *Bytes) const
+{
+	// Projects the converted depth image with the color of the 8 bit capture, in parallel stripes of rows.
+	// Each row is written to its place in the organized cloud, a dense cloud is compacted afterwards.
+	const CameraIntrinsics::Values Intrinsics = Priv->Intrinsics.Get();
+	if (Intrinsics.Version != Priv->RaysVersion) {
+		BackProjection::ComputeRays(Priv->RaysX.GetData(), Priv->Columns, Priv->Stride, Intrinsics.CX, Intrinsics.FX);
+		BackProjection::ComputeRays(Priv->RaysY.GetData(), Priv->Rows, Priv->Stride, Intrinsics.CY, Intrinsics.FY);
+		Priv->RaysVersion = Intrinsics.Version;
+	}
+	const uint32 *Colors = reinterpret_cast<const uint32 *>(ColorData.GetData());
+	BackProjection::Point *Points = reinterpret_cast<BackProjection::Point *>(Bytes);
+	const bool Millimeters = Priv->Encoding == EDepthEncoding::UInt16Millimeters;
+	const bool Organized = Priv->Organized;
+	const uint32 Stride = Priv->Stride, Columns = Priv->Columns;
+	const float MinDepth = FMath::Max(PointCloudMinDepth, 0.f);
+	const float MaxDepth = PointCloudMaxDepth > 0 ? PointCloudMaxDepth : std::numeric_limits<float>::infinity();
+	const float *RaysX = Priv->RaysX.GetData();
+	const float *RaysY = Priv->RaysY.GetData();
+	uint32 *RowPoints = Priv->RowPoints.GetData();
+
+	const uint32 MinRows = FMath::DivideAndRoundUp<uint32>(ImageConversion::MinStripePixels, Columns);
+	Priv->Pool->ParallelFor(Priv->Rows, MinRows, [=](uint32 Begin, uint32 End) {
+		// The kernel needs contiguous meters, so decimated or millimeter rows are gathered first
+		const bool Gather = Stride > 1 || Millimeters;
+		TArray<float> DepthRow;
+		TArray<uint32> ColorRow;
+		if (Gather) {
+			DepthRow.SetNumUninitialized(Columns);
+		}
+		if (Stride > 1) {
+			ColorRow.SetNumUninitialized(Columns);
+		}
+
+		for (uint32 Row = Begin; Row < End; ++Row) {
+			const uint32 First = Row * Stride * Width;
+			const float *Depth = reinterpret_cast<const float *>(DepthBytes) + First;
+			const uint32 *Color = Colors + First;
+			if (Gather) {
+				for (uint32 i = 0; i < Columns; ++i) {
+					DepthRow[i] = Millimeters ? reinterpret_cast<const uint16_t *>(DepthBytes)[First + i * Stride] * 0.001f
+					                          : Depth[i * Stride];
+				}
+				Depth = DepthRow.GetData();
+			}
+			if (Stride > 1) {
+				for (uint32 i = 0; i < Columns; ++i) {
+					ColorRow[i] = Color[i * Stride];
+				}
+				Color = ColorRow.GetData();
+			}
+			RowPoints[Row] = BackProjection::ProjectRow(Depth, Color, RaysX, RaysY[Row], Columns, MinDepth, MaxDepth,
+				Organized, Points + Row * Columns);
+		}
+	});
+
+	if (Organized) {
+		return Columns * Priv->Rows;
+	}
+
+	// Rows are moved down in order, so no row is overwritten before it was moved
+	uint32 Total = 0;
+	for (uint32 Row = 0; Row < Priv->Rows; ++Row) {
+		if (Total != Row * Columns) {
+			FMemory::Memmove(Points + Total, Points + Row * Columns, RowPoints[Row] * sizeof(BackProjection::Point));
+		}
+		Total += RowPoints[Row];
+	}
+	return Total;
+}
+
+void URGBDComponent::ProcessFrame()
+{
+	FrameInfo Info;
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> WaitLock(Priv->WaitFrame);
+			if (!Priv->DoFrame) {
+				Priv->Converting = false;
+				break;
+			}
+			Priv->DoFrame = false;
+			Swap(Priv->ProcessingColor, Priv->PendingColor);
+			Swap(Priv->ProcessingDepth, Priv->PendingDepth);
+			Info = Priv->PendingInfo;
+		}
+
+		// Converting outside of the lock, so that the game thread can submit the next frame meanwhile.
+		// Only the parts with subscribers are converted, the point cloud is projected from the depth image.
+		uint32 Contents = 0;
+		Contents |= Priv->PublishColor ? ContentColor : 0;
+		Contents |= Priv->PublishDepth ? ContentDepth : 0;
+		Contents |= Priv->DoPointCloud && Priv->PublishPointCloud ? ContentPointCloud | ContentDepth : 0;
+		{
+			MEASURE_STAGE(Priv->Stages, Conversion);
+			PipelineTimer WorkerTime(Priv->Times, true);
+			ToImages(Priv->ProcessingColor, Priv->ProcessingDepth, Priv->Buffer->Image, Contents);
+		}
+		Priv->Buffer->HeaderWrite->Contents = Contents;
+		Priv->Buffer->HeaderWrite->Points = 0;
+		if (Contents & ContentPointCloud) {
+			MEASURE_STAGE(Priv->Stages, PointCloud);
+			const double Start = FPlatformTime::Seconds();
+			const uint8 *DepthBytes = Priv->Buffer->Image + (Priv->OffsetDepth - Priv->Buffer->OffsetImage);
+			uint8 *PointBytes = Priv->Buffer->Image + (Priv->OffsetPoints - Priv->Buffer->OffsetImage);
+			const uint32 Points = ToPointCloud(Priv->ProcessingColor, DepthBytes, PointBytes);
+			Priv->Buffer->HeaderWrite->Points = Points;
+
+			const double Now = FPlatformTime::Seconds();
+			++Priv->StatsClouds;
+			Priv->StatsPoints += Points;
+			Priv->StatsTime += Now - Start;
+			if (Now - Priv->StatsStart >= 1.0) {
+				UE_LOG(LogTemp, Log, TEXT("Projected %.1f point clouds/s, %.0f points/cloud, %.2f ms/cloud, %.1f Mpoints/s."),
+					Priv->StatsClouds / (Now - Priv->StatsStart), (double)Priv->StatsPoints / Priv->StatsClouds,
+					Priv->StatsTime * 1000 / Priv->StatsClouds, Priv->StatsClouds * (double)Priv->Columns * Priv->Rows / Priv->StatsTime / 1e6);
+				Priv->StatsStart = Now;
+				Priv->StatsTime = 0;
+				Priv->StatsClouds = 0;
+				Priv->StatsPoints = 0;
+			}
+		}
+		Priv->Buffer->HeaderWrite->TimestampCapture = Info.TimestampCapture;
+		Priv->Buffer->HeaderWrite->ClockCapture = Info.ClockCapture;
+		Priv->Buffer->HeaderWrite->Translation = Info.Translation;
+		Priv->Buffer->HeaderWrite->Rotation = Info.Rotation;
+
+		// Complete Buffer, waits for a slot that no message leases anymore
+		{
+			MEASURE_STAGE(Priv->Stages, BufferWait);
+			Priv->Buffer->DoneWriting();
+		}
+
+		// Starting the publishing job unless it is running already
+		if (Priv->PublishRequests.fetch_add(1) == 0) {
+			Priv->Pool->Submit(Priv->Jobs, [this]() { PublishFrame(); });
+		}
+	}
+}
@@ -2,12 +2,41 @@
 
 #include "ROSIntegrationVision.h"
 
+#include "Containers/Ticker.h"
+#include "Misc/ConfigCacheIni.h"
+
+#include "CaptureScheduler.h"
+#include "SubscriberCounts.h"
+#include "SubscriberPoller.h"
+#include "WorkerPool.h"
+
 #define LOCTEXT_NAMESPACE "FROSIntegrationVisionModule"
 
 void FROSIntegrationVisionModule::StartupModule()
 {
 	// This code will execute after your module is loaded into memory; the exact timing is specified in the .uplugin file per-module
 	UE_LOG(LogTemp, Warning, TEXT("Starting Up Vision Component"));
+
+	int32 WorkerThreads = 0;
+	FString WorkerAffinityMask;
+	GConfig->GetInt(TEXT("ROSIntegrationVision"), TEXT("WorkerThreads"), WorkerThreads, GEngineIni);
+	GConfig->GetString(TEXT("ROSIntegrationVision"), TEXT("WorkerAffinityMask"), WorkerAffinityMask, GEngineIni);
+	const uint64 AffinityMask = FCString::Strtoui64(*WorkerAffinityMask, nullptr, 16);
+
+	Pool = new WorkerPool(FMath::Max(WorkerThreads, 0), AffinityMask);
+	UE_LOG(LogTemp, Log, TEXT("Started %u vision workers, affinity mask 0x%llx"), Pool->GetNumThreads(), AffinityMask);
+
+	float ReadbackBudgetMB = 0;
+	GConfig->GetFloat(TEXT("ROSIntegrationVision"), TEXT("ReadbackBudgetMB"), ReadbackBudgetMB, GEngineIni);
+	Scheduler = new CaptureScheduler((uint64)(FMath::Max(ReadbackBudgetMB, 0.f) * 1024 * 1024));
+	SchedulerTick = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(Scheduler, &CaptureScheduler::Tick));
+
+	Subscribers = new SubscriberCounts();
+
+	float SubscriberPollSeconds = 1;
+	GConfig->GetFloat(TEXT("ROSIntegrationVision"), TEXT("SubscriberPollSeconds"), SubscriberPollSeconds, GEngineIni);
+	Poller = new SubscriberPoller(*Subscribers, FMath::Max(SubscriberPollSeconds, 0.f));
+	PollerTick = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(Poller, &SubscriberPoller::Tick));
 }
 
 void FROSIntegrationVisionModule::ShutdownModule()
@@ -15,6 +44,44 @@ void FROSIntegrationVisionModule::ShutdownModule()
 	// This function may be called during shutdown to clean up your module.  For modules that support dynamic reloading,
 	// we call this function before unloading the module.
 	UE_LOG(LogTemp, Warning, TEXT("Shutting down Vision Component"));
+
+	FTicker::GetCoreTicker().RemoveTicker(SchedulerTick);
+	delete Scheduler;
+	Scheduler = nullptr;
+	// The poller writes into the counts, so it goes first
+	FTicker::GetCoreTicker().RemoveTicker(PollerTick);
+	delete Poller;
+	Poller = nullptr;
+	delete Subscribers;
+	Subscribers = nullptr;
+
+	// The components drained their jobs in EndPlay already
+	delete Pool;
+	Pool = nullptr;
+}
+
+WorkerPool &FROSIntegrationVisionModule::GetWorkerPool()
+{
+	check(Pool);
+	return *Pool;
+}
+
+CaptureScheduler &FROSIntegrationVisionModule::GetScheduler()
+{
+	check(Scheduler);
+	return *Scheduler;
+}
+
+SubscriberCounts &FROSIntegrationVisionModule::GetSubscriberCounts()
+{
+	check(Subscribers);
+	return *Subscribers;
+}
+
+SubscriberPoller &FROSIntegrationVisionModule::GetSubscriberPoller()
+{
+	check(Poller);
+	return *Poller;
 }
 
 #undef LOCTEXT_NAMESPACE
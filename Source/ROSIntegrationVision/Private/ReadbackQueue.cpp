@@ -0,0 +1,199 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "ReadbackQueue.h"
+
+#include "RHICommandList.h"
+#include "TextureResource.h"
+
+namespace
+{
+  // Copies the render target into the staging texture on the GPU, the staging texture is created for the first
+  // frame and again if the size or format of the render target changed
+  void CopyToStaging(FRHICommandListImmediate &RHICmdList, FTextureRenderTargetResource *Resource, FTexture2DRHIRef &Staging)
+  {
+    FRHITexture *Source = Resource->GetRenderTargetTexture();
+    const FIntPoint Size = Resource->GetSizeXY();
+    if (!Staging.IsValid() || Staging->GetSizeXY() != Size || Staging->GetFormat() != Source->GetFormat())
+    {
+      FRHIResourceCreateInfo CreateInfo;
+      Staging = RHICreateTexture2D(Size.X, Size.Y, Source->GetFormat(), 1, 1, TexCreate_CPUReadback, CreateInfo);
+    }
+    RHICmdList.CopyTexture(Source, Staging, FRHICopyTextureInfo());
+  }
+
+  // Copies the rows of a staging texture whose copy is complete into Pixels, mapping does not wait for the GPU
+  template<typename Pixel>
+  void ReadStaging(FRHICommandListImmediate &RHICmdList, FRHITexture2D *Staging, FRHIGPUFence *GPUFence, TArray<Pixel> &Pixels)
+  {
+    check(GPixelFormats[Staging->GetFormat()].BlockBytes == sizeof(Pixel));
+    const FIntPoint Size = Staging->GetSizeXY();
+    check(Pixels.Num() == Size.X * Size.Y);
+
+    // The rows of the mapping may be padded, its width is the row pitch in pixels
+    void *Data = nullptr;
+    int32 Pitch = 0, Rows = 0;
+    RHICmdList.MapStagingSurface(Staging, GPUFence, Data, Pitch, Rows);
+    for (int32 y = 0; y < Size.Y; ++y)
+    {
+      FMemory::Memcpy(Pixels.GetData() + y * Size.X, static_cast<const Pixel*>(Data) + y * Pitch, Size.X * sizeof(Pixel));
+    }
+    RHICmdList.UnmapStagingSurface(Staging);
+  }
+}
+
+ReadbackQueue::ReadbackQueue(const uint32 Depth, const uint32 Width, const uint32 Height, const Content Targets) :
+  Head(0), Count(0), Targets(Targets)
+{
+  check(Depth > 0);
+  for (uint32 i = 0; i < Depth; ++i)
+  {
+    Frame *NewFrame = new Frame();
+    if (Targets != Content::Float16)
+    {
+      NewFrame->PixelsLDR.AddUninitialized(Width * Height);
+    }
+    if (Targets != Content::LDR)
+    {
+      NewFrame->Pixels.AddUninitialized(Width * Height);
+    }
+    Frames.Add(TUniquePtr<Frame>(NewFrame));
+  }
+}
+
+ReadbackQueue::~ReadbackQueue()
+{
+  Flush();
+}
+
+bool ReadbackQueue::IsEmpty() const
+{
+  return Count == 0;
+}
+
+bool ReadbackQueue::IsFull() const
+{
+  return Count == (uint32)Frames.Num();
+}
+
+ReadbackQueue::Frame &ReadbackQueue::Reserve()
+{
+  check(!IsFull());
+  Frame &NextFrame = *Frames[(Head + Count) % Frames.Num()];
+  ++Count;
+  NextFrame.Ready = false;
+  return NextFrame;
+}
+
+ReadbackQueue::Frame &ReadbackQueue::Enqueue(UTextureRenderTarget2D *RenderTarget)
+{
+  check(Targets != Content::LDRAndFloat16);
+  Frame &Next = Reserve();
+
+  // The copy is enqueued after the commands of the scene capture that the caller triggered for this frame, so it
+  // gets the image of the stamp and pose the caller fills in. The game thread only records a fence and continues.
+  FTextureRenderTargetResource *RenderTargetResource = RenderTarget->GameThread_GetRenderTargetResource();
+  Frame *Pending = &Next;
+  ENQUEUE_RENDER_COMMAND(ReadbackQueueCopy)(
+    [RenderTargetResource, Pending](FRHICommandListImmediate &RHICmdList)
+    {
+      if (!Pending->GPUFence.IsValid())
+      {
+        Pending->GPUFence = RHICreateGPUFence(TEXT("ReadbackQueue"));
+      }
+      Pending->GPUFence->Clear();
+      CopyToStaging(RHICmdList, RenderTargetResource, Pending->Staging);
+      RHICmdList.WriteGPUFence(Pending->GPUFence);
+    });
+  Next.Fence.BeginFence();
+  return Next;
+}
+
+ReadbackQueue::Frame &ReadbackQueue::Enqueue(UTextureRenderTarget2D *ColorTarget, UTextureRenderTarget2D *DepthTarget)
+{
+  check(Targets == Content::LDRAndFloat16);
+  Frame &Next = Reserve();
+
+  // Both targets were rendered in the same frame and are copied together, so one fence covers both
+  FTextureRenderTargetResource *ColorResource = ColorTarget->GameThread_GetRenderTargetResource();
+  FTextureRenderTargetResource *DepthResource = DepthTarget->GameThread_GetRenderTargetResource();
+  Frame *Pending = &Next;
+  ENQUEUE_RENDER_COMMAND(ReadbackQueueCopyRGBD)(
+    [ColorResource, DepthResource, Pending](FRHICommandListImmediate &RHICmdList)
+    {
+      if (!Pending->GPUFence.IsValid())
+      {
+        Pending->GPUFence = RHICreateGPUFence(TEXT("ReadbackQueue"));
+      }
+      Pending->GPUFence->Clear();
+      CopyToStaging(RHICmdList, ColorResource, Pending->Staging);
+      CopyToStaging(RHICmdList, DepthResource, Pending->StagingDepth);
+      RHICmdList.WriteGPUFence(Pending->GPUFence);
+    });
+  Next.Fence.BeginFence();
+  return Next;
+}
+
+void ReadbackQueue::EnqueueResolve(Frame &Pending)
+{
+  Frame *Polled = &Pending;
+  const Content Read = Targets;
+  ENQUEUE_RENDER_COMMAND(ReadbackQueueResolve)(
+    [Polled, Read](FRHICommandListImmediate &RHICmdList)
+    {
+      if (!Polled->GPUFence->Poll())
+      {
+        return;
+      }
+      if (Read == Content::Float16)
+      {
+        ReadStaging(RHICmdList, Polled->Staging, Polled->GPUFence, Polled->Pixels);
+      }
+      else
+      {
+        ReadStaging(RHICmdList, Polled->Staging, Polled->GPUFence, Polled->PixelsLDR);
+      }
+      if (Read == Content::LDRAndFloat16)
+      {
+        ReadStaging(RHICmdList, Polled->StagingDepth, Polled->GPUFence, Polled->Pixels);
+      }
+      Polled->Ready.store(true, std::memory_order_release);
+    });
+  Pending.Fence.BeginFence();
+}
+
+ReadbackQueue::Frame *ReadbackQueue::Peek()
+{
+  if (IsEmpty())
+  {
+    return nullptr;
+  }
+  Frame &Oldest = *Frames[Head];
+  if (Oldest.Ready.load(std::memory_order_acquire))
+  {
+    return &Oldest;
+  }
+
+  // One command per frame at a time, the next poll is enqueued once the rendering thread passed the previous one
+  if (Oldest.Fence.IsFenceComplete())
+  {
+    EnqueueResolve(Oldest);
+  }
+  return nullptr;
+}
+
+void ReadbackQueue::Pop()
+{
+  check(!IsEmpty());
+  Head = (Head + 1) % Frames.Num();
+  --Count;
+}
+
+void ReadbackQueue::Flush()
+{
+  // Waits for the commands enqueued for the frames, their copies may still be pending on the GPU and are dropped
+  // with the staging textures
+  for (uint32 i = 0; i < Count; ++i)
+  {
+    Frames[(Head + i) % Frames.Num()]->Fence.Wait();
+  }
+}
@@ -0,0 +1,99 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RenderingThread.h"
+#include "RHI.h"
+#include "Engine/TextureRenderTarget2D.h"
+
+#include <atomic>
+
+#include "ROSTime.h"
+
+#include "PacketBuffer.h"
+
+/**
+ * Capture information of a frame that has to travel together with its image data, so that a frame published
+ * later still carries the stamp and the camera pose from the moment it was captured.
+ */
+struct FrameInfo
+{
+  FROSTime Time;                       // Stamp used for the published ROS messages
+  uint64_t TimestampCapture;           // Timestamp from capture
+  PacketBuffer::Vector Translation;    // Translation of the camera in ROS coordinates
+  PacketBuffer::Quaternion Rotation;   // Rotation of the camera in ROS coordinates
+  uint64_t ClockCapture;               // StopTime::Timestamp at capture for the stage latencies
+};
+
+/**
+ * Ring of in-flight readbacks from a render target. Enqueue copies the render target into a CPU readable staging
+ * texture of the frame on the GPU and writes a GPU fence after the copy, neither the game thread nor the rendering
+ * thread wait for it. Peek polls the fence of the oldest frame on the rendering thread, the staging texture is only
+ * mapped and copied into the pixels once the GPU signalled it, so up to Depth copies overlap with rendering.
+ * All methods have to be called from the game thread.
+ */
+class ROSINTEGRATIONVISION_API ReadbackQueue
+{
+public:
+  // Render targets that are read for each frame
+  enum class Content
+  {
+    Float16,       // One Float16 render target into Pixels
+    LDR,           // One 8 bit render target into PixelsLDR
+    LDRAndFloat16  // An 8 bit color target into PixelsLDR and a Float16 depth target into Pixels, with one fence
+  };
+
+  struct Frame : public FrameInfo
+  {
+    TArray<FFloat16Color> Pixels;
+    TArray<FColor> PixelsLDR;  // Used instead of Pixels for 8 bit render targets
+
+    // Staging textures of the color or only target and of the depth target, reused while the size stays the same
+    FTexture2DRHIRef Staging, StagingDepth;
+    // Signalled by the GPU once the copies into the staging textures are done
+    FGPUFenceRHIRef GPUFence;
+    // Passed by the rendering thread after the last command enqueued for the frame, the copy or a poll
+    FRenderCommandFence Fence;
+    // Set by the rendering thread once the pixels were copied out of the staging textures
+    std::atomic<bool> Ready;
+  };
+
+private:
+  TArray<TUniquePtr<Frame>> Frames;
+  uint32 Head, Count;
+  const Content Targets;
+
+  // Takes the next frame of the ring for a readback
+  Frame &Reserve();
+
+  // Enqueues a poll of the GPU fence of the frame that maps the staging textures once it is signalled
+  void EnqueueResolve(Frame &Pending);
+
+public:
+  // Creates a queue with Depth frames that can be in flight at the same time
+  ReadbackQueue(const uint32 Depth, const uint32 Width, const uint32 Height, const Content Targets = Content::Float16);
+
+  // Waits for all readbacks in flight, the render thread must not write into a destroyed frame
+  ~ReadbackQueue();
+
+  bool IsEmpty() const;
+  bool IsFull() const;
+
+  // Enqueues a readback of the render target and returns the frame it will be written to, so that the
+  // caller can fill in the capture information. Must not be called if the queue is full.
+  Frame &Enqueue(UTextureRenderTarget2D *RenderTarget);
+
+  // Same as Enqueue for LDRAndFloat16, both targets are read in the same render command
+  Frame &Enqueue(UTextureRenderTarget2D *ColorTarget, UTextureRenderTarget2D *DepthTarget);
+
+  // Returns the oldest frame if its readback is completed, nullptr otherwise. Polls the copy of the oldest frame,
+  // so it has to be called regularly, like once per tick.
+  Frame *Peek();
+
+  // Removes the oldest frame from the queue
+  void Pop();
+
+  // Blocks until all readbacks in flight are completed
+  void Flush();
+};
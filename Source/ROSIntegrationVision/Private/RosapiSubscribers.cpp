@@ -0,0 +1,50 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RosapiSubscribers.h"
+
+URosapiSubscribersConverter::URosapiSubscribersConverter(const FObjectInitializer &ObjectInitializer)
+  : Super(ObjectInitializer)
+{
+  _ServiceType = TEXT("rosapi/Subscribers");
+}
+
+bool URosapiSubscribersConverter::ConvertOutgoingRequest(TSharedPtr<FROSBaseServiceRequest> Request, bson_t **BSONRequest)
+{
+  auto ServiceRequest = StaticCastSharedPtr<rosapi::FSubscribersRequest>(Request);
+  *BSONRequest = BCON_NEW("topic", BCON_UTF8(TCHAR_TO_UTF8(*ServiceRequest->topic)));
+  return true;
+}
+
+bool URosapiSubscribersConverter::ConvertIncomingResponse(const ROSBridgeServiceResponseMsg &RES, TSharedRef<TSharedPtr<FROSBaseServiceResponse>> Response)
+{
+  TSharedPtr<rosapi::FSubscribersResponse> ServiceResponse(new rosapi::FSubscribersResponse);
+  *Response = ServiceResponse;
+
+  // The names of the subscribed nodes are in the array values.subscribers
+  bson_iter_t Iter, Subscribers, Name;
+  if (!RES.full_msg_bson_ || !bson_iter_init(&Iter, RES.full_msg_bson_) ||
+      !bson_iter_find_descendant(&Iter, "values.subscribers", &Subscribers) || !BSON_ITER_HOLDS_ARRAY(&Subscribers) ||
+      !bson_iter_recurse(&Subscribers, &Name))
+  {
+    UE_LOG(LogTemp, Warning, TEXT("rosapi/Subscribers response without a subscribers array."));
+    return false;
+  }
+  while (bson_iter_next(&Name))
+  {
+    if (BSON_ITER_HOLDS_UTF8(&Name))
+    {
+      ServiceResponse->subscribers.Add(UTF8_TO_TCHAR(bson_iter_utf8(&Name, nullptr)));
+    }
+  }
+  return true;
+}
+
+TSharedPtr<FROSBaseServiceRequest> URosapiSubscribersConverter::AllocateConcreteRequest()
+{
+  return MakeShareable(new rosapi::FSubscribersRequest);
+}
+
+TSharedPtr<FROSBaseServiceResponse> URosapiSubscribersConverter::AllocateConcreteResponse()
+{
+  return MakeShareable(new rosapi::FSubscribersResponse);
+}
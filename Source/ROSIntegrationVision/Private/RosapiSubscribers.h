@@ -0,0 +1,44 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "ROSBaseServiceRequest.h"
+#include "ROSBaseServiceResponse.h"
+#include "Conversion/Services/BaseRequestConverter.h"
+
+#include "RosapiSubscribers.generated.h"
+
+// rosapi/Subscribers, the nodes subscribed to a topic as rosapi reports them
+namespace rosapi
+{
+  class FSubscribersRequest : public FROSBaseServiceRequest
+  {
+  public:
+    FString topic;
+  };
+
+  class FSubscribersResponse : public FROSBaseServiceResponse
+  {
+  public:
+    TArray<FString> subscribers;
+  };
+}
+
+/**
+ * Converts the rosapi/Subscribers service for the bridge. ROSIntegration finds the converters of all loaded modules
+ * by their class, so the vision module can call the service without changes to ROSIntegration.
+ */
+UCLASS()
+class ROSINTEGRATIONVISION_API URosapiSubscribersConverter : public UBaseRequestConverter
+{
+  GENERATED_UCLASS_BODY()
+
+public:
+  virtual bool ConvertOutgoingRequest(TSharedPtr<FROSBaseServiceRequest> Request, bson_t **BSONRequest) override;
+  virtual bool ConvertIncomingResponse(const ROSBridgeServiceResponseMsg &RES, TSharedRef<TSharedPtr<FROSBaseServiceResponse>> Response) override;
+
+  virtual TSharedPtr<FROSBaseServiceRequest> AllocateConcreteRequest() override;
+  virtual TSharedPtr<FROSBaseServiceResponse> AllocateConcreteResponse() override;
+};
@@ -0,0 +1,339 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "SharedFrameRing.h"
+
+#include <chrono>
+#include <climits>
+#include <cstring>
+
+#if defined(__linux__)
+  #include <fcntl.h>
+  #include <cerrno>
+  #include <linux/futex.h>
+  #include <signal.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+  #define SHARED_FRAMES_SUPPORTED 1
+#else
+  #define SHARED_FRAMES_SUPPORTED 0
+#endif
+
+namespace
+{
+  uint32_t AlignUp(const uint32_t Value)
+  {
+    return (Value + SharedFrameRing::Alignment - 1) / SharedFrameRing::Alignment * SharedFrameRing::Alignment;
+  }
+
+#if SHARED_FRAMES_SUPPORTED
+  // Shared futex, the ring is mapped by several processes
+  void WakeAll(std::atomic<uint32_t> &Word)
+  {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&Word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+  }
+
+  void WaitFor(const std::atomic<uint32_t> &Word, const uint32_t Expected, const int32_t TimeoutMs)
+  {
+    timespec Timeout;
+    Timeout.tv_sec = TimeoutMs / 1000;
+    Timeout.tv_nsec = (TimeoutMs % 1000) * 1000000L;
+    syscall(SYS_futex, reinterpret_cast<const uint32_t*>(&Word), FUTEX_WAIT, Expected, &Timeout, nullptr, 0);
+  }
+
+  // Whether the ring Name was closed or its writer process is gone, so that it may be replaced. Anything else
+  // under the name, including a ring that is being initialized, belongs to someone else.
+  bool IsAbandoned(const std::string &Name)
+  {
+    const int File = shm_open(Name.c_str(), O_RDONLY, 0);
+    if (File < 0)
+    {
+      return errno == ENOENT;
+    }
+    struct stat Status;
+    void *Mapped = MAP_FAILED;
+    if (fstat(File, &Status) == 0 && (size_t)Status.st_size >= sizeof(SharedFrameRing::Ring))
+    {
+      Mapped = mmap(nullptr, sizeof(SharedFrameRing::Ring), PROT_READ, MAP_SHARED, File, 0);
+    }
+    close(File);
+    if (Mapped == MAP_FAILED)
+    {
+      return false;
+    }
+
+    const SharedFrameRing::Ring *Existing = static_cast<const SharedFrameRing::Ring*>(Mapped);
+    const bool Abandoned = Existing->Magic.load(std::memory_order_acquire) == SharedFrameRing::Magic &&
+      (Existing->Closed.load(std::memory_order_acquire) != 0 || (kill(Existing->Writer, 0) != 0 && errno == ESRCH));
+    munmap(Mapped, sizeof(SharedFrameRing::Ring));
+    return Abandoned;
+  }
+#endif
+}
+
+SharedFrameWriter::SharedFrameWriter() : Memory(nullptr), Size(0), Header(nullptr), Sequence(0)
+{
+}
+
+SharedFrameWriter::~SharedFrameWriter()
+{
+  Close();
+}
+
+bool SharedFrameWriter::Open(const std::string &_Name, const uint32_t NumSlots, const uint32_t PacketSize,
+                             const uint32_t OffsetImage, const uint32_t Width, const uint32_t Height,
+                             const uint32_t Bytes, const char *Encoding)
+{
+  Close();
+#if SHARED_FRAMES_SUPPORTED
+  if (NumSlots < 2)
+  {
+    return false;
+  }
+
+  const uint32_t OffsetPacket = AlignUp(sizeof(SharedFrameRing::Slot));
+  const uint32_t SlotSize = AlignUp(OffsetPacket + PacketSize);
+  const size_t Total = AlignUp(sizeof(SharedFrameRing::Ring)) + (size_t)NumSlots * SlotSize;
+
+  // A ring left behind by a crashed writer is replaced, readers still mapping it keep their copy. A ring of a
+  // running writer is not taken over.
+  int File = shm_open(_Name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (File < 0 && errno == EEXIST && IsAbandoned(_Name))
+  {
+    shm_unlink(_Name.c_str());
+    File = shm_open(_Name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  }
+  if (File < 0)
+  {
+    return false;
+  }
+  if (ftruncate(File, (off_t)Total) != 0)
+  {
+    close(File);
+    shm_unlink(_Name.c_str());
+    return false;
+  }
+  void *Mapped = mmap(nullptr, Total, PROT_READ | PROT_WRITE, MAP_SHARED, File, 0);
+  close(File);
+  if (Mapped == MAP_FAILED)
+  {
+    shm_unlink(_Name.c_str());
+    return false;
+  }
+
+  // ftruncate zeroed the memory, so all slots are unlocked and nothing is published
+  Name = _Name;
+  Memory = static_cast<uint8_t*>(Mapped);
+  Size = Total;
+  Sequence = 0;
+  Header = reinterpret_cast<SharedFrameRing::Ring*>(Memory);
+  Header->Version = SharedFrameRing::Version;
+  Header->NumSlots = NumSlots;
+  Header->SlotSize = SlotSize;
+  Header->OffsetPacket = OffsetPacket;
+  Header->PacketSize = PacketSize;
+  Header->OffsetImage = OffsetImage;
+  Header->Width = Width;
+  Header->Height = Height;
+  Header->Bytes = Bytes;
+  std::strncpy(Header->Encoding, Encoding, sizeof(Header->Encoding) - 1);
+  Header->Writer = (int32_t)getpid();
+  Header->Magic.store(SharedFrameRing::Magic, std::memory_order_release);
+  return true;
+#else
+  return false;
+#endif
+}
+
+void SharedFrameWriter::Write(const uint8_t *Packet)
+{
+  if (!Header)
+  {
+    return;
+  }
+
+  ++Sequence;
+  uint8_t *Target = Memory + AlignUp(sizeof(SharedFrameRing::Ring)) + (size_t)((Sequence - 1) % Header->NumSlots) * Header->SlotSize;
+  SharedFrameRing::Slot &Current = *reinterpret_cast<SharedFrameRing::Slot*>(Target);
+
+  // Readers that see the odd value, or it changing after they read, drop the frame
+  Current.Lock.store(2 * Sequence - 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(Target + Header->OffsetPacket, Packet, Header->PacketSize);
+
+  // The sending time is the wall clock in nanoseconds, for measuring the latency on the reader side
+  PacketBuffer::PacketHeader *Sent = reinterpret_cast<PacketBuffer::PacketHeader*>(Target + Header->OffsetPacket);
+  Sent->TimestampSent = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+
+  Current.Lock.store(2 * Sequence, std::memory_order_release);
+  Header->Published.store(Sequence, std::memory_order_release);
+  Header->Notify.fetch_add(1, std::memory_order_release);
+#if SHARED_FRAMES_SUPPORTED
+  WakeAll(Header->Notify);
+#endif
+}
+
+void SharedFrameWriter::Close()
+{
+#if SHARED_FRAMES_SUPPORTED
+  if (!Header)
+  {
+    return;
+  }
+
+  Header->Closed.store(1, std::memory_order_release);
+  Header->Notify.fetch_add(1, std::memory_order_release);
+  WakeAll(Header->Notify);
+  munmap(Memory, Size);
+  shm_unlink(Name.c_str());
+#endif
+  Memory = nullptr;
+  Header = nullptr;
+  Size = 0;
+}
+
+bool SharedFrameWriter::IsOpen() const
+{
+  return Header != nullptr;
+}
+
+SharedFrameReader::SharedFrameReader() : Memory(nullptr), Size(0), Header(nullptr), Last(0), Skipped(0)
+{
+}
+
+SharedFrameReader::~SharedFrameReader()
+{
+  Close();
+}
+
+bool SharedFrameReader::Open(const std::string &Name)
+{
+  Close();
+#if SHARED_FRAMES_SUPPORTED
+  const int File = shm_open(Name.c_str(), O_RDONLY, 0);
+  if (File < 0)
+  {
+    return false;
+  }
+  struct stat Status;
+  if (fstat(File, &Status) != 0 || (size_t)Status.st_size < sizeof(SharedFrameRing::Ring))
+  {
+    close(File);
+    return false;
+  }
+  void *Mapped = mmap(nullptr, (size_t)Status.st_size, PROT_READ, MAP_SHARED, File, 0);
+  close(File);
+  if (Mapped == MAP_FAILED)
+  {
+    return false;
+  }
+
+  Memory = static_cast<uint8_t*>(Mapped);
+  Size = (size_t)Status.st_size;
+  Header = reinterpret_cast<const SharedFrameRing::Ring*>(Memory);
+  const bool Valid = Header->Magic.load(std::memory_order_acquire) == SharedFrameRing::Magic &&
+    Header->Version == SharedFrameRing::Version && Header->NumSlots >= 2 &&
+    AlignUp(sizeof(SharedFrameRing::Ring)) + (size_t)Header->NumSlots * Header->SlotSize <= Size &&
+    Header->OffsetPacket + Header->PacketSize <= Header->SlotSize;
+  if (!Valid)
+  {
+    Close();
+    return false;
+  }
+
+  // Frames written before opening are not returned, only the newest one
+  const uint64_t Published = Header->Published.load(std::memory_order_acquire);
+  Last = Published > 0 ? Published - 1 : 0;
+  Skipped = 0;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void SharedFrameReader::Close()
+{
+#if SHARED_FRAMES_SUPPORTED
+  if (Memory)
+  {
+    munmap(Memory, Size);
+  }
+#endif
+  Memory = nullptr;
+  Header = nullptr;
+  Size = 0;
+}
+
+const SharedFrameRing::Slot &SharedFrameReader::GetSlot(const uint64_t Sequence) const
+{
+  return *reinterpret_cast<const SharedFrameRing::Slot*>(Memory + AlignUp(sizeof(SharedFrameRing::Ring)) + (size_t)((Sequence - 1) % Header->NumSlots) * Header->SlotSize);
+}
+
+bool SharedFrameReader::Wait(Frame &Next, const int32_t TimeoutMs)
+{
+  if (!Header)
+  {
+    return false;
+  }
+
+  const auto Deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TimeoutMs);
+  while (true)
+  {
+    // The futex word is read first, so a frame published after the checks below wakes the wait
+    const uint32_t Notify = Header->Notify.load(std::memory_order_acquire);
+    const uint64_t Published = Header->Published.load(std::memory_order_acquire);
+    if (Published > Last)
+    {
+      const SharedFrameRing::Slot &Current = GetSlot(Published);
+      if (Current.Lock.load(std::memory_order_acquire) == 2 * Published)
+      {
+        const uint8_t *Packet = reinterpret_cast<const uint8_t*>(&Current) + Header->OffsetPacket;
+        Next.Sequence = Published;
+        Next.Header = reinterpret_cast<const PacketBuffer::PacketHeader*>(Packet);
+        Next.Image = Packet + Header->OffsetImage;
+        Skipped += Published - Last - 1;
+        Last = Published;
+        return true;
+      }
+      // Overwritten right away, the next frame is published soon
+      continue;
+    }
+    if (IsClosed())
+    {
+      return false;
+    }
+
+    const auto Now = std::chrono::steady_clock::now();
+    if (Now >= Deadline)
+    {
+      return false;
+    }
+#if SHARED_FRAMES_SUPPORTED
+    WaitFor(Header->Notify, Notify, (int32_t)std::chrono::duration_cast<std::chrono::milliseconds>(Deadline - Now).count() + 1);
+#endif
+  }
+}
+
+bool SharedFrameReader::IsValid(const Frame &Current) const
+{
+  // Orders the reads of the frame data before the check of the lock
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return Header && GetSlot(Current.Sequence).Lock.load(std::memory_order_relaxed) == 2 * Current.Sequence;
+}
+
+bool SharedFrameReader::IsClosed() const
+{
+  return !Header || Header->Closed.load(std::memory_order_acquire) != 0;
+}
+
+const SharedFrameRing::Ring *SharedFrameReader::GetRing() const
+{
+  return Header;
+}
+
+uint64_t SharedFrameReader::GetSkipped() const
+{
+  return Skipped;
+}
@@ -0,0 +1,135 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "PacketBuffer.h"
+
+/**
+ * Ring of frames in POSIX shared memory for readers on the same host, which map the frames instead of receiving
+ * them through rosbridge. A component copies every completed packet, the PacketBuffer::PacketHeader followed by
+ * the image, into the next slot of the ring. Readers use the frame in place and validate it afterwards.
+ *
+ * Memory layout: a Ring header, followed by NumSlots slots of SlotSize bytes. Each slot starts with a Slot header,
+ * the packet follows at OffsetPacket. Every slot is protected by a sequence lock, the writer sets it to
+ * 2 * Sequence - 1 while it copies frame Sequence and to 2 * Sequence once the frame is complete. Readers wait on
+ * the Notify futex, which the writer increments for every frame.
+ * The writer never waits for readers, a reader has to finish a frame before NumSlots - 1 newer ones are written.
+ * SharedFrameRing.cpp does not depend on the engine, consumers build it with PacketBuffer.h and the engine shim
+ * of the benchmark. Only Linux is supported, Open fails on the other platforms.
+ */
+namespace SharedFrameRing
+{
+  const uint32_t Magic = 0x53564952; // "RIVS"
+  const uint32_t Version = 1;
+  const uint32_t Alignment = 64;
+
+  struct alignas(64) Ring
+  {
+    std::atomic<uint32_t> Magic;      // Set last, once the ring is initialized
+    uint32_t Version;
+    uint32_t NumSlots;
+    uint32_t SlotSize;                // Bytes per slot including the slot header
+    uint32_t OffsetPacket;            // Offset of the packet in a slot
+    uint32_t PacketSize;              // Size of the packet, PacketHeader and image
+    uint32_t OffsetImage;             // Offset of the image in the packet
+    uint32_t Width;
+    uint32_t Height;
+    uint32_t Bytes;                   // Bytes per pixel
+    char Encoding[16];                // Encoding of the image like in sensor_msgs/Image
+    std::atomic<uint64_t> Published;  // Sequence of the newest complete frame, starting at 1
+    std::atomic<uint32_t> Notify;     // Futex word, incremented for every frame and on close
+    std::atomic<uint32_t> Closed;     // Set when the writer is gone, readers have to open the ring again
+    int32_t Writer;                   // Process id of the writer, a ring of a crashed writer may be replaced
+  };
+
+  struct alignas(64) Slot
+  {
+    std::atomic<uint64_t> Lock;
+  };
+
+  static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+                "The atomics of the ring have to be lock-free to work across processes");
+}
+
+// Writes the frames of a component, Write must only be called from one thread at a time
+class ROSINTEGRATIONVISION_API SharedFrameWriter
+{
+private:
+  std::string Name;
+  uint8_t *Memory;
+  size_t Size;
+  SharedFrameRing::Ring *Header;
+  uint64_t Sequence;
+
+public:
+  SharedFrameWriter();
+
+  // Closes the ring
+  ~SharedFrameWriter();
+
+  // Creates the shared memory object Name, like "/unreal_camera". An existing ring is only replaced if it was
+  // closed or its writer process is gone. Returns false if the name is in use, creating failed or the platform is
+  // not supported.
+  bool Open(const std::string &Name, const uint32_t NumSlots, const uint32_t PacketSize, const uint32_t OffsetImage,
+            const uint32_t Width, const uint32_t Height, const uint32_t Bytes, const char *Encoding);
+
+  // Copies a packet of PacketSize bytes into the next slot and wakes the readers
+  void Write(const uint8_t *Packet);
+
+  // Wakes the readers with Closed set and removes the shared memory object, readers keep their mapping
+  void Close();
+
+  bool IsOpen() const;
+};
+
+/**
+ * Maps a ring written by a component read-only. Frames point into the mapping, nothing is copied. A frame stays
+ * valid until the writer reuses its slot, so IsValid has to be checked after using its data.
+ */
+class ROSINTEGRATIONVISION_API SharedFrameReader
+{
+public:
+  struct Frame
+  {
+    uint64_t Sequence;
+    const PacketBuffer::PacketHeader *Header;
+    const uint8_t *Image;
+  };
+
+private:
+  uint8_t *Memory;
+  size_t Size;
+  const SharedFrameRing::Ring *Header;
+  uint64_t Last;
+  uint64_t Skipped;
+
+  const SharedFrameRing::Slot &GetSlot(const uint64_t Sequence) const;
+
+public:
+  SharedFrameReader();
+  ~SharedFrameReader();
+
+  // Maps the ring Name, returns false if it does not exist or is not a compatible ring
+  bool Open(const std::string &Name);
+  void Close();
+
+  // Waits up to TimeoutMs for a frame newer than the last one and returns the newest. Returns false on timeout or
+  // if the writer closed the ring, which has to be opened again then.
+  bool Wait(Frame &Next, const int32_t TimeoutMs);
+
+  // Whether the writer did not start to overwrite the frame yet, so the data read from it is intact
+  bool IsValid(const Frame &Current) const;
+
+  bool IsClosed() const;
+
+  // Layout of the mapped ring, nullptr if not open
+  const SharedFrameRing::Ring *GetRing() const;
+
+  // Frames that were written but not returned by Wait, because a newer one was there already
+  uint64_t GetSkipped() const;
+};
@@ -1,3 +1,168 @@
 // Fill out your copyright notice in the Description page of Project Settings.
 
 #include "StopTime.h"
+
+PipelineTimes::PipelineTimes() : GameThread(0), Frames(0), Start(0), Worker(0)
+{
+}
+
+void PipelineTimes::Report(const FString &Name)
+{
+    const double Now = FPlatformTime::Seconds();
+    if (Now - Start < 1.0)
+    {
+        return;
+    }
+
+    const double WorkerTime = Worker.exchange(0, std::memory_order_relaxed) / 1000.0;
+    if (Frames > 0 && Start > 0)
+    {
+        UE_LOG(LogTemp, Log, TEXT("%s: %.3f ms per frame on the game thread, %.3f ms of conversion and publishing per frame moved to the jobs."),
+            *Name, GameThread / Frames, WorkerTime / Frames);
+    }
+    Start = Now;
+    GameThread = 0;
+    Frames = 0;
+}
+
+#if ROSVISION_STAGE_TIMING
+
+#include "Misc/FileHelper.h"
+
+DEFINE_STAT(STAT_ROSVision_Capture);
+DEFINE_STAT(STAT_ROSVision_Readback);
+DEFINE_STAT(STAT_ROSVision_Conversion);
+DEFINE_STAT(STAT_ROSVision_BufferWait);
+DEFINE_STAT(STAT_ROSVision_Publish);
+DEFINE_STAT(STAT_ROSVision_Encode);
+DEFINE_STAT(STAT_ROSVision_PointCloud);
+DEFINE_STAT(STAT_ROSVision_ReadbackLatency);
+DEFINE_STAT(STAT_ROSVision_EndToEndLatency);
+
+// Names of the stages in the CSV file, in the order of EVisionStage
+static const TCHAR *StageNames[(uint8)EVisionStage::Count] =
+{
+    TEXT("Capture"), TEXT("Readback"), TEXT("Conversion"), TEXT("BufferWait"),
+    TEXT("Publish"), TEXT("Encode"), TEXT("PointCloud"), TEXT("EndToEnd")
+};
+
+LatencyHistogram::LatencyHistogram()
+{
+    Reset();
+}
+
+uint32 LatencyHistogram::GetBucket(const uint64 Micros)
+{
+    if (Micros < SubBuckets)
+    {
+        return (uint32)Micros;
+    }
+
+    // The power of two selects the group of buckets, the next 3 bits the bucket within it
+    const uint32 Exponent = FMath::FloorLog2_64(Micros);
+    const uint32 Bucket = (Exponent - 2) * SubBuckets + (uint32)((Micros >> (Exponent - 3)) & (SubBuckets - 1));
+    return FMath::Min(Bucket, NumBuckets - 1);
+}
+
+double LatencyHistogram::GetBucketValue(const uint32 Bucket)
+{
+    if (Bucket < SubBuckets)
+    {
+        return Bucket + 0.5;
+    }
+
+    const uint32 Shift = Bucket / SubBuckets - 1;
+    const double Low = (double)((uint64)(SubBuckets + Bucket % SubBuckets) << Shift);
+    return Low + (double)((uint64)1 << Shift) / 2;
+}
+
+void LatencyHistogram::Record(const double Milliseconds)
+{
+    const uint64 Micros = (uint64)FMath::Max(Milliseconds * 1000.0, 0.0);
+    Buckets[GetBucket(Micros)].fetch_add(1, std::memory_order_relaxed);
+    Sum.fetch_add(Micros, std::memory_order_relaxed);
+
+    uint64 Current = Max.load(std::memory_order_relaxed);
+    while (Micros > Current && !Max.compare_exchange_weak(Current, Micros, std::memory_order_relaxed))
+    {
+    }
+}
+
+void LatencyHistogram::Reset()
+{
+    for (std::atomic<uint64> &Bucket : Buckets)
+    {
+        Bucket.store(0, std::memory_order_relaxed);
+    }
+    Sum.store(0, std::memory_order_relaxed);
+    Max.store(0, std::memory_order_relaxed);
+}
+
+FStageLatency LatencyHistogram::Get() const
+{
+    uint64 Counts[NumBuckets];
+    uint64 Count = 0;
+    for (uint32 i = 0; i < NumBuckets; ++i)
+    {
+        Counts[i] = Buckets[i].load(std::memory_order_relaxed);
+        Count += Counts[i];
+    }
+
+    FStageLatency Latency;
+    if (Count == 0)
+    {
+        return Latency;
+    }
+
+    // Percentiles are the bucket of the sample at their rank, limited by the largest sample
+    const double MaxMicros = (double)Max.load(std::memory_order_relaxed);
+    const double Quantiles[3] = { 0.5, 0.95, 0.99 };
+    float *Results[3] = { &Latency.P50, &Latency.P95, &Latency.P99 };
+    uint64 Seen = 0;
+    uint32 Bucket = 0;
+    for (uint32 q = 0; q < 3; ++q)
+    {
+        const uint64 Rank = FMath::Max((uint64)FMath::CeilToDouble(Quantiles[q] * Count), (uint64)1);
+        while (Seen + Counts[Bucket] < Rank)
+        {
+            Seen += Counts[Bucket++];
+        }
+        *Results[q] = (float)(FMath::Min(GetBucketValue(Bucket), MaxMicros) / 1000.0);
+    }
+
+    Latency.Count = (int32)FMath::Min(Count, (uint64)MAX_int32);
+    Latency.Mean = (float)(Sum.load(std::memory_order_relaxed) / 1000.0 / Count);
+    Latency.Max = (float)(MaxMicros / 1000.0);
+    return Latency;
+}
+
+FStageLatency StageTimes::Get(const EVisionStage Stage) const
+{
+    if (Stage >= EVisionStage::Count)
+    {
+        return FStageLatency();
+    }
+    return Stages[(uint8)Stage].Get();
+}
+
+void StageTimes::Reset()
+{
+    for (LatencyHistogram &Stage : Stages)
+    {
+        Stage.Reset();
+    }
+}
+
+bool StageTimes::WriteCSV(const FString &Path, const FString &Name) const
+{
+    FString Text = TEXT("Component,Stage,Count,Mean ms,P50 ms,P95 ms,P99 ms,Max ms\n");
+    for (uint8 i = 0; i < (uint8)EVisionStage::Count; ++i)
+    {
+        const FStageLatency Latency = Stages[i].Get();
+        Text += FString::Printf(TEXT("%s,%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n"), *Name, StageNames[i],
+            Latency.Count, Latency.Mean, Latency.P50, Latency.P95, Latency.P99, Latency.Max);
+    }
+    return FFileHelper::SaveStringToFile(Text, *Path);
+}
+
+#endif
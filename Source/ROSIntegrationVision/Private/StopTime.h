@@ -2,8 +2,20 @@
 
 #pragma once
 
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+
+#include <atomic>
 #include <chrono>
 
+#include "StageLatency.h"
+
+// Stage timing of the components, set by ROSIntegrationVision.Build.cs. Without it the stage macros below expand
+// to nothing and StageTimes is empty.
+#ifndef ROSVISION_STAGE_TIMING
+#define ROSVISION_STAGE_TIMING 0
+#endif
+
 class ROSINTEGRATIONVISION_API StopTime
 {
 protected:
@@ -11,13 +23,27 @@ protected:
 
 public:
     StopTime() : StartTime(std::chrono::high_resolution_clock::now()) {}
-    
+
     virtual ~StopTime() {}
 
     inline double GetTimePassed() const
     {
         return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - StartTime).count() * 1000.0;
     }
+
+    // Current time as a plain number, so that it can be stored with a frame and passed to other threads
+    static inline uint64_t Timestamp()
+    {
+        return std::chrono::high_resolution_clock::now().time_since_epoch().count();
+    }
+
+    // Milliseconds passed since a Timestamp
+    static inline double GetTimePassed(const uint64_t Timestamp)
+    {
+        const std::chrono::high_resolution_clock::duration Passed =
+            std::chrono::high_resolution_clock::now().time_since_epoch() - std::chrono::high_resolution_clock::duration(Timestamp);
+        return std::chrono::duration<double>(Passed).count() * 1000.0;
+    }
 };
 
 class ROSINTEGRATIONVISION_API ScopeTime : private StopTime
@@ -40,3 +66,173 @@ public:
 #ifndef MEASURE_TIME
 #define MEASURE_TIME(MSG) ScopeTime scopeTime(FString(__FUNCTION__), __LINE__, FString(MSG))
 #endif
+
+/**
+ * Time per frame a component spends on the game thread, and the time its jobs spend on the conversion and publishing
+ * that ran on the game thread before they were pipelined. Report logs both once per second, without stage timing.
+ */
+class ROSINTEGRATIONVISION_API PipelineTimes
+{
+private:
+    // Only touched by the game thread
+    double GameThread; // Milliseconds
+    uint32 Frames;
+    double Start;
+    // Added to by the jobs
+    std::atomic<uint64> Worker; // Microseconds
+
+public:
+    PipelineTimes();
+
+    inline void AddGameThread(const double Milliseconds)
+    {
+        GameThread += Milliseconds;
+    }
+
+    inline void AddWorker(const double Milliseconds)
+    {
+        Worker.fetch_add((uint64)(Milliseconds * 1000.0), std::memory_order_relaxed);
+    }
+
+    // Counts a frame handed over to the jobs, the times are reported per frame
+    inline void CountFrame()
+    {
+        ++Frames;
+    }
+
+    // Called every tick on the game thread, logs the times at most once per second
+    void Report(const FString &Name);
+};
+
+// Adds the time until the end of the scope to the game thread or the worker time of a PipelineTimes
+class ROSINTEGRATIONVISION_API PipelineTimer : private StopTime
+{
+private:
+    PipelineTimes &Times;
+    const bool OnWorker;
+
+public:
+    inline PipelineTimer(PipelineTimes &_Times, const bool _OnWorker) : StopTime(), Times(_Times), OnWorker(_OnWorker) {}
+
+    virtual inline ~PipelineTimer()
+    {
+        if (OnWorker)
+        {
+            Times.AddWorker(GetTimePassed());
+        }
+        else
+        {
+            Times.AddGameThread(GetTimePassed());
+        }
+    }
+};
+
+#if ROSVISION_STAGE_TIMING
+
+/**
+ * Lock-free histogram of latencies in microseconds. The buckets are 1 us wide up to 8 us, above that every power
+ * of two is split into 8 buckets, so a percentile is off by at most 6.25% up to several minutes.
+ * Record may be called from any thread at the same time. Get does not stop them, a concurrent sample may be
+ * missing from one of the values.
+ */
+class ROSINTEGRATIONVISION_API LatencyHistogram
+{
+public:
+    static const uint32 SubBuckets = 8;
+    static const uint32 NumBuckets = 27 * SubBuckets;
+
+private:
+    std::atomic<uint64> Buckets[NumBuckets];
+    std::atomic<uint64> Sum; // Microseconds
+    std::atomic<uint64> Max;
+
+    static uint32 GetBucket(const uint64 Micros);
+    // Middle of the bucket in microseconds
+    static double GetBucketValue(const uint32 Bucket);
+
+public:
+    LatencyHistogram();
+
+    void Record(const double Milliseconds);
+    void Reset();
+    FStageLatency Get() const;
+};
+
+// Histograms of all stages of a component
+class ROSINTEGRATIONVISION_API StageTimes
+{
+private:
+    LatencyHistogram Stages[(uint8)EVisionStage::Count];
+
+public:
+    inline void Record(const EVisionStage Stage, const double Milliseconds)
+    {
+        Stages[(uint8)Stage].Record(Milliseconds);
+    }
+
+    FStageLatency Get(const EVisionStage Stage) const;
+    void Reset();
+
+    // Writes a CSV file with one line per stage, Name fills the first column. Returns false if it failed.
+    bool WriteCSV(const FString &Path, const FString &Name) const;
+};
+
+// Records the time until the end of the scope as a stage
+class ROSINTEGRATIONVISION_API StageTimer : private StopTime
+{
+private:
+    StageTimes &Times;
+    const EVisionStage Stage;
+
+public:
+    inline StageTimer(StageTimes &_Times, const EVisionStage _Stage) : StopTime(), Times(_Times), Stage(_Stage) {}
+
+    virtual inline ~StageTimer()
+    {
+        Times.Record(Stage, GetTimePassed());
+    }
+};
+
+DECLARE_STATS_GROUP(TEXT("ROSIntegrationVision"), STATGROUP_ROSVision, STATCAT_Advanced);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Capture"), STAT_ROSVision_Capture, STATGROUP_ROSVision, ROSINTEGRATIONVISION_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Readback"), STAT_ROSVision_Readback, STATGROUP_ROSVision, ROSINTEGRATIONVISION_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Conversion"), STAT_ROSVision_Conversion, STATGROUP_ROSVision, ROSINTEGRATIONVISION_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Buffer wait"), STAT_ROSVision_BufferWait, STATGROUP_ROSVision, ROSINTEGRATIONVISION_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Publish"), STAT_ROSVision_Publish, STATGROUP_ROSVision, ROSINTEGRATIONVISION_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Encode"), STAT_ROSVision_Encode, STATGROUP_ROSVision, ROSINTEGRATIONVISION_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Point cloud"), STAT_ROSVision_PointCloud, STATGROUP_ROSVision, ROSINTEGRATIONVISION_API);
+// Latencies that span threads, the last value of any component
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Readback latency (ms)"), STAT_ROSVision_ReadbackLatency, STATGROUP_ROSVision, ROSINTEGRATIONVISION_API);
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("End to end latency (ms)"), STAT_ROSVision_EndToEndLatency, STATGROUP_ROSVision, ROSINTEGRATIONVISION_API);
+
+// Times the rest of the scope as a stage of a StageTimes, for the histogram and the cycle stat of the stage
+#define MEASURE_STAGE(TIMES, STAGE) \
+    SCOPE_CYCLE_COUNTER(STAT_ROSVision_##STAGE); \
+    StageTimer stageTimer##STAGE(TIMES, EVisionStage::STAGE)
+
+// Records the time since a STAGE_TIMESTAMP taken on any thread as a stage, for stages without a single scope
+#define RECORD_STAGE_SINCE(TIMES, STAGE, TIMESTAMP) \
+    { \
+        const double stageTime = StopTime::GetTimePassed(TIMESTAMP); \
+        SET_FLOAT_STAT(STAT_ROSVision_##STAGE##Latency, stageTime); \
+        (TIMES).Record(EVisionStage::STAGE, stageTime); \
+    }
+
+#define STAGE_TIMESTAMP() StopTime::Timestamp()
+
+#else
+
+class StageTimes
+{
+public:
+    inline void Record(const EVisionStage Stage, const double Milliseconds) {}
+    inline FStageLatency Get(const EVisionStage Stage) const { return FStageLatency(); }
+    inline void Reset() {}
+    inline bool WriteCSV(const FString &Path, const FString &Name) const { return false; }
+};
+
+#define MEASURE_STAGE(TIMES, STAGE)
+#define RECORD_STAGE_SINCE(TIMES, STAGE, TIMESTAMP)
+#define STAGE_TIMESTAMP() 0
+
+#endif
@@ -0,0 +1,51 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "SubscriberCounts.h"
+
+void SubscriberCounts::Set(const FString &Topic, const int32 Count)
+{
+  std::lock_guard<std::mutex> Lock(Mutex);
+  if (Count < 0)
+  {
+    Counts.Remove(Topic);
+  }
+  else
+  {
+    Counts.Add(Topic, Count);
+  }
+}
+
+void SubscriberCounts::Reset()
+{
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Counts.Empty();
+  Query = nullptr;
+}
+
+void SubscriberCounts::SetQuery(QueryFunction Function)
+{
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Query = std::move(Function);
+}
+
+int32 SubscriberCounts::Get(const FString &Topic) const
+{
+  QueryFunction Function;
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    const int32 *Count = Counts.Find(Topic);
+    if (Count)
+    {
+      return *Count;
+    }
+    if (!Query)
+    {
+      return Unknown;
+    }
+    Function = Query;
+  }
+
+  // Not holding the lock, the query may take a while or set counts itself
+  const int32 Count = Function(Topic);
+  return Count < 0 ? Unknown : Count;
+}
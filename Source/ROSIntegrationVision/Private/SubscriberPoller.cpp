@@ -0,0 +1,110 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "SubscriberPoller.h"
+
+#include "ROSIntegrationCore.h"
+#include "RI/Service.h"
+
+#include "RosapiSubscribers.h"
+#include "SubscriberCounts.h"
+
+namespace
+{
+  // Unanswered intervals after which a topic counts as subscribed again
+  const double TimeoutIntervals = 5.0;
+}
+
+SubscriberPoller::SubscriberPoller(SubscriberCounts &Counts, const double _Interval) :
+  Interval(_Interval), Shared(std::make_shared<State>()), NextPoll(0), WarnedTimeout(false)
+{
+  Shared->Counts = &Counts;
+}
+
+SubscriberPoller::~SubscriberPoller()
+{
+  // Answers still on their way are dropped
+  std::lock_guard<std::mutex> Lock(Shared->Mutex);
+  Shared->Counts = nullptr;
+}
+
+void SubscriberPoller::Watch(UROSIntegrationCore *Core, const FString &Name)
+{
+  if (Interval <= 0 || !Core || Name.IsEmpty())
+  {
+    return;
+  }
+
+  Topic &Watched = Topics.FindOrAdd(Name);
+  if (Watched.Core.Get() != Core)
+  {
+    Watched.Core = Core;
+    Watched.Service.Reset(NewObject<UService>(UService::StaticClass()));
+    Watched.Service->Init(Core, TEXT("/rosapi/subscribers"), TEXT("rosapi/Subscribers"));
+  }
+}
+
+bool SubscriberPoller::Tick(float DeltaTime)
+{
+  const double Now = FPlatformTime::Seconds();
+  if (Interval <= 0 || Now < NextPoll)
+  {
+    return true;
+  }
+  NextPoll = Now + Interval;
+
+  for (auto It = Topics.CreateIterator(); It; ++It)
+  {
+    if (!It.Value().Core.IsValid())
+    {
+      std::lock_guard<std::mutex> Lock(Shared->Mutex);
+      Shared->Pending.Remove(It.Key());
+      Shared->Counts->Set(It.Key(), SubscriberCounts::Unknown);
+      It.RemoveCurrent();
+      continue;
+    }
+    Poll(It.Key(), It.Value(), Now);
+  }
+  return true;
+}
+
+void SubscriberPoller::Poll(const FString &Name, Topic &Watched, const double Now)
+{
+  {
+    std::lock_guard<std::mutex> Lock(Shared->Mutex);
+    const double *Sent = Shared->Pending.Find(Name);
+    if (Sent && Now - *Sent < TimeoutIntervals * Interval)
+    {
+      return;
+    }
+    if (Sent)
+    {
+      if (!WarnedTimeout)
+      {
+        UE_LOG(LogTemp, Warning, TEXT("/rosapi/subscribers did not answer for %s, treating it as subscribed. Is rosapi running?"), *Name);
+        WarnedTimeout = true;
+      }
+      Shared->Counts->Set(Name, SubscriberCounts::Unknown);
+    }
+    Shared->Pending.Add(Name, Now);
+  }
+
+  TSharedPtr<rosapi::FSubscribersRequest> Request(new rosapi::FSubscribersRequest());
+  Request->topic = Name;
+  std::shared_ptr<State> Answer = Shared;
+  const bool Sent = Watched.Service->CallService(Request, [Answer, Name](TSharedPtr<FROSBaseServiceResponse> Response)
+  {
+    TSharedPtr<rosapi::FSubscribersResponse> Subscribers = StaticCastSharedPtr<rosapi::FSubscribersResponse>(Response);
+    std::lock_guard<std::mutex> Lock(Answer->Mutex);
+    Answer->Pending.Remove(Name);
+    if (Answer->Counts && Subscribers.IsValid())
+    {
+      Answer->Counts->Set(Name, Subscribers->subscribers.Num());
+    }
+  });
+
+  if (!Sent)
+  {
+    std::lock_guard<std::mutex> Lock(Shared->Mutex);
+    Shared->Pending.Remove(Name);
+  }
+}
@@ -0,0 +1,62 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/StrongObjectPtr.h"
+#include "UObject/WeakObjectPtr.h"
+
+#include <memory>
+#include <mutex>
+
+class SubscriberCounts;
+class UROSIntegrationCore;
+class UService;
+
+/**
+ * Asks rosapi for the subscribers of the topics the components publish and feeds the counts into SubscriberCounts.
+ * Every Interval seconds one /rosapi/subscribers call per topic is sent through the bridge the topic was advertised
+ * on, without waiting for the answer. A topic whose call is not answered within a few intervals, e.g. because
+ * rosapi is not running, goes back to Unknown and is treated as subscribed again. Topics whose bridge is gone are
+ * no longer polled.
+ * A new subscriber is only noticed with the next answer, so publishing resumes up to Interval plus the round trip of
+ * the call after a subscription, not within the next frame.
+ * Watch and Tick have to be called from the game thread, the answers arrive on the bridge threads.
+ */
+class ROSINTEGRATIONVISION_API SubscriberPoller
+{
+private:
+  struct Topic
+  {
+    TWeakObjectPtr<UROSIntegrationCore> Core;
+    TStrongObjectPtr<UService> Service;
+  };
+
+  // Shared with the answers, which may arrive after the poller is gone
+  struct State
+  {
+    std::mutex Mutex;
+    SubscriberCounts *Counts;
+    // Time the unanswered call of a topic was sent
+    TMap<FString, double> Pending;
+  };
+
+  const double Interval;
+  std::shared_ptr<State> Shared;
+  TMap<FString, Topic> Topics;
+  double NextPoll;
+  bool WarnedTimeout;
+
+  void Poll(const FString &Name, Topic &Watched, const double Now);
+
+public:
+  // Interval in seconds between the polls of a topic, 0 disables polling so that the counts can be set by hand
+  SubscriberPoller(SubscriberCounts &Counts, const double Interval);
+  ~SubscriberPoller();
+
+  // Polls the subscribers of Name through Core from now on, a later call with another bridge replaces it
+  void Watch(UROSIntegrationCore *Core, const FString &Name);
+
+  // Sends the calls that are due, called once per engine frame
+  bool Tick(float DeltaTime);
+};
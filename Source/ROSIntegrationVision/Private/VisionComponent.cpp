@@ -2,15 +2,27 @@
 
 #include "VisionComponent.h"
 
-#include <cmath>
-#include <thread>
+#include <atomic>
+#include <mutex>
 
 #include "ROSTime.h"
-#include "sensor_msgs/CameraInfo.h"
 #include "sensor_msgs/Image.h"
 
+#include "CameraIntrinsics.h"
+#include "CaptureScheduler.h"
+#include "CompressedPublisher.h"
+#include "ImageConversion.h"
+#include "LeasedImage.h"
+#include "OutgoingQueue.h"
 #include "PacketBuffer.h"
+#include "PacketOutputs.h"
+#include "ReadbackQueue.h"
+#include "ROSIntegrationVision.h"
 #include "ROSIntegrationGameInstance.h"
+#include "StopTime.h"
+#include "SubscriberCounts.h"
+#include "SubscriberPoller.h"
+#include "WorkerPool.h"
 
 #include "EngineUtils.h"
 #include "IImageWrapper.h"
@@ -26,17 +38,56 @@ class ROSINTEGRATIONVISION_API UVisionComponent::PrivateData
 {
 public:
 	TSharedPtr<PacketBuffer> Buffer;
-	// TCPServer Server;
+	TSharedPtr<ReadbackQueue> Readback;
+	// Bounded queues of the topics in front of the bridge, created with the topics
+	TSharedPtr<OutgoingQueue> CameraInfoQueue, ImageQueue, CompressedImageQueue;
+	// Shared memory ring, TCP server and capture log of the packets, and the replay of a capture log instead of
+	// the rendered images if ReplayPath is set
+	TSharedPtr<PacketOutputs> Outputs;
+	// Conversion, publishing and encoding jobs of this component on the module thread pool
+	WorkerPool *Pool;
+	WorkerPool::Group Jobs;
+	// CaptureOnDemand or readbacks at BeginPlay, and the number of captures and ticks for the statistics
+	bool OnDemand;
+	// Whether the scene capture renders every frame, it is stopped while no image topic has subscribers
+	bool Capturing;
+	// Topics with subscribers as of the last PublishImages, also read by the publishing job
+	std::atomic<bool> PublishRaw, PublishCompressed, PublishInfo;
+	// Registration with the module scheduler for PublishRate, 0 if not registered yet
+	CaptureScheduler::Handle Schedule;
+	float ScheduledRate;
+	uint32 StatsCaptures, StatsTicks;
+	double StatsCaptureStart;
+	// Intrinsics for the camera info, only recomputed when the properties change
+	CameraIntrinsics Intrinsics;
+	// Latency histograms of the stages of the frames, empty without stage timing
+	StageTimes Stages;
+	// Game thread and job time per frame, logged once per second
+	PipelineTimes Times;
+	// ColorFormat at BeginPlay
+	EColorFormat Format;
 	std::mutex WaitColor;
-	std::condition_variable CVColor;
-	std::thread ThreadColor;
 	bool DoColor;
+	bool Converting;
+	// Frame handed over from the game thread to the conversion job, and the one the job converts
+	TArray<FFloat16Color> PendingColor;
+	TArray<FFloat16Color> ProcessingColor;
+	// Same for the 8 bit formats
+	TArray<FColor> PendingColorLDR;
+	TArray<FColor> ProcessingColorLDR;
+	FrameInfo PendingInfo;
+	// Packets completed since the publishing job last looked for them
+	std::atomic<uint32> PublishRequests;
+	// Compression jobs of the compressed topic on the thread pool
+	IImageWrapperModule *ImageWrapperModule;
+	TSharedPtr<CompressedPublisher> Compressor;
 };
 
 UVisionComponent::UVisionComponent() :
 Width(960),
 Height(540),
-ServerPort(10000)
+ServerPort(10000),
+ReadbackDepth(0)
 {
     Priv = new PrivateData();
     FieldOfView = 90.0;
@@ -74,6 +125,26 @@ bool UVisionComponent::IsPaused() const
     return Paused;
 }
 
+float UVisionComponent::GetAchievedPublishRate() const
+{
+	return Priv->Schedule != 0 ? FROSIntegrationVisionModule::Get().GetScheduler().GetAchievedRate(Priv->Schedule) : 0.f;
+}
+
+FStageLatency UVisionComponent::GetStageLatency(EVisionStage Stage) const
+{
+	return Priv->Stages.Get(Stage);
+}
+
+void UVisionComponent::ResetStageLatencies()
+{
+	Priv->Stages.Reset();
+}
+
+bool UVisionComponent::DumpStageLatencies(const FString &Path) const
+{
+	return Priv->Stages.WriteCSV(Path, GetName());
+}
+
 void UVisionComponent::InitializeTopics()
 {
 	// Establish ROS communication
@@ -85,11 +156,32 @@ void UVisionComponent::InitializeTopics()
 		CameraInfoPublisher = NewObject<UTopic>(UTopic::StaticClass());
 		ImagePublisher = NewObject<UTopic>(UTopic::StaticClass());
 
-		CameraInfoPublisher->Init(rosinst->ROSIntegrationCore, CameraInfoTopicName, TEXT("sensor_msgs/CameraInfo"));
+		CameraInfoPublisher->Init(rosinst->ROSIntegrationCore, CameraInfoTopicName, TEXT("sensor_msgs/CameraInfo"), PublishQueue.GetTopicQueueSize());
 		CameraInfoPublisher->Advertise();
 
-		ImagePublisher->Init(rosinst->ROSIntegrationCore, ImageTopicName, TEXT("sensor_msgs/Image"));
+		ImagePublisher->Init(rosinst->ROSIntegrationCore, ImageTopicName, TEXT("sensor_msgs/Image"), PublishQueue.GetTopicQueueSize());
 		ImagePublisher->Advertise();
+
+		if (!CompressedImageTopicName.IsEmpty())
+		{
+			CompressedImagePublisher = NewObject<UTopic>(UTopic::StaticClass());
+			CompressedImagePublisher->Init(rosinst->ROSIntegrationCore, CompressedImageTopicName, TEXT("sensor_msgs/CompressedImage"), PublishQueue.GetTopicQueueSize());
+			CompressedImagePublisher->Advertise();
+		}
+
+		// Every topic gets its own bounded queue in front of the bridge
+		Priv->CameraInfoQueue = MakeShareable(new OutgoingQueue(CameraInfoTopicName, CameraInfoPublisher, PublishQueue));
+		Priv->ImageQueue = MakeShareable(new OutgoingQueue(ImageTopicName, ImagePublisher, PublishQueue));
+		if (CompressedImagePublisher)
+		{
+			Priv->CompressedImageQueue = MakeShareable(new OutgoingQueue(CompressedImageTopicName, CompressedImagePublisher, PublishQueue));
+		}
+
+		// Subscriber counts of the topics come from rosapi, empty topic names are not polled
+		SubscriberPoller &Poller = FROSIntegrationVisionModule::Get().GetSubscriberPoller();
+		Poller.Watch(rosinst->ROSIntegrationCore, CameraInfoTopicName);
+		Poller.Watch(rosinst->ROSIntegrationCore, ImageTopicName);
+		Poller.Watch(rosinst->ROSIntegrationCore, CompressedImageTopicName);
 	}
 	else
 	{
@@ -98,141 +190,252 @@ void UVisionComponent::InitializeTopics()
 }
 
 void UVisionComponent::PublishImages() {
+	CaptureImages();
+}
+
+bool UVisionComponent::CaptureImages()
+{
+	PipelineTimer GameThreadTime(Priv->Times, false);
+
 	// Check if paused
 	if (Paused) {
-		return;
+		return false;
+	}
+
+	// A replay publishes the frames of the log instead
+	if (Priv->Outputs->GetReplay()) {
+		return false;
 	}
 
 	FROSTime time = FROSTime::Now();
+	Priv->Intrinsics.Update(Width, Height, FieldOfView, TranslateX);
+	const bool Capture = UpdateSubscribers();
+
+	// Rendering stops while nobody listens, the first frame after that is captured right away instead of reading
+	// back the stale render target
+	const bool Resume = Capture && !Priv->Capturing;
+	if (!Priv->OnDemand && Capture != Priv->Capturing) {
+		Color->bCaptureEveryFrame = Capture;
+		Color->bCaptureOnMovement = Capture;
+		UE_LOG(LogTemp, Verbose, TEXT("%s %s capturing."), *GetName(), Capture ? TEXT("resumes") : TEXT("stops"));
+	}
+	Priv->Capturing = Capture;
+
+	if (Capture) {
+		if (Priv->Readback.IsValid() && Priv->Readback->IsFull()) {
+			UE_LOG(LogTemp, Verbose, TEXT("All %d readbacks in flight, skipping frame."), ReadbackDepth);
+			return false;
+		}
+		MEASURE_STAGE(Priv->Stages, Capture);
+
+		// In capture on demand mode the scene is only rendered for frames that are read back. The readback copies
+		// the render target after the capture commands, so it gets the frame of this stamp and pose.
+		if (Priv->OnDemand || Resume) {
+			Color->CaptureScene();
+			++Priv->StatsCaptures;
+		}
+
+		if (Priv->Readback.IsValid()) {
+			// Only queue the readback, TickComponent submits the frame once the data arrived
+			ReadbackQueue::Frame &Frame = Priv->Readback->Enqueue(Color->TextureTarget);
+			GetFrameInfo(Frame, time);
+			return true;
+		}
+
+		FrameInfo Info;
+		GetFrameInfo(Info, time);
+
+		if (Priv->Format == EColorFormat::BGR8FromFloat16) {
+			{
+				MEASURE_STAGE(Priv->Stages, Readback);
+				ReadImage(Color->TextureTarget, ImageColor);
+			}
+			SubmitFrame(ImageColor, Info);
+		}
+		else {
+			{
+				MEASURE_STAGE(Priv->Stages, Readback);
+				ReadImage(Color->TextureTarget, ImageColorLDR);
+			}
+			SubmitFrame(ImageColorLDR, Info);
+		}
+		return true;
+	}
 
-	if (ImagePublisher && ImagePublisher->IsAdvertising()) {
-		auto owner = GetOwner();
-		owner->UpdateComponentTransforms();
-
-		FDateTime Now = FDateTime::UtcNow();
-		Priv->Buffer->HeaderWrite->TimestampCapture = Now.ToUnixTimestamp() * 1000000000 + Now.GetMillisecond() * 1000000;
-
-		FVector Translation = GetComponentLocation();
-		FQuat Rotation = GetComponentQuat();
-		// Convert to meters and ROS coordinate system
-		Priv->Buffer->HeaderWrite->Translation.X = Translation.X / 100.0f;
-		Priv->Buffer->HeaderWrite->Translation.Y = -Translation.Y / 100.0f;
-		Priv->Buffer->HeaderWrite->Translation.Z = Translation.Z / 100.0f;
-		Priv->Buffer->HeaderWrite->Rotation.X = -Rotation.X;
-		Priv->Buffer->HeaderWrite->Rotation.Y = Rotation.Y;
-		Priv->Buffer->HeaderWrite->Rotation.Z = -Rotation.Z;
-		Priv->Buffer->HeaderWrite->Rotation.W = Rotation.W;
-
-		// Read color image and notify processing thread
-		Priv->WaitColor.lock();
-		ReadImage(Color->TextureTarget, ImageColor);
-		Priv->WaitColor.unlock();
-		Priv->DoColor = true;
-		Priv->CVColor.notify_one();
-
-		Priv->Buffer->StartReading();
-		uint32_t xSize = Priv->Buffer->HeaderRead->Size;
-		uint32_t xSizeHeader = Priv->Buffer->HeaderRead->SizeHeader; // Size of the header
-		uint32_t xWidth = Priv->Buffer->HeaderRead->Width; // Width of the images
-		uint32_t xHeight = Priv->Buffer->HeaderRead->Height; // Height of the images
-		uint32_t xBytes = Priv->Buffer->HeaderRead->Bytes;
-
-		// Get the data offsets for the different types of images that are in the buffer
-		const uint32_t& OffsetColor = Priv->Buffer->OffsetImage;
-		UE_LOG(LogTemp, Verbose, TEXT("Buffer Offsets: %d"), OffsetColor);
-
-		TSharedPtr<ROSMessages::sensor_msgs::Image> ImageMessage(new ROSMessages::sensor_msgs::Image());
+	// A job publishes the camera info alone, serializing it or waiting for a full queue must not hold up the frame
+	if (Priv->PublishInfo) {
+		Priv->Pool->Submit(Priv->Jobs, [this, time]() { PublishCameraInfo(time); });
+	}
+	return false;
+}
+
+bool UVisionComponent::UpdateSubscribers()
+{
+	// Topics without subscribers are skipped, subscribers of the camera info alone do not need the image.
+	// Returns whether any output takes the images.
+	SubscriberCounts &Subscribers = FROSIntegrationVisionModule::Get().GetSubscriberCounts();
+	Priv->PublishRaw = ImagePublisher && ImagePublisher->IsAdvertising() && Subscribers.IsSubscribed(ImageTopicName);
+	Priv->PublishCompressed = CompressedImagePublisher && CompressedImagePublisher->IsAdvertising() &&
+		Subscribers.IsSubscribed(CompressedImageTopicName);
+	Priv->PublishInfo = CameraInfoPublisher && CameraInfoPublisher->IsAdvertising() &&
+		Subscribers.IsSubscribed(CameraInfoTopicName);
+	return Priv->PublishRaw || Priv->PublishCompressed || Priv->Outputs->HasConsumers();
+}
+
+void UVisionComponent::GetFrameInfo(FrameInfo &Info, const FROSTime &Time)
+{
+	auto owner = GetOwner();
+	owner->UpdateComponentTransforms();
+
+	// The capture timestamp is the stamp of the messages, so that the publishing thread can restore it
+	Info.Time = Time;
+	Info.TimestampCapture = (uint64_t)Time._Sec * 1000000000 + Time._NSec;
+	Info.ClockCapture = STAGE_TIMESTAMP();
+
+	FVector Translation = GetComponentLocation();
+	FQuat Rotation = GetComponentQuat();
+	// Convert to meters and ROS coordinate system
+	Info.Translation.X = Translation.X / 100.0f;
+	Info.Translation.Y = -Translation.Y / 100.0f;
+	Info.Translation.Z = Translation.Z / 100.0f;
+	Info.Rotation.X = -Rotation.X;
+	Info.Rotation.Y = Rotation.Y;
+	Info.Rotation.Z = -Rotation.Z;
+	Info.Rotation.W = Rotation.W;
+}
+
+void UVisionComponent::SubmitFrame(TArray<FFloat16Color> &Pixels, const FrameInfo &Info)
+{
+	// Only swaps the frame in, the conversion job converts it while the game thread continues.
+	// Pixels receives the previous buffer, which keeps its size for the next read.
+	std::unique_lock<std::mutex> Lock(Priv->WaitColor);
+	Swap(Priv->PendingColor, Pixels);
+	StartConversion(std::move(Lock), Info);
+}
+
+void UVisionComponent::SubmitFrame(TArray<FColor> &Pixels, const FrameInfo &Info)
+{
+	std::unique_lock<std::mutex> Lock(Priv->WaitColor);
+	Swap(Priv->PendingColorLDR, Pixels);
+	StartConversion(std::move(Lock), Info);
+}
+
+void UVisionComponent::StartConversion(std::unique_lock<std::mutex> Lock, const FrameInfo &Info)
+{
+	// Takes over the lock of WaitColor the pixels were swapped in under, and releases it before the job is submitted
+	if (Priv->DoColor) {
+		UE_LOG(LogTemp, Verbose, TEXT("Conversion is behind, replacing pending frame."));
+	}
+	Priv->PendingInfo = Info;
+	Priv->DoColor = true;
+	Priv->Times.CountFrame();
+	// At most one conversion job per component, the buffer has a single writer
+	const bool StartJob = !Priv->Converting;
+	Priv->Converting = true;
+	Lock.unlock();
+
+	if (StartJob) {
+		Priv->Pool->Submit(Priv->Jobs, [this]() { ProcessColor(); });
+	}
+}
+
+void UVisionComponent::PublishColor()
+{
+	// Publishes the completed packets, the job is started for the first request and runs until it handled all
+	// requests that came in meanwhile. Under LatestWins only the newest packet of several is published.
+	uint32 Requests = Priv->PublishRequests.load();
+	while (true)
+	{
+		if (!Priv->Buffer->TryStartReading())
+		{
+			Requests = Priv->PublishRequests.fetch_sub(Requests) - Requests;
+			if (Requests == 0)
+			{
+				break;
+			}
+			continue;
+		}
+
+		MEASURE_STAGE(Priv->Stages, Publish);
+		PipelineTimer WorkerTime(Priv->Times, true);
+
+		// The messages lease the slot, it returns to the buffer once all of them are serialized and destroyed.
+		// The local lease keeps the header valid until the latency is recorded.
+		const std::shared_ptr<const uint8> Lease = Priv->Buffer->LeaseRead();
+		Priv->Outputs->Publish(Lease, true);
+		RECORD_STAGE_SINCE(Priv->Stages, EndToEnd, reinterpret_cast<const PacketBuffer::PacketHeader*>(Lease.get())->ClockCapture);
+	}
+}
+
+void UVisionComponent::PublishMessages(const std::shared_ptr<const uint8> &Lease, const FROSTime &Time)
+{
+	// Publishes a packet of the buffer or of the replayed log to the topics, stamped with the time of its capture
+	const PacketBuffer::PacketHeader &Header = *reinterpret_cast<const PacketBuffer::PacketHeader*>(Lease.get());
+
+	// Get the data offsets for the different types of images that are in the packet
+	const uint32_t OffsetColor = Header.SizeHeader;
+	UE_LOG(LogTemp, Verbose, TEXT("Buffer Offsets: %d"), OffsetColor);
+
+	if (Priv->PublishRaw) {
+		TSharedPtr<ROSMessages::sensor_msgs::Image> ImageMessage(new LeasedImage(Lease, OffsetColor));
 
 		ImageMessage->header.seq = 0;
-		ImageMessage->header.time = time;
+		ImageMessage->header.time = Time;
 		ImageMessage->header.frame_id = ImageOpticalFrame;
-		ImageMessage->height = Height;
-		ImageMessage->width = Width;
-		ImageMessage->encoding = TEXT("bgr8");
-		ImageMessage->step = Width * xBytes;
-		ImageMessage->data = &Priv->Buffer->Read[OffsetColor];
-		ImagePublisher->Publish(ImageMessage);
-
-		Priv->Buffer->DoneReading();
-	}
-
-	// Construct and publish CameraInfo
-	if (CameraInfoPublisher && CameraInfoPublisher->IsAdvertising()) {
-		const float FOVX = Height > Width ? FieldOfView * Width / Height : FieldOfView;
-		const float FOVY = Width > Height ? FieldOfView * Height / Width : FieldOfView;
-		double halfFOVX = FOVX * PI / 360.0; // was M_PI on gcc
-		double halfFOVY = FOVY * PI / 360.0; // was M_PI on gcc
-		const double cX = Width / 2.0;
-		const double cY = Height / 2.0;
-
-		const double K0 = cX / std::tan(halfFOVX);
-		const double K2 = cX;
-		const double K4 = K0;
-		const double K5 = cY;
-		const double K8 = 1;
-
-		const double P0 = K0;
-		const double P2 = K2;
-		const double P5 = K4;
-		const double P6 = K5;
-		const double P10 = 1;
-
-		TSharedPtr<ROSMessages::sensor_msgs::CameraInfo> CamInfo(new ROSMessages::sensor_msgs::CameraInfo());
-		CamInfo->header.seq = 0;
-		CamInfo->header.time = time;
-		CamInfo->header.frame_id = ImageOpticalFrame;
-		CamInfo->height = Height;
-		CamInfo->width = Width;
-		CamInfo->distortion_model = TEXT("plumb_bob");
-		CamInfo->D[0] = 0;
-		CamInfo->D[1] = 0;
-		CamInfo->D[2] = 0;
-		CamInfo->D[3] = 0;
-		CamInfo->D[4] = 0;
-
-		CamInfo->K[0] = K0;
-		CamInfo->K[1] = 0;
-		CamInfo->K[2] = K2;
-		CamInfo->K[3] = 0;
-		CamInfo->K[4] = K4;
-		CamInfo->K[5] = K5;
-		CamInfo->K[6] = 0;
-		CamInfo->K[7] = 0;
-		CamInfo->K[8] = K8;
-
-		CamInfo->R[0] = 1;
-		CamInfo->R[1] = 0;
-		CamInfo->R[2] = 0;
-		CamInfo->R[3] = 0;
-		CamInfo->R[4] = 1;
-		CamInfo->R[5] = 0;
-		CamInfo->R[6] = 0;
-		CamInfo->R[7] = 0;
-		CamInfo->R[8] = 1;
-
-		CamInfo->P[0] = P0;
-		CamInfo->P[1] = 0;
-		CamInfo->P[2] = P2;
-		CamInfo->P[3] = P0 * TranslateX;
-		CamInfo->P[4] = 0;
-		CamInfo->P[5] = P5;
-		CamInfo->P[6] = P6;
-		CamInfo->P[7] = 0;
-		CamInfo->P[8] = 0;
-		CamInfo->P[9] = 0;
-		CamInfo->P[10] = P10;
-		CamInfo->P[11] = 0;
-
-		CamInfo->binning_x = 0;
-		CamInfo->binning_y = 0;
-
-		CamInfo->roi.x_offset = 0;
-		CamInfo->roi.y_offset = 0;
-		CamInfo->roi.height = 0;
-		CamInfo->roi.width = 0;
-		CamInfo->roi.do_rectify = false;
-
-		CameraInfoPublisher->Publish(CamInfo);
+		ImageMessage->height = Header.Height;
+		ImageMessage->width = Header.Width;
+		ImageMessage->encoding = Priv->Format == EColorFormat::BGRA8 ? TEXT("bgra8") : TEXT("bgr8");
+		ImageMessage->step = Header.Width * Header.Bytes;
+		const uint64 ImageBytes = ImageMessage->step * ImageMessage->height;
+		Priv->ImageQueue->Publish(MoveTemp(ImageMessage), ImageBytes);
+	}
+
+	if (Priv->PublishCompressed) {
+		EncodeCompressed(Lease, Time);
+	}
+
+	PublishCameraInfo(Time);
+}
+
+void UVisionComponent::EncodeCompressed(const std::shared_ptr<const uint8> &Lease, const FROSTime &Time)
+{
+	const uint32 OffsetColor = Priv->Buffer->OffsetImage;
+	const uint32 Stride = Priv->Format == EColorFormat::BGRA8 ? 4 : 3;
+	const bool IsJPEG = CompressedFormat == ECompressedFormat::JPEG;
+	const int32 Quality = IsJPEG ? FMath::Clamp(CompressedQuality, 1, 100) : 0;
+	const uint32 ImageWidth = Width, ImageHeight = Height;
+	IImageWrapperModule *ImageWrapperModule = Priv->ImageWrapperModule;
+	auto Encode = [OffsetColor, Stride, IsJPEG, Quality, ImageWidth, ImageHeight, ImageWrapperModule](const uint8 *Packet, TArray<uint8> &Data)
+	{
+		// The image wrappers need 4 channels
+		const uint32 Pixels = ImageWidth * ImageHeight;
+		const uint8 *BGR = Packet + OffsetColor;
+		TArray<uint8> RGBA;
+		RGBA.SetNumUninitialized(Pixels * 4);
+		uint8 *Out = RGBA.GetData();
+		for (uint32 i = 0; i < Pixels; ++i, BGR += Stride, Out += 4)
+		{
+			Out[0] = BGR[2];
+			Out[1] = BGR[1];
+			Out[2] = BGR[0];
+			Out[3] = 255;
+		}
+
+		TSharedPtr<IImageWrapper> Wrapper = ImageWrapperModule->CreateImageWrapper(IsJPEG ? EImageFormat::JPEG : EImageFormat::PNG);
+		if (Wrapper.IsValid() && Wrapper->SetRaw(RGBA.GetData(), RGBA.Num(), ImageWidth, ImageHeight, ERGBFormat::RGBA, 8))
+		{
+			Data = Wrapper->GetCompressed(Quality);
+		}
+	};
+
+	Priv->Compressor->Publish(Lease, Encode, *Priv->CompressedImageQueue, Time, ImageOpticalFrame,
+		IsJPEG ? TEXT("bgr8; jpeg compressed bgr8") : TEXT("bgr8; png compressed bgr8"), (uint64)Width * Height * 3, MaxEncodingJobs);
+}
+
+void UVisionComponent::PublishCameraInfo(const FROSTime &Time)
+{
+	if (Priv->PublishInfo) {
+		Priv->Intrinsics.Publish(*Priv->CameraInfoQueue, Time, ImageOpticalFrame);
 	}
 }
 
@@ -244,44 +447,235 @@ void UVisionComponent::InitializeComponent()
 void UVisionComponent::BeginPlay()
 {
 	Super::BeginPlay();
+
+	// The outputs besides the topics, the topics get the packets from PublishMessages. A replay at full speed
+	// publishes a frame once the image topic has room for it, if it has subscribers.
+	Priv->Pool = &FROSIntegrationVisionModule::Get().GetWorkerPool();
+	Priv->Outputs = MakeShareable(new PacketOutputs(GetName(),
+		[this](const std::shared_ptr<const uint8> &Lease, const FROSTime &Time) { PublishMessages(Lease, Time); },
+		[this](const double Timeout) {
+			const CaptureLog::FileHeader &Log = *Priv->Outputs->GetReplay()->GetHeader();
+			return !Priv->PublishRaw || Priv->ImageQueue->WaitForSpace((uint64)Log.Width * Log.Height * Log.Bytes, Timeout);
+		}));
+
+	// A replay takes the layout of the images from the log instead of the properties
+	if (!ReplayPath.IsEmpty()) {
+		const CaptureLog::FileHeader *Header = Priv->Outputs->OpenReplay(ReplayPath);
+		const bool BGRA = Header && Header->Bytes == 4 && FCStringAnsi::Strncmp(Header->Encoding, "bgra8", sizeof(Header->Encoding)) == 0;
+		const bool BGR = Header && Header->Bytes == 3 && FCStringAnsi::Strncmp(Header->Encoding, "bgr8", sizeof(Header->Encoding)) == 0;
+		if ((BGRA || BGR) && Header->OffsetImage == sizeof(PacketBuffer::PacketHeader) &&
+			Header->PacketSize == Header->OffsetImage + Header->Width * Header->Height * Header->Bytes) {
+			Width = Header->Width;
+			Height = Header->Height;
+			TranslateX = Header->TranslateX;
+			if (BGRA) {
+				ColorFormat = EColorFormat::BGRA8;
+			}
+			else if (ColorFormat == EColorFormat::BGRA8) {
+				ColorFormat = EColorFormat::BGR8;
+			}
+			if (Priv->Outputs->GetReplay()->GetNumFrames() > 0) {
+				const PacketBuffer::PacketHeader *First = Priv->Outputs->GetReplay()->GetPacket(0);
+				FieldOfView = FMath::Max(First->FieldOfViewX, First->FieldOfViewY);
+			}
+		}
+		else {
+			UE_LOG(LogTemp, Warning, TEXT("%s could not replay %s, it is no color capture log."), *GetName(), *ReplayPath);
+			Priv->Outputs->CloseReplay();
+		}
+	}
+
+	Priv->Format = ColorFormat;
+	const bool LDR = Priv->Format != EColorFormat::BGR8FromFloat16;
+
     // Initializing buffers for reading images from the GPU
-	ImageColor.AddUninitialized(Width * Height);
+	if (LDR) {
+		ImageColorLDR.AddUninitialized(Width * Height);
+	}
+	else {
+		ImageColor.AddUninitialized(Width * Height);
+	}
 
-	// Reinit renderer
-	Color->TextureTarget->InitAutoFormat(Width, Height);
+	// Reinit renderer, the LDR capture is read as it is from an 8 bit target
+	if (LDR) {
+		Color->TextureTarget->InitCustomFormat(Width, Height, PF_B8G8R8A8, false);
+	}
+	else {
+		Color->TextureTarget->InitAutoFormat(Width, Height);
+	}
 
 	AspectRatio = Width / (float)Height;
 
 	// Setting flags for each camera
 	ShowFlagsLit(Color->ShowFlags);
 
-	// Creating double buffer and setting the pointer of the server object
-	Priv->Buffer = TSharedPtr<PacketBuffer>(new PacketBuffer(Width, Height, 3, FieldOfView));
+	// Creating packet ring buffer and setting the pointer of the server object
+	// One slot more than the minimum, so that a message still holding its lease does not stall the writer,
+	// one for each encoding job, which also holds a lease, and the three the server holds at most
+	const uint32 EncodingSlots = CompressedImageTopicName.IsEmpty() ? 0 : FMath::Max(MaxEncodingJobs, 0);
+	const uint32 Bytes = Priv->Format == EColorFormat::BGRA8 ? 4 : 3;
+	Priv->Buffer = TSharedPtr<PacketBuffer>(new PacketBuffer(Width, Height, Bytes, FieldOfView, 4 + EncodingSlots + (EnableServer ? 3 : 0)));
+
+	// The packets are described like in a capture log, for the shared memory ring as well
+	CaptureLog::FileHeader Description;
+	FMemory::Memzero(Description);
+	Description.PacketSize = Priv->Buffer->Size;
+	Description.OffsetImage = Priv->Buffer->OffsetImage;
+	Description.Width = Width;
+	Description.Height = Height;
+	Description.Bytes = Bytes;
+	Description.TranslateX = TranslateX;
+	FCStringAnsi::Strncpy(Description.Encoding, Priv->Format == EColorFormat::BGRA8 ? "bgra8" : "bgr8", sizeof(Description.Encoding));
+	FCStringAnsi::Strncpy(Description.FrameId, TCHAR_TO_UTF8(*ImageOpticalFrame), sizeof(Description.FrameId));
+	PacketOutputs::Settings Settings;
+	Settings.SharedMemoryName = SharedMemoryName;
+	Settings.SharedMemorySlots = SharedMemorySlots;
+	Settings.EnableServer = EnableServer;
+	Settings.ServerPort = ServerPort;
+	Settings.RecordPath = RecordPath;
+	Priv->Outputs->Open(Settings, Description);
 
 	Running = true;
 	Paused = false;
+	Priv->Schedule = 0;
+	Priv->ScheduledRate = 0;
+
+	// Without per-frame captures the render target is only updated by PublishImages. Readbacks always capture
+	// explicitly, a capture every frame is rendered after the tick and the copy would get the previous frame.
+	Priv->OnDemand = CaptureOnDemand || ReadbackDepth > 0;
+	Color->bCaptureEveryFrame = !Priv->OnDemand;
+	Color->bCaptureOnMovement = !Priv->OnDemand;
+	Priv->Capturing = !Priv->OnDemand;
+	Priv->PublishRaw = false;
+	Priv->PublishCompressed = false;
+	Priv->PublishInfo = false;
+	Priv->StatsCaptures = 0;
+	Priv->StatsTicks = 0;
+	Priv->StatsCaptureStart = FPlatformTime::Seconds();
+	Priv->Stages.Reset();
 
 	Priv->DoColor = false;
+	Priv->Converting = false;
+	Priv->PublishRequests = 0;
+	if (LDR) {
+		Priv->PendingColorLDR.AddUninitialized(Width * Height);
+		Priv->ProcessingColorLDR.AddUninitialized(Width * Height);
+	}
+	else {
+		Priv->PendingColor.AddUninitialized(Width * Height);
+		Priv->ProcessingColor.AddUninitialized(Width * Height);
+	}
+
+	// The module has to be loaded on the game thread, the encoding jobs only create image wrappers
+	Priv->ImageWrapperModule = &FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
+	Priv->Compressor = MakeShareable(new CompressedPublisher(GetName(), *Priv->Pool, Priv->Jobs, Priv->Stages));
+
+	// Ring of non-blocking readbacks, without it the render target is read synchronously
+	if (ReadbackDepth > 0)
+	{
+		Priv->Readback = TSharedPtr<ReadbackQueue>(new ReadbackQueue(ReadbackDepth, Width, Height,
+			LDR ? ReadbackQueue::Content::LDR : ReadbackQueue::Content::Float16));
+	}
 
-	// Starting threads to process image data
-	Priv->ThreadColor = std::thread(&UVisionComponent::ProcessColor, this);
+	// Nothing is rendered during a replay
+	if (Priv->Outputs->GetReplay()) {
+		Color->bCaptureEveryFrame = false;
+		Color->bCaptureOnMovement = false;
+		Priv->Capturing = false;
+		Priv->Intrinsics.Update(Width, Height, FieldOfView, TranslateX);
+		Priv->Outputs->StartReplay(ReplaySpeed, ReplayLoop);
+	}
 }
 
 void UVisionComponent::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction *TickFunction)
 {
     Super::TickComponent(DeltaTime, TickType, TickFunction);
+
+	// The replay publishes to the outputs that take the images as of the last tick, and pauses without any
+	if (Priv->Outputs->GetReplay()) {
+		Priv->Intrinsics.Update(Width, Height, FieldOfView, TranslateX);
+		Priv->Outputs->SetConsumed(UpdateSubscribers());
+		return;
+	}
+
+	PipelineTimer GameThreadTime(Priv->Times, false);
+
+	// Submit all frames whose readback completed in the meantime, oldest first
+	while (Priv->Readback.IsValid())
+	{
+		ReadbackQueue::Frame *Frame = Priv->Readback->Peek();
+		if (!Frame)
+		{
+			break;
+		}
+		RECORD_STAGE_SINCE(Priv->Stages, Readback, Frame->ClockCapture);
+
+		if (Priv->Format == EColorFormat::BGR8FromFloat16) {
+			SubmitFrame(Frame->Pixels, *Frame);
+		}
+		else {
+			SubmitFrame(Frame->PixelsLDR, *Frame);
+		}
+		Priv->Readback->Pop();
+	}
+
+	// The module scheduler calls PublishImages at the target rate, staggered with the other components
+	if (PublishRate != Priv->ScheduledRate && Running) {
+		CaptureScheduler &Scheduler = FROSIntegrationVisionModule::Get().GetScheduler();
+		if (Priv->Schedule == 0) {
+			const uint64 ReadbackBytes = (uint64)Width * Height * (Priv->Format == EColorFormat::BGR8FromFloat16 ? sizeof(FFloat16Color) : sizeof(FColor));
+			Priv->Schedule = Scheduler.Register(GetName(), PublishRate, ReadbackBytes, [this]() { return CaptureImages(); });
+		}
+		else {
+			Scheduler.SetRate(Priv->Schedule, PublishRate);
+		}
+		Priv->ScheduledRate = PublishRate;
+	}
+
+	++Priv->StatsTicks;
+	if (!Priv->OnDemand && Priv->Capturing) {
+		++Priv->StatsCaptures;
+	}
+	const double Now = FPlatformTime::Seconds();
+	if (Now - Priv->StatsCaptureStart >= 1.0) {
+		UE_LOG(LogTemp, Verbose, TEXT("%s captured %u times in %u frames."), *GetName(), Priv->StatsCaptures, Priv->StatsTicks);
+		Priv->StatsCaptureStart = Now;
+		Priv->StatsCaptures = 0;
+		Priv->StatsTicks = 0;
+	}
+	Priv->Times.Report(GetName());
 }
 
 void UVisionComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
 	Super::EndPlay(EndPlayReason);
-    Running = false;
+	Running = false;
 
-    // Stopping processing threads
-	Priv->DoColor = true;
-    Priv->CVColor.notify_one();
+	if (Priv->Schedule != 0) {
+		FROSIntegrationVisionModule::Get().GetScheduler().Unregister(Priv->Schedule);
+		Priv->Schedule = 0;
+	}
+
+	// Waiting for readbacks in flight before their frames are destroyed
+	Priv->Readback.Reset();
+
+	// The replay stops within one frame or queue timeout, leases of its frames keep the log mapped
+	Priv->Outputs->StopReplay();
 
-    Priv->ThreadColor.join();
+	// Waiting for the conversion, publishing and encoding jobs, they access the component
+	Priv->Jobs.Wait();
+	Priv->Outputs->Close();
+
+	// Messages still waiting for the bridge are dropped, the ones it holds finish on their own
+	if (Priv->CameraInfoQueue.IsValid()) {
+		Priv->CameraInfoQueue->Close();
+	}
+	if (Priv->ImageQueue.IsValid()) {
+		Priv->ImageQueue->Close();
+	}
+	if (Priv->CompressedImageQueue.IsValid()) {
+		Priv->CompressedImageQueue->Close();
+	}
 }
 
 void UVisionComponent::ShowFlagsBasicSetting(FEngineShowFlags &ShowFlags) const
@@ -318,32 +712,93 @@ void UVisionComponent::ReadImage(UTextureRenderTarget2D *RenderTarget, TArray<FF
 	RenderTargetResource->ReadFloat16Pixels(ImageData);
 }
 
+void UVisionComponent::ReadImage(UTextureRenderTarget2D *RenderTarget, TArray<FColor> &ImageData) const
+{
+	FTextureRenderTargetResource *RenderTargetResource = RenderTarget->GameThread_GetRenderTargetResource();
+	// The data is copied as it is, without any gamma conversion
+	FReadSurfaceDataFlags Flags(RCM_UNorm, CubeFace_MAX);
+	Flags.SetLinearToGamma(false);
+	RenderTargetResource->ReadPixelsPtr(ImageData.GetData(), Flags);
+}
+
 void UVisionComponent::ToColorImage(const TArray<FFloat16Color> &ImageData, uint8 *Bytes) const
 {
-	const FFloat16Color *itI = ImageData.GetData();
-	uint8_t *itO = Bytes;
+	static_assert(sizeof(FFloat16Color) == 4 * sizeof(uint16_t), "FFloat16Color has to be four packed half floats");
 
-	// Converts Float colors to bytes
-	for (size_t i = 0; i < ImageData.Num(); ++i, ++itI, ++itO)
-	{
-		*itO = (uint8_t)std::round((float)itI->B * 255.f);
-		*++itO = (uint8_t)std::round((float)itI->G * 255.f);
-		*++itO = (uint8_t)std::round((float)itI->R * 255.f);
+	check((uint32)ImageData.Num() == Width * Height);
+
+	// Converts Float colors to bytes, vectorized if the CPU supports F16C.
+	// Large frames are split into stripes of rows that are converted in parallel.
+	const uint16_t *In = reinterpret_cast<const uint16_t *>(ImageData.GetData());
+	const uint32 MinRows = FMath::DivideAndRoundUp<uint32>(ImageConversion::MinStripePixels, Width);
+	Priv->Pool->ParallelFor(Height, MinRows, [this, In, Bytes](uint32 Begin, uint32 End) {
+		ImageConversion::HalfToBGR8(In + Begin * Width * 4, Bytes + Begin * Width * 3, (End - Begin) * Width);
+	});
+}
+
+void UVisionComponent::ToColorImage(const TArray<FColor> &ImageData, uint8 *Bytes) const
+{
+	static_assert(sizeof(FColor) == 4, "FColor has to be four packed bytes");
+
+	check((uint32)ImageData.Num() == Width * Height);
+
+	// FColor is stored as BGRA, so bgra8 is copied and bgr8 only drops the alpha channel
+	const uint8 *In = reinterpret_cast<const uint8 *>(ImageData.GetData());
+	const uint32 MinRows = FMath::DivideAndRoundUp<uint32>(ImageConversion::MinStripePixels, Width);
+	if (Priv->Format == EColorFormat::BGRA8) {
+		Priv->Pool->ParallelFor(Height, MinRows, [this, In, Bytes](uint32 Begin, uint32 End) {
+			FMemory::Memcpy(Bytes + Begin * Width * 4, In + Begin * Width * 4, (End - Begin) * Width * 4);
+		});
+	}
+	else {
+		Priv->Pool->ParallelFor(Height, MinRows, [this, In, Bytes](uint32 Begin, uint32 End) {
+			ImageConversion::BGRA8ToBGR8(In + Begin * Width * 4, Bytes + Begin * Width * 3, (End - Begin) * Width);
+		});
 	}
-	return;
 }
 
 void UVisionComponent::ProcessColor()
 {
+	FrameInfo Info;
 	while (true)
 	{
-		std::unique_lock<std::mutex> WaitLock(Priv->WaitColor);
-		Priv->CVColor.wait(WaitLock, [this] {return Priv->DoColor; });
-		Priv->DoColor = false;
-		if (!this->Running) break;
-		ToColorImage(ImageColor, Priv->Buffer->Image);
-
-		// Complete Buffer
-		Priv->Buffer->DoneWriting();
+		{
+			std::lock_guard<std::mutex> WaitLock(Priv->WaitColor);
+			if (!Priv->DoColor) {
+				Priv->Converting = false;
+				break;
+			}
+			Priv->DoColor = false;
+			Swap(Priv->ProcessingColor, Priv->PendingColor);
+			Swap(Priv->ProcessingColorLDR, Priv->PendingColorLDR);
+			Info = Priv->PendingInfo;
+		}
+
+		// Converting outside of the lock, so that the game thread can submit the next frame meanwhile
+		{
+			MEASURE_STAGE(Priv->Stages, Conversion);
+			PipelineTimer WorkerTime(Priv->Times, true);
+			if (Priv->Format == EColorFormat::BGR8FromFloat16) {
+				ToColorImage(Priv->ProcessingColor, Priv->Buffer->Image);
+			}
+			else {
+				ToColorImage(Priv->ProcessingColorLDR, Priv->Buffer->Image);
+			}
+		}
+		Priv->Buffer->HeaderWrite->TimestampCapture = Info.TimestampCapture;
+		Priv->Buffer->HeaderWrite->ClockCapture = Info.ClockCapture;
+		Priv->Buffer->HeaderWrite->Translation = Info.Translation;
+		Priv->Buffer->HeaderWrite->Rotation = Info.Rotation;
+
+		// Complete Buffer, waits for a slot that no message leases anymore
+		{
+			MEASURE_STAGE(Priv->Stages, BufferWait);
+			Priv->Buffer->DoneWriting();
+		}
+
+		// Starting the publishing job unless it is running already
+		if (Priv->PublishRequests.fetch_add(1) == 0) {
+			Priv->Pool->Submit(Priv->Jobs, [this]() { PublishColor(); });
+		}
 	}
 }
\ No newline at end of file
@@ -0,0 +1,240 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+#if defined(__linux__)
+  #include <pthread.h>
+  #include <sched.h>
+#elif defined(_WIN32)
+  #include "Windows/AllowWindowsPlatformTypes.h"
+  #include <windows.h>
+  #include "Windows/HideWindowsPlatformTypes.h"
+#endif
+
+namespace
+{
+  // Pool and index of the worker running on this thread, so that jobs submitted from a worker stay local
+  thread_local const WorkerPool *CurrentPool = nullptr;
+  thread_local uint32_t CurrentWorker = 0;
+
+  void SetAffinity(const uint64_t AffinityMask)
+  {
+#if defined(__linux__)
+    cpu_set_t Set;
+    CPU_ZERO(&Set);
+    for (uint32_t Core = 0; Core < 64; ++Core)
+    {
+      if (AffinityMask & (1ull << Core))
+      {
+        CPU_SET(Core, &Set);
+      }
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set);
+#elif defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)AffinityMask);
+#endif
+  }
+}
+
+WorkerPool::Group::Group() : Pending(0)
+{
+}
+
+void WorkerPool::Group::Wait()
+{
+  std::unique_lock<std::mutex> WaitLock(Lock);
+  CVDone.wait(WaitLock, [this] {return Pending == 0; });
+}
+
+void WorkerPool::Group::Add()
+{
+  std::lock_guard<std::mutex> AddLock(Lock);
+  ++Pending;
+}
+
+void WorkerPool::Group::Done()
+{
+  // Notifying under the lock, the group might be destroyed as soon as Wait returned
+  std::lock_guard<std::mutex> DoneLock(Lock);
+  if (--Pending == 0)
+  {
+    CVDone.notify_all();
+  }
+}
+
+WorkerPool::WorkerPool(const uint32_t NumThreads, const uint64_t AffinityMask) :
+  Queued(0), NextWorker(0), Stopping(false)
+{
+  uint32_t Threads = NumThreads;
+  if (Threads == 0)
+  {
+    const uint32_t Cores = std::thread::hardware_concurrency();
+    Threads = Cores > 1 ? Cores - 1 : 1;
+  }
+
+  for (uint32_t i = 0; i < Threads; ++i)
+  {
+    Workers.emplace_back(new Worker());
+  }
+  // Started after all queues exist, workers steal from every queue
+  for (uint32_t i = 0; i < Threads; ++i)
+  {
+    Workers[i]->Thread = std::thread(&WorkerPool::Run, this, i, AffinityMask);
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> StopLock(WaitLock);
+    Stopping = true;
+  }
+  CVWork.notify_all();
+
+  for (std::unique_ptr<Worker> &Current : Workers)
+  {
+    Current->Thread.join();
+  }
+}
+
+void WorkerPool::Submit(Group &Jobs, std::function<void()> Job)
+{
+  Jobs.Add();
+
+  const uint32_t Index = CurrentPool == this ? CurrentWorker : NextWorker.fetch_add(1) % Workers.size();
+  {
+    std::lock_guard<std::mutex> QueueLock(Workers[Index]->Lock);
+    Workers[Index]->Queue.push_back(Task{ &Jobs, std::move(Job) });
+  }
+
+  // Counted under the lock the workers wait with, so that no worker misses the job
+  {
+    std::lock_guard<std::mutex> CountLock(WaitLock);
+    ++Queued;
+  }
+  CVWork.notify_one();
+}
+
+void WorkerPool::ParallelFor(const uint32_t Count, const uint32_t MinRange,
+                             const std::function<void(uint32_t, uint32_t)> &Body)
+{
+  // A few ranges per worker balance uneven progress of the workers
+  const uint32_t MaxRanges = ((uint32_t)Workers.size() + 1) * 4;
+  const uint32_t Ranges = std::max(1u, std::min(MaxRanges, Count / std::max(MinRange, 1u)));
+  if (Ranges == 1)
+  {
+    Body(0, Count);
+    return;
+  }
+
+  // Shared with the helper jobs, which may only start after the caller already returned
+  struct State
+  {
+    std::function<void(uint32_t, uint32_t)> Body;
+    uint32_t Count, Ranges;
+    std::atomic<uint32_t> Next, Done;
+    std::mutex Lock;
+    std::condition_variable CVDone;
+    Group Helpers;
+
+    // Processes ranges until none is left
+    void Work()
+    {
+      uint32_t Finished = 0;
+      for (uint32_t Range = Next++; Range < Ranges; Range = Next++)
+      {
+        Body((uint64_t)Count * Range / Ranges, (uint64_t)Count * (Range + 1) / Ranges);
+        ++Finished;
+      }
+      if (Finished && Done.fetch_add(Finished) + Finished == Ranges)
+      {
+        std::lock_guard<std::mutex> DoneLock(Lock);
+        CVDone.notify_all();
+      }
+    }
+  };
+  std::shared_ptr<State> Shared(new State());
+  Shared->Body = Body;
+  Shared->Count = Count;
+  Shared->Ranges = Ranges;
+  Shared->Next = 0;
+  Shared->Done = 0;
+
+  const uint32_t Helpers = std::min(Ranges - 1, (uint32_t)Workers.size());
+  for (uint32_t i = 0; i < Helpers; ++i)
+  {
+    // The job owns the state, which also keeps the group alive until the pool marked the job as done
+    Submit(Shared->Helpers, [Shared]() { Shared->Work(); });
+  }
+  Shared->Work();
+
+  // Only waiting for ranges taken by helpers, not for helpers that did not start yet
+  std::unique_lock<std::mutex> WaitLock(Shared->Lock);
+  Shared->CVDone.wait(WaitLock, [&Shared] {return Shared->Done == Shared->Ranges; });
+}
+
+uint32_t WorkerPool::GetNumThreads() const
+{
+  return (uint32_t)Workers.size();
+}
+
+bool WorkerPool::TakeTask(const uint32_t Index, Task &Next)
+{
+  // Own queue from the back, the most recent job is the most likely to have its data in the cache
+  {
+    Worker &Own = *Workers[Index];
+    std::lock_guard<std::mutex> QueueLock(Own.Lock);
+    if (!Own.Queue.empty())
+    {
+      Next = std::move(Own.Queue.back());
+      Own.Queue.pop_back();
+      return true;
+    }
+  }
+
+  // Stealing the oldest job of another worker
+  for (uint32_t i = 1; i < Workers.size(); ++i)
+  {
+    Worker &Other = *Workers[(Index + i) % Workers.size()];
+    std::lock_guard<std::mutex> QueueLock(Other.Lock);
+    if (!Other.Queue.empty())
+    {
+      Next = std::move(Other.Queue.front());
+      Other.Queue.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkerPool::Run(const uint32_t Index, const uint64_t AffinityMask)
+{
+  CurrentPool = this;
+  CurrentWorker = Index;
+  if (AffinityMask)
+  {
+    SetAffinity(AffinityMask);
+  }
+
+  while (true)
+  {
+    Task Next;
+    if (TakeTask(Index, Next))
+    {
+      --Queued;
+      Next.Job();
+      Next.Jobs->Done();
+      continue;
+    }
+
+    // Queued jobs are finished before stopping
+    std::unique_lock<std::mutex> Lock(WaitLock);
+    CVWork.wait(Lock, [this] {return Queued > 0 || Stopping; });
+    if (Stopping && Queued == 0)
+    {
+      break;
+    }
+  }
+}
@@ -0,0 +1,81 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Work-stealing thread pool shared by all vision components of the module. Every worker has its own queue,
+ * jobs submitted from a worker go to its own queue and idle workers steal from the others.
+ * Jobs are submitted to a Group, which can be waited on to drain the jobs of one component. A job may submit
+ * further jobs to its group, they are waited for as well.
+ */
+class ROSINTEGRATIONVISION_API WorkerPool
+{
+public:
+  class Group
+  {
+  public:
+    Group();
+
+    // Blocks until all jobs of the group, including the ones submitted meanwhile, are done
+    void Wait();
+
+  private:
+    friend class WorkerPool;
+    std::mutex Lock;
+    std::condition_variable CVDone;
+    uint32_t Pending;
+
+    void Add();
+    void Done();
+  };
+
+  // Starts NumThreads workers, 0 uses one less than the number of cores. A non-zero AffinityMask pins all
+  // workers to the given cores.
+  WorkerPool(const uint32_t NumThreads, const uint64_t AffinityMask = 0);
+
+  // Finishes the queued jobs and stops the workers
+  ~WorkerPool();
+
+  void Submit(Group &Jobs, std::function<void()> Job);
+
+  // Calls Body(Begin, End) for consecutive ranges covering [0, Count) in parallel and returns once all are done.
+  // Ranges hold at least MinRange elements, the number of ranges is limited to a few per worker. The calling
+  // thread processes ranges as well, so it does not depend on free workers and may itself be a worker.
+  void ParallelFor(const uint32_t Count, const uint32_t MinRange, const std::function<void(uint32_t, uint32_t)> &Body);
+
+  uint32_t GetNumThreads() const;
+
+private:
+  struct Task
+  {
+    Group *Jobs;
+    std::function<void()> Job;
+  };
+
+  struct Worker
+  {
+    std::mutex Lock;
+    std::deque<Task> Queue;
+    std::thread Thread;
+  };
+
+  std::vector<std::unique_ptr<Worker>> Workers;
+  std::mutex WaitLock;
+  std::condition_variable CVWork;
+  std::atomic<uint32_t> Queued;
+  std::atomic<uint32_t> NextWorker;
+  bool Stopping;
+
+  void Run(const uint32_t Index, const uint64_t AffinityMask);
+  bool TakeTask(const uint32_t Index, Task &Next);
+};
@@ -4,10 +4,36 @@
 #include "Components/SceneCaptureComponent2D.h"
 #include "Engine/TextureRenderTarget2D.h"
 
+#include <memory>
+
+#include "ROSTime.h"
 #include "RI/Topic.h"
 
+#include "OutgoingQueueSettings.h"
+#include "StageLatency.h"
+
 #include "DepthComponent.generated.h"
 
+struct FrameInfo;
+
+UENUM(BlueprintType)
+enum class EDepthEncoding : uint8
+{
+    // 32FC1, depth in meters as float
+    Float32Meters UMETA(DisplayName = "32FC1 (meters)"),
+    // 16UC1, depth in millimeters as unsigned short, half the bandwidth of 32FC1
+    UInt16Millimeters UMETA(DisplayName = "16UC1 (millimeters)")
+};
+
+UENUM(BlueprintType)
+enum class EDepthCompression : uint8
+{
+    // 16 bit PNG, smaller but slower to encode
+    PNG UMETA(DisplayName = "PNG"),
+    // Run-length variable-length coding, very cheap to encode and decode
+    RVL UMETA(DisplayName = "RVL")
+};
+
 UCLASS()
 class ROSINTEGRATIONVISION_API UDepthComponent : public UCameraComponent {
 
@@ -24,13 +50,73 @@ public:
         void InitializeTopics();
     UFUNCTION(BlueprintCallable, Category = "ROS")
         void PublishImages();
+    // Rate in Hz at which the scheduler published during the last seconds, to compare with PublishRate
+    UFUNCTION(BlueprintPure, Category = "ROS")
+        float GetAchievedPublishRate() const;
+    // Latency of a stage of the frames since BeginPlay or the last reset, zero if stage timing is compiled out
+    UFUNCTION(BlueprintPure, Category = "ROS")
+        FStageLatency GetStageLatency(EVisionStage Stage) const;
+    UFUNCTION(BlueprintCallable, Category = "ROS")
+        void ResetStageLatencies();
+    // Writes the latencies of all stages to a CSV file, returns false if that failed or stage timing is compiled out
+    UFUNCTION(BlueprintCallable, Category = "ROS")
+        bool DumpStageLatencies(const FString& Path) const;
 
+    // Baseline in meters, P[3] of the camera info is the focal length times it. 0 for a monocular camera.
+    UPROPERTY(EditAnywhere, Category = "Depth Component")
+        float TranslateX;
     UPROPERTY(EditAnywhere, Category = "Depth Component")
         uint32 Width;
     UPROPERTY(EditAnywhere, Category = "Depth Component")
         uint32 Height;
+    // Streams every packet, the PacketBuffer header followed by the image, to TCP clients on ServerPort. Clients
+    // that do not keep up skip frames. Only supported on Linux, changes take effect on BeginPlay.
+    UPROPERTY(EditAnywhere, Category = "Depth Component")
+        bool EnableServer = false;
     UPROPERTY(EditAnywhere, Category = "Depth Component")
         int32 ServerPort;
+    // Name of a POSIX shared memory ring, like "/unreal_camera", that receives every packet for readers on the same
+    // host. Empty disables it. Only supported on Linux, changes take effect on BeginPlay.
+    UPROPERTY(EditAnywhere, Category = "Depth Component")
+        FString SharedMemoryName;
+    // Number of frames in the ring, a reader has to be done with a frame before the ring wraps around to it
+    UPROPERTY(EditAnywhere, Category = "Depth Component")
+        int32 SharedMemorySlots = 4;
+    // Capture log that every packet is appended to, relative paths are in the Saved directory of the project. Empty
+    // disables it. The log is finished on EndPlay. Only supported on Linux, changes take effect on BeginPlay.
+    UPROPERTY(EditAnywhere, Category = "Depth Component")
+        FString RecordPath;
+    // Capture log that is published instead of rendered images, with the stamps of its frames. Relative paths are in
+    // the Saved directory of the project. The size, encoding, field of view and baseline are taken from the log.
+    // Empty disables it. Only supported on Linux, changes take effect on BeginPlay.
+    UPROPERTY(EditAnywhere, Category = "Depth Component")
+        FString ReplayPath;
+    // Factor on the speed the replayed frames were recorded at, 0 publishes them as fast as the image topic takes
+    // them. Changes take effect on BeginPlay.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Depth Component")
+        float ReplaySpeed = 1;
+    // Starts the replay over after the last frame
+    UPROPERTY(EditAnywhere, Category = "Depth Component")
+        bool ReplayLoop = false;
+    // Number of frames that are read back from the GPU asynchronously and published in a later tick. The scene is
+    // then captured on demand for every frame that is read back, like with CaptureOnDemand.
+    // 0 reads every frame synchronously in PublishImages, which stalls the game thread until rendering is done.
+    UPROPERTY(EditAnywhere, Category = "Depth Component")
+        int32 ReadbackDepth;
+    // Renders the scene capture only for frames that are published instead of in every frame, which saves the
+    // GPU time of all other frames. The render target is not updated otherwise. Changes take effect on BeginPlay.
+    UPROPERTY(EditAnywhere, Category = "Depth Component")
+        bool CaptureOnDemand = false;
+    // Rate in Hz at which the module scheduler calls PublishImages, staggered with the other components. 0 disables it.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Depth Component")
+        float PublishRate = 0;
+    // Encoding of the published depth image, changes take effect on BeginPlay
+    UPROPERTY(EditAnywhere, Category = "Depth Component")
+        EDepthEncoding Encoding;
+    // Depth values beyond this range in meters are clamped to it, 0 disables the clamp.
+    // 16UC1 is always limited to 65.535 meters.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Depth Component")
+        float MaxRange;
 
     UPROPERTY(Transient, EditAnywhere, BlueprintReadWrite, Category = "Depth Component")
         USceneCaptureComponent2D* Depth;
@@ -44,11 +130,26 @@ public:
         FString CameraInfoTopicName = TEXT("/unreal_ros/camera_info");
     UPROPERTY(EditAnywhere, Category = "Depth Component")
         FString ImageTopicName = TEXT("/unreal_ros/image_depth");
+    // compressedDepth topic of image_transport, nothing is compressed if it is empty.
+    // The compressed depth is always 16UC1 in millimeters, independent of Encoding.
+    UPROPERTY(EditAnywhere, Category = "Depth Component")
+        FString CompressedDepthTopicName;
+    UPROPERTY(EditAnywhere, Category = "Depth Component")
+        EDepthCompression Compression = EDepthCompression::PNG;
+    // Number of frames that are encoded in parallel on the thread pool, further frames are not compressed
+    UPROPERTY(EditAnywhere, Category = "Depth Component")
+        int32 MaxEncodingJobs = 4;
+    // Limits and drop policy of the queue of each topic while the ROS bridge falls behind, changes take effect
+    // on InitializeTopics
+    UPROPERTY(EditAnywhere, Category = "Depth Component")
+        FOutgoingQueueSettings PublishQueue;
 
     UPROPERTY(Transient, EditAnywhere, Category = "Depth Component")
         UTopic* CameraInfoPublisher;
     UPROPERTY(Transient, EditAnywhere, Category = "Depth Component")
         UTopic* ImagePublisher;
+    UPROPERTY(Transient, EditAnywhere, Category = "Depth Component")
+        UTopic* CompressedDepthPublisher;
 
 protected:
 
@@ -73,7 +174,15 @@ private:
 
     void ReadImage(UTextureRenderTarget2D* RenderTarget, TArray<FFloat16Color>& ImageData) const;
     void ToDepthImage(const TArray<FFloat16Color>& ImageData, uint8* Bytes) const;
+    bool UpdateSubscribers();
+    bool CaptureImages();
     void ProcessDepth();
-    // in must hold Width*Height*2(float) Bytes
-    void convertDepth(const uint16_t* in, __m128* out) const;
+    void GetFrameInfo(FrameInfo& Info, const FROSTime& Time);
+    void SubmitFrame(TArray<FFloat16Color>& Pixels, const FrameInfo& Info);
+    void PublishDepth();
+    void PublishMessages(const std::shared_ptr<const uint8>& Lease, const FROSTime& Time);
+    void EncodeCompressed(const std::shared_ptr<const uint8>& Lease, const FROSTime& Time);
+    void PublishCameraInfo(const FROSTime& Time);
+    // in must hold Pixels RGBA Float16 pixels, out receives Pixels floats
+    void convertDepth(const uint16_t* in, float* out, const uint32 Pixels) const;
 };
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "OutgoingQueueSettings.generated.h"
+
+UENUM(BlueprintType)
+enum class EQueuePolicy : uint8
+{
+    // A full queue drops its oldest waiting message for the new one, subscribers get the latest frames
+    DropOldest UMETA(DisplayName = "Drop oldest"),
+    // A full queue drops the new message, subscribers get every frame up to the first that did not fit
+    DropNewest UMETA(DisplayName = "Drop newest"),
+    // The publishing job waits up to BlockTimeout for space, the message is dropped after that
+    Block UMETA(DisplayName = "Block with timeout")
+};
+
+/**
+ * Limits of the outgoing queue of each topic of a component. Messages wait in the queue while the previous message
+ * of the topic is serialized, so that slow serialization drops frames instead of piling them up. MaxFrames also
+ * sizes the send queue of the topic in the ROS bridge, which keeps the serialized messages until they are sent.
+ * Every topic has its own queues, a large camera does not take up the space of a small one.
+ */
+USTRUCT(BlueprintType)
+struct ROSINTEGRATIONVISION_API FOutgoingQueueSettings
+{
+    GENERATED_BODY()
+
+    // Messages per topic that wait for or are being serialized, at least one, and serialized messages the bridge
+    // keeps per topic before dropping the oldest. Under DropOldest the newest message is always queued.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Outgoing Queue")
+        int32 MaxFrames = 2;
+    // Size of these messages in MB, 0 is unlimited. A single message is always accepted.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Outgoing Queue")
+        float MaxMegabytes = 0;
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Outgoing Queue")
+        EQueuePolicy Policy = EQueuePolicy::DropOldest;
+    // Seconds the publishing job waits for space under the Block policy
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Outgoing Queue")
+        float BlockTimeout = 0.1f;
+
+    // Queue size the topics are initialized with, for the send queue of the bridge
+    int32 GetTopicQueueSize() const
+    {
+        return FMath::Max(MaxFrames, 1);
+    }
+};
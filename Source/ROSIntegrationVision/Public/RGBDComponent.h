@@ -0,0 +1,148 @@
+#pragma once
+
+#include "Camera/CameraComponent.h"
+#include "Components/SceneCaptureComponent2D.h"
+#include "Engine/TextureRenderTarget2D.h"
+
+#include "ROSTime.h"
+#include "RI/Topic.h"
+
+#include "DepthComponent.h"
+
+#include "RGBDComponent.generated.h"
+
+struct FrameInfo;
+
+/**
+ * Color and depth camera with a single optical center. Both images are captured in the same frame, read back
+ * together and converted into one packet, so the color image, the depth image and the camera info are published
+ * with the identical stamp and can be matched exactly by message_filters.
+ */
+UCLASS()
+class ROSINTEGRATIONVISION_API URGBDComponent : public UCameraComponent {
+
+    GENERATED_BODY()
+
+public:
+
+    URGBDComponent();
+    ~URGBDComponent();
+    void Pause(const bool _Pause = true);
+    bool IsPaused() const;
+
+    UFUNCTION(BlueprintCallable, Category = "ROS")
+        void InitializeTopics();
+    UFUNCTION(BlueprintCallable, Category = "ROS")
+        void PublishImages();
+    // Rate in Hz at which the scheduler published during the last seconds, to compare with PublishRate
+    UFUNCTION(BlueprintPure, Category = "ROS")
+        float GetAchievedPublishRate() const;
+    // Latency of a stage of the frames since BeginPlay or the last reset, zero if stage timing is compiled out
+    UFUNCTION(BlueprintPure, Category = "ROS")
+        FStageLatency GetStageLatency(EVisionStage Stage) const;
+    UFUNCTION(BlueprintCallable, Category = "ROS")
+        void ResetStageLatencies();
+    // Writes the latencies of all stages to a CSV file, returns false if that failed or stage timing is compiled out
+    UFUNCTION(BlueprintCallable, Category = "ROS")
+        bool DumpStageLatencies(const FString& Path) const;
+
+    UPROPERTY(EditAnywhere, Category = "RGBD Component")
+        uint32 Width;
+    UPROPERTY(EditAnywhere, Category = "RGBD Component")
+        uint32 Height;
+    // Number of frames that are read back from the GPU asynchronously and published in a later tick. The scene is
+    // then captured on demand for every frame that is read back, like with CaptureOnDemand.
+    // 0 reads every frame synchronously in PublishImages, which stalls the game thread until rendering is done.
+    UPROPERTY(EditAnywhere, Category = "RGBD Component")
+        int32 ReadbackDepth;
+    // Renders the scene capture only for frames that are published instead of in every frame, which saves the
+    // GPU time of all other frames. The render target is not updated otherwise. Changes take effect on BeginPlay.
+    UPROPERTY(EditAnywhere, Category = "RGBD Component")
+        bool CaptureOnDemand = false;
+    // Rate in Hz at which the module scheduler calls PublishImages, staggered with the other components. 0 disables it.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RGBD Component")
+        float PublishRate = 0;
+    // Encoding of the published depth image, changes take effect on BeginPlay
+    UPROPERTY(EditAnywhere, Category = "RGBD Component")
+        EDepthEncoding DepthEncoding;
+    // Depth values beyond this range in meters are clamped to it, 0 disables the clamp.
+    // 16UC1 is always limited to 65.535 meters.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RGBD Component")
+        float MaxRange;
+
+    UPROPERTY(Transient, EditAnywhere, BlueprintReadWrite, Category = "RGBD Component")
+        USceneCaptureComponent2D* Color;
+    UPROPERTY(Transient, EditAnywhere, BlueprintReadWrite, Category = "RGBD Component")
+        USceneCaptureComponent2D* Depth;
+
+    UPROPERTY(BlueprintReadWrite, Category = "RGBD Component")
+        FString ImageFrame = TEXT("camera_frame");
+    UPROPERTY(BlueprintReadWrite, Category = "RGBD Component")
+        FString ImageOpticalFrame = TEXT("camera_frame_optical");
+
+    UPROPERTY(EditAnywhere, Category = "RGBD Component")
+        FString CameraInfoTopicName = TEXT("/unreal_ros/camera_info");
+    UPROPERTY(EditAnywhere, Category = "RGBD Component")
+        FString ColorTopicName = TEXT("/unreal_ros/image_color");
+    UPROPERTY(EditAnywhere, Category = "RGBD Component")
+        FString DepthTopicName = TEXT("/unreal_ros/image_depth");
+    // sensor_msgs/PointCloud2 topic with the colored points, no cloud is generated if it is empty
+    UPROPERTY(EditAnywhere, Category = "RGBD Component")
+        FString PointCloudTopicName;
+    // Only every Stride-th pixel of every Stride-th row becomes a point, changes take effect on BeginPlay
+    UPROPERTY(EditAnywhere, Category = "RGBD Component")
+        int32 PointCloudStride = 1;
+    // Organized clouds keep the image layout with NaN points for invalid depth, otherwise these are left out.
+    // Changes take effect on BeginPlay.
+    UPROPERTY(EditAnywhere, Category = "RGBD Component")
+        bool PointCloudOrganized = false;
+    // Depth values in meters up to MinDepth and beyond MaxDepth are invalid, 0 disables the MaxDepth limit.
+    // Clamped depth values equal MaxRange, so MaxDepth should be below it to drop them.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RGBD Component")
+        float PointCloudMinDepth = 0;
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RGBD Component")
+        float PointCloudMaxDepth = 0;
+    // Limits and drop policy of the queue of each topic while the ROS bridge falls behind, changes take effect
+    // on InitializeTopics
+    UPROPERTY(EditAnywhere, Category = "RGBD Component")
+        FOutgoingQueueSettings PublishQueue;
+
+    UPROPERTY(Transient, EditAnywhere, Category = "RGBD Component")
+        UTopic* CameraInfoPublisher;
+    UPROPERTY(Transient, EditAnywhere, Category = "RGBD Component")
+        UTopic* ColorPublisher;
+    UPROPERTY(Transient, EditAnywhere, Category = "RGBD Component")
+        UTopic* DepthPublisher;
+    UPROPERTY(Transient, EditAnywhere, Category = "RGBD Component")
+        UTopic* PointCloudPublisher;
+
+protected:
+
+    virtual void InitializeComponent() override;
+    virtual void BeginPlay() override;
+    virtual void TickComponent(float DeltaTime,
+        enum ELevelTick TickType,
+        FActorComponentTickFunction* TickFunction) override;
+    virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+private:
+
+    // Private data container
+    class PrivateData;
+    PrivateData* Priv;
+
+    TArray<FColor> ImageColor;
+    TArray<FFloat16Color> ImageDepth;
+    bool Running, Paused;
+
+    void ShowFlagsLit(FEngineShowFlags& ShowFlags) const;
+    void ReadImages(TArray<FColor>& ColorData, TArray<FFloat16Color>& DepthData) const;
+    void ToImages(const TArray<FColor>& ColorData, const TArray<FFloat16Color>& DepthData, uint8* Bytes, uint32 Contents) const;
+    uint32 ToPointCloud(const TArray<FColor>& ColorData, const uint8* DepthBytes, uint8* Bytes) const;
+    bool CaptureImages();
+    void ProcessFrame();
+    void GetFrameInfo(FrameInfo& Info, const FROSTime& Time);
+    void SubmitFrame(TArray<FColor>& ColorPixels, TArray<FFloat16Color>& DepthPixels, const FrameInfo& Info);
+    void PublishFrame();
+    void PublishCameraInfo(const FROSTime& Time);
+};
@@ -5,6 +5,11 @@
 #include "CoreMinimal.h"
 #include "Modules/ModuleManager.h"
 
+class CaptureScheduler;
+class SubscriberCounts;
+class SubscriberPoller;
+class WorkerPool;
+
 class FROSIntegrationVisionModule : public IModuleInterface
 {
 public:
@@ -33,4 +38,39 @@ public:
 	{
 		return FModuleManager::Get().IsModuleLoaded("ROSIntegrationVision");
 	}
+
+	/**
+	* Thread pool shared by all components for converting and encoding images.
+	* Configured in the [ROSIntegrationVision] section of the engine ini with WorkerThreads (0 uses one less than
+	* the number of cores) and WorkerAffinityMask (hexadecimal, 0 does not pin the workers).
+	*/
+	WorkerPool &GetWorkerPool();
+
+	/**
+	* Scheduler calling PublishImages of the components with a PublishRate, ticked once per engine frame.
+	* ReadbackBudgetMB in the [ROSIntegrationVision] section limits the data read back per frame (0 is unlimited).
+	*/
+	CaptureScheduler &GetScheduler();
+
+	/**
+	* Subscriber counts of the topics, the components only capture and publish images of subscribed topics.
+	* Topics without a count are treated as subscribed.
+	*/
+	SubscriberCounts &GetSubscriberCounts();
+
+	/**
+	* Poller asking /rosapi/subscribers for the counts of the topics the components advertise, ticked once per engine
+	* frame. SubscriberPollSeconds in the [ROSIntegrationVision] section sets the interval (default 1, 0 disables
+	* polling so that the counts can be set by hand). Publishing resumes up to one interval plus the round trip of the
+	* call after a subscription.
+	*/
+	SubscriberPoller &GetSubscriberPoller();
+
+private:
+	WorkerPool *Pool = nullptr;
+	CaptureScheduler *Scheduler = nullptr;
+	FDelegateHandle SchedulerTick;
+	SubscriberCounts *Subscribers = nullptr;
+	SubscriberPoller *Poller = nullptr;
+	FDelegateHandle PollerTick;
 };
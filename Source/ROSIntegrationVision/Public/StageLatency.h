@@ -0,0 +1,51 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "StageLatency.generated.h"
+
+// Stages of a frame from the capture to the messages handed to the outgoing queues
+UENUM(BlueprintType)
+enum class EVisionStage : uint8
+{
+    // Game thread part of PublishImages: scene capture, readback request or synchronous read
+    Capture UMETA(DisplayName = "Capture"),
+    // From the readback request until TickComponent found the pixels, or the synchronous read
+    Readback UMETA(DisplayName = "Readback"),
+    // Conversion of the pixels into the packet by the conversion job
+    Conversion UMETA(DisplayName = "Conversion"),
+    // Conversion job waiting for a packet slot that is not leased by messages
+    BufferWait UMETA(DisplayName = "Buffer wait"),
+    // Publishing job creating the messages of a packet and queuing them
+    Publish UMETA(DisplayName = "Publish"),
+    // Compression job of the compressed topic
+    Encode UMETA(DisplayName = "Encode"),
+    // Point cloud generation of the RGBD component
+    PointCloud UMETA(DisplayName = "Point cloud"),
+    // From the capture until the publishing job queued the messages, the compression continues after it
+    EndToEnd UMETA(DisplayName = "End to end"),
+    Count UMETA(Hidden)
+};
+
+/**
+ * Latency distribution of one stage since BeginPlay in milliseconds. The percentiles are accurate to about 6%,
+ * the histogram buckets grow with the latency. Everything is 0 if the module was built without stage timing.
+ */
+USTRUCT(BlueprintType)
+struct ROSINTEGRATIONVISION_API FStageLatency
+{
+    GENERATED_BODY()
+
+    UPROPERTY(BlueprintReadOnly, Category = "Stage Latency")
+        int32 Count = 0;
+    UPROPERTY(BlueprintReadOnly, Category = "Stage Latency")
+        float Mean = 0;
+    UPROPERTY(BlueprintReadOnly, Category = "Stage Latency")
+        float P50 = 0;
+    UPROPERTY(BlueprintReadOnly, Category = "Stage Latency")
+        float P95 = 0;
+    UPROPERTY(BlueprintReadOnly, Category = "Stage Latency")
+        float P99 = 0;
+    UPROPERTY(BlueprintReadOnly, Category = "Stage Latency")
+        float Max = 0;
+};
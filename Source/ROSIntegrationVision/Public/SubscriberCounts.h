@@ -0,0 +1,49 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include <functional>
+#include <mutex>
+
+/**
+ * Number of subscribers per topic, so that the components skip capturing, reading back and converting images of
+ * topics nobody listens to. rosbridge does not tell a publisher about its subscribers, so by default the module's
+ * SubscriberPoller sets the counts of the advertised topics from /rosapi/subscribers. With polling disabled the
+ * counts are set from outside, e.g. by a node that watches the ROS graph, or by a stand-in in tests. A query function
+ * can be installed instead, it is asked for topics without a set count.
+ * Topics without any information are treated as subscribed, so nothing is skipped until counts are provided.
+ * The components resume with their next frame once a count shows a subscription, how soon that happens after the
+ * subscription depends on the source of the counts, up to one poll interval plus the round trip with the poller.
+ * All methods are thread safe, the counts may be set from the ROS callback threads.
+ */
+class ROSINTEGRATIONVISION_API SubscriberCounts
+{
+public:
+  // Count of a topic without any information
+  static const int32 Unknown = -1;
+
+  typedef std::function<int32(const FString &Topic)> QueryFunction;
+
+private:
+  mutable std::mutex Mutex;
+  TMap<FString, int32> Counts;
+  QueryFunction Query;
+
+public:
+  // Sets the number of subscribers of the topic, Unknown removes it
+  void Set(const FString &Topic, const int32 Count);
+  void Reset();
+
+  // Installs a function that returns the count of topics without a set one, it may return Unknown
+  void SetQuery(QueryFunction Function);
+
+  int32 Get(const FString &Topic) const;
+
+  // False only if the topic is known to have no subscribers
+  bool IsSubscribed(const FString &Topic) const
+  {
+    return Get(Topic) != 0;
+  }
+};
@@ -5,10 +5,39 @@
 #include "Components/SceneCaptureComponent2D.h"
 #include "Engine/TextureRenderTarget2D.h"
 
+#include <memory>
+#include <mutex>
+
+#include "ROSTime.h"
 #include "RI/Topic.h"
 
+#include "OutgoingQueueSettings.h"
+#include "StageLatency.h"
+
 #include "VisionComponent.generated.h"
 
+struct FrameInfo;
+
+UENUM(BlueprintType)
+enum class EColorFormat : uint8
+{
+    // bgr8 read from an 8 bit render target
+    BGR8 UMETA(DisplayName = "bgr8"),
+    // bgra8 read from an 8 bit render target, published without conversion
+    BGRA8 UMETA(DisplayName = "bgra8"),
+    // bgr8 read from a Float16 render target, for HDR capture sources
+    BGR8FromFloat16 UMETA(DisplayName = "bgr8 (Float16 render target)")
+};
+
+UENUM(BlueprintType)
+enum class ECompressedFormat : uint8
+{
+    // Lossy, CompressedQuality selects the quality
+    JPEG UMETA(DisplayName = "JPEG"),
+    // Lossless, slower to encode and larger than JPEG
+    PNG UMETA(DisplayName = "PNG")
+};
+
 UCLASS()
 class ROSINTEGRATIONVISION_API UVisionComponent : public UCameraComponent {
     
@@ -24,6 +53,17 @@ public:
         void InitializeTopics();
     UFUNCTION(BlueprintCallable, Category = "ROS")
         void PublishImages();
+    // Rate in Hz at which the scheduler published during the last seconds, to compare with PublishRate
+    UFUNCTION(BlueprintPure, Category = "ROS")
+        float GetAchievedPublishRate() const;
+    // Latency of a stage of the frames since BeginPlay or the last reset, zero if stage timing is compiled out
+    UFUNCTION(BlueprintPure, Category = "ROS")
+        FStageLatency GetStageLatency(EVisionStage Stage) const;
+    UFUNCTION(BlueprintCallable, Category = "ROS")
+        void ResetStageLatencies();
+    // Writes the latencies of all stages to a CSV file, returns false if that failed or stage timing is compiled out
+    UFUNCTION(BlueprintCallable, Category = "ROS")
+        bool DumpStageLatencies(const FString& Path) const;
 
     UPROPERTY(EditAnywhere, Category = "Vision Component")
         float TranslateX;
@@ -31,8 +71,51 @@ public:
         uint32 Width;
     UPROPERTY(EditAnywhere, Category = "Vision Component")
         uint32 Height;
+    // Streams every packet, the PacketBuffer header followed by the image, to TCP clients on ServerPort. Clients
+    // that do not keep up skip frames. Only supported on Linux, changes take effect on BeginPlay.
+    UPROPERTY(EditAnywhere, Category = "Vision Component")
+        bool EnableServer = false;
     UPROPERTY(EditAnywhere, Category = "Vision Component")
         int32 ServerPort;
+    // Name of a POSIX shared memory ring, like "/unreal_camera", that receives every packet for readers on the same
+    // host. Empty disables it. Only supported on Linux, changes take effect on BeginPlay.
+    UPROPERTY(EditAnywhere, Category = "Vision Component")
+        FString SharedMemoryName;
+    // Number of frames in the ring, a reader has to be done with a frame before the ring wraps around to it
+    UPROPERTY(EditAnywhere, Category = "Vision Component")
+        int32 SharedMemorySlots = 4;
+    // Capture log that every packet is appended to, relative paths are in the Saved directory of the project. Empty
+    // disables it. The log is finished on EndPlay. Only supported on Linux, changes take effect on BeginPlay.
+    UPROPERTY(EditAnywhere, Category = "Vision Component")
+        FString RecordPath;
+    // Capture log that is published instead of rendered images, with the stamps of its frames. Relative paths are in
+    // the Saved directory of the project. The size, format, field of view and baseline are taken from the log.
+    // Empty disables it. Only supported on Linux, changes take effect on BeginPlay.
+    UPROPERTY(EditAnywhere, Category = "Vision Component")
+        FString ReplayPath;
+    // Factor on the speed the replayed frames were recorded at, 0 publishes them as fast as the image topic takes
+    // them. Changes take effect on BeginPlay.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Vision Component")
+        float ReplaySpeed = 1;
+    // Starts the replay over after the last frame
+    UPROPERTY(EditAnywhere, Category = "Vision Component")
+        bool ReplayLoop = false;
+    // Number of frames that are read back from the GPU asynchronously and published in a later tick. The scene is
+    // then captured on demand for every frame that is read back, like with CaptureOnDemand.
+    // 0 reads every frame synchronously in PublishImages, which stalls the game thread until rendering is done.
+    UPROPERTY(EditAnywhere, Category = "Vision Component")
+        int32 ReadbackDepth;
+    // Renders the scene capture only for frames that are published instead of in every frame, which saves the
+    // GPU time of all other frames. The render target is not updated otherwise. Changes take effect on BeginPlay.
+    UPROPERTY(EditAnywhere, Category = "Vision Component")
+        bool CaptureOnDemand = false;
+    // Rate in Hz at which the module scheduler calls PublishImages, staggered with the other components. 0 disables it.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Vision Component")
+        float PublishRate = 0;
+    // Format of the render target and the published image, changes take effect on BeginPlay.
+    // The 8 bit formats read back half the data of the Float16 render target.
+    UPROPERTY(EditAnywhere, Category = "Vision Component")
+        EColorFormat ColorFormat = EColorFormat::BGR8FromFloat16;
 
     // The cameras for color, depth and objects;
     UPROPERTY(Transient, EditAnywhere, BlueprintReadWrite, Category = "Vision Component")
@@ -47,11 +130,28 @@ public:
         FString CameraInfoTopicName = TEXT("/unreal_ros/camera_info");
     UPROPERTY(EditAnywhere, Category = "Vision Component")
         FString ImageTopicName = TEXT("/unreal_ros/image_color");
+    // sensor_msgs/CompressedImage topic, nothing is compressed if it is empty
+    UPROPERTY(EditAnywhere, Category = "Vision Component")
+        FString CompressedImageTopicName;
+    UPROPERTY(EditAnywhere, Category = "Vision Component")
+        ECompressedFormat CompressedFormat = ECompressedFormat::JPEG;
+    // JPEG quality from 1 to 100
+    UPROPERTY(EditAnywhere, Category = "Vision Component")
+        int32 CompressedQuality = 90;
+    // Number of frames that are encoded in parallel on the thread pool, further frames are not compressed
+    UPROPERTY(EditAnywhere, Category = "Vision Component")
+        int32 MaxEncodingJobs = 4;
+    // Limits and drop policy of the queue of each topic while the ROS bridge falls behind, changes take effect
+    // on InitializeTopics
+    UPROPERTY(EditAnywhere, Category = "Vision Component")
+        FOutgoingQueueSettings PublishQueue;
 
     UPROPERTY(Transient, EditAnywhere, Category = "Vision Component")
         UTopic* CameraInfoPublisher;
     UPROPERTY(Transient, EditAnywhere, Category = "Vision Component")
         UTopic* ImagePublisher;
+    UPROPERTY(Transient, EditAnywhere, Category = "Vision Component")
+        UTopic* CompressedImagePublisher;
 
 protected:
   
@@ -69,13 +169,26 @@ private:
     PrivateData *Priv;
   
     TArray<FFloat16Color> ImageColor;
+    TArray<FColor> ImageColorLDR;
     TArray<uint8> DataColor;
     bool Running, Paused;
   
     void ShowFlagsBasicSetting(FEngineShowFlags &ShowFlags) const;
     void ShowFlagsLit(FEngineShowFlags &ShowFlags) const;
     void ReadImage(UTextureRenderTarget2D *RenderTarget, TArray<FFloat16Color> &ImageData) const;
+    void ReadImage(UTextureRenderTarget2D *RenderTarget, TArray<FColor> &ImageData) const;
     void ToColorImage(const TArray<FFloat16Color> &ImageData, uint8 *Bytes) const;
+    void ToColorImage(const TArray<FColor> &ImageData, uint8 *Bytes) const;
+    bool UpdateSubscribers();
+    bool CaptureImages();
     void ProcessColor();
+    void GetFrameInfo(FrameInfo &Info, const FROSTime &Time);
+    void SubmitFrame(TArray<FFloat16Color> &Pixels, const FrameInfo &Info);
+    void SubmitFrame(TArray<FColor> &Pixels, const FrameInfo &Info);
+    void StartConversion(std::unique_lock<std::mutex> Lock, const FrameInfo &Info);
+    void PublishColor();
+    void PublishMessages(const std::shared_ptr<const uint8> &Lease, const FROSTime &Time);
+    void EncodeCompressed(const std::shared_ptr<const uint8> &Lease, const FROSTime &Time);
+    void PublishCameraInfo(const FROSTime &Time);
 
 };
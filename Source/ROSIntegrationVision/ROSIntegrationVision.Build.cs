@@ -24,6 +24,9 @@ public class ROSIntegrationVision : ModuleRules
 
     PrivateIncludePaths.Add(Path.Combine(ModuleDirectory, "Private"));
 
+    // Per-stage latency histograms of the components, see StopTime.h. Compiled out of shipping builds.
+    PrivateDefinitions.Add("ROSVISION_STAGE_TIMING=" + (Target.Configuration == UnrealTargetConfiguration.Shipping ? "0" : "1"));
+
     PublicDependencyModuleNames.AddRange(
       new string[]
       {
@@ -41,7 +44,9 @@ public class ROSIntegrationVision : ModuleRules
         "Core",
         "CoreUObject",
         "Engine",
+        "ImageWrapper",
         "RenderCore",
+        "RHI",
         "Sockets",
         "Networking",
         "ROSIntegration"